@@ -6,12 +6,15 @@
 #include <fstream>
 #include <string>
 #include <sstream>
+#include <thread>
 
 #include "graphics/Renderer.h"
 #include "graphics/ParticleRenderer.h"
 #include "Utils.h"
 
 #include "physics/SimulationSystem.h"
+#include "physics/SimulationThread.h"
+#include "physics/TrajectoryPlayer.h"
 #include "physics/Constants.h"
 #include "core/Time.h"
 
@@ -112,6 +115,7 @@ int main(void)
       
         float particleRadius = 2.7f;
         float particleMass = 1.0f;
+        float radiusSpread = 1.0f; // largest / smallest spawned radius
         float simBorderColor[4] = { 1.0f, 1.0f, 1.0f, 0.5f };
         float borderWidth = 2.0f;
         float simBGColor[4] = { 0.0f, 0.0f, 0.0f, 1.0f };
@@ -123,6 +127,7 @@ int main(void)
         unsigned int totalNumberOfParticles = 1000;
 
         int subSteps = 8;
+        int numThreads = 0; // 0 = hardware concurrency
         float simWidth = 1000.0f;
         float simHeight = 1000.0f;
         Vec2 bottomLeft(-simWidth / 2, -simHeight / 2);
@@ -131,12 +136,21 @@ int main(void)
         bool addParticleInBulk = true;
         bool renderVelocity = true;
         bool renderTemperature = false;
+        bool renderPressure = false;        // pressures through the temperature shader
+        float pressureScale = 0.2f;         // shader temperature per unit of pressure
+        std::vector<float> pressureColors;
         bool needsReset = false;
+        char snapshotPath[256] = "snapshot.psim";
+        char trajectoryPath[256] = "trajectory.ptraj";
+        char replayPath[256] = "trajectory.ptraj";
+        TrajectoryPlayer player;
         
         
         // Initialize simulation
         SimulationSystem sim(totalNumberOfParticles, bottomLeft, topRight, particleRadius, subSteps);
-        sim.SetZoom(0.6f); // Just looks better
+        Camera camera;
+        numThreads = sim.GetNumThreads();
+        const int maxThreads = std::max(static_cast<int>(std::thread::hardware_concurrency()), numThreads);
 
         if (addParticleInBulk)
         {
@@ -158,25 +172,66 @@ int main(void)
         Shader tempShader(tempShaderPath);
         Shader* activeShader = renderTemperature ? &tempShader : &velShader;
         std::unique_ptr<ParticleRenderer> renderer =
-            std::make_unique<ParticleRenderer>(sim, *activeShader, renderTemperature);
+            std::make_unique<ParticleRenderer>(*activeShader, renderTemperature, totalNumberOfParticles);
         Time timeManager(fixedDeltaTime);
         int FPScounter = 0;
 
+        // Settings shown by the interface. The simulation runs on its own thread from here on, the
+        // interface keeps its own copy of the settings and sends the changes as commands
+        bool useFusedCollisions = sim.GetUseFusedCollisions();
+        bool useFusedIntegration = sim.GetUseFusedIntegration();
+        bool useHashedGrid = sim.GetUseHashedGrid();
+        bool useNeighborLists = sim.GetUseNeighborLists();
+        float neighborSkin = sim.GetNeighborSkin();
+        unsigned int attributes = sim.GetAttributes();
+        int reorderInterval = static_cast<int>(sim.GetReorderInterval());
+        int simdLevel = static_cast<int>(sim.GetSimdLevel());
+        const int maxSimdLevel = static_cast<int>(sim.GetMaxSimdLevel());
+        bool useAdaptiveSubSteps = sim.GetUseAdaptiveSubSteps();
+        int minSubSteps = static_cast<int>(sim.GetMinSubSteps());
+        int maxSubSteps = static_cast<int>(sim.GetMaxSubSteps());
+        float targetDisplacement = sim.GetTargetDisplacement();
+        float targetOverlap = sim.GetTargetOverlap();
+        bool useSleeping = sim.GetUseSleeping();
+        float sleepThreshold = sim.GetSleepThreshold();
+        float wakeThreshold = sim.GetWakeThreshold();
+        int sleepSubSteps = static_cast<int>(sim.GetSleepSubSteps());
+        bool useFluid = sim.GetUseFluid();
+        FluidSettings fluidSettings = sim.GetFluidSettings();
+        bool useStableRemoval = sim.GetUseStableRemoval();
+        float sinkCorners[4] = { 0.0f, 0.0f, 100.0f, 100.0f };
+        int emitterShape = static_cast<int>(EmitterShape::Rect);
+        float emitterCoordinates[4] = { -100.0f, 300.0f, 100.0f, 400.0f };
+        float emitterRate = 120.0f;
+        float emitterVelocity[2] = { 0.0f, 0.0f };
+        bool isDeterministic = sim.GetIsDeterministic();
+        unsigned int seed = sim.GetSeed();
+        PhysicsConstants constants = GetPhysicsConstants();
+
+        // Sequence number of the last snapshot load, the interface syncs once a frame reflects it
+        uint64_t pendingLoadCommand = 0;
+
+        SimulationThread simulationThread(sim, fixedDeltaTime);
+        simulationThread.Start();
+        simulationThread.AcquireFrame();
+
         #pragma endregion
 
         // Main loop
         while (!glfwWindowShouldClose(window))
         {
-            // Update physics  
-            if (!sim.GetIsPaused())
-            {
-                int steps = timeManager.update();
-                for (int i = 0; i < steps; i++)
-                    sim.Update(timeManager.getFixedDeltaTime());
-            }
+            // Newest state published by the simulation thread, the previous one stays if there is none
+            simulationThread.AcquireFrame();
+            const SimulationFrame& frame = simulationThread.GetFrame();
+
+            // Frame timing of the render thread, the simulation keeps its own fixed rate
+            timeManager.update();
+            if (player.IsOpen())
+                player.Advance(timeManager.getLastFrameTimeMs() / 1000.0f);
 
             // Process user input
-            ProcessInput(window, sim, timeManager.getFixedDeltaTime());
+            const Bounds displayedBounds = player.IsOpen() ? player.GetBounds() : frame.bounds;
+            ProcessInput(window, simulationThread, camera, displayedBounds, timeManager.getLastFrameTimeMs() / 1000.0f);
 
             #pragma region Rendering / ImGui / Metrics
 
@@ -187,20 +242,89 @@ int main(void)
             ImGui_ImplGlfw_NewFrame();
             ImGui::NewFrame();
 
-            // Rendering
-            renderer->UpdateBuffers(fixedDeltaTime);
-            renderer->Render();
-            BoundsRenderer(sim.GetBounds().bottomLeft, sim.GetBounds().topRight,
-                borderWidth, glm::make_vec4(simBorderColor), sim.GetProjMatrix() * sim.GetViewMatrix());
+            // Rendering, a replay takes the place of the simulation while it's open
+            if (player.IsOpen())
+            {
+                // The simulation renders displacements per substep, scale the frame displacements the same way
+                renderer->UpdateBuffers(player.GetPositions(), player.GetPrevPositions(), player.GetTemperatures(), {},
+                    player.GetParticleRadius(), player.GetFrameTime() * subSteps);
+            }
+            else if (renderPressure)
+            {
+                pressureColors.resize(frame.pressures.size());
+                for (size_t i = 0; i < frame.pressures.size(); i++)
+                    pressureColors[i] = frame.pressures[i] * pressureScale;
+                renderer->UpdateBuffers(frame.positions, frame.prevPositions, pressureColors, frame.radii, frame.particleRadius, fixedDeltaTime);
+            }
+            else
+            {
+                renderer->UpdateBuffers(frame.positions, frame.prevPositions, frame.temperatures, frame.radii, frame.particleRadius, fixedDeltaTime);
+            }
+
+            const glm::mat4 viewProjection = camera.GetViewProjection(displayedBounds, GetFramebufferAspect());
+            renderer->Render(viewProjection);
+            BoundsRenderer(displayedBounds.bottomLeft, displayedBounds.topRight,
+                borderWidth, glm::make_vec4(simBorderColor), viewProjection);
+            if (!player.IsOpen())
+            {
+                for (const ParticleSink& sink : frame.sinks)
+                    BoundsRenderer(sink.bottomLeft, sink.topRight, borderWidth, glm::make_vec4(simBorderColor), viewProjection);
+
+                // Emitters are outlined by their bounding box, a point stream is too small to show
+                for (const EmitterSettings& emitter : frame.emitters)
+                {
+                    const Vec2 extent(emitter.radius, emitter.radius);
+                    const Vec2 bottomLeft = emitter.shape == EmitterShape::Disc ? emitter.start - extent :
+                        Vec2(std::min(emitter.start.x, emitter.end.x), std::min(emitter.start.y, emitter.end.y));
+                    const Vec2 topRight = emitter.shape == EmitterShape::Disc ? emitter.start + extent :
+                        Vec2(std::max(emitter.start.x, emitter.end.x), std::max(emitter.start.y, emitter.end.y));
+                    if (bottomLeft != topRight)
+                        BoundsRenderer(bottomLeft, topRight, borderWidth, glm::make_vec4(simBorderColor), viewProjection);
+                }
+            }
+
+            // Keep the interface in sync with a loaded snapshot
+            if (pendingLoadCommand != 0 && frame.commandsExecuted >= pendingLoadCommand)
+            {
+                particleRadius = frame.particleRadius;
+                radiusSpread = frame.radiusSpread;
+                subSteps = static_cast<int>(frame.subSteps);
+                simWidth = frame.bounds.topRight.x - frame.bounds.bottomLeft.x;
+                simHeight = frame.bounds.topRight.y - frame.bounds.bottomLeft.y;
+                totalNumberOfParticles = static_cast<unsigned int>(frame.positions.size());
+                reorderInterval = static_cast<int>(frame.reorderInterval);
+                attributes = frame.attributes;
+                useFluid = frame.useFluid;
+                constants = frame.constants;
+                pendingLoadCommand = 0;
+            }
 
             ImGui::Begin("Settings");
             if (ImGui::CollapsingHeader("General"))
             {
                 // Particle radius and mass
                 if (ImGui::SliderFloat("Particle Radius", &particleRadius, 1.0f, 100.0f, "%.1f"))
-                    sim.SetParticleRadius(particleRadius);
+                    simulationThread.Post([particleRadius](SimulationSystem& simulation) { simulation.SetParticleRadius(particleRadius); });
                 if (ImGui::SliderFloat("Particle Mass", &particleMass, 1.0f, 100.0f, "%.1f"))
-                    sim.UpdateMass(particleMass);
+                    simulationThread.Post([particleMass](SimulationSystem& simulation) { simulation.UpdateMass(particleMass); });
+
+                // Spawned radii go from the particle radius up to this many times it, used by the next reset
+                if (ImGui::SliderFloat("Radius Spread", &radiusSpread, 1.0f, 10.0f, "%.1f"))
+                {
+                    simulationThread.Post([radiusSpread](SimulationSystem& simulation) { simulation.SetRadiusSpread(radiusSpread); });
+                    needsReset = true;
+                }
+
+                // Optional particle columns, a disabled one costs no memory and its kernels skip it.
+                // Without masses every particle has the particle mass, without temperatures they render cold
+                ImGui::Text("Particle attributes:");
+                bool attributesChanged = ImGui::CheckboxFlags("Accelerations", &attributes, SimulationSystem::ATTRIBUTE_ACCELERATIONS);
+                ImGui::SameLine();
+                attributesChanged |= ImGui::CheckboxFlags("Masses", &attributes, SimulationSystem::ATTRIBUTE_MASSES);
+                ImGui::SameLine();
+                attributesChanged |= ImGui::CheckboxFlags("Temperatures", &attributes, SimulationSystem::ATTRIBUTE_TEMPERATURES);
+                if (attributesChanged)
+                    simulationThread.Post([attributes](SimulationSystem& simulation) { simulation.SetAttributes(attributes); });
 
                 // Particle spawning options
                 ImGui::Text("Particle spawn method:");
@@ -242,25 +366,191 @@ int main(void)
                     }
                 }
 
-                // Substeps
-                if (ImGui::SliderInt("Substeps", &subSteps, 1, 10, "%1"))
-                    sim.SetSubSteps(subSteps);
+                // Substeps, chosen every update by the simulation in adaptive mode
+                if (ImGui::Checkbox("Adaptive Substeps", &useAdaptiveSubSteps))
+                    simulationThread.Post([useAdaptiveSubSteps](SimulationSystem& simulation) { simulation.SetUseAdaptiveSubSteps(useAdaptiveSubSteps); });
+
+                if (!useAdaptiveSubSteps)
+                {
+                    if (ImGui::SliderInt("Substeps", &subSteps, 1, 10, "%1"))
+                        simulationThread.Post([subSteps](SimulationSystem& simulation) { simulation.SetSubSteps(subSteps); });
+                }
+                else
+                {
+                    subSteps = static_cast<int>(frame.subSteps);
+
+                    if (ImGui::DragIntRange2("Substep Range", &minSubSteps, &maxSubSteps, 0.1f, 1, 20))
+                        simulationThread.Post([minSubSteps, maxSubSteps](SimulationSystem& simulation)
+                        {
+                            simulation.SetSubStepRange(static_cast<unsigned int>(minSubSteps), static_cast<unsigned int>(maxSubSteps));
+                        });
+                    if (ImGui::SliderFloat("Target Move (radii)", &targetDisplacement, 0.05f, 1.0f, "%.2f"))
+                        simulationThread.Post([targetDisplacement](SimulationSystem& simulation) { simulation.SetTargetDisplacement(targetDisplacement); });
+                    if (ImGui::SliderFloat("Target Overlap (radii)", &targetOverlap, 0.02f, 0.5f, "%.2f"))
+                        simulationThread.Post([targetOverlap](SimulationSystem& simulation) { simulation.SetTargetOverlap(targetOverlap); });
+
+                    const SubStepStats& stats = frame.subStepStats;
+                    ImGui::Text("Substeps %u (avg %.1f)  move %.3f  overlap %.3f", stats.subSteps, stats.averageSubSteps,
+                        stats.maxDisplacement, stats.maxOverlap);
+                }
+
+                // Sleeping, settled particles are skipped until something moves next to them
+                if (ImGui::Checkbox("Sleep Settled Particles", &useSleeping))
+                    simulationThread.Post([useSleeping](SimulationSystem& simulation) { simulation.SetUseSleeping(useSleeping); });
+
+                if (useSleeping)
+                {
+                    if (ImGui::SliderFloat("Sleep Move (radii)", &sleepThreshold, 0.005f, 0.1f, "%.3f"))
+                        simulationThread.Post([sleepThreshold](SimulationSystem& simulation) { simulation.SetSleepThreshold(sleepThreshold); });
+                    if (ImGui::SliderFloat("Wake Move (radii)", &wakeThreshold, 0.01f, 0.5f, "%.2f"))
+                        simulationThread.Post([wakeThreshold](SimulationSystem& simulation) { simulation.SetWakeThreshold(wakeThreshold); });
+                    if (ImGui::SliderInt("Substeps Before Sleep", &sleepSubSteps, 1, 254))
+                        simulationThread.Post([sleepSubSteps](SimulationSystem& simulation) { simulation.SetSleepSubSteps(static_cast<unsigned int>(sleepSubSteps)); });
+
+                    ImGui::Text("Sleeping %u / %u", frame.sleepingCount, frame.currentNumOfParticles);
+                }
+
+                // Fluid, the particles push each other apart by their SPH pressure instead of colliding
+                if (ImGui::Checkbox("Fluid", &useFluid))
+                {
+                    simulationThread.Post([useFluid](SimulationSystem& simulation) { simulation.SetUseFluid(useFluid); });
+                    if (useFluid)
+                        attributes |= SimulationSystem::FLUID_ATTRIBUTES;
+                }
+
+                if (useFluid)
+                {
+                    bool fluidChanged = ImGui::SliderFloat("Stiffness", &fluidSettings.stiffness, 1000.0f, 1000000.0f, "%.0f", ImGuiSliderFlags_Logarithmic);
+                    fluidChanged |= ImGui::SliderFloat("Viscosity", &fluidSettings.viscosity, 0.0f, 200.0f, "%.1f");
+                    if (fluidChanged)
+                        simulationThread.Post([fluidSettings](SimulationSystem& simulation) { simulation.SetFluidSettings(fluidSettings); });
+                }
+
+                // Solver threads
+                if (ImGui::SliderInt("Worker Threads", &numThreads, 1, maxThreads))
+                    simulationThread.Post([numThreads](SimulationSystem& simulation) { simulation.SetNumThreads(numThreads); });
+
+                // Collision pass
+                if (ImGui::Checkbox("Fused Collision Pass", &useFusedCollisions))
+                    simulationThread.Post([useFusedCollisions](SimulationSystem& simulation) { simulation.SetUseFusedCollisions(useFusedCollisions); });
+
+                // Neighbor lists, the grid and its pairs are kept until a particle moved half the skin
+                if (ImGui::Checkbox("Neighbor Lists", &useNeighborLists))
+                    simulationThread.Post([useNeighborLists](SimulationSystem& simulation) { simulation.SetUseNeighborLists(useNeighborLists); });
+                if (useNeighborLists)
+                {
+                    if (ImGui::SliderFloat("Skin (radii)", &neighborSkin, 0.0f, 0.5f, "%.2f"))
+                        simulationThread.Post([neighborSkin](SimulationSystem& simulation) { simulation.SetNeighborSkin(neighborSkin); });
+
+                    const NeighborListStats& listStats = frame.neighborListStats;
+                    ImGui::Text("Builds %llu / %llu substeps  pairs %zu", static_cast<unsigned long long>(listStats.builds),
+                        static_cast<unsigned long long>(listStats.subSteps), listStats.pairCount);
+                }
+
+                // Integration pass
+                if (ImGui::Checkbox("Fused Integration Pass", &useFusedIntegration))
+                    simulationThread.Post([useFusedIntegration](SimulationSystem& simulation) { simulation.SetUseFusedIntegration(useFusedIntegration); });
+
+                // Grid storage, the hashed grid only stores the occupied cells
+                if (ImGui::Checkbox("Hashed Grid", &useHashedGrid))
+                    simulationThread.Post([useHashedGrid](SimulationSystem& simulation) { simulation.SetUseHashedGrid(useHashedGrid); });
+                if (frame.useHashedGrid)
+                    ImGui::Text("Occupied Cells %zu", frame.gridCellCount);
+
+                // Memory reordering, 0 disables it
+                if (ImGui::SliderInt("Reorder Interval", &reorderInterval, 0, 300))
+                    simulationThread.Post([reorderInterval](SimulationSystem& simulation) { simulation.SetReorderInterval(static_cast<unsigned int>(reorderInterval)); });
+
+                // Integration kernel, only the instruction sets this CPU supports
+                if (ImGui::SliderInt("Integration Kernel", &simdLevel, 0, maxSimdLevel, GetSimdLevelName(static_cast<SimdLevel>(simdLevel))))
+                    simulationThread.Post([simdLevel](SimulationSystem& simulation) { simulation.SetSimdLevel(static_cast<SimdLevel>(simdLevel)); });
+
+                // Reproducible runs, the seed is used by the next reset
+                if (ImGui::Checkbox("Deterministic", &isDeterministic))
+                    simulationThread.Post([isDeterministic](SimulationSystem& simulation) { simulation.SetIsDeterministic(isDeterministic); });
+                if (ImGui::InputScalar("Seed", ImGuiDataType_U32, &seed, NULL, NULL, "%u"))
+                    simulationThread.Post([seed](SimulationSystem& simulation) { simulation.SetSeed(seed); });
+                if (isDeterministic)
+                    ImGui::Text("Step %llu hash %016llx", static_cast<unsigned long long>(frame.stepIndex),
+                        static_cast<unsigned long long>(frame.stateHash));
 
                 // Simulation size
+                // Sinks, the particles entering one are removed at the end of the update
+                ImGui::InputFloat4("Sink Corners", sinkCorners, "%.0f");
+                if (ImGui::Button("Add Sink", ImVec2(ImGui::GetContentRegionAvail().x * 0.5f, 0)))
+                {
+                    const Vec2 bottomLeft(sinkCorners[0], sinkCorners[1]);
+                    const Vec2 topRight(sinkCorners[2], sinkCorners[3]);
+                    simulationThread.Post([bottomLeft, topRight](SimulationSystem& simulation) { simulation.AddSink(bottomLeft, topRight); });
+                }
+                ImGui::SameLine();
+                if (ImGui::Button("Clear Sinks", ImVec2(ImGui::GetContentRegionAvail().x, 0)))
+                    simulationThread.Post([](SimulationSystem& simulation) { simulation.ClearSinks(); });
+                if (ImGui::Checkbox("Keep Order on Removal", &useStableRemoval))
+                    simulationThread.Post([useStableRemoval](SimulationSystem& simulation) { simulation.SetUseStableRemoval(useStableRemoval); });
+                ImGui::Text("Removed %llu by %zu sinks", static_cast<unsigned long long>(frame.removedCount), frame.sinks.size());
+
+                // Emitters, a line or a rectangle between two corners or a disc around a center
+                const char* emitterShapes[] = { "Line", "Disc", "Rect" };
+                ImGui::Combo("Emitter Shape", &emitterShape, emitterShapes, IM_ARRAYSIZE(emitterShapes));
+                ImGui::InputFloat4(emitterShape == static_cast<int>(EmitterShape::Disc) ? "Center, Radius" : "Emitter Corners", emitterCoordinates, "%.0f");
+                ImGui::InputFloat("Emitter Rate", &emitterRate, 10.0f, 100.0f, "%.0f");
+                ImGui::InputFloat2("Emitter Velocity", emitterVelocity, "%.2f");
+                if (ImGui::Button("Add Emitter", ImVec2(ImGui::GetContentRegionAvail().x * 0.5f, 0)))
+                {
+                    EmitterSettings settings;
+                    settings.shape = static_cast<EmitterShape>(emitterShape);
+                    settings.start = Vec2(emitterCoordinates[0], emitterCoordinates[1]);
+                    settings.end = Vec2(emitterCoordinates[2], emitterCoordinates[3]);
+                    settings.radius = emitterCoordinates[2];
+                    settings.velocity = Vec2(emitterVelocity[0], emitterVelocity[1]);
+                    settings.acceleration = GRAVITY;
+                    settings.mass = particleMass;
+                    settings.rateCurve.push_back({ 0.0f, emitterRate });
+                    simulationThread.Post([settings](SimulationSystem& simulation) { simulation.AddEmitter(settings); });
+                }
+                ImGui::SameLine();
+                if (ImGui::Button("Clear Emitters", ImVec2(ImGui::GetContentRegionAvail().x, 0)))
+                    simulationThread.Post([](SimulationSystem& simulation) { simulation.ClearEmitters(); });
+                ImGui::Text("Spawned %d by %zu emitters", frame.emittedCount, frame.emitters.size());
+
                 if (ImGui::SliderFloat("heigth", &simHeight, 10, 5000, "%.1f"))
-                    sim.SetSimHeight(simHeight);
+                    simulationThread.Post([simHeight](SimulationSystem& simulation) { simulation.SetSimHeight(simHeight); });
 
                 if (ImGui::SliderFloat("width", &simWidth, 10, 5000, "%.1f"))
-                    sim.SetSimWidth(simWidth);
+                    simulationThread.Post([simWidth](SimulationSystem& simulation) { simulation.SetSimWidth(simWidth); });
 
 
                 const float buttonWidth = ImGui::GetContentRegionAvail().x;
                 if (ImGui::Button("Reset Simulation", ImVec2(buttonWidth, 30)))
                 {
-                    ResetSimulation(sim, 0.6f, addParticleInBulk, addParticleInStream,
-                        streamSpeed, initialParticleSpeed, particleMass, totalNumberOfParticles, particleRadius);
+                    const bool bulk = addParticleInBulk;
+                    const bool stream = addParticleInStream;
+                    simulationThread.Post([=](SimulationSystem& simulation)
+                    {
+                        ResetSimulation(simulation, bulk, stream, streamSpeed, initialParticleSpeed, particleMass, totalNumberOfParticles, particleRadius);
+                    });
+                    camera = Camera();
+                    needsReset = false;
+                }
+
+                // Checkpoints
+                ImGui::InputText("Snapshot File", snapshotPath, sizeof(snapshotPath));
+                const std::string path = snapshotPath;
+                if (ImGui::Button("Save Snapshot", ImVec2(buttonWidth * 0.5f, 0)))
+                {
+                    simulationThread.Post([path](SimulationSystem& simulation)
+                    {
+                        if (simulation.SaveSnapshot(path))
+                            std::cout << "Saved " << simulation.GetParticleCount() << " particles to " << path << std::endl;
+                    });
+                }
+                ImGui::SameLine();
+                if (ImGui::Button("Load Snapshot", ImVec2(ImGui::GetContentRegionAvail().x, 0)))
+                {
+                    // The interface syncs with the loaded state once a frame reflects the load, nothing changes if it failed
+                    pendingLoadCommand = simulationThread.Post([path](SimulationSystem& simulation) { simulation.LoadSnapshot(path); });
                     needsReset = false;
-                    timeManager = Time(fixedDeltaTime);
                 }
             }
 
@@ -278,17 +568,26 @@ int main(void)
 
                 bool oldRenderTemperature = renderTemperature;
                 if (ImGui::RadioButton("Velocity", !renderTemperature))
-                    renderTemperature = false;
+                    renderTemperature = renderPressure = false;
                 ImGui::SameLine();
-                if (ImGui::RadioButton("Temperature", renderTemperature))
+                if (ImGui::RadioButton("Temperature", renderTemperature && !renderPressure))
+                {
                     renderTemperature = true;
+                    renderPressure = false;
+                }
+                ImGui::SameLine();
+                if (ImGui::RadioButton("Pressure", renderPressure))
+                    renderTemperature = renderPressure = true;
+
+                if (renderPressure)
+                    ImGui::SliderFloat("Pressure Scale", &pressureScale, 0.001f, 1.0f, "%.3f", ImGuiSliderFlags_Logarithmic);
 
                 // Not the best implementation but it works
                 if (oldRenderTemperature != renderTemperature)
                 {
                     renderVelocity = !renderTemperature;
                     activeShader = renderTemperature ? &tempShader : &velShader;
-                    renderer = std::make_unique<ParticleRenderer>(sim, *activeShader, renderTemperature);
+                    renderer = std::make_unique<ParticleRenderer>(*activeShader, renderTemperature, frame.positions.size());
                 }
             }
             
@@ -296,58 +595,180 @@ int main(void)
 
             if (ImGui::CollapsingHeader("Physics constants"))
             {
+                // Every change sends the whole set, the solver never sees half updated constants
+                bool hasChanged = false;
+
                 // Gravity
-                float gravityValues[2] = { GRAVITY.x, GRAVITY.y };
+                float gravityValues[2] = { constants.gravity.x, constants.gravity.y };
                 if (ImGui::InputFloat2("Gravity", gravityValues))
                 {
-                    GRAVITY.x = gravityValues[0];
-                    GRAVITY.y = gravityValues[1];
+                    constants.gravity.x = gravityValues[0];
+                    constants.gravity.y = gravityValues[1];
+                    hasChanged = true;
                 }
 
                 // Restitution (bounce factor)
-                ImGui::SliderFloat("Restitution", &RESTITUTION, 0.0f, 1.0f, "%.3f");
+                hasChanged |= ImGui::SliderFloat("Restitution", &constants.restitution, 0.0f, 1.0f, "%.3f");
 
                 // Air resistance
-                if (ImGui::SliderFloat("Air Resistance", &AIR_RESISTANCE, 0.0f, 0.1f, "%.4f"))
-                    INVERSE_AIR_RESISTANCE = (AIR_RESISTANCE > 0.0f) ? 1.0f / AIR_RESISTANCE : 0.0f;
-                
+                hasChanged |= ImGui::SliderFloat("Air Resistance", &constants.airResistance, 0.0f, 0.1f, "%.4f");
 
                 // Max velocity
-                if (ImGui::SliderFloat("Max Velocity", &MAX_VELOCITY, 50.0f, 1000.0f, "%.1f"))
-                    MAX_VELOCITY_SQ = MAX_VELOCITY * MAX_VELOCITY;
-                
+                hasChanged |= ImGui::SliderFloat("Max Velocity", &constants.maxVelocity, 50.0f, 1000.0f, "%.1f");
 
                 // Min delta movement
-                ImGui::SliderFloat("Min Delta Movement", &MIN_DELTA_MOVEMENT, 0.001f, 0.1f, "%.4f");
+                hasChanged |= ImGui::SliderFloat("Min Delta Movement", &constants.minDeltaMovement, 0.001f, 0.1f, "%.4f");
 
                 // Damping factor
-                ImGui::SliderFloat("Damping Factor", &DAMPING_FACTOR, 0.0f, 2.0f, "%.3f");
+                hasChanged |= ImGui::SliderFloat("Damping Factor", &constants.dampingFactor, 0.0f, 2.0f, "%.3f");
 
                 // Force coefficients
-                ImGui::SliderFloat("Spacebar Force", &SPACEBAR_FORCE_COEFFICIENT, 0.0f, 2000.0f, "%.1f");
-                ImGui::SliderFloat("Left Click Force", &LEFT_CLICK_FORCE_COEFFICIENT, 0.0f, 5000.0f, "%.1f");
-                ImGui::SliderFloat("Max Force Distance Squared", &MAX_FORCE_DISTANCE_SQ, 1000.0f, 200000.0f, "%.0f");
+                hasChanged |= ImGui::SliderFloat("Spacebar Force", &constants.spaceBarForce, 0.0f, 2000.0f, "%.1f");
+                hasChanged |= ImGui::SliderFloat("Left Click Force", &constants.leftClickForce, 0.0f, 5000.0f, "%.1f");
+                hasChanged |= ImGui::SliderFloat("Max Force Distance Squared", &constants.maxForceDistanceSq, 1000.0f, 200000.0f, "%.0f");
 
                 // Heat stuff
-                ImGui::SliderFloat("Thermal Dispersion/Frame", &THERMAL_DISPERSION_PER_FRAME, 0.0f, 1.0f, "%.3f");
-                ImGui::SliderFloat("Max Thermal Diffusion/Collision", &MAX_THERMAL_DIFFUSION_PER_COLLISION, 0.0f, 50.0f, "%.1f");
+                hasChanged |= ImGui::SliderFloat("Thermal Dispersion/Frame", &constants.thermalDispersion, 0.0f, 1.0f, "%.3f");
+                hasChanged |= ImGui::SliderFloat("Max Thermal Diffusion/Collision", &constants.maxThermalDiffusion, 0.0f, 50.0f, "%.1f");
 
                 // Reset to defaults button
                 if (ImGui::Button("Reset Physics Constants to Defaults", ImVec2(ImGui::GetContentRegionAvail().x, 0)))
                 {
-                    GRAVITY = { 0.0f, -50.0f };
-                    RESTITUTION = 0.8f;
-                    AIR_RESISTANCE = 0.005f;
-                    INVERSE_AIR_RESISTANCE = 1.0f / AIR_RESISTANCE;
-                    MAX_VELOCITY = 200.0f;
-                    MAX_VELOCITY_SQ = MAX_VELOCITY * MAX_VELOCITY;
-                    MIN_DELTA_MOVEMENT = 0.005f;
-                    DAMPING_FACTOR = 1.0f;
-                    SPACEBAR_FORCE_COEFFICIENT = 500.0f;
-                    LEFT_CLICK_FORCE_COEFFICIENT = 1000.0f;
-                    MAX_FORCE_DISTANCE_SQ = 50000.0f;
-                    THERMAL_DISPERSION_PER_FRAME = 0.1f;
-                    MAX_THERMAL_DIFFUSION_PER_COLLISION = 15.0f;
+                    constants = PhysicsConstants();
+                    hasChanged = true;
+                }
+
+                if (hasChanged)
+                    simulationThread.Post([constants](SimulationSystem&) { SetPhysicsConstants(constants); });
+            }
+
+            ImGui::Separator();
+
+            if (ImGui::CollapsingHeader("Recording"))
+            {
+                ImGui::InputText("Trajectory File", trajectoryPath, sizeof(trajectoryPath));
+
+                const float buttonWidth = ImGui::GetContentRegionAvail().x;
+                if (!frame.isRecording)
+                {
+                    if (ImGui::Button("Start Recording", ImVec2(buttonWidth, 0)))
+                        simulationThread.StartRecording(trajectoryPath);
+                }
+                else
+                {
+                    if (ImGui::Button("Stop Recording", ImVec2(buttonWidth, 0)))
+                        simulationThread.StopRecording();
+                }
+
+                // Size on disk against raw floats
+                const double rawMB = frame.recordedRawBytes / (1024.0 * 1024.0);
+                const double writtenMB = frame.recordedBytes / (1024.0 * 1024.0);
+                ImGui::Text("Frames: %llu  Stalls: %llu", static_cast<unsigned long long>(frame.recordedFrames),
+                    static_cast<unsigned long long>(frame.recordingStalls));
+                ImGui::Text("Written: %.2f MB (raw %.2f MB, %.1f%%)", writtenMB, rawMB, rawMB > 0.0 ? writtenMB / rawMB * 100.0 : 0.0);
+            }
+
+            ImGui::Separator();
+
+            if (ImGui::CollapsingHeader("Replay"))
+            {
+                ImGui::InputText("Replay File", replayPath, sizeof(replayPath));
+
+                const float buttonWidth = ImGui::GetContentRegionAvail().x;
+                if (!player.IsOpen())
+                {
+                    // The simulation is suspended and continues when the replay is closed
+                    if (ImGui::Button("Open Replay", ImVec2(buttonWidth, 0)) && player.Open(replayPath))
+                    {
+                        player.SetIsPlaying(true);
+                        simulationThread.SetIsSuspended(true);
+                    }
+                }
+                else
+                {
+                    if (ImGui::Button("Close Replay", ImVec2(buttonWidth, 0)))
+                    {
+                        player.Close();
+                        simulationThread.SetIsSuspended(false);
+                    }
+                }
+
+                if (player.IsOpen())
+                {
+                    bool isPlaying = player.GetIsPlaying();
+                    if (ImGui::Checkbox("Play", &isPlaying))
+                        player.SetIsPlaying(isPlaying);
+                    ImGui::SameLine();
+                    bool isLooping = player.GetIsLooping();
+                    if (ImGui::Checkbox("Loop", &isLooping))
+                        player.SetIsLooping(isLooping);
+
+                    float speed = player.GetSpeed();
+                    if (ImGui::SliderFloat("Speed", &speed, 0.1f, 32.0f, "%.2fx", ImGuiSliderFlags_Logarithmic))
+                        player.SetSpeed(speed);
+
+                    // Scrubbing
+                    int frame = static_cast<int>(player.GetCurrentFrame());
+                    if (ImGui::SliderInt("Frame", &frame, 0, static_cast<int>(player.GetFrameCount()) - 1))
+                        player.Seek(static_cast<size_t>(frame));
+
+                    ImGui::Text("%u particles, %.1f s recorded, last seek decoded %u frames",
+                        static_cast<unsigned int>(player.GetPositions().size()),
+                        player.GetFrameCount() * player.GetFrameTime(), player.GetLastSeekDecodes());
+                }
+            }
+
+            ImGui::Separator();
+
+            if (ImGui::CollapsingHeader("Profiler"))
+            {
+                if (!Profiler::IsCompiledIn())
+                {
+                    ImGui::Text("Profiler compiled out (ENABLE_PROFILER = 0)");
+                }
+                else
+                {
+                    bool profilerEnabled = frame.isProfilerEnabled;
+                    if (ImGui::Checkbox("Record Timings", &profilerEnabled))
+                        simulationThread.Post([profilerEnabled](SimulationSystem& simulation) { simulation.GetProfiler().SetIsEnabled(profilerEnabled); });
+
+                    ImGui::Text("Per update over the last %u updates (ms)", static_cast<unsigned int>(frame.profiledFrames));
+
+                    // One row per phase
+                    if (ImGui::BeginTable("ProfilerTable", 5, ImGuiTableFlags_Borders | ImGuiTableFlags_RowBg))
+                    {
+                        ImGui::TableSetupColumn("Phase");
+                        ImGui::TableSetupColumn("Last");
+                        ImGui::TableSetupColumn("Min");
+                        ImGui::TableSetupColumn("Avg");
+                        ImGui::TableSetupColumn("P99");
+                        ImGui::TableHeadersRow();
+
+                        for (int p = 0; p < static_cast<int>(ProfilePhase::Count); p++)
+                        {
+                            const ProfilePhaseStats& stats = frame.phaseStats[p];
+                            ImGui::TableNextRow();
+                            ImGui::TableNextColumn(); ImGui::Text("%s", GetProfilePhaseName(static_cast<ProfilePhase>(p)));
+                            ImGui::TableNextColumn(); ImGui::Text("%.3f", stats.lastMs);
+                            ImGui::TableNextColumn(); ImGui::Text("%.3f", stats.minMs);
+                            ImGui::TableNextColumn(); ImGui::Text("%.3f", stats.avgMs);
+                            ImGui::TableNextColumn(); ImGui::Text("%.3f", stats.p99Ms);
+                        }
+                        ImGui::EndTable();
+                    }
+
+                    const float buttonWidth = ImGui::GetContentRegionAvail().x;
+                    if (ImGui::Button("Dump CSV (profiler.csv)", ImVec2(buttonWidth * 0.5f, 0)))
+                    {
+                        simulationThread.Post([](SimulationSystem& simulation)
+                        {
+                            if (!simulation.GetProfiler().DumpCSV("profiler.csv"))
+                                std::cerr << "Failed to write profiler.csv" << std::endl;
+                        });
+                    }
+                    ImGui::SameLine();
+                    if (ImGui::Button("Clear", ImVec2(ImGui::GetContentRegionAvail().x, 0)))
+                        simulationThread.Post([](SimulationSystem& simulation) { simulation.GetProfiler().Reset(); });
                 }
             }
 
@@ -359,7 +780,7 @@ int main(void)
             // Display fps and mspf
             if (++FPScounter > 75)
             {
-                UpdateWindowTitle(window, timeManager, sim.GetCurNumOfParticles());
+                UpdateWindowTitle(window, timeManager, frame.currentNumOfParticles);
                 FPScounter = 0;
             }
 
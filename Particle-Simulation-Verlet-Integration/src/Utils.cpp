@@ -177,7 +177,7 @@ void UpdateWindowTitle(GLFWwindow* window, const Time& timeManager, unsigned int
     glfwSetWindowTitle(window, title.c_str());
 }
 
-void UpdateMousePosition(GLFWwindow* window, SimulationSystem& sim) 
+Vec2 GetMouseSimulationPosition(GLFWwindow* window, const Camera& camera, const Bounds& bounds)
 {
    // Update mouse position
    double cursorX, cursorY;
@@ -192,129 +192,94 @@ void UpdateMousePosition(GLFWwindow* window, SimulationSystem& sim)
 
    // Map normalized position to simulation coordinates
    glm::vec4 cursorPosNormalized(normalizedX, normalizedY, 0.0f, 1.0f);
-   glm::vec4 cursorSimPos = glm::inverse(sim.GetProjMatrix() * sim.GetViewMatrix()) * cursorPosNormalized;
+   glm::vec4 cursorSimPos = glm::inverse(camera.GetViewProjection(bounds, GetFramebufferAspect())) * cursorPosNormalized;
 
    // Check if the mouse is inside the simulation bounds
-   const Bounds bounds = sim.GetBounds();
    if (cursorSimPos.x < bounds.bottomLeft.x || cursorSimPos.x > bounds.topRight.x ||
        cursorSimPos.y < bounds.bottomLeft.y || cursorSimPos.y > bounds.topRight.y) 
    {
        // Set mouse position to {-1, -1} if outside bounds
-       sim.SetMousePosition(-1.0, -1.0);
+       return Vec2(-1.0f, -1.0f);
    } 
-   else 
-   {
-       // Update the mouse position in the simulation system
-       sim.SetMousePosition(cursorSimPos.x, cursorSimPos.y);
-   }
+
+   return Vec2(cursorSimPos.x, cursorSimPos.y);
 }
 
-void ProcessInput(GLFWwindow* window, SimulationSystem& sim, float deltaTime)
+void ProcessInput(GLFWwindow* window, SimulationThread& simulationThread, Camera& camera, const Bounds& bounds, float deltaTime)
 {
     // Close window on ESC key press
     if (glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS)
         glfwSetWindowShouldClose(window, true);
 
-    // Helper 
-    UpdateMousePosition(window, sim);
-
-    static bool spaceKeyPressed = false;
     static bool pKeyPressed = false; 
-    static bool leftMousePressed = false;
-    static bool rightMousePressed = false;
-
+    static SimulationInput lastInput;
 
     // Z/X keys to adjust zoom
     if (glfwGetKey(window, GLFW_KEY_Z) == GLFW_PRESS)
     {
-        sim.SetZoom(sim.GetZoom() * (1.0f - 0.002));
+        camera.zoom *= (1.0f - 0.002f);
     }
     if (glfwGetKey(window, GLFW_KEY_X) == GLFW_PRESS)
     {
-        sim.SetZoom(sim.GetZoom() * (1.0f + 0.002));
+        camera.zoom *= (1.0f + 0.002f);
     }
 
     // Handle camera movement with arrow keys
-    float cameraSpeed = 100.0f * deltaTime / sim.GetZoom();
+    float cameraSpeed = 100.0f * deltaTime / camera.zoom;
 
     if (glfwGetKey(window, GLFW_KEY_UP) == GLFW_PRESS)
     {
-        sim.MoveCamera({ 0.0f, cameraSpeed });
+        camera.position += { 0.0f, cameraSpeed };
     }
     if (glfwGetKey(window, GLFW_KEY_DOWN) == GLFW_PRESS)
     {
-        sim.MoveCamera({ 0.0f, -cameraSpeed });
+        camera.position += { 0.0f, -cameraSpeed };
     }
     if (glfwGetKey(window, GLFW_KEY_RIGHT) == GLFW_PRESS)
     {
-        sim.MoveCamera({ cameraSpeed, 0.0f });
+        camera.position += { cameraSpeed, 0.0f };
     }
     if (glfwGetKey(window, GLFW_KEY_LEFT) == GLFW_PRESS)
     {
-        sim.MoveCamera({ -cameraSpeed, 0.0f });
+        camera.position += { -cameraSpeed, 0.0f };
     }
 
     // Reset camera position with R key
     if (glfwGetKey(window, GLFW_KEY_R) == GLFW_PRESS)
     {
-        sim.SetCameraPosition({ 0.0f, 0.0f });
-    }
-
-    // Space key handling
-    if (glfwGetKey(window, GLFW_KEY_SPACE) == GLFW_PRESS)
-    {
-        if (!spaceKeyPressed) {
-            spaceKeyPressed = true;
-            sim.SetIsSpaceBarPressed(spaceKeyPressed);
-        }
-    }
-    else if (glfwGetKey(window, GLFW_KEY_SPACE) == GLFW_RELEASE)
-    {
-        spaceKeyPressed = false;
-        sim.SetIsSpaceBarPressed(spaceKeyPressed);
+        camera.position = { 0.0f, 0.0f };
     }
 
-    // Mouse LEFT click handling 
-    if ((glfwGetMouseButton(window, GLFW_MOUSE_BUTTON_LEFT) == GLFW_PRESS))
-    {
-        if (!leftMousePressed) {
-            leftMousePressed = true;
-            sim.SetIsMouseLeftClicked(leftMousePressed);
-        }
-    }
-    else if (glfwGetMouseButton(window, GLFW_MOUSE_BUTTON_LEFT) == GLFW_RELEASE)
-    {
-        leftMousePressed = false;
-        sim.SetIsMouseLeftClicked(leftMousePressed);
-    }
+    // Mouse, space key and mouse buttons
+    SimulationInput input;
+    input.mousePosition = GetMouseSimulationPosition(window, camera, bounds);
+    input.isSpaceBarPressed = glfwGetKey(window, GLFW_KEY_SPACE) == GLFW_PRESS;
+    input.isLeftClickPressed = glfwGetMouseButton(window, GLFW_MOUSE_BUTTON_LEFT) == GLFW_PRESS;
+    input.isRightClickPressed = glfwGetMouseButton(window, GLFW_MOUSE_BUTTON_RIGHT) == GLFW_PRESS;
 
-    // Mouse RIGHT click handling 
-    if ((glfwGetMouseButton(window, GLFW_MOUSE_BUTTON_RIGHT) == GLFW_PRESS))
-    {
-        if (!rightMousePressed) {
-            rightMousePressed = true;
-            sim.SetIsMouseRightClicked(rightMousePressed);
-        }
-    }
-    else if (glfwGetMouseButton(window, GLFW_MOUSE_BUTTON_RIGHT) == GLFW_RELEASE)
+    // Only send the input when it changed, it's applied before the next update
+    if (input.mousePosition != lastInput.mousePosition || input.isSpaceBarPressed != lastInput.isSpaceBarPressed ||
+        input.isLeftClickPressed != lastInput.isLeftClickPressed || input.isRightClickPressed != lastInput.isRightClickPressed)
     {
-        rightMousePressed = false;
-        sim.SetIsMouseRightClicked(rightMousePressed);
+        simulationThread.SetInput(input);
+        lastInput = input;
     }
 
     // Only toggle pause state on key press, not while holding
     bool isPCurrentlyPressed = glfwGetKey(window, GLFW_KEY_P) == GLFW_PRESS;
     if (isPCurrentlyPressed && !pKeyPressed) {
-        sim.SetIsPaused(!sim.GetIsPaused());
-        std::cout << "Pause toggled: " << (sim.GetIsPaused() ? "Paused" : "Unpaused") << std::endl;
+        simulationThread.Post([](SimulationSystem& sim)
+        {
+            sim.SetIsPaused(!sim.GetIsPaused());
+            std::cout << "Pause toggled: " << (sim.GetIsPaused() ? "Paused" : "Unpaused") << std::endl;
+        });
     }
     pKeyPressed = isPCurrentlyPressed; 
 }
 
 // Function to reset the simulation with current parameters
-void ResetSimulation(SimulationSystem& sim, float zoom, bool bulk, bool stream, float streamSpeed, Vec2 InitialSpeed, float mass, unsigned int totalParticles, float particleRad) {
+void ResetSimulation(SimulationSystem& sim, bool bulk, bool stream, float streamSpeed, Vec2 InitialSpeed, float mass, unsigned int totalParticles, float particleRad) {
     sim.Reset(particleRad);
-    sim.SetZoom(zoom);
 
     if (bulk) {
         sim.AddBulkParticles(totalParticles, Vec2(0.0f, 0.0f), Vec2(0.0f, 0.0f), mass);
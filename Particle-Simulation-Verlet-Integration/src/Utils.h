@@ -18,6 +18,20 @@
 #include "core/Time.h"
 #include "physics/Vec2.h"
 #include "physics/SimulationSystem.h"
+#include "physics/SimulationThread.h"
+
+// View of the simulation, owned by the render thread
+struct Camera
+{
+    Vec2 position = { 0.0f, 0.0f };
+    float zoom = 0.6f; // Just looks better
+
+    // Return the view projection matrix for the given simulation bounds
+    glm::mat4 GetViewProjection(const Bounds& bounds, float windowAspect) const
+    {
+        return SimulationSystem::GetProjMatrix(bounds, zoom, windowAspect) * SimulationSystem::GetViewMatrix(bounds, position);
+    }
+};
 
 // Returns true if shaderPath is valid
 bool IsShaderPathOk(std::string shaderPath);
@@ -29,7 +43,8 @@ void BoundsRenderer(Vec2 bottomLeft, Vec2 topRight, float borderWidth,
 void UpdateWindowTitle(GLFWwindow* window, const Time& timeManager, unsigned int currentNumOfParticles, const std::string& appName = "Particle Simulation");
 
 // In the future this could be in a seperate file called "UserInput"
-void ProcessInput(GLFWwindow* window, SimulationSystem& sim, float deltaTime);
+// Camera keys are applied directly, the simulation input is sent to the simulation thread when it changes
+void ProcessInput(GLFWwindow* window, SimulationThread& simulationThread, Camera& camera, const Bounds& bounds, float deltaTime);
 
-void ResetSimulation(SimulationSystem& sim, float zoom, bool bulk, bool stream, 
+void ResetSimulation(SimulationSystem& sim, bool bulk, bool stream, 
     float streamSpeed, Vec2 InitialSpeed, float mass, unsigned int totalParticles, float particleRad);
\ No newline at end of file
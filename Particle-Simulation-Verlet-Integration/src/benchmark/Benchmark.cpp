@@ -0,0 +1,468 @@
+// Microbenchmarks for the physics hot paths.
+// Every kernel runs on reproducible seeded scenes, the particle state is restored before each
+// repetition so all repetitions see the same input.
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <cstdlib>
+#include <cstdio>
+#include <algorithm>
+#include <functional>
+
+#include "physics/SimulationSystem.h"
+#include "physics/Solver.h"
+#include "physics/Constants.h"
+
+enum class SceneType
+{
+    SettledPile,
+    FreeFallGas,
+    DenseStream
+};
+
+static const char* GetSceneName(SceneType scene)
+{
+    switch (scene)
+    {
+    case SceneType::SettledPile: return "settled_pile";
+    case SceneType::FreeFallGas: return "free_fall_gas";
+    default:                     return "dense_stream";
+    }
+}
+
+struct BenchmarkConfig
+{
+    std::vector<unsigned int> sizes = { 1000, 10000, 100000, 1000000 };
+    std::vector<SceneType> scenes = { SceneType::SettledPile, SceneType::FreeFallGas, SceneType::DenseStream };
+    unsigned int threads = 0;
+    unsigned int subSteps = 8;
+    unsigned int seed = 12345;
+    float particleRadius = 2.7f;
+    float repetitionScale = 1.0f;
+    std::string jsonPath;
+};
+
+struct KernelResult
+{
+    std::string scene;
+    std::string kernel;
+    unsigned int particles;
+    unsigned int repetitions;
+    double minNs;
+    double medianNs;
+    double nsPerParticle;
+    double pairsPerSecond;      // 0 when the kernel doesn't produce pairs
+    double bandwidthGBs;        // estimated from the bytes each kernel has to touch
+};
+
+// Domain side for the requested particle count, so every scene keeps the same density at any size
+static float GetDomainSize(SceneType scene, unsigned int particles, float radius)
+{
+    const float diameter = radius * 2.0f;
+    switch (scene)
+    {
+    case SceneType::FreeFallGas:
+        // 10% area fraction
+        return std::sqrt(particles * 3.14159265f * radius * radius / 0.1f);
+    default:
+        // A lattice filling half of the domain
+        return std::sqrt(particles * diameter * diameter * 2.0f);
+    }
+}
+
+static void BuildScene(SimulationSystem& sim, SceneType scene, unsigned int particles, float radius, unsigned int seed)
+{
+    std::mt19937 gen(seed);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+
+    const Bounds bounds = sim.GetBounds();
+    const float width = bounds.topRight.x - bounds.bottomLeft.x;
+    const float height = bounds.topRight.y - bounds.bottomLeft.y;
+    const float diameter = radius * 2.0f;
+
+    // Velocities are given per substep like AddBulkParticles expects
+    switch (scene)
+    {
+    case SceneType::SettledPile:
+    {
+        // Slightly overlapping lattice resting on the floor
+        const float spacing = diameter * 0.98f;
+        const unsigned int columns = std::max(1u, static_cast<unsigned int>((width - diameter) / spacing));
+        for (unsigned int i = 0; i < particles; i++)
+        {
+            const unsigned int row = i / columns;
+            const unsigned int column = i % columns;
+            const float offset = (row % 2) ? spacing * 0.5f : 0.0f;
+            Vec2 position(bounds.bottomLeft.x + radius + column * spacing + offset,
+                bounds.bottomLeft.y + radius + row * spacing * 0.866f);
+            sim.AddParticle(position, Vec2(0.0f, 0.0f), Vec2(0.0f, 0.0f), 1.0f, radius);
+        }
+        break;
+    }
+    case SceneType::FreeFallGas:
+    {
+        std::uniform_real_distribution<float> velocity(-0.5f, 0.5f);
+        for (unsigned int i = 0; i < particles; i++)
+        {
+            Vec2 position(bounds.bottomLeft.x + radius + unit(gen) * (width - diameter),
+                bounds.bottomLeft.y + radius + unit(gen) * (height - diameter));
+            sim.AddParticle(position, Vec2(velocity(gen), velocity(gen)), Vec2(0.0f, 0.0f), 1.0f, radius);
+        }
+        break;
+    }
+    case SceneType::DenseStream:
+    {
+        // Packed jittered column falling fast, half the domain wide so it spans the full height
+        const float bandWidth = width * 0.5f;
+        const unsigned int columns = std::max(1u, static_cast<unsigned int>(bandWidth / diameter));
+        const float left = bounds.bottomLeft.x + (width - bandWidth) * 0.5f;
+        for (unsigned int i = 0; i < particles; i++)
+        {
+            const unsigned int row = i / columns;
+            const unsigned int column = i % columns;
+            Vec2 position(left + (column + 0.5f) * diameter + (unit(gen) - 0.5f) * radius * 0.2f,
+                bounds.topRight.y - radius - row * diameter * 0.95f);
+            sim.AddParticle(position, Vec2(0.0f, -1.0f), Vec2(0.0f, 0.0f), 1.0f, radius);
+        }
+        break;
+    }
+    }
+
+    sim.SetReorderInterval(0);
+}
+
+struct SceneSnapshot
+{
+    std::vector<Vec2> positions;
+    std::vector<Vec2> prevPositions;
+    std::vector<Vec2> accelerations;
+    std::vector<float> temperatures;
+
+    void Save(SimulationSystem& sim)
+    {
+        positions.assign(sim.GetPositions().begin(), sim.GetPositions().end());
+        prevPositions.assign(sim.GetPrevPositions().begin(), sim.GetPrevPositions().end());
+        accelerations.assign(sim.GetAccelerations().begin(), sim.GetAccelerations().end());
+        temperatures.assign(sim.GetTemperatures().begin(), sim.GetTemperatures().end());
+    }
+
+    // Same sizes so no reallocation happens, the optional columns only if they are still enabled
+    void Restore(SimulationSystem& sim) const
+    {
+        std::copy(positions.begin(), positions.end(), sim.GetPositions().begin());
+        std::copy(prevPositions.begin(), prevPositions.end(), sim.GetPrevPositions().begin());
+        if (sim.GetAccelerations().size() == accelerations.size())
+            std::copy(accelerations.begin(), accelerations.end(), sim.GetAccelerations().begin());
+        if (sim.GetTemperatures().size() == temperatures.size())
+            std::copy(temperatures.begin(), temperatures.end(), sim.GetTemperatures().begin());
+    }
+};
+
+// Time kernel() repetitions times, setup() runs before each repetition and is not timed
+static std::vector<double> TimeKernel(unsigned int repetitions, const std::function<void()>& setup, const std::function<void()>& kernel)
+{
+    std::vector<double> samples;
+    samples.reserve(repetitions);
+
+    for (unsigned int r = 0; r < repetitions; r++)
+    {
+        setup();
+        auto start = std::chrono::steady_clock::now();
+        kernel();
+        auto end = std::chrono::steady_clock::now();
+        samples.push_back(std::chrono::duration<double, std::nano>(end - start).count());
+    }
+
+    std::sort(samples.begin(), samples.end());
+    return samples;
+}
+
+static KernelResult MakeResult(SceneType scene, const char* kernel, unsigned int particles, const std::vector<double>& samples,
+    double pairs, double bytes)
+{
+    KernelResult result;
+    result.scene = GetSceneName(scene);
+    result.kernel = kernel;
+    result.particles = particles;
+    result.repetitions = static_cast<unsigned int>(samples.size());
+    result.minNs = samples.front();
+    result.medianNs = samples[samples.size() / 2];
+    result.nsPerParticle = result.medianNs / std::max(1u, particles);
+    result.pairsPerSecond = pairs > 0.0 ? pairs / (result.medianNs * 1e-9) : 0.0;
+    result.bandwidthGBs = bytes / result.medianNs; // bytes per ns == GB/s
+    return result;
+}
+
+static void RunScene(const BenchmarkConfig& config, SceneType scene, unsigned int particles, std::vector<KernelResult>& results)
+{
+    const float radius = config.particleRadius;
+    const float size = GetDomainSize(scene, particles, radius);
+    const float deltaTime = 1.0f / 60.0f;
+
+    SimulationSystem sim(particles, Vec2(-size / 2, -size / 2), Vec2(size / 2, size / 2), radius, config.subSteps, config.threads);
+    BuildScene(sim, scene, particles, radius, config.seed);
+
+    SceneSnapshot snapshot;
+    snapshot.Save(sim);
+
+    // Around 2e7 particle updates per kernel, capped so small scenes don't run forever
+    const unsigned int repetitions = static_cast<unsigned int>(std::min(200.0, std::max(3.0, 2e7 / particles * config.repetitionScale)));
+    const unsigned int stepRepetitions = static_cast<unsigned int>(std::min(50.0, std::max(2.0, 2e6 / particles * config.repetitionScale)));
+
+    const double n = particles;
+    const size_t cellCount = sim.GetSpatialGrid().GetTotalCellCount();
+    auto restore = [&]() { snapshot.Restore(sim); };
+    auto restoreAndBuild = [&]() { snapshot.Restore(sim); sim.UpdateSpatialGrid(); };
+
+    // Grid build: read positions, write cell/slot, scatter and sort indices, plus the cell arrays
+    sim.UpdateSpatialGrid();
+    std::vector<double> samples = TimeKernel(repetitions, restore, [&]() { sim.UpdateSpatialGrid(); });
+    results.push_back(MakeResult(scene, "SpatialGrid::BuildCells", particles, samples, 0.0, n * (8 + 4 + 4 + 4 + 8) + cellCount * (4 * 4)));
+
+    // Pair generation: positions of every candidate plus the pair list
+    SpatialGrid& grid = sim.GetSpatialGrid();
+    grid.GenerateCollisionPairs(sim.GetPositions(), sim.GetRadii());
+    const double pairs = static_cast<double>(grid.GetCollisionPairs().size());
+    samples = TimeKernel(repetitions, restoreAndBuild, [&]() { grid.GenerateCollisionPairs(sim.GetPositions(), sim.GetRadii()); });
+    results.push_back(MakeResult(scene, "SpatialGrid::GenerateCollisionPairs", particles, samples, pairs, n * (8 + 4) + cellCount * 8 + pairs * 8));
+
+    // Collision resolution, both modes include the grid build the solver always does first
+    sim.SetUseFusedCollisions(true);
+    samples = TimeKernel(repetitions, restore, [&]() { SolveParticleCollisions(sim, deltaTime); });
+    results.push_back(MakeResult(scene, "SolveParticleCollisions(fused)", particles, samples, pairs, n * (8 + 8 + 4 + 4) * 2 + cellCount * 16));
+
+    sim.SetUseFusedCollisions(false);
+    samples = TimeKernel(repetitions, restore, [&]() { SolveParticleCollisions(sim, deltaTime); });
+    results.push_back(MakeResult(scene, "SolveParticleCollisions(pairs)", particles, samples, pairs, n * (8 + 8 + 4 + 4) * 2 + cellCount * 16 + pairs * 16));
+    sim.SetUseFusedCollisions(true);
+
+    // Same build and fused pass with the hashed grid, the table slots are read and written a few times per occupied cell
+    sim.SetUseHashedGrid(true);
+    sim.UpdateSpatialGrid();
+    const size_t hashedCellCount = sim.GetSpatialGrid().GetTotalCellCount();
+    samples = TimeKernel(repetitions, restore, [&]() { sim.UpdateSpatialGrid(); });
+    results.push_back(MakeResult(scene, "SpatialGrid::BuildCells(hashed)", particles, samples, 0.0, n * (8 + 4 + 4 + 4 + 8 + 4) + hashedCellCount * (4 * 8)));
+
+    samples = TimeKernel(repetitions, restore, [&]() { SolveParticleCollisions(sim, deltaTime); });
+    results.push_back(MakeResult(scene, "SolveParticleCollisions(hashed)", particles, samples, pairs, n * (8 + 8 + 4 + 4) * 2 + hashedCellCount * 24));
+    sim.SetUseHashedGrid(false);
+    sim.UpdateSpatialGrid();
+
+    // Boundary: read and write positions, previous positions and temperatures
+    samples = TimeKernel(repetitions, restore, [&]() { SolveBoundaryCollisions(sim, deltaTime); });
+    results.push_back(MakeResult(scene, "SolveBoundaryCollisions", particles, samples, 0.0, n * (8 + 8 + 4) * 2));
+
+    // One full fixed step with all its substeps. Per substep the integration streams every column,
+    // the collision pass the positions, masses and temperatures plus the grid, the split passes add
+    // a boundary sweep and a velocity cap sweep that the fused pass only does once per step
+    const double integrateBytes = n * (8 + 8 + 8 + 4 + 4) * 2;
+    const double boundaryBytes = n * (8 + 8 + 4) * 2;
+    const double collisionBytes = n * (8 + 4 + 4) * 2 + n * (8 + 4 + 4 + 4 + 8) + cellCount * 16;
+    const double capBytes = n * (8 + 8) + n * 8;
+
+    sim.SetUseFusedIntegration(true);
+    samples = TimeKernel(stepRepetitions, restore, [&]() { SolvePhysics(sim, deltaTime, false, false, false); });
+    KernelResult step = MakeResult(scene, "SolvePhysics", particles, samples, pairs * config.subSteps,
+        config.subSteps * (integrateBytes + collisionBytes) + capBytes);
+    step.nsPerParticle /= config.subSteps; // per particle per substep
+    results.push_back(step);
+
+    // Same step with separate integration, boundary and velocity cap passes
+    sim.SetUseFusedIntegration(false);
+    samples = TimeKernel(stepRepetitions, restore, [&]() { SolvePhysics(sim, deltaTime, false, false, false); });
+    KernelResult splitStep = MakeResult(scene, "SolvePhysics(split passes)", particles, samples, pairs * config.subSteps,
+        config.subSteps * (integrateBytes + boundaryBytes + collisionBytes + capBytes));
+    splitStep.nsPerParticle /= config.subSteps;
+    results.push_back(splitStep);
+    sim.SetUseFusedIntegration(true);
+
+    // Same step with every optional column disabled, constant mass and gravity only: the integration
+    // streams positions and previous positions, the collision pass no longer reads masses or temperatures
+    sim.SetAttributes(0);
+    samples = TimeKernel(stepRepetitions, restore, [&]() { SolvePhysics(sim, deltaTime, false, false, false); });
+    KernelResult minimalStep = MakeResult(scene, "SolvePhysics(no optional columns)", particles, samples, pairs * config.subSteps,
+        config.subSteps * (n * (8 + 8) * 2 + n * 8 * 2 + n * (8 + 4 + 4 + 4 + 8) + cellCount * 16) + capBytes);
+    minimalStep.nsPerParticle /= config.subSteps;
+    results.push_back(minimalStep);
+    sim.SetAttributes(SimulationSystem::DEFAULT_ATTRIBUTES);
+
+    // Same step with neighbor lists: the collision pass reads the listed pairs and only rebuilds the grid and the
+    // list once a particle moved half the skin, the displacement check streams the positions and the build positions
+    sim.SetUseNeighborLists(true);
+    samples = TimeKernel(stepRepetitions, restore, [&]() { SolvePhysics(sim, deltaTime, false, false, false); });
+    const double listPairs = static_cast<double>(sim.GetNeighborListStats().pairCount);
+    KernelResult listStep = MakeResult(scene, "SolvePhysics(neighbor lists)", particles, samples, pairs * config.subSteps,
+        config.subSteps * (integrateBytes + n * (8 + 8) + listPairs * 8 + n * (8 + 4 + 4) * 2) + capBytes);
+    listStep.nsPerParticle /= config.subSteps;
+    results.push_back(listStep);
+    sim.SetUseNeighborLists(false);
+
+    // Fluid pass including its grid build: the density pass reads the positions and writes densities and
+    // pressures, the force pass reads every column of the neighbors and adds to the accelerations
+    sim.SetUseFluid(true);
+    samples = TimeKernel(repetitions, restore, [&]() { SolveFluidForces(sim, deltaTime); });
+    results.push_back(MakeResult(scene, "SolveFluidForces", particles, samples, 0.0,
+        n * (8 + 4 + 4) + n * (8 + 8 + 4 + 4 + 8 * 2) + cellCount * 16 * 2));
+    sim.SetUseFluid(false);
+}
+
+static void WriteJson(std::ostream& out, const BenchmarkConfig& config, unsigned int threads, const std::vector<KernelResult>& results)
+{
+    out << "{\n"
+        << "  \"threads\": " << threads << ",\n"
+        << "  \"substeps\": " << config.subSteps << ",\n"
+        << "  \"seed\": " << config.seed << ",\n"
+        << "  \"particle_radius\": " << config.particleRadius << ",\n"
+        << "  \"results\": [\n";
+
+    for (size_t i = 0; i < results.size(); i++)
+    {
+        const KernelResult& r = results[i];
+        out << "    { \"scene\": \"" << r.scene << "\", \"kernel\": \"" << r.kernel << "\", \"particles\": " << r.particles
+            << ", \"repetitions\": " << r.repetitions << ", \"min_ns\": " << r.minNs << ", \"median_ns\": " << r.medianNs
+            << ", \"ns_per_particle\": " << r.nsPerParticle << ", \"pairs_per_second\": " << r.pairsPerSecond
+            << ", \"bandwidth_gb_s\": " << r.bandwidthGBs << " }" << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+
+    out << "  ]\n}\n";
+}
+
+static void PrintUsage(const char* exe)
+{
+    std::cout << "Usage: " << exe << " [options]\n"
+        << "  --sizes LIST      comma separated particle counts (default 1000,10000,100000,1000000)\n"
+        << "  --scenes LIST     comma separated subset of pile,gas,stream (default all)\n"
+        << "  --threads N       solver threads, 0 = hardware concurrency (default 0)\n"
+        << "  --substeps N      substeps per fixed step (default 8)\n"
+        << "  --seed N          scene seed (default 12345)\n"
+        << "  --reps-scale F    multiply the number of repetitions (default 1)\n"
+        << "  --json PATH       write the results as JSON, - for stdout\n";
+}
+
+static std::vector<std::string> SplitList(const char* value)
+{
+    std::vector<std::string> items;
+    std::stringstream ss(value);
+    std::string item;
+    while (std::getline(ss, item, ','))
+        if (!item.empty())
+            items.push_back(item);
+    return items;
+}
+
+static bool ParseArguments(int argc, char** argv, BenchmarkConfig& config)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        const char* arg = argv[i];
+        if (std::strcmp(arg, "--help") == 0 || std::strcmp(arg, "-h") == 0)
+            return false;
+
+        if (i + 1 >= argc)
+        {
+            std::cerr << "Missing value for " << arg << std::endl;
+            return false;
+        }
+
+        const char* value = argv[++i];
+        if (std::strcmp(arg, "--sizes") == 0)
+        {
+            config.sizes.clear();
+            for (const std::string& item : SplitList(value))
+                config.sizes.push_back(static_cast<unsigned int>(std::strtoul(item.c_str(), nullptr, 10)));
+        }
+        else if (std::strcmp(arg, "--scenes") == 0)
+        {
+            config.scenes.clear();
+            for (const std::string& item : SplitList(value))
+            {
+                if (item == "pile") config.scenes.push_back(SceneType::SettledPile);
+                else if (item == "gas") config.scenes.push_back(SceneType::FreeFallGas);
+                else if (item == "stream") config.scenes.push_back(SceneType::DenseStream);
+                else
+                {
+                    std::cerr << "Unknown scene: " << item << std::endl;
+                    return false;
+                }
+            }
+        }
+        else if (std::strcmp(arg, "--threads") == 0)
+            config.threads = static_cast<unsigned int>(std::strtoul(value, nullptr, 10));
+        else if (std::strcmp(arg, "--substeps") == 0)
+            config.subSteps = std::max(1u, static_cast<unsigned int>(std::strtoul(value, nullptr, 10)));
+        else if (std::strcmp(arg, "--seed") == 0)
+            config.seed = static_cast<unsigned int>(std::strtoul(value, nullptr, 10));
+        else if (std::strcmp(arg, "--reps-scale") == 0)
+            config.repetitionScale = std::strtof(value, nullptr);
+        else if (std::strcmp(arg, "--json") == 0)
+            config.jsonPath = value;
+        else
+        {
+            std::cerr << "Unknown option: " << arg << std::endl;
+            return false;
+        }
+    }
+
+    return !config.sizes.empty() && !config.scenes.empty();
+}
+
+int main(int argc, char** argv)
+{
+    BenchmarkConfig config;
+    if (!ParseArguments(argc, argv, config))
+    {
+        PrintUsage(argv[0]);
+        return 1;
+    }
+
+    std::vector<KernelResult> results;
+
+    // The table goes to stderr when stdout carries the JSON, so the JSON can be piped as is
+    std::ostream& table = config.jsonPath == "-" ? std::cerr : std::cout;
+
+    for (SceneType scene : config.scenes)
+    {
+        for (unsigned int particles : config.sizes)
+        {
+            const size_t first = results.size();
+            RunScene(config, scene, particles, results);
+
+            for (size_t i = first; i < results.size(); i++)
+            {
+                const KernelResult& r = results[i];
+                char line[256];
+                snprintf(line, sizeof(line), "%-14s %8u  %-36s %10.2f ns/particle %12.3e pairs/s %7.2f GB/s",
+                    r.scene.c_str(), r.particles, r.kernel.c_str(), r.nsPerParticle, r.pairsPerSecond, r.bandwidthGBs);
+                table << line << std::endl;
+            }
+        }
+    }
+
+    // Threads actually used, resolved the same way the simulation does it
+    ThreadPool probe(config.threads);
+    const unsigned int threads = probe.GetNumThreads();
+
+    if (config.jsonPath == "-")
+    {
+        WriteJson(std::cout, config, threads, results);
+    }
+    else if (!config.jsonPath.empty())
+    {
+        std::ofstream file(config.jsonPath);
+        if (!file.good())
+        {
+            std::cerr << "Cannot open " << config.jsonPath << std::endl;
+            return 1;
+        }
+        WriteJson(file, config, threads, results);
+    }
+
+    return 0;
+}
@@ -0,0 +1,110 @@
+#include "Profiler.h"
+
+#include <fstream>
+#include <algorithm>
+
+const char* GetProfilePhaseName(ProfilePhase phase)
+{
+    switch (phase)
+    {
+    case ProfilePhase::Step:             return "Step";
+    case ProfilePhase::Reorder:          return "Reorder";
+    case ProfilePhase::Integrate:        return "Integrate";
+    case ProfilePhase::Boundary:         return "Boundary";
+    case ProfilePhase::GridBuild:        return "GridBuild";
+    case ProfilePhase::PairGeneration:   return "PairGeneration";
+    case ProfilePhase::CollisionResolve: return "CollisionResolve";
+    case ProfilePhase::VelocityCap:      return "VelocityCap";
+    case ProfilePhase::StateHash:        return "StateHash";
+    case ProfilePhase::Sleep:            return "Sleep";
+    case ProfilePhase::Fluid:            return "Fluid";
+    case ProfilePhase::NeighborList:     return "NeighborList";
+    case ProfilePhase::Removal:          return "Removal";
+    case ProfilePhase::OverlapCheck:     return "OverlapCheck";
+    default:                             return "Unknown";
+    }
+}
+
+Profiler::Profiler(size_t historySize)
+    : m_HistorySize(std::max<size_t>(historySize, 1)), m_HistoryHead(0), m_RecordedFrames(0), m_FrameIndex(0), m_IsEnabled(true)
+{
+    m_History.resize(m_HistorySize * PHASE_COUNT, 0.0f);
+    std::fill(m_CurrentFrame, m_CurrentFrame + PHASE_COUNT, 0.0);
+}
+
+void Profiler::EndFrame()
+{
+    if (!m_IsEnabled)
+        return;
+
+    float* frame = &m_History[m_HistoryHead * PHASE_COUNT];
+    for (size_t p = 0; p < PHASE_COUNT; p++)
+    {
+        frame[p] = static_cast<float>(m_CurrentFrame[p]);
+        m_CurrentFrame[p] = 0.0;
+    }
+
+    m_HistoryHead = (m_HistoryHead + 1) % m_HistorySize;
+    m_RecordedFrames = std::min(m_RecordedFrames + 1, m_HistorySize);
+    m_FrameIndex++;
+}
+
+void Profiler::Reset()
+{
+    std::fill(m_CurrentFrame, m_CurrentFrame + PHASE_COUNT, 0.0);
+    m_HistoryHead = 0;
+    m_RecordedFrames = 0;
+}
+
+ProfilePhaseStats Profiler::GetStats(ProfilePhase phase) const
+{
+    ProfilePhaseStats stats;
+    if (m_RecordedFrames == 0)
+        return stats;
+
+    const size_t p = static_cast<size_t>(phase);
+    const size_t oldest = (m_HistoryHead + m_HistorySize - m_RecordedFrames) % m_HistorySize;
+
+    std::vector<float> values(m_RecordedFrames);
+    double sum = 0.0;
+    for (size_t k = 0; k < m_RecordedFrames; k++)
+    {
+        values[k] = m_History[((oldest + k) % m_HistorySize) * PHASE_COUNT + p];
+        sum += values[k];
+    }
+
+    stats.lastMs = values.back();
+    stats.avgMs = static_cast<float>(sum / m_RecordedFrames);
+    stats.minMs = *std::min_element(values.begin(), values.end());
+
+    // Nearest rank percentile
+    const size_t rank = std::min(m_RecordedFrames - 1, (m_RecordedFrames * 99 + 99) / 100 - 1);
+    std::nth_element(values.begin(), values.begin() + rank, values.end());
+    stats.p99Ms = values[rank];
+
+    return stats;
+}
+
+bool Profiler::DumpCSV(const std::string& path) const
+{
+    std::ofstream file(path);
+    if (!file.good())
+        return false;
+
+    file << "frame";
+    for (size_t p = 0; p < PHASE_COUNT; p++)
+        file << "," << GetProfilePhaseName(static_cast<ProfilePhase>(p)) << "_ms";
+    file << "\n";
+
+    const size_t oldest = (m_HistoryHead + m_HistorySize - m_RecordedFrames) % m_HistorySize;
+    for (size_t k = 0; k < m_RecordedFrames; k++)
+    {
+        const float* frame = &m_History[((oldest + k) % m_HistorySize) * PHASE_COUNT];
+        file << (m_FrameIndex - m_RecordedFrames + k);
+        for (size_t p = 0; p < PHASE_COUNT; p++)
+            file << "," << frame[p];
+        file << "\n";
+    }
+
+    return file.good();
+}
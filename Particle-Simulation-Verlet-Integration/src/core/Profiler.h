@@ -0,0 +1,128 @@
+#pragma once
+#include <vector>
+#include <string>
+#include <chrono>
+
+// Set ENABLE_PROFILER to 0 to compile the instrumentation out, PROFILE_SCOPE then expands to nothing
+#ifndef ENABLE_PROFILER
+#define ENABLE_PROFILER 1
+#endif
+
+// Phases timed inside a simulation step. Phases can nest, the grid builds done by a reorder
+// are counted both in Reorder and in GridBuild. With the fused integration pass the boundary
+// collisions are part of Integrate.
+enum class ProfilePhase
+{
+    Step = 0,
+    Reorder,
+    Integrate,
+    Boundary,
+    GridBuild,
+    PairGeneration,
+    CollisionResolve,
+    VelocityCap,
+    StateHash,
+    Sleep,
+    Fluid,
+    NeighborList,
+    Removal,
+    OverlapCheck,
+    Count
+};
+
+// Return a readable name for the ImGui interface and the CSV header
+const char* GetProfilePhaseName(ProfilePhase phase);
+
+// Milliseconds spent in a phase per frame over the recorded history
+struct ProfilePhaseStats
+{
+    float lastMs = 0.0f;
+    float minMs = 0.0f;
+    float avgMs = 0.0f;
+    float p99Ms = 0.0f;
+};
+
+// Accumulates the time of every phase during a frame (one SimulationSystem::Update) and keeps the
+// totals of the last frames in a ring buffer. Samples are only added from the thread driving the
+// solver, the parallel passes are timed as a whole.
+class Profiler
+{
+private:
+    static const size_t PHASE_COUNT = static_cast<size_t>(ProfilePhase::Count);
+
+    double m_CurrentFrame[PHASE_COUNT];
+    std::vector<float> m_History;       // m_HistorySize frames of PHASE_COUNT values
+    size_t m_HistorySize;
+    size_t m_HistoryHead;
+    size_t m_RecordedFrames;
+    unsigned long long m_FrameIndex;
+    bool m_IsEnabled;
+
+public:
+    Profiler(size_t historySize = 300);
+
+    // Add the time spent in a phase to the current frame
+    void AddSample(ProfilePhase phase, double milliseconds) { m_CurrentFrame[static_cast<size_t>(phase)] += milliseconds; }
+
+    // Store the current frame in the history and start a new one
+    void EndFrame();
+
+    // Forget all the recorded frames
+    void Reset();
+
+    // Return min/avg/p99 of a phase over the recorded frames
+    ProfilePhaseStats GetStats(ProfilePhase phase) const;
+
+    // Write every recorded frame as a CSV row, one column per phase in milliseconds. Returns false if the file can't be opened
+    bool DumpCSV(const std::string& path) const;
+
+    // Return the number of frames in the history
+    size_t GetRecordedFrames() const { return m_RecordedFrames; }
+
+    // Return true if timers record samples
+    bool GetIsEnabled() const { return m_IsEnabled; }
+
+    // Enable or disable recording at runtime
+    void SetIsEnabled(bool v) { m_IsEnabled = v; }
+
+    // Return true if the instrumentation was compiled in
+    static bool IsCompiledIn() { return ENABLE_PROFILER != 0; }
+};
+
+// Adds the lifetime of the object to a phase of the profiler
+class ScopedTimer
+{
+private:
+    Profiler& m_Profiler;
+    ProfilePhase m_Phase;
+    bool m_IsActive;
+    std::chrono::steady_clock::time_point m_Start;
+
+public:
+    ScopedTimer(Profiler& profiler, ProfilePhase phase)
+        : m_Profiler(profiler), m_Phase(phase), m_IsActive(profiler.GetIsEnabled())
+    {
+        if (m_IsActive)
+            m_Start = std::chrono::steady_clock::now();
+    }
+
+    ~ScopedTimer()
+    {
+        if (m_IsActive)
+            m_Profiler.AddSample(m_Phase, std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - m_Start).count());
+    }
+
+    ScopedTimer(const ScopedTimer&) = delete;
+    ScopedTimer& operator=(const ScopedTimer&) = delete;
+};
+
+#define PROFILE_CONCAT_INNER(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_INNER(a, b)
+
+#if ENABLE_PROFILER
+#define PROFILE_SCOPE(profiler, phase) ScopedTimer PROFILE_CONCAT(profileTimer, __LINE__)(profiler, phase)
+#define PROFILE_END_FRAME(profiler) (profiler).EndFrame()
+#else
+#define PROFILE_SCOPE(profiler, phase)
+#define PROFILE_END_FRAME(profiler)
+#endif
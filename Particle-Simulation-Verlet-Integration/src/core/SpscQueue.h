@@ -0,0 +1,48 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <utility>
+
+// Fixed capacity lock-free queue for exactly one producer thread and one consumer thread.
+// Head and tail live on their own cache lines so the two threads don't invalidate each other.
+template<typename T, size_t Capacity>
+class SpscQueue
+{
+private:
+    static_assert((Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+
+    T m_Slots[Capacity];
+    alignas(64) std::atomic<size_t> m_Head;     // next slot to pop, written by the consumer
+    alignas(64) std::atomic<size_t> m_Tail;     // next slot to push, written by the producer
+
+public:
+    SpscQueue() : m_Head(0), m_Tail(0) {}
+
+    SpscQueue(const SpscQueue&) = delete;
+    SpscQueue& operator=(const SpscQueue&) = delete;
+
+    // Producer: returns false if the queue is full
+    bool TryPush(T&& value)
+    {
+        const size_t tail = m_Tail.load(std::memory_order_relaxed);
+        if (tail - m_Head.load(std::memory_order_acquire) == Capacity)
+            return false;
+
+        m_Slots[tail & (Capacity - 1)] = std::move(value);
+        m_Tail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer: returns false if the queue is empty
+    bool TryPop(T& value)
+    {
+        const size_t head = m_Head.load(std::memory_order_relaxed);
+        if (head == m_Tail.load(std::memory_order_acquire))
+            return false;
+
+        value = std::move(m_Slots[head & (Capacity - 1)]);
+        m_Slots[head & (Capacity - 1)] = T();   // release what the slot holds now rather than when it's reused
+        m_Head.store(head + 1, std::memory_order_release);
+        return true;
+    }
+};
@@ -0,0 +1,117 @@
+#include "ThreadPool.h"
+
+void Barrier::Wait()
+{
+    std::unique_lock<std::mutex> lock(m_Mutex);
+    unsigned long long generation = m_Generation;
+
+    if (++m_Waiting == m_Count)
+    {
+        // Last thread to arrive releases everybody
+        m_Waiting = 0;
+        m_Generation++;
+        m_Condition.notify_all();
+        return;
+    }
+
+    m_Condition.wait(lock, [&] { return generation != m_Generation; });
+}
+
+ThreadPool::ThreadPool(unsigned int numThreads)
+    : m_NumThreads(1), m_Task(nullptr), m_Generation(0), m_Pending(0), m_Stop(false), m_PhaseBarrier(1)
+{
+    SetNumThreads(numThreads);
+}
+
+ThreadPool::~ThreadPool()
+{
+    StopWorkers();
+}
+
+void ThreadPool::SetNumThreads(unsigned int numThreads)
+{
+    if (numThreads == 0)
+        numThreads = std::max(1u, std::thread::hardware_concurrency());
+
+    if (numThreads == m_NumThreads && m_Workers.size() == numThreads - 1)
+        return;
+
+    StopWorkers();
+    m_NumThreads = numThreads;
+    m_PhaseBarrier.Reset(numThreads);
+    StartWorkers();
+}
+
+void ThreadPool::StartWorkers()
+{
+    m_Stop = false;
+    m_Workers.reserve(m_NumThreads - 1);
+
+    // Thread index 0 is the calling thread
+    for (unsigned int i = 1; i < m_NumThreads; i++)
+        m_Workers.emplace_back(&ThreadPool::WorkerLoop, this, i, m_Generation);
+}
+
+void ThreadPool::StopWorkers()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        m_Stop = true;
+    }
+    m_StartCondition.notify_all();
+
+    for (auto& worker : m_Workers)
+        worker.join();
+
+    m_Workers.clear();
+}
+
+void ThreadPool::WorkerLoop(unsigned int threadIndex, unsigned long long lastGeneration)
+{
+    while (true)
+    {
+        const std::function<void(unsigned int)>* task;
+        {
+            std::unique_lock<std::mutex> lock(m_Mutex);
+            m_StartCondition.wait(lock, [&] { return m_Stop || m_Generation != lastGeneration; });
+
+            if (m_Stop)
+                return;
+
+            lastGeneration = m_Generation;
+            task = m_Task;
+        }
+
+        (*task)(threadIndex);
+
+        {
+            std::lock_guard<std::mutex> lock(m_Mutex);
+            if (--m_Pending == 0)
+                m_DoneCondition.notify_one();
+        }
+    }
+}
+
+void ThreadPool::Run(const std::function<void(unsigned int)>& task)
+{
+    if (m_Workers.empty())
+    {
+        task(0);
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        m_Task = &task;
+        m_Pending = static_cast<unsigned int>(m_Workers.size());
+        m_Generation++;
+    }
+    m_StartCondition.notify_all();
+
+    // The calling thread does its share too
+    task(0);
+
+    std::unique_lock<std::mutex> lock(m_Mutex);
+    m_DoneCondition.wait(lock, [&] { return m_Pending == 0; });
+    m_Task = nullptr;
+}
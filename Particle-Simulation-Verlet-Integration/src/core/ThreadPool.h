@@ -0,0 +1,191 @@
+#pragma once
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <algorithm>
+
+// Reusable barrier, every participating thread blocks in Wait() until all of them arrived
+class Barrier
+{
+private:
+    std::mutex m_Mutex;
+    std::condition_variable m_Condition;
+    unsigned int m_Count;
+    unsigned int m_Waiting;
+    unsigned long long m_Generation;
+
+public:
+    Barrier(unsigned int count) : m_Count(count), m_Waiting(0), m_Generation(0) {}
+
+    void Wait();
+
+    // Change the number of participating threads, only call when no thread is waiting
+    void Reset(unsigned int count) { m_Count = count; m_Waiting = 0; }
+};
+
+// Long lived worker threads used by the solver. The calling thread always takes part in the work
+// so a pool with N threads spawns N - 1 workers.
+class ThreadPool
+{
+private:
+    std::vector<std::thread> m_Workers;
+    unsigned int m_NumThreads;
+
+    std::mutex m_Mutex;
+    std::condition_variable m_StartCondition;
+    std::condition_variable m_DoneCondition;
+    const std::function<void(unsigned int)>* m_Task;
+    unsigned long long m_Generation;
+    unsigned int m_Pending;
+    bool m_Stop;
+
+    // Used by Sync() to separate the phases of a task
+    Barrier m_PhaseBarrier;
+
+    // Sums of the chunks of ExclusiveScan(), kept to reuse their storage
+    std::vector<unsigned int> m_ScanChunkOffsets;
+
+    void StartWorkers();
+    void StopWorkers();
+    void WorkerLoop(unsigned int threadIndex, unsigned long long lastGeneration);
+
+public:
+    // numThreads = 0 uses the hardware concurrency
+    ThreadPool(unsigned int numThreads = 0);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    // Return the number of threads taking part in the work (workers + calling thread)
+    unsigned int GetNumThreads() const { return m_NumThreads; }
+
+    // Restart the pool with a different number of threads, must not be called while a task is running
+    void SetNumThreads(unsigned int numThreads);
+
+    // Run task(threadIndex) once on every thread and block until all of them finished.
+    // Tasks can't be nested.
+    void Run(const std::function<void(unsigned int)>& task);
+
+    // Block until every thread of the running task reached this point, only valid inside Run()
+    void Sync() { m_PhaseBarrier.Wait(); }
+
+    // Split [begin, end) in chunks of at least minChunk elements and call func(start, end, threadIndex)
+    // for each of them. Chunks are handed out dynamically, returns once the whole range is processed.
+    template<typename Func>
+    void ParallelFor(size_t begin, size_t end, Func&& func, size_t minChunk = 256)
+    {
+        if (end <= begin)
+            return;
+
+        const size_t count = end - begin;
+
+        // Not worth waking up the workers
+        if (m_NumThreads == 1 || count <= minChunk)
+        {
+            func(begin, end, 0u);
+            return;
+        }
+
+        // Around 4 chunks per thread to balance uneven work
+        const size_t chunkSize = std::max(minChunk, (count + m_NumThreads * 4 - 1) / (m_NumThreads * 4));
+        std::atomic<size_t> nextChunk(begin);
+
+        Run([&](unsigned int threadIndex)
+        {
+            while (true)
+            {
+                size_t start = nextChunk.fetch_add(chunkSize);
+                if (start >= end)
+                    break;
+
+                func(start, std::min(start + chunkSize, end), threadIndex);
+            }
+        });
+    }
+
+    // Same as ParallelFor but every chunk has exactly chunkSize elements (the last one can be shorter), so
+    // the chunk boundaries don't depend on the number of threads. Even a single thread processes the same chunks.
+    template<typename Func>
+    void ParallelForFixedChunks(size_t begin, size_t end, Func&& func, size_t chunkSize)
+    {
+        if (end <= begin)
+            return;
+
+        if (m_NumThreads == 1 || end - begin <= chunkSize)
+        {
+            for (size_t start = begin; start < end; start += chunkSize)
+                func(start, std::min(start + chunkSize, end), 0u);
+            return;
+        }
+
+        std::atomic<size_t> nextChunk(begin);
+
+        Run([&](unsigned int threadIndex)
+        {
+            while (true)
+            {
+                size_t start = nextChunk.fetch_add(chunkSize);
+                if (start >= end)
+                    break;
+
+                func(start, std::min(start + chunkSize, end), threadIndex);
+            }
+        });
+    }
+
+    // Write to offsets the sum of value(k) over the elements before each of the count ones, and the total at offsets[count].
+    // Fixed chunks are summed in parallel, then offset by the sums of the chunks before them. Returns the total.
+    // Only call from the thread owning the pool, outside of any task
+    template<typename Value>
+    unsigned int ExclusiveScan(size_t count, Value&& value, std::vector<unsigned int>& offsets)
+    {
+        const size_t chunkSize = 4096;
+        std::vector<unsigned int>& chunkOffsets = m_ScanChunkOffsets;
+        chunkOffsets.assign((count + chunkSize - 1) / chunkSize, 0);
+        offsets.resize(count + 1);
+
+        ParallelForFixedChunks(0, count, [&](size_t start, size_t end, unsigned int)
+        {
+            unsigned int sum = 0;
+            for (size_t k = start; k < end; k++)
+                sum += value(k);
+            chunkOffsets[start / chunkSize] = sum;
+        }, chunkSize);
+
+        unsigned int total = 0;
+        for (unsigned int& offset : chunkOffsets)
+        {
+            const unsigned int sum = offset;
+            offset = total;
+            total += sum;
+        }
+
+        ParallelForFixedChunks(0, count, [&](size_t start, size_t end, unsigned int)
+        {
+            unsigned int offset = chunkOffsets[start / chunkSize];
+            for (size_t k = start; k < end; k++)
+            {
+                offsets[k] = offset;
+                offset += value(k);
+            }
+        }, chunkSize);
+
+        offsets[count] = total;
+        return total;
+    }
+
+    // Split [begin, end) in one contiguous range per thread, to be called by every thread inside Run()
+    void GetThreadRange(size_t begin, size_t end, unsigned int threadIndex, size_t& outStart, size_t& outEnd) const
+    {
+        const size_t count = end - begin;
+        const size_t perThread = count / m_NumThreads;
+        const size_t remainder = count % m_NumThreads;
+
+        outStart = begin + threadIndex * perThread + std::min<size_t>(threadIndex, remainder);
+        outEnd = outStart + perThread + (threadIndex < remainder ? 1 : 0);
+    }
+};
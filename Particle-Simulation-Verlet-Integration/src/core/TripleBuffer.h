@@ -0,0 +1,48 @@
+#pragma once
+#include <atomic>
+
+// Lock-free handoff of the latest value from one writer thread to one reader thread.
+// The writer fills the back slot and swaps it with the middle one, the reader swaps the
+// middle slot with its front slot when a newer value is there. Neither side ever waits and
+// the reader always sees a complete value, intermediate values are dropped if it's slower.
+// The slots are reused, so vectors inside T keep their capacity between writes.
+template<typename T>
+class TripleBuffer
+{
+private:
+    static const unsigned int INDEX_MASK = 3;
+    static const unsigned int NEW_VALUE_FLAG = 4;   // set on the middle index when the writer published since the last read
+
+    T m_Slots[3];
+    std::atomic<unsigned int> m_Middle;
+    unsigned int m_Back;                            // owned by the writer
+    unsigned int m_Front;                           // owned by the reader
+
+public:
+    TripleBuffer() : m_Middle(1), m_Back(2), m_Front(0) {}
+
+    TripleBuffer(const TripleBuffer&) = delete;
+    TripleBuffer& operator=(const TripleBuffer&) = delete;
+
+    // Writer: slot to fill, holds whatever was written three publishes ago
+    T& GetWriteBuffer() { return m_Slots[m_Back]; }
+
+    // Writer: make the write buffer the latest value
+    void Publish()
+    {
+        m_Back = m_Middle.exchange(m_Back | NEW_VALUE_FLAG, std::memory_order_acq_rel) & INDEX_MASK;
+    }
+
+    // Reader: take the latest value if there is a new one, returns true if GetReadBuffer changed
+    bool Acquire()
+    {
+        if (!(m_Middle.load(std::memory_order_relaxed) & NEW_VALUE_FLAG))
+            return false;
+
+        m_Front = m_Middle.exchange(m_Front, std::memory_order_acq_rel) & INDEX_MASK;
+        return true;
+    }
+
+    // Reader: value taken by the last Acquire, stays valid until the next one
+    const T& GetReadBuffer() const { return m_Slots[m_Front]; }
+};
@@ -3,11 +3,11 @@
 #include "VertexBufferLayout.h"
 #include <iostream>
 
-ParticleRenderer::ParticleRenderer(const SimulationSystem& simulation, const Shader& shader, bool renderTemperature)
-    : m_Simulation(simulation), m_Shader(shader), m_RenderTemperature(renderTemperature), m_VertexArray(nullptr),
-    m_VertexBuffer(nullptr), m_InstanceBuffer(nullptr), m_IndexBuffer(nullptr)
+ParticleRenderer::ParticleRenderer(const Shader& shader, bool renderTemperature, size_t initialParticleCount)
+    : m_Shader(shader), m_RenderTemperature(renderTemperature), m_VertexArray(nullptr),
+    m_VertexBuffer(nullptr), m_InstanceBuffer(nullptr), m_IndexBuffer(nullptr), m_InstanceCount(0)
 {
-    InitBuffers();
+    InitBuffers(initialParticleCount);
 }
 
 ParticleRenderer::~ParticleRenderer()
@@ -38,7 +38,7 @@ ParticleRenderer::~ParticleRenderer()
     }
 }
 
-void ParticleRenderer::InitBuffers()
+void ParticleRenderer::InitBuffers(size_t initialParticleCount)
 {
     // Create a new vertex array
     m_VertexArray = new VertexArray();
@@ -84,7 +84,7 @@ void ParticleRenderer::InitBuffers()
         sizeof(ParticleInstanceTemperature) : sizeof(ParticleInstanceVelocity);
 
     // Allocate based on current particle count
-    const size_t initialBufferSize = instanceStructSize * m_Simulation.GetPositions().size();
+    const size_t initialBufferSize = instanceStructSize * initialParticleCount;
     m_InstanceBuffer = new VertexBuffer(nullptr, initialBufferSize, GL_STREAM_DRAW);
 
     // Set up instance buffer layout
@@ -137,17 +137,18 @@ void ParticleRenderer::InitBuffers()
     m_IndexBuffer->UnBind();
 }
 
-void ParticleRenderer::UpdateBuffers(float deltaTime)
+void ParticleRenderer::UpdateBuffers(const std::vector<Vec2>& positions, const std::vector<Vec2>& prevPositions,
+    const std::vector<float>& temperatures, const std::vector<float>& radii, float particleRadius, float deltaTime)
 {
-    // Get particle data from simulation
-    const std::vector<Vec2>& positions = m_Simulation.GetPositions();
-    const std::vector<Vec2>& prevPositions = m_Simulation.GetPrevPositions();
-    const std::vector<float>& temperatures = m_Simulation.GetTemperatures();
     const size_t particleCount = positions.size();
+    m_InstanceCount = particleCount;
 
     if (particleCount == 0)
         return;
 
+    const bool hasRadii = radii.size() == particleCount;
+    const bool hasTemperatures = temperatures.size() == particleCount;
+
     // Calculate the size of each instance based on rendering mode
     size_t instanceStructSize = m_RenderTemperature ?
         sizeof(ParticleInstanceTemperature) : sizeof(ParticleInstanceVelocity);
@@ -158,12 +159,11 @@ void ParticleRenderer::UpdateBuffers(float deltaTime)
         std::vector<ParticleInstanceTemperature> tempData;
         tempData.resize(particleCount);
 
-        float particleRadius = m_Simulation.GetParticleRadius();
         for (size_t i = 0; i < particleCount; i++) 
         {
             tempData[i].position = positions[i];
-            tempData[i].temperature = temperatures[i];
-            tempData[i].size = particleRadius;
+            tempData[i].temperature = hasTemperatures ? temperatures[i] : 0.0f;
+            tempData[i].size = hasRadii ? radii[i] : particleRadius;
         }
 
         // Update buffer
@@ -189,7 +189,6 @@ void ParticleRenderer::UpdateBuffers(float deltaTime)
         
 
         // Update instance data with particle positions and velocities
-        float particleRadius = m_Simulation.GetParticleRadius();
         for (size_t i = 0; i < particleCount; i++) 
         {
             m_InstanceData[i].position = positions[i];
@@ -197,7 +196,7 @@ void ParticleRenderer::UpdateBuffers(float deltaTime)
             // Calculate velocity from positions (Verlet)
             Vec2 velocity = (positions[i] - prevPositions[i]) / deltaTime;
             m_InstanceData[i].velocity = velocity;
-            m_InstanceData[i].size = particleRadius;
+            m_InstanceData[i].size = hasRadii ? radii[i] : particleRadius;
         }
 
         // Update buffer
@@ -220,19 +219,16 @@ void ParticleRenderer::UpdateBuffers(float deltaTime)
     m_InstanceBuffer->UnBind();
 }
 
-void ParticleRenderer::Render()
+void ParticleRenderer::Render(const glm::mat4& viewProjection)
 {
     // No particles to render
-    if (m_Simulation.GetPositions().empty())
+    if (m_InstanceCount == 0)
         return;
 
-    // Create MVP for particles, there is no model mat because the position is 
+    // Bind shader and set uniforms, there is no model mat because the position is 
     // stored in the instance data and there are no rotaions or scaling factors
-    glm::mat4 particleMVP = m_Simulation.GetProjMatrix() * m_Simulation.GetViewMatrix();
-
-    // Bind shader and set uniforms
     m_Shader.Bind();
-    m_Shader.setUniformMat4f("u_MVP", particleMVP);
+    m_Shader.setUniformMat4f("u_MVP", viewProjection);
 
     // Bind vertex array and index buffer
     m_VertexArray->Bind();
@@ -244,7 +240,7 @@ void ParticleRenderer::Render()
         6,                                                       // 6 indices per quad (2 triangles)
         GL_UNSIGNED_INT,
         0,
-        static_cast<GLsizei>(m_Simulation.GetPositions().size()) // Number of instances
+        static_cast<GLsizei>(m_InstanceCount)                    // Number of instances
     ));
 
     // Unbind everything
@@ -24,7 +24,6 @@ private:
         float size;
     };
 
-    const SimulationSystem& m_Simulation;
     const Shader& m_Shader;
 
     VertexArray* m_VertexArray;
@@ -35,13 +34,22 @@ private:
     std::vector<ParticleInstanceVelocity> m_InstanceData;
 
     bool m_RenderTemperature;
+
+    // Number of particles uploaded by the last UpdateBuffers
+    size_t m_InstanceCount;
     
-    void InitBuffers();
+    void InitBuffers(size_t initialParticleCount);
 
 public:
-    ParticleRenderer(const SimulationSystem& simulation, const Shader& shader, bool renderTemperature = false);
+    // The renderer never reads the simulation, which runs on its own thread, initialParticleCount only sizes the first buffer
+    ParticleRenderer(const Shader& shader, bool renderTemperature = false, size_t initialParticleCount = 0);
     ~ParticleRenderer();
 
-    void UpdateBuffers(float deltaTime);
-    void Render();
+    // Upload particles, from a published simulation frame or a trajectory replay.
+    // Without per-particle radii every particle is drawn with particleRadius
+    void UpdateBuffers(const std::vector<Vec2>& positions, const std::vector<Vec2>& prevPositions,
+        const std::vector<float>& temperatures, const std::vector<float>& radii, float particleRadius, float deltaTime);
+
+    // Draw the uploaded particles with the given view projection matrix
+    void Render(const glm::mat4& viewProjection);
 };
\ No newline at end of file
@@ -1,4 +1,5 @@
 #include "Renderer.h"
+#include <GLFW/glfw3.h>
 #include <iostream>
 
 void GLClearError()
@@ -16,6 +17,13 @@ bool GLLogCall(const char* function, const char* file, int line)
     return true;
 }
 
+float GetFramebufferAspect()
+{
+    int width, height;
+    glfwGetFramebufferSize(glfwGetCurrentContext(), &width, &height);
+    return (height > 0) ? (float)width / (float)height : 1.0f;
+}
+
 void Renderer::Draw(const VertexArray& va, const IndexBuffer& ib, const Shader& shader) const
 {
     shader.Bind();
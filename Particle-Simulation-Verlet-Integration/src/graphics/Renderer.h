@@ -13,6 +13,9 @@
 void GLClearError();
 bool GLLogCall(const char* function, const char* file, int line);
 
+// Aspect ratio of the framebuffer of the current context, used for the simulation projection matrix
+float GetFramebufferAspect();
+
 class Renderer
 {
 private:
@@ -0,0 +1,617 @@
+// Command line runner for the physics core, no window, no OpenGL.
+// Runs a fixed number of steps as fast as possible and prints throughput and final statistics.
+
+#include <iostream>
+#include <string>
+#include <cstring>
+#include <cstdlib>
+#include <chrono>
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+
+#include "physics/SimulationSystem.h"
+#include "physics/TrajectoryRecorder.h"
+#include "physics/Constants.h"
+
+struct RunnerConfig
+{
+    unsigned int particles = 10000;
+    unsigned int steps = 600;
+    unsigned int subSteps = 8;
+    bool adaptiveSubSteps = false;
+    unsigned int minSubSteps = 1;
+    unsigned int maxSubSteps = 10;
+    bool sleeping = false;
+    bool hashedGrid = false;
+    bool neighborLists = false;
+    float neighborSkin = 0.3f;
+    bool fluid = false;
+    FluidSettings fluidSettings;
+    uint32_t attributes = SimulationSystem::DEFAULT_ATTRIBUTES;
+    unsigned int threads = 0;
+    float particleRadius = 2.7f;
+    float radiusSpread = 1.0f;
+    float particleMass = 1.0f;
+    float simWidth = 1000.0f;
+    float simHeight = 1000.0f;
+    float fixedDeltaTime = 1.0f / 60.0f;
+    bool stream = false;
+    float streamSpeed = 18.0f;
+    std::vector<ParticleSink> sinks;
+    std::vector<EmitterSettings> emitters;
+    bool stableRemoval = true;
+    Vec2 initialParticleSpeed = { 300.0f, 0.0f };
+    std::string profileCsvPath;
+    std::string loadSnapshotPath;
+    std::string saveSnapshotPath;
+    std::string trajectoryPath;
+    bool hasSeed = false;
+    unsigned int seed = 0;
+    std::string hashLogPath;
+};
+
+static void PrintUsage(const char* exe)
+{
+    std::cout << "Usage: " << exe << " [options]\n"
+        << "  --particles N     number of particles (default 10000)\n"
+        << "  --steps N         fixed steps to run (default 600)\n"
+        << "  --substeps N      substeps per fixed step (default 8)\n"
+        << "  --adaptive-substeps MIN:MAX  choose the substeps of every step from the particle motion, starting at --substeps\n"
+        << "  --sleep 0|1       put settled particles to sleep (default 0)\n"
+        << "  --hashed-grid 0|1 store only the occupied grid cells in a hash table (default 0)\n"
+        << "  --neighbor-lists 0|1  reuse the grid and its candidate pairs until a particle moved half the skin (default 0)\n"
+        << "  --skin R          margin of the neighbor list pairs in radii, at most 0.5 without a radius spread (default 0.3)\n"
+        << "  --fluid 0|1       SPH fluid instead of granular contacts (default 0)\n"
+        << "  --fluid-stiffness K  fluid pressure per unit of compression (default 100000)\n"
+        << "  --fluid-viscosity V  fluid kinematic viscosity (default 20)\n"
+        << "  --attributes LIST optional particle columns, comma separated acceleration,mass,temperature,density,pressure\n"
+        << "                    or none (default acceleration,mass,temperature)\n"
+        << "  --threads N       solver threads, 0 = hardware concurrency (default 0)\n"
+        << "  --radius R        particle radius (default 2.7)\n"
+        << "  --radius-spread S radii drawn between R and R * S (default 1)\n"
+        << "  --mass M          particle mass (default 1)\n"
+        << "  --width W         simulation width (default 1000)\n"
+        << "  --height H        simulation height (default 1000)\n"
+        << "  --dt T            fixed step in seconds (default 1/60)\n"
+        << "  --scene NAME      bulk or stream (default bulk)\n"
+        << "  --stream-speed S  particles per second of each stream (default 18)\n"
+        << "  --sink X0,Y0,X1,Y1  remove the particles entering the rectangle, can be repeated\n"
+        << "  --emitter line|rect,X0,Y0,X1,Y1 or disc,X,Y,R  spawn particles on a shape without overlaps, can be repeated\n"
+        << "  --emitter-rate R or T:R,T:R...  particles per second of the last emitter, linear between the times (default 60)\n"
+        << "  --emitter-velocity VX,VY  initial velocity of the last emitter in units per substep (default 0,0)\n"
+        << "  --stable-removal 0|1  removals keep the memory order (1) or fill the holes with the last particles (0) (default 1)\n"
+        << "  --profile-csv P   write the per phase timings of the last steps to a CSV file\n"
+        << "  --load-snapshot P start from a snapshot instead of a new scene\n"
+        << "  --save-snapshot P write a snapshot of the final state\n"
+        << "  --record P        record the trajectory of every step to a file\n"
+        << "  --seed N          deterministic run: seeded scene, thread count independent results, state hash per step\n"
+        << "  --hash-log P      write the state hash of every step to a file (implies deterministic mode)\n";
+}
+
+// Parse count comma separated numbers, returns false if there are fewer
+static bool ParseFloats(const char* value, float* numbers, int count)
+{
+    const char* next = value;
+    for (int k = 0; k < count; k++)
+    {
+        char* end = nullptr;
+        numbers[k] = std::strtof(next, &end);
+        if (end == next || (k < count - 1 && *end != ','))
+            return false;
+        next = end + 1;
+    }
+    return true;
+}
+
+// Parse an emitter shape followed by its coordinates
+static bool ParseEmitter(const char* value, EmitterSettings& settings)
+{
+    const char* comma = std::strchr(value, ',');
+    if (!comma)
+        return false;
+
+    const std::string shape(value, comma);
+    float numbers[4];
+    if (shape == "line" || shape == "rect")
+    {
+        if (!ParseFloats(comma + 1, numbers, 4))
+            return false;
+        settings.shape = shape == "line" ? EmitterShape::Line : EmitterShape::Rect;
+        settings.start = Vec2(numbers[0], numbers[1]);
+        settings.end = Vec2(numbers[2], numbers[3]);
+        return true;
+    }
+    if (shape == "disc")
+    {
+        if (!ParseFloats(comma + 1, numbers, 3))
+            return false;
+        settings.shape = EmitterShape::Disc;
+        settings.start = Vec2(numbers[0], numbers[1]);
+        settings.radius = numbers[2];
+        return true;
+    }
+    return false;
+}
+
+// Parse a constant rate or time:rate keys
+static bool ParseRateCurve(const std::string& list, std::vector<EmitterRateKey>& curve)
+{
+    curve.clear();
+    size_t start = 0;
+    while (start <= list.size())
+    {
+        const size_t end = std::min(list.find(',', start), list.size());
+        const std::string key = list.substr(start, end - start);
+        const size_t colon = key.find(':');
+
+        char* parsedEnd = nullptr;
+        EmitterRateKey rateKey = { 0.0f, 0.0f };
+        if (colon != std::string::npos)
+            rateKey.time = std::strtof(key.c_str(), nullptr);
+        const char* rate = key.c_str() + (colon == std::string::npos ? 0 : colon + 1);
+        rateKey.rate = std::strtof(rate, &parsedEnd);
+        if (parsedEnd == rate)
+            return false;
+
+        curve.push_back(rateKey);
+        start = end + 1;
+    }
+    return !curve.empty();
+}
+
+// Names of the optional particle columns for --attributes
+static const struct { const char* name; uint32_t attribute; } ATTRIBUTE_NAMES[] = {
+    { "acceleration", SimulationSystem::ATTRIBUTE_ACCELERATIONS },
+    { "mass", SimulationSystem::ATTRIBUTE_MASSES },
+    { "temperature", SimulationSystem::ATTRIBUTE_TEMPERATURES },
+    { "density", SimulationSystem::ATTRIBUTE_DENSITIES },
+    { "pressure", SimulationSystem::ATTRIBUTE_PRESSURES },
+};
+
+// Returns false on an unknown attribute name
+static bool ParseAttributes(const std::string& list, uint32_t& attributes)
+{
+    attributes = 0;
+    if (list == "none")
+        return true;
+
+    size_t start = 0;
+    while (start <= list.size())
+    {
+        const size_t end = std::min(list.find(',', start), list.size());
+        const std::string name = list.substr(start, end - start);
+
+        bool isKnown = false;
+        for (const auto& entry : ATTRIBUTE_NAMES)
+        {
+            if (name == entry.name)
+            {
+                attributes |= entry.attribute;
+                isKnown = true;
+            }
+        }
+
+        if (!isKnown)
+        {
+            std::cerr << "Unknown attribute: " << name << std::endl;
+            return false;
+        }
+        start = end + 1;
+    }
+
+    return true;
+}
+
+static std::string FormatAttributes(uint32_t attributes)
+{
+    std::string list;
+    for (const auto& entry : ATTRIBUTE_NAMES)
+    {
+        if (attributes & entry.attribute)
+            list += (list.empty() ? "" : ",") + std::string(entry.name);
+    }
+    return list.empty() ? "none" : list;
+}
+
+// Returns false on unknown or malformed options
+static bool ParseArguments(int argc, char** argv, RunnerConfig& config)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        const char* arg = argv[i];
+        const bool hasValue = i + 1 < argc;
+
+        if (std::strcmp(arg, "--help") == 0 || std::strcmp(arg, "-h") == 0)
+            return false;
+
+        if (!hasValue)
+        {
+            std::cerr << "Missing value for " << arg << std::endl;
+            return false;
+        }
+
+        const char* value = argv[++i];
+        if (std::strcmp(arg, "--particles") == 0)
+            config.particles = static_cast<unsigned int>(std::strtoul(value, nullptr, 10));
+        else if (std::strcmp(arg, "--steps") == 0)
+            config.steps = static_cast<unsigned int>(std::strtoul(value, nullptr, 10));
+        else if (std::strcmp(arg, "--substeps") == 0)
+            config.subSteps = std::max(1u, static_cast<unsigned int>(std::strtoul(value, nullptr, 10)));
+        else if (std::strcmp(arg, "--adaptive-substeps") == 0)
+        {
+            char* end = nullptr;
+            config.minSubSteps = static_cast<unsigned int>(std::strtoul(value, &end, 10));
+            if (*end != ':')
+            {
+                std::cerr << "Expected MIN:MAX for --adaptive-substeps" << std::endl;
+                return false;
+            }
+            config.maxSubSteps = static_cast<unsigned int>(std::strtoul(end + 1, nullptr, 10));
+            config.adaptiveSubSteps = true;
+        }
+        else if (std::strcmp(arg, "--sleep") == 0)
+            config.sleeping = std::strtoul(value, nullptr, 10) != 0;
+        else if (std::strcmp(arg, "--hashed-grid") == 0)
+            config.hashedGrid = std::strtoul(value, nullptr, 10) != 0;
+        else if (std::strcmp(arg, "--neighbor-lists") == 0)
+            config.neighborLists = std::strtoul(value, nullptr, 10) != 0;
+        else if (std::strcmp(arg, "--skin") == 0)
+            config.neighborSkin = std::strtof(value, nullptr);
+        else if (std::strcmp(arg, "--fluid") == 0)
+            config.fluid = std::strtoul(value, nullptr, 10) != 0;
+        else if (std::strcmp(arg, "--fluid-stiffness") == 0)
+            config.fluidSettings.stiffness = std::strtof(value, nullptr);
+        else if (std::strcmp(arg, "--fluid-viscosity") == 0)
+            config.fluidSettings.viscosity = std::strtof(value, nullptr);
+        else if (std::strcmp(arg, "--attributes") == 0)
+        {
+            if (!ParseAttributes(value, config.attributes))
+                return false;
+        }
+        else if (std::strcmp(arg, "--threads") == 0)
+            config.threads = static_cast<unsigned int>(std::strtoul(value, nullptr, 10));
+        else if (std::strcmp(arg, "--radius") == 0)
+            config.particleRadius = std::strtof(value, nullptr);
+        else if (std::strcmp(arg, "--radius-spread") == 0)
+            config.radiusSpread = std::strtof(value, nullptr);
+        else if (std::strcmp(arg, "--mass") == 0)
+            config.particleMass = std::strtof(value, nullptr);
+        else if (std::strcmp(arg, "--width") == 0)
+            config.simWidth = std::strtof(value, nullptr);
+        else if (std::strcmp(arg, "--height") == 0)
+            config.simHeight = std::strtof(value, nullptr);
+        else if (std::strcmp(arg, "--dt") == 0)
+            config.fixedDeltaTime = std::strtof(value, nullptr);
+        else if (std::strcmp(arg, "--stream-speed") == 0)
+            config.streamSpeed = std::strtof(value, nullptr);
+        else if (std::strcmp(arg, "--profile-csv") == 0)
+            config.profileCsvPath = value;
+        else if (std::strcmp(arg, "--load-snapshot") == 0)
+            config.loadSnapshotPath = value;
+        else if (std::strcmp(arg, "--save-snapshot") == 0)
+            config.saveSnapshotPath = value;
+        else if (std::strcmp(arg, "--record") == 0)
+            config.trajectoryPath = value;
+        else if (std::strcmp(arg, "--seed") == 0)
+        {
+            config.seed = static_cast<unsigned int>(std::strtoul(value, nullptr, 10));
+            config.hasSeed = true;
+        }
+        else if (std::strcmp(arg, "--hash-log") == 0)
+            config.hashLogPath = value;
+        else if (std::strcmp(arg, "--sink") == 0)
+        {
+            float bounds[4];
+            if (!ParseFloats(value, bounds, 4))
+            {
+                std::cerr << "Expected X0,Y0,X1,Y1 for --sink" << std::endl;
+                return false;
+            }
+            ParticleSink sink;
+            sink.bottomLeft = Vec2(bounds[0], bounds[1]);
+            sink.topRight = Vec2(bounds[2], bounds[3]);
+            config.sinks.push_back(sink);
+        }
+        else if (std::strcmp(arg, "--emitter") == 0)
+        {
+            EmitterSettings settings;
+            settings.rateCurve.push_back({ 0.0f, 60.0f });
+            if (!ParseEmitter(value, settings))
+            {
+                std::cerr << "Expected line|rect,X0,Y0,X1,Y1 or disc,X,Y,R for --emitter" << std::endl;
+                return false;
+            }
+            config.emitters.push_back(settings);
+        }
+        else if (std::strcmp(arg, "--emitter-rate") == 0)
+        {
+            if (config.emitters.empty() || !ParseRateCurve(value, config.emitters.back().rateCurve))
+            {
+                std::cerr << "Expected R or T:R,T:R... after an --emitter for --emitter-rate" << std::endl;
+                return false;
+            }
+        }
+        else if (std::strcmp(arg, "--emitter-velocity") == 0)
+        {
+            float velocity[2];
+            if (config.emitters.empty() || !ParseFloats(value, velocity, 2))
+            {
+                std::cerr << "Expected VX,VY after an --emitter for --emitter-velocity" << std::endl;
+                return false;
+            }
+            config.emitters.back().velocity = Vec2(velocity[0], velocity[1]);
+        }
+        else if (std::strcmp(arg, "--stable-removal") == 0)
+            config.stableRemoval = std::strtoul(value, nullptr, 10) != 0;
+        else if (std::strcmp(arg, "--scene") == 0)
+        {
+            if (std::strcmp(value, "bulk") == 0)
+                config.stream = false;
+            else if (std::strcmp(value, "stream") == 0)
+                config.stream = true;
+            else
+            {
+                std::cerr << "Unknown scene: " << value << std::endl;
+                return false;
+            }
+        }
+        else
+        {
+            std::cerr << "Unknown option: " << arg << std::endl;
+            return false;
+        }
+    }
+
+    if (config.particleRadius <= 0.0f || config.simWidth <= 0.0f || config.simHeight <= 0.0f || config.fixedDeltaTime <= 0.0f)
+    {
+        std::cerr << "Radius, size and dt must be positive" << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+// Same scene setup as ResetSimulation in Utils.cpp
+static void SetupScene(SimulationSystem& sim, const RunnerConfig& config)
+{
+    if (!config.stream)
+    {
+        sim.AddBulkParticles(config.particles, Vec2(0.0f, 0.0f), Vec2(0.0f, 0.0f), config.particleMass);
+    }
+    else
+    {
+        const unsigned int numberOfStreams = std::max(std::min(config.particles / 1500, 10u), 1u);
+        for (unsigned int i = 0; i < numberOfStreams; i++)
+            sim.AddParticleStream(config.particles / numberOfStreams, config.streamSpeed, config.initialParticleSpeed,
+                config.particleMass, { 10, 5 * config.particleRadius * i });
+    }
+}
+
+static void PrintStatistics(const SimulationSystem& sim, float subStepDt)
+{
+    const ParticleColumn<Vec2>& positions = sim.GetPositions();
+    const ParticleColumn<Vec2>& prevPositions = sim.GetPrevPositions();
+    const Bounds bounds = sim.GetBounds();
+    const size_t particleCount = positions.size();
+
+    double speedSum = 0.0;
+    double kineticEnergy = 0.0;
+    double temperatureSum = 0.0;
+    float maxSpeed = 0.0f;
+    size_t outOfBounds = 0;
+
+    for (size_t i = 0; i < particleCount; i++)
+    {
+        Vec2 velocity = (positions[i] - prevPositions[i]) / subStepDt;
+        float speed = velocity.length();
+
+        speedSum += speed;
+        maxSpeed = std::max(maxSpeed, speed);
+        kineticEnergy += 0.5 * sim.GetMass(i) * velocity.length_sq();
+        temperatureSum += sim.GetTemperature(i);
+
+        if (positions[i].x < bounds.bottomLeft.x || positions[i].x > bounds.topRight.x ||
+            positions[i].y < bounds.bottomLeft.y || positions[i].y > bounds.topRight.y)
+            outOfBounds++;
+    }
+
+    const double invCount = particleCount > 0 ? 1.0 / particleCount : 0.0;
+    std::cout << "Particles:           " << particleCount << "\n"
+        << "Mean speed:          " << speedSum * invCount << "\n"
+        << "Max speed:           " << maxSpeed << "\n"
+        << "Kinetic energy:      " << kineticEnergy << "\n"
+        << "Mean temperature:    " << temperatureSum * invCount << "\n"
+        << "Out of bounds:       " << outOfBounds << std::endl;
+}
+
+int main(int argc, char** argv)
+{
+    RunnerConfig config;
+    if (!ParseArguments(argc, argv, config))
+    {
+        PrintUsage(argv[0]);
+        return 1;
+    }
+
+    Vec2 bottomLeft(-config.simWidth / 2, -config.simHeight / 2);
+    Vec2 topRight(config.simWidth / 2, config.simHeight / 2);
+
+    SimulationSystem sim(config.particles, bottomLeft, topRight, config.particleRadius, config.subSteps, config.threads);
+    if (config.hasSeed)
+        sim.SetSeed(config.seed);
+    sim.SetIsDeterministic(config.hasSeed || !config.hashLogPath.empty());
+    sim.SetUseAdaptiveSubSteps(config.adaptiveSubSteps);
+    sim.SetSubStepRange(config.minSubSteps, config.maxSubSteps);
+    sim.SetUseSleeping(config.sleeping);
+    sim.SetUseHashedGrid(config.hashedGrid);
+    sim.SetNeighborSkin(config.neighborSkin);
+    sim.SetUseNeighborLists(config.neighborLists);
+    sim.SetRadiusSpread(config.radiusSpread);
+    sim.SetAttributes(config.attributes);
+    sim.SetFluidSettings(config.fluidSettings);
+    sim.SetUseFluid(config.fluid);
+    sim.SetUseStableRemoval(config.stableRemoval);
+    for (const ParticleSink& sink : config.sinks)
+        sim.AddSink(sink.bottomLeft, sink.topRight);
+    if (!sim.HasAttribute(SimulationSystem::ATTRIBUTE_MASSES))
+        sim.UpdateMass(config.particleMass);
+
+    if (config.loadSnapshotPath.empty())
+    {
+        SetupScene(sim, config);
+    }
+    else
+    {
+        auto loadStart = std::chrono::steady_clock::now();
+        if (!sim.LoadSnapshot(config.loadSnapshotPath))
+            return 1;
+        const double loadSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - loadStart).count();
+        std::cout << "Loaded " << sim.GetParticleCount() << " particles from " << config.loadSnapshotPath
+            << " in " << loadSeconds * 1000.0 << " ms" << std::endl;
+    }
+
+    // Added after loading, snapshots only bring back the emitters of streams
+    for (EmitterSettings settings : config.emitters)
+    {
+        settings.acceleration = GRAVITY;
+        settings.mass = config.particleMass;
+        sim.AddEmitter(settings);
+    }
+
+    std::cout << "Running " << config.steps << " steps, " << sim.GetSubSteps() << " substeps, "
+        << sim.GetNumThreads() << " threads, " << GetSimdLevelName(sim.GetSimdLevel()) << " kernel, seed " << sim.GetSeed()
+        << (sim.GetIsDeterministic() ? " (deterministic)" : "") << std::endl;
+
+    // A snapshot brings its own columns
+    if (sim.GetAttributes() != SimulationSystem::DEFAULT_ATTRIBUTES)
+        std::cout << "Attributes: " << FormatAttributes(sim.GetAttributes()) << std::endl;
+
+    // One "step hash" line per step, diff two logs to find the first step where the runs diverge
+    std::ofstream hashLog;
+    if (!config.hashLogPath.empty())
+    {
+        hashLog.open(config.hashLogPath);
+        if (!hashLog.good())
+        {
+            std::cerr << "Cannot write " << config.hashLogPath << std::endl;
+            return 1;
+        }
+        hashLog << std::hex << std::setfill('0');
+    }
+
+    TrajectoryRecorder recorder;
+    if (!config.trajectoryPath.empty() && !recorder.Start(config.trajectoryPath, sim, config.fixedDeltaTime))
+        return 1;
+
+    // Particle count and substeps change over time, accumulate the work actually done
+    double particleSteps = 0.0;
+    double particleSubSteps = 0.0;
+    unsigned int minUsedSubSteps = sim.GetSubSteps();
+    unsigned int maxUsedSubSteps = sim.GetSubSteps();
+
+    auto startTime = std::chrono::steady_clock::now();
+    for (unsigned int step = 0; step < config.steps; step++)
+    {
+        const unsigned int subSteps = sim.GetSubSteps();
+        minUsedSubSteps = std::min(minUsedSubSteps, subSteps);
+        maxUsedSubSteps = std::max(maxUsedSubSteps, subSteps);
+
+        sim.Update(config.fixedDeltaTime);
+        recorder.CaptureFrame(sim);
+        particleSteps += static_cast<double>(sim.GetParticleCount());
+        particleSubSteps += static_cast<double>(sim.GetParticleCount()) * subSteps;
+
+        if (hashLog.is_open())
+            hashLog << std::dec << sim.GetStepIndex() << ' ' << std::hex << std::setw(16) << sim.GetStateHash() << '\n';
+    }
+    auto endTime = std::chrono::steady_clock::now();
+
+    if (recorder.IsRecording())
+    {
+        recorder.Stop();
+        const double ratio = recorder.GetRawBytes() > 0 ? static_cast<double>(recorder.GetBytesWritten()) / recorder.GetRawBytes() : 0.0;
+        std::cout << "Recorded " << recorder.GetFramesWritten() << " frames, " << recorder.GetBytesWritten() << " bytes ("
+            << ratio * 100.0 << "% of raw), " << recorder.GetStalls() << " stalls" << std::endl;
+    }
+
+    const double seconds = std::chrono::duration<double>(endTime - startTime).count();
+    const double stepsPerSecond = seconds > 0.0 ? config.steps / seconds : 0.0;
+    const double particleStepsPerSecond = seconds > 0.0 ? particleSteps / seconds : 0.0;
+
+    std::cout << "Elapsed:             " << seconds << " s\n"
+        << "Steps/s:             " << stepsPerSecond << "\n"
+        << "Particle-steps/s:    " << particleStepsPerSecond << "\n"
+        << "Particle-substeps/s: " << (seconds > 0.0 ? particleSubSteps / seconds : 0.0) << std::endl;
+
+    if (sim.GetUseAdaptiveSubSteps())
+    {
+        const SubStepStats& stats = sim.GetSubStepStats();
+        std::cout << "Substeps:            " << minUsedSubSteps << " to " << maxUsedSubSteps << ", mean "
+            << (particleSteps > 0.0 ? particleSubSteps / particleSteps : 0.0) << ", last " << stats.subSteps << "\n"
+            << "Last max move:       " << stats.maxDisplacement << " radii/substep\n"
+            << "Last max overlap:    " << stats.maxOverlap << " radii" << std::endl;
+    }
+
+    PrintStatistics(sim, config.fixedDeltaTime / sim.GetSubSteps());
+
+    if (sim.GetSpatialGrid().GetLevelCount() > 1)
+        std::cout << "Grid levels:         " << sim.GetSpatialGrid().GetLevelCount() << std::endl;
+
+    if (sim.GetUseHashedGrid())
+        std::cout << "Grid cells:          " << sim.GetSpatialGrid().GetTotalCellCount() << " occupied, "
+            << sim.GetSpatialGrid().GetHashCapacity() << " hash slots" << std::endl;
+
+    if (sim.GetUseSleeping())
+        std::cout << "Sleeping:            " << sim.GetSleepingCount() << std::endl;
+
+    if (!sim.GetSinks().empty())
+        std::cout << "Removed:             " << sim.GetRemovedCount() << " by " << sim.GetSinks().size() << " sinks" << std::endl;
+
+    if (sim.GetEmitterCount() > 0)
+    {
+        int spawned = 0;
+        size_t sites = 0;
+        for (const ParticleEmitter& emitter : sim.GetEmitters())
+        {
+            spawned += emitter.GetSpawned();
+            sites += emitter.GetSites().size();
+        }
+        std::cout << "Emitters:            " << sim.GetEmitterCount() << " with " << sites << " sites, "
+            << spawned << " particles spawned" << std::endl;
+    }
+
+    if (sim.GetUseNeighborLists())
+    {
+        const NeighborListStats& stats = sim.GetNeighborListStats();
+        std::cout << "Neighbor lists:      " << stats.builds << " builds over " << stats.subSteps << " substeps, "
+            << (stats.builds > 0 ? static_cast<double>(stats.subSteps) / stats.builds : 0.0) << " substeps per build\n"
+            << "Neighbor pairs:      " << stats.pairCount << " with a skin of " << stats.skin << " radii" << std::endl;
+    }
+
+    if (sim.GetUseFluid() && sim.GetParticleCount() > 0)
+    {
+        const ParticleColumn<float>& densities = sim.GetDensities();
+        const ParticleColumn<float>& pressures = sim.GetPressures();
+        double densitySum = 0.0;
+        for (float density : densities)
+            densitySum += density;
+        std::cout << "Fluid density:       " << densitySum / densities.size() / GetFluidRestDensity(sim) << " x rest, max "
+            << *std::max_element(densities.begin(), densities.end()) / GetFluidRestDensity(sim) << " x rest\n"
+            << "Fluid max pressure:  " << *std::max_element(pressures.begin(), pressures.end()) << std::endl;
+    }
+
+    if (sim.GetIsDeterministic())
+        std::cout << "State hash:          " << std::hex << std::setw(16) << std::setfill('0') << sim.GetStateHash() << std::dec << std::endl;
+
+    if (!config.saveSnapshotPath.empty() && !sim.SaveSnapshot(config.saveSnapshotPath))
+        return 1;
+
+    if (!config.profileCsvPath.empty() && !sim.GetProfiler().DumpCSV(config.profileCsvPath))
+    {
+        std::cerr << "Cannot write " << config.profileCsvPath << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
@@ -14,3 +14,36 @@ float MAX_FORCE_DISTANCE_SQ = 50000.0f;
 float THERMAL_DISPERSION_PER_FRAME = 0.1f;
 float MAX_THERMAL_DIFFUSION_PER_COLLISION = 15.0f;
 
+PhysicsConstants GetPhysicsConstants()
+{
+    PhysicsConstants constants;
+    constants.gravity = GRAVITY;
+    constants.restitution = RESTITUTION;
+    constants.airResistance = AIR_RESISTANCE;
+    constants.maxVelocity = MAX_VELOCITY;
+    constants.minDeltaMovement = MIN_DELTA_MOVEMENT;
+    constants.dampingFactor = DAMPING_FACTOR;
+    constants.spaceBarForce = SPACEBAR_FORCE_COEFFICIENT;
+    constants.leftClickForce = LEFT_CLICK_FORCE_COEFFICIENT;
+    constants.maxForceDistanceSq = MAX_FORCE_DISTANCE_SQ;
+    constants.thermalDispersion = THERMAL_DISPERSION_PER_FRAME;
+    constants.maxThermalDiffusion = MAX_THERMAL_DIFFUSION_PER_COLLISION;
+    return constants;
+}
+
+void SetPhysicsConstants(const PhysicsConstants& constants)
+{
+    GRAVITY = constants.gravity;
+    RESTITUTION = constants.restitution;
+    AIR_RESISTANCE = constants.airResistance;
+    INVERSE_AIR_RESISTANCE = (AIR_RESISTANCE > 0.0f) ? 1.0f / AIR_RESISTANCE : 0.0f;
+    MAX_VELOCITY = constants.maxVelocity;
+    MAX_VELOCITY_SQ = MAX_VELOCITY * MAX_VELOCITY;
+    MIN_DELTA_MOVEMENT = constants.minDeltaMovement;
+    DAMPING_FACTOR = constants.dampingFactor;
+    SPACEBAR_FORCE_COEFFICIENT = constants.spaceBarForce;
+    LEFT_CLICK_FORCE_COEFFICIENT = constants.leftClickForce;
+    MAX_FORCE_DISTANCE_SQ = constants.maxForceDistanceSq;
+    THERMAL_DISPERSION_PER_FRAME = constants.thermalDispersion;
+    MAX_THERMAL_DIFFUSION_PER_COLLISION = constants.maxThermalDiffusion;
+}
@@ -1,5 +1,5 @@
 #pragma once
-#include "vec2.h"
+#include "Vec2.h"
 
 extern Vec2 GRAVITY;
 extern float RESTITUTION;
@@ -13,4 +13,27 @@ extern float SPACEBAR_FORCE_COEFFICIENT;
 extern float LEFT_CLICK_FORCE_COEFFICIENT;
 extern float MAX_FORCE_DISTANCE_SQ;
 extern float THERMAL_DISPERSION_PER_FRAME;
-extern float MAX_THERMAL_DIFFUSION_PER_COLLISION;
\ No newline at end of file
+extern float MAX_THERMAL_DIFFUSION_PER_COLLISION;
+
+// Copy of the tunable constants, the interface edits a copy and hands it to the simulation thread
+// instead of writing the globals while the solver reads them
+struct PhysicsConstants
+{
+    Vec2 gravity = { 0.0f, -50.0f };
+    float restitution = 0.8f;
+    float airResistance = 0.005f;
+    float maxVelocity = 200.0f;
+    float minDeltaMovement = 0.005f;
+    float dampingFactor = 1.0f;
+    float spaceBarForce = 500.0f;
+    float leftClickForce = 1000.0f;
+    float maxForceDistanceSq = 50000.0f;
+    float thermalDispersion = 0.1f;
+    float maxThermalDiffusion = 15.0f;
+};
+
+// Return the current values of the globals
+PhysicsConstants GetPhysicsConstants();
+
+// Write the globals, derived values (inverse air resistance, squared max velocity) included
+void SetPhysicsConstants(const PhysicsConstants& constants);
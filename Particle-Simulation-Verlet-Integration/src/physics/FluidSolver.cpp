@@ -0,0 +1,178 @@
+#include "FluidSolver.h"
+#include "SimulationSystem.h"
+#include "SimdKernels.h"
+#include <cmath>
+#include <vector>
+#include <algorithm>
+
+static const float PI = 3.14159265358979f;
+
+// Kernel factors for the kernel radius of the current grid
+static FluidKernelParams MakeFluidKernelParams(const SimulationSystem& sim, float subStepDt)
+{
+    const float h = sim.GetSpatialGrid().GetCellSize(0);
+    const float h2 = h * h;
+    const float h5 = h2 * h2 * h;
+
+    FluidKernelParams params;
+    params.kernelRadius = h;
+    params.kernelRadiusSq = h2;
+    params.mass = sim.GetUniformMass();
+    params.poly6 = 4.0f / (PI * h5 * h2 * h);
+    params.spikyGradient = 30.0f / (PI * h5);
+    params.viscosityLaplacian = 40.0f / (PI * h5);
+    params.viscosity = sim.GetFluidSettings().viscosity;
+    params.invSubStepDt = 1.0f / subStepDt;
+    return params;
+}
+
+float GetFluidRestDensity(const SimulationSystem& sim)
+{
+    const FluidSettings& settings = sim.GetFluidSettings();
+    if (settings.restDensity > 0.0f)
+        return settings.restDensity;
+
+    // Sum the density kernel over the rows of a hexagonal packing around a particle
+    const FluidKernelParams params = MakeFluidKernelParams(sim, 1.0f);
+    const float spacing = params.kernelRadius * FLUID_REST_SPACING;
+    const float rowHeight = spacing * std::sqrt(3.0f) * 0.5f;
+    const int range = static_cast<int>(1.0f / FLUID_REST_SPACING) + 1;
+
+    float sum = 0.0f;
+    for (int row = -2 * range; row <= 2 * range; row++)
+    {
+        for (int column = -range; column <= range; column++)
+        {
+            const float x = (column + ((row & 1) ? 0.5f : 0.0f)) * spacing;
+            const float y = row * rowHeight;
+            const float falloff = params.kernelRadiusSq - (x * x + y * y);
+            if (falloff > 0.0f)
+                sum += falloff * falloff * falloff;
+        }
+    }
+
+    return params.mass * params.poly6 * sum;
+}
+
+// Scalar versions of the fluid kernels for the candidates from start on
+static float SumFluidDensity(const FluidNeighborhood& neighborhood, const FluidKernelParams& params, size_t start)
+{
+    float sum = 0.0f;
+    for (size_t k = start; k < neighborhood.count; k++)
+    {
+        const float dx = neighborhood.x - neighborhood.neighborX[k];
+        const float dy = neighborhood.y - neighborhood.neighborY[k];
+        const float falloff = params.kernelRadiusSq - (dx * dx + dy * dy);
+        if (falloff > 0.0f)
+            sum += falloff * falloff * falloff;
+    }
+    return sum;
+}
+
+static void AccumulateFluidForces(const FluidNeighborhood& neighborhood, const FluidKernelParams& params, size_t start,
+    float& accelerationX, float& accelerationY)
+{
+    const float pressureFactor = params.mass * params.spikyGradient;
+    const float viscosityFactor = params.viscosity * params.viscosityLaplacian * params.invSubStepDt;
+
+    for (size_t k = start; k < neighborhood.count; k++)
+    {
+        const float dx = neighborhood.x - neighborhood.neighborX[k];
+        const float dy = neighborhood.y - neighborhood.neighborY[k];
+        const float distSq = dx * dx + dy * dy;
+        if (distSq >= params.kernelRadiusSq || distSq <= 0.0f)
+            continue;
+
+        const float dist = std::sqrt(distSq);
+        const float falloff = params.kernelRadius - dist;
+        const float invDensity = 1.0f / neighborhood.neighborDensities[k];
+        const float neighborPressureTerm = neighborhood.neighborPressures[k] * (invDensity * invDensity);
+
+        // Pressure pushes along the direction from the neighbor, viscosity pulls the velocities together
+        const float pressureScale = pressureFactor * (neighborhood.pressureTerm + neighborPressureTerm) * (falloff * falloff) / dist;
+        const float viscosityScale = viscosityFactor * (params.mass * invDensity) * falloff;
+        const float relativeX = (neighborhood.neighborX[k] - neighborhood.neighborPrevX[k]) - neighborhood.displacementX;
+        const float relativeY = (neighborhood.neighborY[k] - neighborhood.neighborPrevY[k]) - neighborhood.displacementY;
+
+        accelerationX += pressureScale * dx + viscosityScale * relativeX;
+        accelerationY += pressureScale * dy + viscosityScale * relativeY;
+    }
+}
+
+void SolveFluidForces(SimulationSystem& sim, float deltaTime)
+{
+    sim.UpdateSpatialGrid();
+
+    const ParticleColumn<Vec2>& positions = sim.GetPositions();
+    const ParticleColumn<Vec2>& prevPositions = sim.GetPrevPositions();
+    ParticleColumn<Vec2>& accelerations = sim.GetAccelerations();
+    ParticleColumn<float>& densities = sim.GetDensities();
+    ParticleColumn<float>& pressures = sim.GetPressures();
+
+    const size_t particleCount = positions.size();
+    const SpatialGrid& grid = sim.GetSpatialGrid();
+    const SimdLevel simdLevel = sim.GetSimdLevel();
+    const FluidKernelParams params = MakeFluidKernelParams(sim, deltaTime / sim.GetSubSteps());
+    const float stiffness = sim.GetFluidSettings().stiffness;
+    const float restDensity = GetFluidRestDensity(sim);
+
+    std::vector<FluidCandidates>& threadCandidates = sim.GetFluidCandidates();
+    threadCandidates.resize(sim.GetNumThreads());
+
+    PROFILE_SCOPE(sim.GetProfiler(), ProfilePhase::Fluid);
+
+    // Every particle only writes its own entries, the passes read the others once the previous one is done.
+    // The neighbors are gathered into SoA buffers so the kernels use plain vector loads
+    sim.GetThreadPool().ParallelFor(0, particleCount, [&](size_t start, size_t end, unsigned int threadIndex)
+    {
+        FluidCandidates& candidates = threadCandidates[threadIndex];
+        for (size_t i = start; i < end; i++)
+        {
+            candidates.Gather(grid, positions[i], positions, prevPositions, pressures, densities, false, params.kernelRadiusSq);
+            const FluidNeighborhood neighborhood = candidates.MakeNeighborhood(positions[i]);
+
+            float sum = 0.0f;
+            size_t k = 0;
+            if (simdLevel == SimdLevel::AVX2)
+                k = SumFluidDensityAVX2(neighborhood, params, sum);
+            else if (simdLevel == SimdLevel::SSE)
+                k = SumFluidDensitySSE(neighborhood, params, sum);
+            sum += SumFluidDensity(neighborhood, params, k);
+
+            densities[i] = params.mass * params.poly6 * sum;
+        }
+
+        // Equation of state, a fluid below its rest density pulls nothing together
+        size_t i = start;
+        if (simdLevel == SimdLevel::AVX2)
+            i = ComputeFluidPressuresAVX2(start, end, densities.data(), pressures.data(), stiffness, restDensity);
+        else if (simdLevel == SimdLevel::SSE)
+            i = ComputeFluidPressuresSSE(start, end, densities.data(), pressures.data(), stiffness, restDensity);
+        for (; i < end; i++)
+            pressures[i] = std::max(stiffness * (densities[i] - restDensity), 0.0f);
+    });
+
+    sim.GetThreadPool().ParallelFor(0, particleCount, [&](size_t start, size_t end, unsigned int threadIndex)
+    {
+        FluidCandidates& candidates = threadCandidates[threadIndex];
+        for (size_t i = start; i < end; i++)
+        {
+            candidates.Gather(grid, positions[i], positions, prevPositions, pressures, densities, true, params.kernelRadiusSq);
+            FluidNeighborhood neighborhood = candidates.MakeNeighborhood(positions[i]);
+            neighborhood.displacementX = positions[i].x - prevPositions[i].x;
+            neighborhood.displacementY = positions[i].y - prevPositions[i].y;
+            neighborhood.pressureTerm = pressures[i] / (densities[i] * densities[i]);
+
+            float accelerationX = 0.0f;
+            float accelerationY = 0.0f;
+            size_t k = 0;
+            if (simdLevel == SimdLevel::AVX2)
+                k = AccumulateFluidForcesAVX2(neighborhood, params, accelerationX, accelerationY);
+            else if (simdLevel == SimdLevel::SSE)
+                k = AccumulateFluidForcesSSE(neighborhood, params, accelerationX, accelerationY);
+            AccumulateFluidForces(neighborhood, params, k, accelerationX, accelerationY);
+
+            accelerations[i] += Vec2(accelerationX, accelerationY);
+        }
+    });
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include "SpatialGrid.h"
+#include "SimdKernels.h"
+
+class SimulationSystem;
+
+// Weakly compressible SPH. Every particle is a sample of the fluid with the uniform particle mass, the kernel radius is
+// the cell size of the first grid level (2.5 particle radii) so the neighbors are found in the 3x3 cells around a particle.
+// At rest the particles sit one radius apart, closer than the granular contacts.
+struct FluidSettings
+{
+    float stiffness = 100000.0f;    // pressure per unit of density above the rest density, the squared speed of sound
+    float viscosity = 20.0f;        // kinematic viscosity
+    float restDensity = 0.0f;       // 0 uses the density of a hexagonal packing one particle radius apart
+};
+
+// Spacing of the particles at rest, in kernel radii
+const float FLUID_REST_SPACING = 0.4f;
+
+// Return the rest density of the fluid pass, from the settings or the packing of the current kernel radius
+float GetFluidRestDensity(const SimulationSystem& sim);
+
+// Compute the densities and pressures of every particle and add the pressure and viscosity accelerations,
+// the integration of the substep applies them. Rebuilds the spatial grid first
+void SolveFluidForces(SimulationSystem& sim, float deltaTime);
+
+// SoA copy of the candidates of one particle, kept per thread by the simulation system. The buffers only grow
+struct FluidCandidates
+{
+    std::vector<float> x, y, prevX, prevY, pressures, densities;
+    size_t count = 0;
+
+    void Reserve(size_t size)
+    {
+        if (x.size() >= size)
+            return;
+        size = std::max(size, x.size() * 2);
+        for (std::vector<float>* buffer : { &x, &y, &prevX, &prevY, &pressures, &densities })
+            buffer->resize(size);
+    }
+
+    // The density pass takes every particle of the cells around, the force pass only those within the kernel
+    // radius: every candidate is written and the count only moves past the ones in range, there is no branch to mispredict
+    void Gather(const SpatialGrid& grid, const Vec2& position, const ParticleColumn<Vec2>& positions,
+        const ParticleColumn<Vec2>& prevPositions, const ParticleColumn<float>& particlePressures,
+        const ParticleColumn<float>& particleDensities, bool withForceInputs, float kernelRadiusSq)
+    {
+        count = 0;
+        grid.ForEachNeighborCell(position, [&](const unsigned int* particles, unsigned int cellCount)
+        {
+            Reserve(count + cellCount);
+            for (unsigned int k = 0; k < cellCount; k++)
+            {
+                const unsigned int j = particles[k];
+                const Vec2 neighbor = positions[j];
+                x[count] = neighbor.x;
+                y[count] = neighbor.y;
+                if (!withForceInputs)
+                {
+                    count++;
+                    continue;
+                }
+
+                prevX[count] = prevPositions[j].x;
+                prevY[count] = prevPositions[j].y;
+                pressures[count] = particlePressures[j];
+                densities[count] = particleDensities[j];
+                count += (neighbor - position).length_sq() < kernelRadiusSq;
+            }
+        });
+    }
+
+    FluidNeighborhood MakeNeighborhood(const Vec2& position) const
+    {
+        FluidNeighborhood neighborhood = {};
+        neighborhood.x = position.x;
+        neighborhood.y = position.y;
+        neighborhood.neighborX = x.data();
+        neighborhood.neighborY = y.data();
+        neighborhood.neighborPrevX = prevX.data();
+        neighborhood.neighborPrevY = prevY.data();
+        neighborhood.neighborPressures = pressures.data();
+        neighborhood.neighborDensities = densities.data();
+        neighborhood.count = count;
+        return neighborhood;
+    }
+};
@@ -0,0 +1,45 @@
+#include "ParticleColumn.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+#ifndef MAP_NORESERVE
+#define MAP_NORESERVE 0
+#endif
+
+void* ReserveColumnMemory(size_t bytes)
+{
+#ifdef _WIN32
+    return VirtualAlloc(nullptr, bytes, MEM_RESERVE, PAGE_NOACCESS);
+#else
+    void* memory = mmap(nullptr, bytes, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    return (memory == MAP_FAILED) ? nullptr : memory;
+#endif
+}
+
+bool CommitColumnMemory(void* address, size_t bytes)
+{
+    if (bytes == 0)
+        return true;
+
+#ifdef _WIN32
+    return VirtualAlloc(address, bytes, MEM_COMMIT, PAGE_READWRITE) != nullptr;
+#else
+    return mprotect(address, bytes, PROT_READ | PROT_WRITE) == 0;
+#endif
+}
+
+void ReleaseColumnMemory(void* address, size_t bytes)
+{
+#ifdef _WIN32
+    (void)bytes;
+    VirtualFree(address, 0, MEM_RELEASE);
+#else
+    munmap(address, bytes);
+#endif
+}
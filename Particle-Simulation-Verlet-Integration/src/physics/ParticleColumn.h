@@ -0,0 +1,180 @@
+#pragma once
+#include <cstddef>
+#include <cstring>
+#include <algorithm>
+#include <iterator>
+#include <new>
+#include <type_traits>
+
+// Every column reserves a large range of address space up front and commits memory at its end in fixed size chunks
+// as it grows. Nothing is copied when a column grows and data() keeps its address, the kernels, the grid and anything
+// holding a pointer into a column don't see a reallocation. Only a column outgrowing its reservation is moved to a
+// larger one, that takes hundreds of millions of particles on 64 bit builds.
+const size_t COLUMN_CHUNK_BYTES = 64 * 1024;
+const size_t COLUMN_RESERVE_BYTES = (sizeof(void*) >= 8) ? (size_t(1) << 30) : (size_t(16) << 20);
+const size_t COLUMN_ALIGNMENT = 64;
+
+// Reserve address space without memory behind it, nullptr on failure. The start is page aligned
+void* ReserveColumnMemory(size_t bytes);
+
+// Back part of a reservation with zeroed memory, both ends page aligned. Returns false when out of memory
+bool CommitColumnMemory(void* address, size_t bytes);
+
+// Release a whole reservation
+void ReleaseColumnMemory(void* address, size_t bytes);
+
+// One SoA column of particle data. Same interface as std::vector for the parts the simulation uses, plus Append for
+// bulk spawns. Only for plain types, elements are moved with memcpy and never destroyed
+template<typename T>
+class ParticleColumn
+{
+    static_assert(std::is_trivially_copyable<T>::value, "Particle columns only hold trivially copyable types");
+    static_assert(COLUMN_ALIGNMENT % alignof(T) == 0, "Particle columns are 64 byte aligned");
+
+private:
+    T* m_Data;
+    size_t m_Size;
+    size_t m_CommittedBytes;
+    size_t m_ReservedBytes;
+
+    // Commit chunks until minCapacity elements fit
+    void Grow(size_t minCapacity)
+    {
+        const size_t bytes = (minCapacity * sizeof(T) + COLUMN_CHUNK_BYTES - 1) / COLUMN_CHUNK_BYTES * COLUMN_CHUNK_BYTES;
+
+        if (bytes > m_ReservedBytes)
+        {
+            // First chunk, or past the end of the reservation
+            const size_t reservedBytes = std::max(bytes, std::max(COLUMN_RESERVE_BYTES, m_ReservedBytes * 2));
+            void* memory = ReserveColumnMemory(reservedBytes);
+            if (memory == nullptr || !CommitColumnMemory(memory, bytes))
+            {
+                if (memory != nullptr)
+                    ReleaseColumnMemory(memory, reservedBytes);
+                throw std::bad_alloc();
+            }
+
+            if (m_Data != nullptr)
+            {
+                std::memcpy(memory, m_Data, m_Size * sizeof(T));
+                ReleaseColumnMemory(m_Data, m_ReservedBytes);
+            }
+
+            m_Data = static_cast<T*>(memory);
+            m_ReservedBytes = reservedBytes;
+            m_CommittedBytes = bytes;
+            return;
+        }
+
+        if (!CommitColumnMemory(reinterpret_cast<unsigned char*>(m_Data) + m_CommittedBytes, bytes - m_CommittedBytes))
+            throw std::bad_alloc();
+        m_CommittedBytes = bytes;
+    }
+
+    void Release()
+    {
+        if (m_Data != nullptr)
+            ReleaseColumnMemory(m_Data, m_ReservedBytes);
+        m_Data = nullptr;
+        m_Size = 0;
+        m_CommittedBytes = 0;
+        m_ReservedBytes = 0;
+    }
+
+public:
+    ParticleColumn() : m_Data(nullptr), m_Size(0), m_CommittedBytes(0), m_ReservedBytes(0) {}
+    ~ParticleColumn() { Release(); }
+
+    ParticleColumn(const ParticleColumn& other) : ParticleColumn() { assign(other.begin(), other.end()); }
+    ParticleColumn(ParticleColumn&& other) : m_Data(other.m_Data), m_Size(other.m_Size), m_CommittedBytes(other.m_CommittedBytes),
+        m_ReservedBytes(other.m_ReservedBytes)
+    {
+        other.m_Data = nullptr;
+        other.Release();
+    }
+
+    ParticleColumn& operator=(const ParticleColumn& other)
+    {
+        if (this != &other)
+            assign(other.begin(), other.end());
+        return *this;
+    }
+
+    ParticleColumn& operator=(ParticleColumn&& other)
+    {
+        if (this != &other)
+        {
+            Release();
+            std::swap(m_Data, other.m_Data);
+            std::swap(m_Size, other.m_Size);
+            std::swap(m_CommittedBytes, other.m_CommittedBytes);
+            std::swap(m_ReservedBytes, other.m_ReservedBytes);
+        }
+        return *this;
+    }
+
+    size_t size() const { return m_Size; }
+    bool empty() const { return m_Size == 0; }
+    size_t capacity() const { return m_CommittedBytes / sizeof(T); }
+
+    T* data() { return m_Data; }
+    const T* data() const { return m_Data; }
+
+    T& operator[](size_t index) { return m_Data[index]; }
+    const T& operator[](size_t index) const { return m_Data[index]; }
+
+    T* begin() { return m_Data; }
+    T* end() { return m_Data + m_Size; }
+    const T* begin() const { return m_Data; }
+    const T* end() const { return m_Data + m_Size; }
+
+    void reserve(size_t count)
+    {
+        if (count > capacity())
+            Grow(count);
+    }
+
+    void resize(size_t count, const T& value = T())
+    {
+        reserve(count);
+        if (count > m_Size)
+            std::fill(m_Data + m_Size, m_Data + count, value);
+        m_Size = count;
+    }
+
+    void assign(size_t count, const T& value)
+    {
+        m_Size = 0;
+        resize(count, value);
+    }
+
+    template<typename Iterator, typename = typename std::iterator_traits<Iterator>::iterator_category>
+    void assign(Iterator first, Iterator last)
+    {
+        const size_t count = static_cast<size_t>(std::distance(first, last));
+        reserve(count);
+        std::copy(first, last, m_Data);
+        m_Size = count;
+    }
+
+    void push_back(const T& value)
+    {
+        // value may live in the column if it has to move to a larger reservation
+        const T copy = value;
+        if (m_Size == capacity())
+            Grow(m_Size + 1);
+        m_Data[m_Size++] = copy;
+    }
+
+    // Keeps the committed memory
+    void clear() { m_Size = 0; }
+
+    // Grow by count elements without initializing them and return the first one, the caller fills them
+    T* Append(size_t count)
+    {
+        reserve(m_Size + count);
+        T* first = m_Data + m_Size;
+        m_Size += count;
+        return first;
+    }
+};
@@ -0,0 +1,139 @@
+#include "ParticleEmitter.h"
+#include <cmath>
+#include <algorithm>
+
+static const float PI = 3.14159265358979f;
+
+ParticleEmitter::ParticleEmitter(const EmitterSettings& settings)
+    : m_Settings(settings), m_SiteRadius(0.0f), m_Time(0.0f), m_Credit(0.0f), m_Spawned(0), m_NextSite(0), m_IsActive(true)
+{
+    std::sort(m_Settings.rateCurve.begin(), m_Settings.rateCurve.end(),
+        [](const EmitterRateKey& a, const EmitterRateKey& b) { return a.time < b.time; });
+}
+
+float ParticleEmitter::GetRate(float time) const
+{
+    const std::vector<EmitterRateKey>& curve = m_Settings.rateCurve;
+    if (curve.empty())
+        return 0.0f;
+    if (time <= curve.front().time)
+        return curve.front().rate;
+    if (time >= curve.back().time)
+        return curve.back().rate;
+
+    size_t k = 1;
+    while (curve[k].time < time)
+        k++;
+    const float t = (time - curve[k - 1].time) / (curve[k].time - curve[k - 1].time);
+    return curve[k - 1].rate + (curve[k].rate - curve[k - 1].rate) * t;
+}
+
+void ParticleEmitter::LayoutSites(float maxRadius)
+{
+    // Two particles jittered around neighboring sites are still a diameter apart
+    const float spacing = (2.0f + 2.0f * m_Settings.jitter) * maxRadius * 1.01f;
+    const float rowHeight = spacing * std::sqrt(3.0f) * 0.5f;
+    m_Sites.clear();
+    m_SiteRadius = maxRadius;
+    m_NextSite = 0;
+
+    switch (m_Settings.shape)
+    {
+    case EmitterShape::Line:
+    {
+        const Vec2 direction = m_Settings.end - m_Settings.start;
+        const int intervals = static_cast<int>(direction.length() / spacing);
+        if (intervals == 0)
+        {
+            m_Sites.push_back((m_Settings.start + m_Settings.end) * 0.5f);
+            break;
+        }
+        for (int k = 0; k <= intervals; k++)
+            m_Sites.push_back(m_Settings.start + direction * (static_cast<float>(k) / intervals));
+        break;
+    }
+    case EmitterShape::Disc:
+    {
+        // Rows of a hexagonal lattice centered on the disc
+        const int rowRange = static_cast<int>(m_Settings.radius / rowHeight);
+        const int columnRange = static_cast<int>(m_Settings.radius / spacing) + 1;
+        for (int row = -rowRange; row <= rowRange; row++)
+        {
+            for (int column = -columnRange; column <= columnRange; column++)
+            {
+                const Vec2 offset((column + ((row & 1) ? 0.5f : 0.0f)) * spacing, row * rowHeight);
+                if (offset.length_sq() <= m_Settings.radius * m_Settings.radius)
+                    m_Sites.push_back(m_Settings.start + offset);
+            }
+        }
+        break;
+    }
+    case EmitterShape::Rect:
+    {
+        const Vec2 bottomLeft(std::min(m_Settings.start.x, m_Settings.end.x), std::min(m_Settings.start.y, m_Settings.end.y));
+        const Vec2 topRight(std::max(m_Settings.start.x, m_Settings.end.x), std::max(m_Settings.start.y, m_Settings.end.y));
+        for (int row = 0; bottomLeft.y + row * rowHeight <= topRight.y; row++)
+        {
+            const float y = bottomLeft.y + row * rowHeight;
+            for (float x = bottomLeft.x + ((row & 1) ? spacing * 0.5f : 0.0f); x <= topRight.x; x += spacing)
+                m_Sites.push_back(Vec2(x, y));
+        }
+        break;
+    }
+    }
+
+    // A shape too small for a single lattice site still spawns at its start
+    if (m_Sites.empty())
+        m_Sites.push_back(m_Settings.start);
+}
+
+int ParticleEmitter::Advance(float deltaTime, float maxRadius)
+{
+    const float rate = 0.5f * (GetRate(m_Time) + GetRate(m_Time + deltaTime));
+    m_Time += deltaTime;
+    if (!m_IsActive || IsDone())
+        return 0;
+
+    if (maxRadius != m_SiteRadius)
+        LayoutSites(maxRadius);
+
+    // A backlog of one spawn per site is kept for the particles deferred by blocked sites, beyond it the rate is lost
+    const float sites = static_cast<float>(m_Sites.size());
+    m_Credit = std::min(m_Credit + rate * deltaTime, 2.0f * sites);
+    int due = static_cast<int>(std::min(m_Credit, sites));
+    if (m_Settings.total >= 0)
+        due = std::min(due, m_Settings.total - m_Spawned);
+    return due;
+}
+
+void ParticleEmitter::SetProgress(float time, float credit, int spawned, float siteRadius, size_t nextSite)
+{
+    m_Time = time;
+    m_Credit = credit;
+    m_Spawned = spawned;
+    if (siteRadius > 0.0f)
+    {
+        LayoutSites(siteRadius);
+        m_NextSite = m_Sites.empty() ? 0 : nextSite % m_Sites.size();
+    }
+}
+
+Vec2 ParticleEmitter::GetCandidate(size_t k, std::mt19937& randomGenerator) const
+{
+    const Vec2 site = m_Sites[(m_NextSite + k) % m_Sites.size()];
+    if (m_Settings.jitter <= 0.0f)
+        return site;
+
+    // Uniform in a disc of the jitter radius
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    const float angle = unit(randomGenerator) * 2.0f * PI;
+    const float distance = std::sqrt(unit(randomGenerator)) * m_Settings.jitter * m_SiteRadius;
+    return site + Vec2::fromAngle(angle) * distance;
+}
+
+void ParticleEmitter::OnSpawned(int count, size_t tried)
+{
+    m_Credit -= static_cast<float>(count);
+    m_Spawned += count;
+    m_NextSite = (m_NextSite + tried) % m_Sites.size();
+}
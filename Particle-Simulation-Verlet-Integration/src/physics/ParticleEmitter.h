@@ -0,0 +1,85 @@
+#pragma once
+#include <vector>
+#include <random>
+
+#include "Vec2.h"
+
+enum class EmitterShape
+{
+    Line,       // from start to end, a single point when they are equal
+    Disc,       // centered on start
+    Rect        // between the corners start and end
+};
+
+// Spawn rate at a time since the emitter was added, the rate is linear between the keys and held past the first and last
+struct EmitterRateKey
+{
+    float time;     // seconds
+    float rate;     // particles per second
+};
+
+struct EmitterSettings
+{
+    EmitterShape shape = EmitterShape::Line;
+    Vec2 start;
+    Vec2 end;
+    float radius = 0.0f;                    // disc radius
+    Vec2 velocity;                          // initial velocity of the particles
+    Vec2 acceleration;
+    float mass = 1.0f;                      // mass of a particle of the reference radius, scaled by the area
+    float jitter = 0.5f;                    // random offset around the lattice sites, in largest radii
+    int total = -1;                         // particles to spawn, negative for no limit
+    std::vector<EmitterRateKey> rateCurve;  // no key spawns nothing
+};
+
+// Spawns particles on a lattice covering its shape. The sites are a hexagonal lattice, or evenly spaced along a line, far
+// enough apart that particles of the largest radius jittered around them never overlap each other. Whether a site is
+// free of the particles already there is up to the caller, see SimulationSystem::UpdateEmitters
+class ParticleEmitter
+{
+private:
+    EmitterSettings m_Settings;
+    std::vector<Vec2> m_Sites;
+    float m_SiteRadius;         // largest radius the sites were laid out for, 0 before the first layout
+    float m_Time;
+    float m_Credit;             // particles due, the fraction carries over to the next update
+    int m_Spawned;
+    size_t m_NextSite;          // first site tried by the next spawn, so the sites are used in turn
+    bool m_IsActive;
+
+    void LayoutSites(float maxRadius);
+
+public:
+    ParticleEmitter(const EmitterSettings& settings);
+
+    // Return the spawn rate at a time since the emitter was added
+    float GetRate(float time) const;
+
+    // Advance the emitter time, lay the sites out again if the largest radius changed and return how many particles are
+    // due. The count is at most the number of sites, an emitter blocked for a while doesn't burst once it is free and
+    // catches up on at most one spawn per site
+    int Advance(float deltaTime, float maxRadius);
+
+    // Return the position of the k-th site tried by the current spawn, jittered
+    Vec2 GetCandidate(size_t k, std::mt19937& randomGenerator) const;
+
+    // Record the spawn of count particles after trying tried sites
+    void OnSpawned(int count, size_t tried);
+
+    const EmitterSettings& GetSettings() const { return m_Settings; }
+    const std::vector<Vec2>& GetSites() const { return m_Sites; }
+    int GetSpawned() const { return m_Spawned; }
+    float GetTime() const { return m_Time; }
+    float GetCredit() const { return m_Credit; }
+    float GetSiteRadius() const { return m_SiteRadius; }
+    size_t GetNextSite() const { return m_NextSite; }
+    bool GetIsActive() const { return m_IsActive; }
+    void SetIsActive(bool v) { m_IsActive = v; }
+
+    // Return true once the total was spawned
+    bool IsDone() const { return m_Settings.total >= 0 && m_Spawned >= m_Settings.total; }
+
+    // Restore the progress of a saved emitter. The sites are laid out again for the saved radius, so the next spawn
+    // starts at the same site as long as the largest radius did not change
+    void SetProgress(float time, float credit, int spawned, float siteRadius, size_t nextSite);
+};
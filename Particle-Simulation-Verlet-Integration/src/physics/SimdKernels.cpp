@@ -0,0 +1,592 @@
+#include "SimdKernels.h"
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+#define SIMD_KERNELS_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#else
+#define SIMD_KERNELS_X86 0
+#endif
+
+// MSVC emits any intrinsic, GCC and Clang need the instruction set enabled on the function itself
+#if SIMD_KERNELS_X86 && !defined(_MSC_VER)
+#define SIMD_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define SIMD_TARGET_AVX2
+#endif
+
+SimdLevel DetectSimdLevel()
+{
+#if SIMD_KERNELS_X86
+#ifdef _MSC_VER
+    int info[4];
+    __cpuid(info, 0);
+    const int maxLeaf = info[0];
+
+    __cpuid(info, 1);
+    const bool hasSSE2 = (info[3] & (1 << 26)) != 0;
+    const bool hasOSXSAVE = (info[2] & (1 << 27)) != 0;
+    const bool hasAVX = (info[2] & (1 << 28)) != 0;
+
+    bool hasAVX2 = false;
+    if (maxLeaf >= 7)
+    {
+        __cpuidex(info, 7, 0);
+        hasAVX2 = (info[1] & (1 << 5)) != 0;
+    }
+
+    // The OS also has to save the YMM registers on context switches
+    if (hasAVX && hasAVX2 && hasOSXSAVE && (_xgetbv(0) & 0x6) == 0x6)
+        return SimdLevel::AVX2;
+    if (hasSSE2)
+        return SimdLevel::SSE;
+#else
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return SimdLevel::AVX2;
+    if (__builtin_cpu_supports("sse2"))
+        return SimdLevel::SSE;
+#endif
+#endif
+    return SimdLevel::Scalar;
+}
+
+const char* GetSimdLevelName(SimdLevel level)
+{
+    switch (level)
+    {
+    case SimdLevel::AVX2: return "AVX2";
+    case SimdLevel::SSE:  return "SSE";
+    default:              return "Scalar";
+    }
+}
+
+#if SIMD_KERNELS_X86
+
+template<bool HasAccelerations, bool HasMasses, bool HasTemperatures>
+static size_t UpdateParticlesSSE(size_t start, size_t end, const IntegrationParams& params,
+    float* positions, float* prevPositions, float* accelerations, float* temperatures, const float* masses)
+{
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 two = _mm_set1_ps(2.0f);
+    const __m128 dt = _mm_set1_ps(params.dt);
+    const __m128 dtSq = _mm_set1_ps(params.dt * params.dt);
+    const __m128 minDistSq = _mm_set1_ps(0.01f);
+    const __m128 maxForceDistSq = _mm_set1_ps(params.maxForceDistanceSq);
+    const __m128 maxVelocity = _mm_set1_ps(params.maxVelocity);
+    const __m128 maxVelocitySq = _mm_set1_ps(params.maxVelocitySq);
+    const __m128 air = _mm_set1_ps(params.airResistance);
+    const __m128 heatFromDrag = _mm_set1_ps(params.airResistance * 0.01f);
+    const __m128 dispersion = _mm_set1_ps(params.thermalDispersion);
+    const __m128 maxTemperature = _mm_set1_ps(400.0f);
+    const __m128 uniformInvMass = _mm_div_ps(one, _mm_set1_ps(params.uniformMass));
+
+    size_t i = start;
+    for (; i + 4 <= end; i += 4)
+    {
+        // Split the interleaved Vec2s of 4 particles into x and y registers
+        __m128 a = _mm_loadu_ps(positions + 2 * i);
+        __m128 b = _mm_loadu_ps(positions + 2 * i + 4);
+        __m128 posX = _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+        __m128 posY = _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+
+        a = _mm_loadu_ps(prevPositions + 2 * i);
+        b = _mm_loadu_ps(prevPositions + 2 * i + 4);
+        __m128 prevX = _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+        __m128 prevY = _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+
+        __m128 accX = zero;
+        __m128 accY = zero;
+        if (HasAccelerations)
+        {
+            a = _mm_loadu_ps(accelerations + 2 * i);
+            b = _mm_loadu_ps(accelerations + 2 * i + 4);
+            accX = _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+            accY = _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+        }
+
+        const __m128 invMass = HasMasses ? _mm_div_ps(one, _mm_loadu_ps(masses + i)) : uniformInvMass;
+        __m128 temperature = HasTemperatures ? _mm_loadu_ps(temperatures + i) : zero;
+
+        // Gravity
+        accX = _mm_add_ps(accX, _mm_set1_ps(params.gravityX));
+        accY = _mm_add_ps(accY, _mm_set1_ps(params.gravityY));
+
+        // Central force, lanes too close to the center are masked out
+        if (params.applySpaceBar)
+        {
+            __m128 toX = _mm_sub_ps(_mm_set1_ps(params.centerX), posX);
+            __m128 toY = _mm_sub_ps(_mm_set1_ps(params.centerY), posY);
+            __m128 lenSq = _mm_add_ps(_mm_mul_ps(toX, toX), _mm_mul_ps(toY, toY));
+            __m128 mask = _mm_cmpgt_ps(lenSq, minDistSq);
+
+            __m128 scale = _mm_mul_ps(_mm_div_ps(_mm_set1_ps(params.spaceBarForce), _mm_sqrt_ps(lenSq)), invMass);
+            accX = _mm_add_ps(accX, _mm_and_ps(mask, _mm_mul_ps(toX, scale)));
+            accY = _mm_add_ps(accY, _mm_and_ps(mask, _mm_mul_ps(toY, scale)));
+        }
+
+        // Mouse force, only lanes inside the force range
+        if (params.applyMouseForce)
+        {
+            __m128 toX = _mm_sub_ps(_mm_set1_ps(params.mouseX), posX);
+            __m128 toY = _mm_sub_ps(_mm_set1_ps(params.mouseY), posY);
+            __m128 distSq = _mm_add_ps(_mm_mul_ps(toX, toX), _mm_mul_ps(toY, toY));
+            __m128 mask = _mm_and_ps(_mm_cmpgt_ps(distSq, minDistSq), _mm_cmplt_ps(distSq, maxForceDistSq));
+
+            __m128 dist = _mm_sqrt_ps(distSq);
+            __m128 magnitude = _mm_div_ps(_mm_set1_ps(params.mouseForce * params.mouseForceSign),
+                _mm_add_ps(one, _mm_mul_ps(dist, _mm_set1_ps(0.01f))));
+            __m128 scale = _mm_mul_ps(_mm_div_ps(magnitude, dist), invMass);
+            accX = _mm_add_ps(accX, _mm_and_ps(mask, _mm_mul_ps(toX, scale)));
+            accY = _mm_add_ps(accY, _mm_and_ps(mask, _mm_mul_ps(toY, scale)));
+        }
+
+        // Velocity with cap
+        __m128 velX = _mm_div_ps(_mm_sub_ps(posX, prevX), dt);
+        __m128 velY = _mm_div_ps(_mm_sub_ps(posY, prevY), dt);
+        __m128 velSq = _mm_add_ps(_mm_mul_ps(velX, velX), _mm_mul_ps(velY, velY));
+        __m128 capMask = _mm_cmpgt_ps(velSq, maxVelocitySq);
+        __m128 capScale = _mm_or_ps(_mm_and_ps(capMask, _mm_div_ps(maxVelocity, _mm_sqrt_ps(velSq))), _mm_andnot_ps(capMask, one));
+        velX = _mm_mul_ps(velX, capScale);
+        velY = _mm_mul_ps(velY, capScale);
+        prevX = _mm_or_ps(_mm_and_ps(capMask, _mm_sub_ps(posX, _mm_mul_ps(velX, dt))), _mm_andnot_ps(capMask, prevX));
+        prevY = _mm_or_ps(_mm_and_ps(capMask, _mm_sub_ps(posY, _mm_mul_ps(velY, dt))), _mm_andnot_ps(capMask, prevY));
+
+        // Air resistance and the heat it generates
+        __m128 drag = _mm_mul_ps(air, invMass);
+        accX = _mm_sub_ps(accX, _mm_mul_ps(velX, drag));
+        accY = _mm_sub_ps(accY, _mm_mul_ps(velY, drag));
+        if (HasTemperatures)
+        {
+            __m128 speed = _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(velX, velX), _mm_mul_ps(velY, velY)));
+            temperature = _mm_add_ps(temperature, _mm_mul_ps(speed, heatFromDrag));
+        }
+
+        // Verlet integration
+        __m128 newX = _mm_add_ps(_mm_sub_ps(_mm_mul_ps(posX, two), prevX), _mm_mul_ps(accX, dtSq));
+        __m128 newY = _mm_add_ps(_mm_sub_ps(_mm_mul_ps(posY, two), prevY), _mm_mul_ps(accY, dtSq));
+
+        // Interleave back and store, the old position becomes the previous one
+        _mm_storeu_ps(prevPositions + 2 * i, _mm_unpacklo_ps(posX, posY));
+        _mm_storeu_ps(prevPositions + 2 * i + 4, _mm_unpackhi_ps(posX, posY));
+        _mm_storeu_ps(positions + 2 * i, _mm_unpacklo_ps(newX, newY));
+        _mm_storeu_ps(positions + 2 * i + 4, _mm_unpackhi_ps(newX, newY));
+
+        if (HasAccelerations)
+        {
+            _mm_storeu_ps(accelerations + 2 * i, zero);
+            _mm_storeu_ps(accelerations + 2 * i + 4, zero);
+        }
+
+        // Heat dispersion and temperature bounds
+        if (HasTemperatures)
+        {
+            temperature = _mm_sub_ps(temperature, dispersion);
+            temperature = _mm_min_ps(_mm_max_ps(temperature, zero), maxTemperature);
+            _mm_storeu_ps(temperatures + i, temperature);
+        }
+    }
+
+    return i;
+}
+
+size_t UpdateParticlesSSE(size_t start, size_t end, const IntegrationParams& params,
+    float* positions, float* prevPositions, float* accelerations, float* temperatures, const float* masses)
+{
+    return DispatchAttributeFlags(accelerations != nullptr, masses != nullptr, temperatures != nullptr,
+        [&](auto hasAccelerations, auto hasMasses, auto hasTemperatures)
+    {
+        return UpdateParticlesSSE<decltype(hasAccelerations)::value, decltype(hasMasses)::value, decltype(hasTemperatures)::value>(
+            start, end, params, positions, prevPositions, accelerations, temperatures, masses);
+    });
+}
+
+// Split 8 interleaved Vec2s into x and y registers in particle order
+SIMD_TARGET_AVX2 static inline void LoadVec2x8(const float* src, __m256& outX, __m256& outY)
+{
+    __m256 a = _mm256_loadu_ps(src);
+    __m256 b = _mm256_loadu_ps(src + 8);
+
+    // Shuffles work per 128 bit lane, this gives x0 x1 x4 x5 | x2 x3 x6 x7...
+    __m256 x = _mm256_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+    __m256 y = _mm256_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+
+    // ...and swapping the middle 64 bit blocks restores the order
+    outX = _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(x), _MM_SHUFFLE(3, 1, 2, 0)));
+    outY = _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(y), _MM_SHUFFLE(3, 1, 2, 0)));
+}
+
+// Interleave x and y registers back into 8 Vec2s
+SIMD_TARGET_AVX2 static inline void StoreVec2x8(float* dst, __m256 x, __m256 y)
+{
+    __m256 lo = _mm256_unpacklo_ps(x, y);  // x0 y0 x1 y1 | x4 y4 x5 y5
+    __m256 hi = _mm256_unpackhi_ps(x, y);  // x2 y2 x3 y3 | x6 y6 x7 y7
+    _mm256_storeu_ps(dst, _mm256_permute2f128_ps(lo, hi, 0x20));
+    _mm256_storeu_ps(dst + 8, _mm256_permute2f128_ps(lo, hi, 0x31));
+}
+
+template<bool HasAccelerations, bool HasMasses, bool HasTemperatures>
+SIMD_TARGET_AVX2 static size_t UpdateParticlesAVX2(size_t start, size_t end, const IntegrationParams& params,
+    float* positions, float* prevPositions, float* accelerations, float* temperatures, const float* masses)
+{
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 one = _mm256_set1_ps(1.0f);
+    const __m256 two = _mm256_set1_ps(2.0f);
+    const __m256 dt = _mm256_set1_ps(params.dt);
+    const __m256 dtSq = _mm256_set1_ps(params.dt * params.dt);
+    const __m256 minDistSq = _mm256_set1_ps(0.01f);
+    const __m256 maxForceDistSq = _mm256_set1_ps(params.maxForceDistanceSq);
+    const __m256 maxVelocity = _mm256_set1_ps(params.maxVelocity);
+    const __m256 maxVelocitySq = _mm256_set1_ps(params.maxVelocitySq);
+    const __m256 air = _mm256_set1_ps(params.airResistance);
+    const __m256 heatFromDrag = _mm256_set1_ps(params.airResistance * 0.01f);
+    const __m256 dispersion = _mm256_set1_ps(params.thermalDispersion);
+    const __m256 maxTemperature = _mm256_set1_ps(400.0f);
+    const __m256 uniformInvMass = _mm256_div_ps(one, _mm256_set1_ps(params.uniformMass));
+
+    size_t i = start;
+    for (; i + 8 <= end; i += 8)
+    {
+        __m256 posX, posY, prevX, prevY;
+        LoadVec2x8(positions + 2 * i, posX, posY);
+        LoadVec2x8(prevPositions + 2 * i, prevX, prevY);
+
+        __m256 accX = zero;
+        __m256 accY = zero;
+        if (HasAccelerations)
+            LoadVec2x8(accelerations + 2 * i, accX, accY);
+
+        const __m256 invMass = HasMasses ? _mm256_div_ps(one, _mm256_loadu_ps(masses + i)) : uniformInvMass;
+        __m256 temperature = HasTemperatures ? _mm256_loadu_ps(temperatures + i) : zero;
+
+        // Gravity
+        accX = _mm256_add_ps(accX, _mm256_set1_ps(params.gravityX));
+        accY = _mm256_add_ps(accY, _mm256_set1_ps(params.gravityY));
+
+        // Central force, lanes too close to the center are masked out
+        if (params.applySpaceBar)
+        {
+            __m256 toX = _mm256_sub_ps(_mm256_set1_ps(params.centerX), posX);
+            __m256 toY = _mm256_sub_ps(_mm256_set1_ps(params.centerY), posY);
+            __m256 lenSq = _mm256_add_ps(_mm256_mul_ps(toX, toX), _mm256_mul_ps(toY, toY));
+            __m256 mask = _mm256_cmp_ps(lenSq, minDistSq, _CMP_GT_OQ);
+
+            __m256 scale = _mm256_mul_ps(_mm256_div_ps(_mm256_set1_ps(params.spaceBarForce), _mm256_sqrt_ps(lenSq)), invMass);
+            accX = _mm256_add_ps(accX, _mm256_and_ps(mask, _mm256_mul_ps(toX, scale)));
+            accY = _mm256_add_ps(accY, _mm256_and_ps(mask, _mm256_mul_ps(toY, scale)));
+        }
+
+        // Mouse force, only lanes inside the force range
+        if (params.applyMouseForce)
+        {
+            __m256 toX = _mm256_sub_ps(_mm256_set1_ps(params.mouseX), posX);
+            __m256 toY = _mm256_sub_ps(_mm256_set1_ps(params.mouseY), posY);
+            __m256 distSq = _mm256_add_ps(_mm256_mul_ps(toX, toX), _mm256_mul_ps(toY, toY));
+            __m256 mask = _mm256_and_ps(_mm256_cmp_ps(distSq, minDistSq, _CMP_GT_OQ),
+                _mm256_cmp_ps(distSq, maxForceDistSq, _CMP_LT_OQ));
+
+            __m256 dist = _mm256_sqrt_ps(distSq);
+            __m256 magnitude = _mm256_div_ps(_mm256_set1_ps(params.mouseForce * params.mouseForceSign),
+                _mm256_add_ps(one, _mm256_mul_ps(dist, _mm256_set1_ps(0.01f))));
+            __m256 scale = _mm256_mul_ps(_mm256_div_ps(magnitude, dist), invMass);
+            accX = _mm256_add_ps(accX, _mm256_and_ps(mask, _mm256_mul_ps(toX, scale)));
+            accY = _mm256_add_ps(accY, _mm256_and_ps(mask, _mm256_mul_ps(toY, scale)));
+        }
+
+        // Velocity with cap
+        __m256 velX = _mm256_div_ps(_mm256_sub_ps(posX, prevX), dt);
+        __m256 velY = _mm256_div_ps(_mm256_sub_ps(posY, prevY), dt);
+        __m256 velSq = _mm256_add_ps(_mm256_mul_ps(velX, velX), _mm256_mul_ps(velY, velY));
+        __m256 capMask = _mm256_cmp_ps(velSq, maxVelocitySq, _CMP_GT_OQ);
+        __m256 capScale = _mm256_blendv_ps(one, _mm256_div_ps(maxVelocity, _mm256_sqrt_ps(velSq)), capMask);
+        velX = _mm256_mul_ps(velX, capScale);
+        velY = _mm256_mul_ps(velY, capScale);
+        prevX = _mm256_blendv_ps(prevX, _mm256_sub_ps(posX, _mm256_mul_ps(velX, dt)), capMask);
+        prevY = _mm256_blendv_ps(prevY, _mm256_sub_ps(posY, _mm256_mul_ps(velY, dt)), capMask);
+
+        // Air resistance and the heat it generates
+        __m256 drag = _mm256_mul_ps(air, invMass);
+        accX = _mm256_sub_ps(accX, _mm256_mul_ps(velX, drag));
+        accY = _mm256_sub_ps(accY, _mm256_mul_ps(velY, drag));
+        if (HasTemperatures)
+        {
+            __m256 speed = _mm256_sqrt_ps(_mm256_add_ps(_mm256_mul_ps(velX, velX), _mm256_mul_ps(velY, velY)));
+            temperature = _mm256_add_ps(temperature, _mm256_mul_ps(speed, heatFromDrag));
+        }
+
+        // Verlet integration
+        __m256 newX = _mm256_add_ps(_mm256_sub_ps(_mm256_mul_ps(posX, two), prevX), _mm256_mul_ps(accX, dtSq));
+        __m256 newY = _mm256_add_ps(_mm256_sub_ps(_mm256_mul_ps(posY, two), prevY), _mm256_mul_ps(accY, dtSq));
+
+        // The old position becomes the previous one
+        StoreVec2x8(prevPositions + 2 * i, posX, posY);
+        StoreVec2x8(positions + 2 * i, newX, newY);
+
+        if (HasAccelerations)
+        {
+            _mm256_storeu_ps(accelerations + 2 * i, zero);
+            _mm256_storeu_ps(accelerations + 2 * i + 8, zero);
+        }
+
+        // Heat dispersion and temperature bounds
+        if (HasTemperatures)
+        {
+            temperature = _mm256_sub_ps(temperature, dispersion);
+            temperature = _mm256_min_ps(_mm256_max_ps(temperature, zero), maxTemperature);
+            _mm256_storeu_ps(temperatures + i, temperature);
+        }
+    }
+
+    return i;
+}
+
+size_t UpdateParticlesAVX2(size_t start, size_t end, const IntegrationParams& params,
+    float* positions, float* prevPositions, float* accelerations, float* temperatures, const float* masses)
+{
+    return DispatchAttributeFlags(accelerations != nullptr, masses != nullptr, temperatures != nullptr,
+        [&](auto hasAccelerations, auto hasMasses, auto hasTemperatures)
+    {
+        return UpdateParticlesAVX2<decltype(hasAccelerations)::value, decltype(hasMasses)::value, decltype(hasTemperatures)::value>(
+            start, end, params, positions, prevPositions, accelerations, temperatures, masses);
+    });
+}
+
+// Sum of the 4 lanes, always added in the same order so a run gives the same result every time
+static inline float HorizontalSum(__m128 v)
+{
+    __m128 shuffled = _mm_movehl_ps(v, v);
+    __m128 sums = _mm_add_ps(v, shuffled);
+    shuffled = _mm_shuffle_ps(sums, sums, _MM_SHUFFLE(1, 1, 1, 1));
+    return _mm_cvtss_f32(_mm_add_ss(sums, shuffled));
+}
+
+SIMD_TARGET_AVX2 static inline float HorizontalSum(__m256 v)
+{
+    return HorizontalSum(_mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1)));
+}
+
+size_t SumFluidDensitySSE(const FluidNeighborhood& neighborhood, const FluidKernelParams& params, float& sum)
+{
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 x = _mm_set1_ps(neighborhood.x);
+    const __m128 y = _mm_set1_ps(neighborhood.y);
+    const __m128 kernelRadiusSq = _mm_set1_ps(params.kernelRadiusSq);
+
+    __m128 total = zero;
+    size_t k = 0;
+    for (; k + 4 <= neighborhood.count; k += 4)
+    {
+        const __m128 dx = _mm_sub_ps(x, _mm_loadu_ps(neighborhood.neighborX + k));
+        const __m128 dy = _mm_sub_ps(y, _mm_loadu_ps(neighborhood.neighborY + k));
+        const __m128 distSq = _mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy));
+
+        // Zero past the kernel radius
+        const __m128 falloff = _mm_max_ps(_mm_sub_ps(kernelRadiusSq, distSq), zero);
+        total = _mm_add_ps(total, _mm_mul_ps(_mm_mul_ps(falloff, falloff), falloff));
+    }
+
+    sum += HorizontalSum(total);
+    return k;
+}
+
+size_t AccumulateFluidForcesSSE(const FluidNeighborhood& neighborhood, const FluidKernelParams& params, float& accelerationX, float& accelerationY)
+{
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 x = _mm_set1_ps(neighborhood.x);
+    const __m128 y = _mm_set1_ps(neighborhood.y);
+    const __m128 displacementX = _mm_set1_ps(neighborhood.displacementX);
+    const __m128 displacementY = _mm_set1_ps(neighborhood.displacementY);
+    const __m128 pressureTerm = _mm_set1_ps(neighborhood.pressureTerm);
+    const __m128 kernelRadius = _mm_set1_ps(params.kernelRadius);
+    const __m128 kernelRadiusSq = _mm_set1_ps(params.kernelRadiusSq);
+    const __m128 mass = _mm_set1_ps(params.mass);
+    const __m128 pressureFactor = _mm_set1_ps(params.mass * params.spikyGradient);
+    const __m128 viscosityFactor = _mm_set1_ps(params.viscosity * params.viscosityLaplacian * params.invSubStepDt);
+
+    __m128 totalX = zero;
+    __m128 totalY = zero;
+    size_t k = 0;
+    for (; k + 4 <= neighborhood.count; k += 4)
+    {
+        const __m128 dx = _mm_sub_ps(x, _mm_loadu_ps(neighborhood.neighborX + k));
+        const __m128 dy = _mm_sub_ps(y, _mm_loadu_ps(neighborhood.neighborY + k));
+        const __m128 distSq = _mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy));
+        const __m128 isNeighbor = _mm_and_ps(_mm_cmplt_ps(distSq, kernelRadiusSq), _mm_cmpgt_ps(distSq, zero));
+
+        // The particle itself gives inf and nan here, the mask clears them
+        const __m128 dist = _mm_sqrt_ps(distSq);
+        const __m128 falloff = _mm_sub_ps(kernelRadius, dist);
+
+        const __m128 invDensity = _mm_div_ps(one, _mm_loadu_ps(neighborhood.neighborDensities + k));
+        const __m128 neighborPressureTerm = _mm_mul_ps(_mm_loadu_ps(neighborhood.neighborPressures + k), _mm_mul_ps(invDensity, invDensity));
+
+        // Pressure pushes along the direction from the neighbor, viscosity pulls the velocities together
+        const __m128 pressureScale = _mm_div_ps(_mm_mul_ps(_mm_mul_ps(pressureFactor, _mm_add_ps(pressureTerm, neighborPressureTerm)),
+            _mm_mul_ps(falloff, falloff)), dist);
+        const __m128 viscosityScale = _mm_mul_ps(_mm_mul_ps(viscosityFactor, _mm_mul_ps(mass, invDensity)), falloff);
+
+        const __m128 relativeX = _mm_sub_ps(_mm_sub_ps(_mm_loadu_ps(neighborhood.neighborX + k), _mm_loadu_ps(neighborhood.neighborPrevX + k)), displacementX);
+        const __m128 relativeY = _mm_sub_ps(_mm_sub_ps(_mm_loadu_ps(neighborhood.neighborY + k), _mm_loadu_ps(neighborhood.neighborPrevY + k)), displacementY);
+
+        const __m128 forceX = _mm_add_ps(_mm_mul_ps(pressureScale, dx), _mm_mul_ps(viscosityScale, relativeX));
+        const __m128 forceY = _mm_add_ps(_mm_mul_ps(pressureScale, dy), _mm_mul_ps(viscosityScale, relativeY));
+        totalX = _mm_add_ps(totalX, _mm_and_ps(forceX, isNeighbor));
+        totalY = _mm_add_ps(totalY, _mm_and_ps(forceY, isNeighbor));
+    }
+
+    accelerationX += HorizontalSum(totalX);
+    accelerationY += HorizontalSum(totalY);
+    return k;
+}
+
+size_t ComputeFluidPressuresSSE(size_t start, size_t end, const float* densities, float* pressures, float stiffness, float restDensity)
+{
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 stiffnessVec = _mm_set1_ps(stiffness);
+    const __m128 restDensityVec = _mm_set1_ps(restDensity);
+
+    size_t i = start;
+    for (; i + 4 <= end; i += 4)
+    {
+        const __m128 compression = _mm_sub_ps(_mm_loadu_ps(densities + i), restDensityVec);
+        _mm_storeu_ps(pressures + i, _mm_max_ps(_mm_mul_ps(stiffnessVec, compression), zero));
+    }
+    return i;
+}
+
+SIMD_TARGET_AVX2 size_t SumFluidDensityAVX2(const FluidNeighborhood& neighborhood, const FluidKernelParams& params, float& sum)
+{
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 x = _mm256_set1_ps(neighborhood.x);
+    const __m256 y = _mm256_set1_ps(neighborhood.y);
+    const __m256 kernelRadiusSq = _mm256_set1_ps(params.kernelRadiusSq);
+
+    __m256 total = zero;
+    size_t k = 0;
+    for (; k + 8 <= neighborhood.count; k += 8)
+    {
+        const __m256 dx = _mm256_sub_ps(x, _mm256_loadu_ps(neighborhood.neighborX + k));
+        const __m256 dy = _mm256_sub_ps(y, _mm256_loadu_ps(neighborhood.neighborY + k));
+        const __m256 distSq = _mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy));
+
+        const __m256 falloff = _mm256_max_ps(_mm256_sub_ps(kernelRadiusSq, distSq), zero);
+        total = _mm256_add_ps(total, _mm256_mul_ps(_mm256_mul_ps(falloff, falloff), falloff));
+    }
+
+    sum += HorizontalSum(total);
+    return k;
+}
+
+SIMD_TARGET_AVX2 size_t AccumulateFluidForcesAVX2(const FluidNeighborhood& neighborhood, const FluidKernelParams& params,
+    float& accelerationX, float& accelerationY)
+{
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 one = _mm256_set1_ps(1.0f);
+    const __m256 x = _mm256_set1_ps(neighborhood.x);
+    const __m256 y = _mm256_set1_ps(neighborhood.y);
+    const __m256 displacementX = _mm256_set1_ps(neighborhood.displacementX);
+    const __m256 displacementY = _mm256_set1_ps(neighborhood.displacementY);
+    const __m256 pressureTerm = _mm256_set1_ps(neighborhood.pressureTerm);
+    const __m256 kernelRadius = _mm256_set1_ps(params.kernelRadius);
+    const __m256 kernelRadiusSq = _mm256_set1_ps(params.kernelRadiusSq);
+    const __m256 mass = _mm256_set1_ps(params.mass);
+    const __m256 pressureFactor = _mm256_set1_ps(params.mass * params.spikyGradient);
+    const __m256 viscosityFactor = _mm256_set1_ps(params.viscosity * params.viscosityLaplacian * params.invSubStepDt);
+
+    __m256 totalX = zero;
+    __m256 totalY = zero;
+    size_t k = 0;
+    for (; k + 8 <= neighborhood.count; k += 8)
+    {
+        const __m256 dx = _mm256_sub_ps(x, _mm256_loadu_ps(neighborhood.neighborX + k));
+        const __m256 dy = _mm256_sub_ps(y, _mm256_loadu_ps(neighborhood.neighborY + k));
+        const __m256 distSq = _mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy));
+        const __m256 isNeighbor = _mm256_and_ps(_mm256_cmp_ps(distSq, kernelRadiusSq, _CMP_LT_OQ), _mm256_cmp_ps(distSq, zero, _CMP_GT_OQ));
+
+        const __m256 dist = _mm256_sqrt_ps(distSq);
+        const __m256 falloff = _mm256_sub_ps(kernelRadius, dist);
+
+        const __m256 invDensity = _mm256_div_ps(one, _mm256_loadu_ps(neighborhood.neighborDensities + k));
+        const __m256 neighborPressureTerm = _mm256_mul_ps(_mm256_loadu_ps(neighborhood.neighborPressures + k), _mm256_mul_ps(invDensity, invDensity));
+
+        const __m256 pressureScale = _mm256_div_ps(_mm256_mul_ps(_mm256_mul_ps(pressureFactor, _mm256_add_ps(pressureTerm, neighborPressureTerm)),
+            _mm256_mul_ps(falloff, falloff)), dist);
+        const __m256 viscosityScale = _mm256_mul_ps(_mm256_mul_ps(viscosityFactor, _mm256_mul_ps(mass, invDensity)), falloff);
+
+        const __m256 relativeX = _mm256_sub_ps(_mm256_sub_ps(_mm256_loadu_ps(neighborhood.neighborX + k), _mm256_loadu_ps(neighborhood.neighborPrevX + k)), displacementX);
+        const __m256 relativeY = _mm256_sub_ps(_mm256_sub_ps(_mm256_loadu_ps(neighborhood.neighborY + k), _mm256_loadu_ps(neighborhood.neighborPrevY + k)), displacementY);
+
+        const __m256 forceX = _mm256_add_ps(_mm256_mul_ps(pressureScale, dx), _mm256_mul_ps(viscosityScale, relativeX));
+        const __m256 forceY = _mm256_add_ps(_mm256_mul_ps(pressureScale, dy), _mm256_mul_ps(viscosityScale, relativeY));
+        totalX = _mm256_add_ps(totalX, _mm256_and_ps(forceX, isNeighbor));
+        totalY = _mm256_add_ps(totalY, _mm256_and_ps(forceY, isNeighbor));
+    }
+
+    accelerationX += HorizontalSum(totalX);
+    accelerationY += HorizontalSum(totalY);
+    return k;
+}
+
+SIMD_TARGET_AVX2 size_t ComputeFluidPressuresAVX2(size_t start, size_t end, const float* densities, float* pressures, float stiffness, float restDensity)
+{
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 stiffnessVec = _mm256_set1_ps(stiffness);
+    const __m256 restDensityVec = _mm256_set1_ps(restDensity);
+
+    size_t i = start;
+    for (; i + 8 <= end; i += 8)
+    {
+        const __m256 compression = _mm256_sub_ps(_mm256_loadu_ps(densities + i), restDensityVec);
+        _mm256_storeu_ps(pressures + i, _mm256_max_ps(_mm256_mul_ps(stiffnessVec, compression), zero));
+    }
+    return i;
+}
+
+#else
+
+// No vector kernels on this architecture, everything goes through the scalar path
+size_t UpdateParticlesSSE(size_t start, size_t, const IntegrationParams&, float*, float*, float*, float*, const float*)
+{
+    return start;
+}
+
+size_t UpdateParticlesAVX2(size_t start, size_t, const IntegrationParams&, float*, float*, float*, float*, const float*)
+{
+    return start;
+}
+
+size_t SumFluidDensitySSE(const FluidNeighborhood&, const FluidKernelParams&, float&)
+{
+    return 0;
+}
+
+size_t SumFluidDensityAVX2(const FluidNeighborhood&, const FluidKernelParams&, float&)
+{
+    return 0;
+}
+
+size_t AccumulateFluidForcesSSE(const FluidNeighborhood&, const FluidKernelParams&, float&, float&)
+{
+    return 0;
+}
+
+size_t AccumulateFluidForcesAVX2(const FluidNeighborhood&, const FluidKernelParams&, float&, float&)
+{
+    return 0;
+}
+
+size_t ComputeFluidPressuresSSE(size_t start, size_t, const float*, float*, float, float)
+{
+    return start;
+}
+
+size_t ComputeFluidPressuresAVX2(size_t start, size_t, const float*, float*, float, float)
+{
+    return start;
+}
+
+#endif
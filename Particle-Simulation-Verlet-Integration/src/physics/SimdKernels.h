@@ -0,0 +1,111 @@
+#pragma once
+#include <cstddef>
+#include <type_traits>
+
+// Instruction sets the integration kernel can use, ordered from slowest to fastest
+enum class SimdLevel
+{
+    Scalar = 0,
+    SSE = 1,
+    AVX2 = 2
+};
+
+// Everything UpdateParticles needs besides the particle arrays, flattened to plain floats
+// so the kernels don't depend on the global constants
+struct IntegrationParams
+{
+    float dt;
+    float gravityX, gravityY;
+    float centerX, centerY;
+    float mouseX, mouseY;
+
+    bool applySpaceBar;
+    bool applyMouseForce;
+    float mouseForceSign;   // 1 attracts (left click), -1 repels (right click)
+
+    float spaceBarForce;
+    float mouseForce;
+    float maxForceDistanceSq;
+    float maxVelocity;
+    float maxVelocitySq;
+    float airResistance;
+    float thermalDispersion;
+    float uniformMass;      // mass of every particle when there is no mass column
+};
+
+// Call func with a std::true_type or std::false_type tag for each flag. Passes templated on the optional particle
+// columns they use are compiled once per combination and the enabled set is picked at runtime
+template<typename Func>
+inline auto DispatchAttributeFlags(bool hasAccelerations, bool hasMasses, bool hasTemperatures, Func&& func)
+{
+    typedef std::true_type On;
+    typedef std::false_type Off;
+    if (hasAccelerations)
+    {
+        if (hasMasses)
+            return hasTemperatures ? func(On(), On(), On()) : func(On(), On(), Off());
+        return hasTemperatures ? func(On(), Off(), On()) : func(On(), Off(), Off());
+    }
+    if (hasMasses)
+        return hasTemperatures ? func(Off(), On(), On()) : func(Off(), On(), Off());
+    return hasTemperatures ? func(Off(), Off(), On()) : func(Off(), Off(), Off());
+}
+
+// Return the best instruction set supported by the CPU and the OS
+SimdLevel DetectSimdLevel();
+
+// Return a readable name for the ImGui interface
+const char* GetSimdLevelName(SimdLevel level);
+
+// Vectorized versions of UpdateParticles working on the interleaved x/y floats of the Vec2 arrays.
+// They process particles from start in batches of 4 (SSE) or 8 (AVX2) and return the index of the
+// first particle they did not touch, the caller handles the remainder with the scalar path.
+// accelerations, temperatures and masses are null when the column is disabled.
+size_t UpdateParticlesSSE(size_t start, size_t end, const IntegrationParams& params,
+    float* positions, float* prevPositions, float* accelerations, float* temperatures, const float* masses);
+
+size_t UpdateParticlesAVX2(size_t start, size_t end, const IntegrationParams& params,
+    float* positions, float* prevPositions, float* accelerations, float* temperatures, const float* masses);
+
+// One fluid particle and an SoA copy of its candidate neighbors, every particle of the grid cells around it including
+// itself. Candidates further than the kernel radius add nothing, so the kernels run over the whole list without branches
+struct FluidNeighborhood
+{
+    float x, y;
+    float displacementX, displacementY;     // position - previous position
+    float pressureTerm;                     // pressure / density^2
+    const float* neighborX;
+    const float* neighborY;
+    const float* neighborPrevX;
+    const float* neighborPrevY;
+    const float* neighborPressures;
+    const float* neighborDensities;
+    size_t count;
+};
+
+// Kernel radius h and the factors of the 2D SPH kernels
+struct FluidKernelParams
+{
+    float kernelRadius;
+    float kernelRadiusSq;
+    float mass;
+    float poly6;                // density kernel, 4 / (pi h^8) * (h^2 - r^2)^3
+    float spikyGradient;        // gradient of the pressure kernel, 30 / (pi h^5) * (h - r)^2
+    float viscosityLaplacian;   // laplacian of the viscosity kernel, 40 / (pi h^5) * (h - r)
+    float viscosity;            // kinematic
+    float invSubStepDt;         // displacements to velocities
+};
+
+// Vectorized parts of the fluid pass, same conventions as UpdateParticlesSSE/AVX2: they work on batches of 4 or 8
+// and return the index of the first element they did not touch, the caller handles the remainder.
+// SumFluidDensity adds the sum of (h^2 - r^2)^3 over the candidates to sum, the caller applies mass and poly6.
+size_t SumFluidDensitySSE(const FluidNeighborhood& neighborhood, const FluidKernelParams& params, float& sum);
+size_t SumFluidDensityAVX2(const FluidNeighborhood& neighborhood, const FluidKernelParams& params, float& sum);
+
+// Add the pressure and viscosity accelerations from the candidates, the particle itself is skipped
+size_t AccumulateFluidForcesSSE(const FluidNeighborhood& neighborhood, const FluidKernelParams& params, float& accelerationX, float& accelerationY);
+size_t AccumulateFluidForcesAVX2(const FluidNeighborhood& neighborhood, const FluidKernelParams& params, float& accelerationX, float& accelerationY);
+
+// Equation of state over [start, end): pressure = stiffness * (density - restDensity), never negative
+size_t ComputeFluidPressuresSSE(size_t start, size_t end, const float* densities, float* pressures, float stiffness, float restDensity);
+size_t ComputeFluidPressuresAVX2(size_t start, size_t end, const float* densities, float* pressures, float stiffness, float restDensity);
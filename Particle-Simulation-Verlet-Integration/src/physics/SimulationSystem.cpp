@@ -1,62 +1,211 @@
 #include "SimulationSystem.h"
 #include "Solver.h"
+#include "Snapshot.h"
+
+#include <iostream>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+#include <atomic>
 
 unsigned long long int particleIndex = 0;
 
 SimulationSystem::SimulationSystem(unsigned int numberOfParticles, const Vec2& bottomLeft, const Vec2& topRight,
     float particleRadius,
-    const unsigned int substeps)
-    : m_Bounds({ bottomLeft, topRight }), m_ParticleRadius(particleRadius), m_Zoom(1.0f), m_subSteps(substeps),
+    const unsigned int substeps, unsigned int numThreads)
+    : m_Bounds({ bottomLeft, topRight }), m_ParticleRadius(particleRadius), m_RadiusSpread(1.0f), m_subSteps(substeps),
     m_IsSpaceBarPressed(false), m_IsPaused(false), m_IsLeftButtonClicked(false), m_IsRightButtonClicked(false),
-    m_CurrentNumOfParticles(0),
-    m_SpatialGrid(numberOfParticles, particleRadius, bottomLeft, topRight),
-    m_SpatialGridInitialized(false), m_CameraPosition(0.0f, 0.0f)
+    m_CurrentNumOfParticles(0), m_Attributes(DEFAULT_ATTRIBUTES), m_UniformMass(1.0f),
+    m_NextParticleId(0), m_ReorderInterval(30), m_UpdatesSinceReorder(0),
+    m_SpawnCellSize(0.0f), m_SpawnColumns(0), m_SpawnRows(0), m_GridDrift(-1.0f),
+    m_UseStableRemoval(true), m_RemovedCount(0),
+    m_SpatialGrid(numberOfParticles, m_Radii, particleRadius, bottomLeft, topRight),
+    m_SpatialGridInitialized(false), m_UseHashedGrid(false),
+    m_ThreadPool(numThreads), m_UseFusedCollisions(true), m_UseFusedIntegration(true),
+    m_MaxSimdLevel(DetectSimdLevel()), m_UseAdaptiveSubSteps(false), m_MinSubSteps(1), m_MaxSubSteps(10),
+    m_TargetDisplacement(0.25f), m_TargetOverlap(0.15f), m_UseSleeping(false), m_SleepThreshold(0.02f),
+    m_WakeThreshold(0.05f), m_SleepSubSteps(60), m_SleepingCount(0), m_UseNeighborLists(false),
+    m_NeighborSkin(0.3f), m_NeighborListValid(false), m_UseFluid(false), m_Seed(std::random_device()()), m_IsDeterministic(false),
+    m_StepIndex(0), m_StateHash(0)
 {
+    m_RandomGenerator.seed(m_Seed);
+
     m_SimHeight = std::abs(topRight.y - bottomLeft.y);
     m_SimWidth = std::abs(topRight.x - bottomLeft.x);
+    m_SimdLevel = m_MaxSimdLevel;
 
-    m_Positions.reserve(numberOfParticles);
-    m_PrevPositions.reserve(numberOfParticles);
-    m_Accelerations.reserve(numberOfParticles);
-    m_Masses.reserve(numberOfParticles);
-    m_Temperatures.reserve(numberOfParticles);
-    m_Densities.reserve(numberOfParticles);
-    m_Pressures.reserve(numberOfParticles);
+    ReserveColumns(numberOfParticles);
 }
 
 SimulationSystem::~SimulationSystem() {};
 
-void SimulationSystem::AddParticle(const Vec2& position, const Vec2& velocity, const Vec2& acceleration, float mass)
+void SimulationSystem::ReserveColumns(size_t count)
+{
+    m_Positions.reserve(count);
+    m_PrevPositions.reserve(count);
+    m_Radii.reserve(count);
+    m_SleepCounters.reserve(count);
+    m_SleepAnchors.reserve(count);
+    m_ParticleIds.reserve(count);
+    m_IdToIndex.reserve(count);
+
+    if (HasAttribute(ATTRIBUTE_ACCELERATIONS))
+        m_Accelerations.reserve(count);
+    if (HasAttribute(ATTRIBUTE_MASSES))
+        m_Masses.reserve(count);
+    if (HasAttribute(ATTRIBUTE_TEMPERATURES))
+        m_Temperatures.reserve(count);
+    if (HasAttribute(ATTRIBUTE_DENSITIES))
+        m_Densities.reserve(count);
+    if (HasAttribute(ATTRIBUTE_PRESSURES))
+        m_Pressures.reserve(count);
+}
+
+void SimulationSystem::SetAttributes(uint32_t attributes)
 {
-    m_Positions.push_back(position);
-    m_PrevPositions.push_back(position - velocity); // Calculate prev position from velocity
-    m_Accelerations.push_back(acceleration);
-    m_Masses.push_back(mass);
-    m_Temperatures.push_back(0.0f);  // Default temperature from Particle constructor
-    m_Densities.push_back(0.0f);     // Default density
-    m_Pressures.push_back(0.0f);     // Default pressure
+    const size_t particleCount = m_Positions.size();
+    if (m_UseFluid)
+        attributes |= FLUID_ATTRIBUTES;
+
+    // Freed columns go back to the system, resize fills the enabled ones with their default
+    auto updateColumn = [&](auto& column, uint32_t attribute, auto defaultValue)
+    {
+        if (attributes & attribute)
+            column.resize(particleCount, defaultValue);
+        else
+            column = typename std::decay<decltype(column)>::type();
+    };
+
+    updateColumn(m_Accelerations, ATTRIBUTE_ACCELERATIONS, Vec2(0.0f, 0.0f));
+    updateColumn(m_Masses, ATTRIBUTE_MASSES, m_UniformMass);
+    updateColumn(m_Temperatures, ATTRIBUTE_TEMPERATURES, 0.0f);
+    updateColumn(m_Densities, ATTRIBUTE_DENSITIES, 0.0f);
+    updateColumn(m_Pressures, ATTRIBUTE_PRESSURES, 0.0f);
+
+    m_Attributes = attributes;
+}
+
+size_t SimulationSystem::AppendParticles(size_t count)
+{
+    const size_t first = m_Positions.size();
+    const size_t newSize = first + count;
+
+    m_Positions.resize(newSize);
+    m_PrevPositions.resize(newSize);
+    m_Radii.resize(newSize);
+    m_SleepCounters.resize(newSize, 0);    // Awake
+    m_SleepAnchors.resize(newSize);
+
+    if (HasAttribute(ATTRIBUTE_ACCELERATIONS))
+        m_Accelerations.resize(newSize);
+    if (HasAttribute(ATTRIBUTE_MASSES))
+        m_Masses.resize(newSize);
+    if (HasAttribute(ATTRIBUTE_TEMPERATURES))
+        m_Temperatures.resize(newSize, 0.0f);  // Default temperature from Particle constructor
+    if (HasAttribute(ATTRIBUTE_DENSITIES))
+        m_Densities.resize(newSize, 0.0f);     // Default density
+    if (HasAttribute(ATTRIBUTE_PRESSURES))
+        m_Pressures.resize(newSize, 0.0f);     // Default pressure
+
+    // New particles get the next ids
+    unsigned int* ids = m_ParticleIds.Append(count);
+    unsigned int* indices = m_IdToIndex.Append(count);
+    for (size_t k = 0; k < count; k++)
+    {
+        ids[k] = m_NextParticleId++;
+        indices[k] = static_cast<unsigned int>(first + k);
+        m_LiveIds.push_back(ids[k]);
+    }
+
+    return first;
+}
+
+void SimulationSystem::InitParticle(size_t index, const Vec2& position, const Vec2& velocity, const Vec2& acceleration, float mass, float radius)
+{
+    m_Positions[index] = position;
+    m_PrevPositions[index] = position - velocity; // Calculate prev position from velocity
+    m_Radii[index] = radius;
+    m_SleepAnchors[index] = position;
+
+    // Dropped when the column is disabled, every particle then has the uniform mass
+    if (HasAttribute(ATTRIBUTE_ACCELERATIONS))
+        m_Accelerations[index] = acceleration;
+    if (HasAttribute(ATTRIBUTE_MASSES))
+        m_Masses[index] = mass;
+
+    // The grid levels are sized for the radius range
+    if (radius < m_SpatialGrid.GetMinRadius() || radius > m_SpatialGrid.GetMaxRadius())
+        m_SpatialGridInitialized = false;
+}
+
+void SimulationSystem::AddParticle(const Vec2& position, const Vec2& velocity, const Vec2& acceleration, float mass, float radius)
+{
+    InitParticle(AppendParticles(1), position, velocity, acceleration, mass, radius);
+}
+
+void SimulationSystem::AddParticles(size_t count, const Vec2* positions, const Vec2* velocities, const Vec2& acceleration, float mass, float radius)
+{
+    const size_t first = AppendParticles(count);
+    for (size_t k = 0; k < count; k++)
+        InitParticle(first + k, positions[k], velocities[k], acceleration, mass, radius);
+}
+
+float SimulationSystem::DrawSpreadRadius()
+{
+    // Nothing is drawn without a spread, the random sequence of the positions stays the same
+    if (m_RadiusSpread <= 1.0f)
+        return m_ParticleRadius;
+
+    // Uniform in log scale, as many small as large particles
+    std::uniform_real_distribution<float> spreadDist(0.0f, std::log(m_RadiusSpread));
+    return m_ParticleRadius * std::exp(spreadDist(m_RandomGenerator));
+}
+
+void SimulationSystem::AddSpreadParticle(const Vec2& position, const Vec2& velocity, const Vec2& acceleration, float mass)
+{
+    const float radius = DrawSpreadRadius();
+    const float scale = radius / m_ParticleRadius;
+    AddParticle(position, velocity, acceleration, mass * scale * scale, radius);
 }
 
 void SimulationSystem::Update(float deltaTime)
 {
-    UpdateStreams(deltaTime);
-    SolvePhysics(*this, deltaTime, GetIsSpaceBarPressed(), GetIsMouseLeftClicked(), GetIsMouseRightClicked());
+    {
+        PROFILE_SCOPE(m_Profiler, ProfilePhase::Step);
+
+        UpdateEmitters(deltaTime);
+        ApplySinks();
+
+        // Keep neighbors close in memory as particles mix
+        if (m_ReorderInterval > 0 && ++m_UpdatesSinceReorder >= m_ReorderInterval)
+        {
+            PROFILE_SCOPE(m_Profiler, ProfilePhase::Reorder);
+            ReorderParticles();
+            m_UpdatesSinceReorder = 0;
+        }
+
+        SolvePhysics(*this, deltaTime, GetIsSpaceBarPressed(), GetIsMouseLeftClicked(), GetIsMouseRightClicked());
+
+        if (m_IsDeterministic)
+        {
+            PROFILE_SCOPE(m_Profiler, ProfilePhase::StateHash);
+            m_StateHash = ComputeStateHash();
+        }
+        m_StepIndex++;
+    }
+
+    PROFILE_END_FRAME(m_Profiler);
 }
 
-glm::mat4 SimulationSystem::GetProjMatrix() const
+glm::mat4 SimulationSystem::GetProjMatrix(const Bounds& bounds, float zoom, float windowAspect)
 {
     // Calculate the simulation boundaries
-    const float simWidth = m_Bounds.topRight.x - m_Bounds.bottomLeft.x;
-    const float simHeight = m_Bounds.topRight.y - m_Bounds.bottomLeft.y;
-
-    // Calculate window aspect ratio
-    int width, height;
-    glfwGetFramebufferSize(glfwGetCurrentContext(), &width, &height);
-    float windowAspect = (float)width / (float)height;
+    const float simWidth = bounds.topRight.x - bounds.bottomLeft.x;
+    const float simHeight = bounds.topRight.y - bounds.bottomLeft.y;
 
     // Calculate the orthographic projection that preserves aspect ratio
-    float baseWidth = simWidth / m_Zoom;
-    float baseHeight = simHeight / m_Zoom;
+    float baseWidth = simWidth / zoom;
+    float baseHeight = simHeight / zoom;
 
     // Adjust to match window aspect ratio
     if (windowAspect > 1.0f) 
@@ -77,11 +226,11 @@ glm::mat4 SimulationSystem::GetProjMatrix() const
     );
 }
 
-glm::mat4 SimulationSystem::GetViewMatrix() const
+glm::mat4 SimulationSystem::GetViewMatrix(const Bounds& bounds, const Vec2& cameraPosition)
 {
     Vec2 simulationCenter = {
-        (m_Bounds.topRight.x + m_Bounds.bottomLeft.x) * 0.5f,
-        (m_Bounds.topRight.y + m_Bounds.bottomLeft.y) * 0.5f
+        (bounds.topRight.x + bounds.bottomLeft.x) * 0.5f,
+        (bounds.topRight.y + bounds.bottomLeft.y) * 0.5f
     };
 
     // Create view transformation matrix
@@ -89,8 +238,8 @@ glm::mat4 SimulationSystem::GetViewMatrix() const
 
     // Center the view on the simulation area and apply camera offset
     view = glm::translate(view, glm::vec3(
-        -simulationCenter.x - m_CameraPosition.x,  // Center X with camera offset
-        -simulationCenter.y - m_CameraPosition.y,  // Center Y with camera offset
+        -simulationCenter.x - cameraPosition.x,    // Center X with camera offset
+        -simulationCenter.y - cameraPosition.y,    // Center Y with camera offset
         0.0f                                       // Z remains unchanged
     ));
 
@@ -100,54 +249,53 @@ glm::mat4 SimulationSystem::GetViewMatrix() const
 void SimulationSystem::AddParticleStream(int totalParticles, float spawnRate, const Vec2& initialVelocity,
     float mass, const Vec2& initialOffset)
 {
-    ParticleStream newStream;
-    newStream.isActive = true;
-    newStream.startPos =
+    // A stream is an emitter with a single site and no jitter
+    EmitterSettings settings;
+    settings.shape = EmitterShape::Line;
+    settings.start =
     {
         m_Bounds.bottomLeft.x + m_ParticleRadius + initialOffset.x,
         m_Bounds.topRight.y - m_ParticleRadius - initialOffset.y
     };
-    newStream.initialVelocity = initialVelocity;
-    newStream.acceleration = GRAVITY; // Default to gravity
-    newStream.total = totalParticles;
-    newStream.spawnInterval = 1.0f / spawnRate;
-    newStream.timer = 0.0f;
-    newStream.spawned = 0;
-    newStream.mass = mass;
+    settings.end = settings.start;
+    settings.velocity = initialVelocity;
+    settings.acceleration = GRAVITY; // Default to gravity
+    settings.mass = mass;
+    settings.jitter = 0.0f;
+    settings.total = totalParticles;
+    settings.rateCurve.push_back({ 0.0f, spawnRate });
 
-    m_Streams.push_back(newStream);
+    AddEmitter(settings);
 }
 
-void SimulationSystem::AddBulkParticles(unsigned int count, const Vec2& initialVelocity, const Vec2& acceleration, float mass)
+size_t SimulationSystem::AddEmitter(const EmitterSettings& settings)
 {
-    // Reserve space for new particles
-    size_t currentSize = m_Positions.size();
-    if (m_Positions.size() + count > m_Positions.capacity()) {
-        m_Positions.reserve(currentSize + count);
-        m_PrevPositions.reserve(currentSize + count);
-        m_Accelerations.reserve(currentSize + count);
-        m_Masses.reserve(currentSize + count);
-        m_Temperatures.reserve(currentSize + count);
-        m_Densities.reserve(currentSize + count);
-        m_Pressures.reserve(currentSize + count);
-    }
+    m_Emitters.push_back(ParticleEmitter(settings));
+    return m_Emitters.size() - 1;
+}
 
-    // Define the safe spawn area 
-    float minX = m_Bounds.bottomLeft.x + m_ParticleRadius * 1.5f;
-    float maxX = m_Bounds.topRight.x - m_ParticleRadius * 1.5f;
-    float minY = m_Bounds.bottomLeft.y + m_ParticleRadius * 1.5f;
-    float maxY = m_Bounds.topRight.y - m_ParticleRadius * 1.5f;
+void SimulationSystem::AddBulkParticles(unsigned int count, const Vec2& initialVelocity, const Vec2& acceleration, float mass)
+{
+    // Define the safe spawn area, far enough from the walls for the largest radius
+    const float maxRadius = m_ParticleRadius * m_RadiusSpread;
+    float minX = m_Bounds.bottomLeft.x + maxRadius * 1.5f;
+    float maxX = m_Bounds.topRight.x - maxRadius * 1.5f;
+    float minY = m_Bounds.bottomLeft.y + maxRadius * 1.5f;
+    float maxY = m_Bounds.topRight.y - maxRadius * 1.5f;
 
     // Random stuff
-    std::random_device rd;
-    std::mt19937 gen(rd());
     std::uniform_real_distribution<float> xDist(minX, maxX);
     std::uniform_real_distribution<float> yDist(minY, maxY);
 
-    // Adding stuff
+    // Adding stuff, all the columns grow once
+    const size_t first = AppendParticles(count);
     for (unsigned int i = 0; i < count; i++) {
-        Vec2 position(xDist(gen), yDist(gen));
-        AddParticle(position, initialVelocity, acceleration, mass);
+        // Separate statements so x, y and the radius are always drawn in this order
+        const float x = xDist(m_RandomGenerator);
+        const float y = yDist(m_RandomGenerator);
+        const float radius = DrawSpreadRadius();
+        const float scale = radius / m_ParticleRadius;
+        InitParticle(first + i, Vec2(x, y), initialVelocity, acceleration, mass * scale * scale, radius);
         m_CurrentNumOfParticles++;
     }
 
@@ -155,60 +303,501 @@ void SimulationSystem::AddBulkParticles(unsigned int count, const Vec2& initialV
     m_SpatialGridInitialized = false;
 }
 
-void SimulationSystem::UpdateStreams(float deltaTime)
+void SimulationSystem::GatherSpawnNeighbors(const Vec2& siteMin, const Vec2& siteMax, float maxRadius)
 {
-    for (auto& stream : m_Streams) {
-        if (!stream.isActive || stream.spawned >= stream.total) continue;
+    // Every particle within its radius plus the new ones of a site
+    if (m_SpawnThreadNeighbors.size() != m_ThreadPool.GetNumThreads())
+        m_SpawnThreadNeighbors.resize(m_ThreadPool.GetNumThreads());
+    for (std::vector<unsigned int>& neighbors : m_SpawnThreadNeighbors)
+        neighbors.clear();
+
+    auto isNearSites = [&](size_t i)
+    {
+        const Vec2& position = m_Positions[i];
+        const float reach = m_Radii[i] + maxRadius;
+        return position.x > siteMin.x - reach && position.x < siteMax.x + reach &&
+            position.y > siteMin.y - reach && position.y < siteMax.y + reach;
+    };
+
+    // The grid holds the particles of its build, those appended since by another emitter follow them. A grid the particles
+    // moved far from would visit more cells than the scan costs
+    const size_t binnedCount = m_SpatialGrid.GetBinnedCount();
+    if (m_SpatialGridInitialized && m_GridDrift >= 0.0f && m_GridDrift < m_SpatialGrid.GetCellSize(0) && binnedCount <= m_Positions.size())
+    {
+        std::vector<unsigned int>& neighbors = m_SpawnThreadNeighbors[0];
+        m_SpatialGrid.ForEachCellInBox(siteMin, siteMax, maxRadius + m_GridDrift, [&](const unsigned int* particles, unsigned int count)
+        {
+            for (unsigned int k = 0; k < count; k++)
+            {
+                if (isNearSites(particles[k]))
+                    neighbors.push_back(particles[k]);
+            }
+        });
+        for (size_t i = binnedCount; i < m_Positions.size(); i++)
+        {
+            if (isNearSites(i))
+                neighbors.push_back(static_cast<unsigned int>(i));
+        }
+    }
+    else
+    {
+        m_ThreadPool.ParallelFor(0, m_Positions.size(), [&](size_t start, size_t end, unsigned int threadIndex)
+        {
+            std::vector<unsigned int>& neighbors = m_SpawnThreadNeighbors[threadIndex];
+            for (size_t i = start; i < end; i++)
+            {
+                if (isNearSites(i))
+                    neighbors.push_back(static_cast<unsigned int>(i));
+            }
+        }, 4096);
+    }
+
+    // Cells a largest diameter wide, a new particle only has to check the 3x3 cells around it for the smaller particles
+    m_SpawnCellSize = 2.0f * maxRadius;
+    m_SpawnOrigin = siteMin - Vec2(m_SpawnCellSize, m_SpawnCellSize);
+    m_SpawnColumns = static_cast<int>((siteMax.x - siteMin.x) / m_SpawnCellSize) + 3;
+    m_SpawnRows = static_cast<int>((siteMax.y - siteMin.y) / m_SpawnCellSize) + 3;
+    m_SpawnCellStart.assign(static_cast<size_t>(m_SpawnColumns) * m_SpawnRows + 1, 0);
+    m_SpawnLargeParticles.clear();
+
+    auto cellOf = [&](const Vec2& position)
+    {
+        const int column = std::min(std::max(static_cast<int>((position.x - m_SpawnOrigin.x) / m_SpawnCellSize), 0), m_SpawnColumns - 1);
+        const int row = std::min(std::max(static_cast<int>((position.y - m_SpawnOrigin.y) / m_SpawnCellSize), 0), m_SpawnRows - 1);
+        return static_cast<size_t>(row) * m_SpawnColumns + column;
+    };
 
-        stream.timer += deltaTime;
+    // Counting sort of the neighbors by cell
+    for (const std::vector<unsigned int>& neighbors : m_SpawnThreadNeighbors)
+    {
+        for (unsigned int i : neighbors)
+        {
+            if (m_Radii[i] > maxRadius)
+                m_SpawnLargeParticles.push_back(i);
+            else
+                m_SpawnCellStart[cellOf(m_Positions[i]) + 1]++;
+        }
+    }
+    for (size_t c = 1; c < m_SpawnCellStart.size(); c++)
+        m_SpawnCellStart[c] += m_SpawnCellStart[c - 1];
 
-        while (stream.timer >= stream.spawnInterval && stream.spawned < stream.total) 
+    m_SpawnCellEntries.resize(m_SpawnCellStart.back());
+    for (const std::vector<unsigned int>& neighbors : m_SpawnThreadNeighbors)
+    {
+        for (unsigned int i : neighbors)
         {
-            AddParticle(stream.startPos, stream.initialVelocity, stream.acceleration, stream.mass);
-            m_CurrentNumOfParticles++;
-            stream.spawned++;
-            stream.timer -= stream.spawnInterval;
+            if (m_Radii[i] <= maxRadius)
+                m_SpawnCellEntries[m_SpawnCellStart[cellOf(m_Positions[i])]++] = i;
         }
     }
+
+    // The inserts moved every start to the end of its cell
+    for (size_t c = m_SpawnCellStart.size() - 1; c > 0; c--)
+        m_SpawnCellStart[c] = m_SpawnCellStart[c - 1];
+    m_SpawnCellStart[0] = 0;
 }
 
-void SimulationSystem::UpdateSpatialGrid() 
+bool SimulationSystem::IsSpawnSiteFree(const Vec2& position, float radius) const
 {
-    const size_t particleCount = m_Positions.size();
+    auto overlaps = [&](unsigned int i)
+    {
+        const float contactDistance = radius + m_Radii[i];
+        return (m_Positions[i] - position).length_sq() < contactDistance * contactDistance;
+    };
+
+    const int column = static_cast<int>(std::floor((position.x - m_SpawnOrigin.x) / m_SpawnCellSize));
+    const int row = static_cast<int>(std::floor((position.y - m_SpawnOrigin.y) / m_SpawnCellSize));
+    for (int y = std::max(row - 1, 0); y <= std::min(row + 1, m_SpawnRows - 1); y++)
+    {
+        for (int x = std::max(column - 1, 0); x <= std::min(column + 1, m_SpawnColumns - 1); x++)
+        {
+            const size_t cell = static_cast<size_t>(y) * m_SpawnColumns + x;
+            for (unsigned int k = m_SpawnCellStart[cell]; k < m_SpawnCellStart[cell + 1]; k++)
+            {
+                if (overlaps(m_SpawnCellEntries[k]))
+                    return false;
+            }
+        }
+    }
+
+    for (unsigned int i : m_SpawnLargeParticles)
+    {
+        if (overlaps(i))
+            return false;
+    }
+    return true;
+}
+
+void SimulationSystem::UpdateEmitters(float deltaTime)
+{
+    const float maxRadius = m_ParticleRadius * std::max(m_RadiusSpread, 1.0f);
+
+    for (ParticleEmitter& emitter : m_Emitters)
+    {
+        const int due = emitter.Advance(deltaTime, maxRadius);
+        if (due <= 0)
+            continue;
+
+        // The sites are far enough apart for the new particles not to overlap each other, only the particles
+        // already there have to be checked
+        const std::vector<Vec2>& sites = emitter.GetSites();
+        const float jitter = emitter.GetSettings().jitter * maxRadius;
+        Vec2 siteMin = sites.front();
+        Vec2 siteMax = sites.front();
+        for (const Vec2& site : sites)
+        {
+            siteMin = Vec2(std::min(siteMin.x, site.x), std::min(siteMin.y, site.y));
+            siteMax = Vec2(std::max(siteMax.x, site.x), std::max(siteMax.y, site.y));
+        }
+        GatherSpawnNeighbors(siteMin - Vec2(jitter, jitter), siteMax + Vec2(jitter, jitter), maxRadius);
+
+        // Each site is tried at most once, a blocked one is left for a later update
+        m_SpawnPositions.clear();
+        m_SpawnRadii.clear();
+        size_t tried = 0;
+        while (tried < sites.size() && m_SpawnPositions.size() < static_cast<size_t>(due))
+        {
+            const float radius = DrawSpreadRadius();
+            const Vec2 position = emitter.GetCandidate(tried++, m_RandomGenerator);
+            if (IsSpawnSiteFree(position, radius))
+            {
+                m_SpawnPositions.push_back(position);
+                m_SpawnRadii.push_back(radius);
+            }
+        }
 
-    // If the grid hasn't been initialized or particle count has changed a lot
+        // Everything spawned this update is appended at once
+        const EmitterSettings& settings = emitter.GetSettings();
+        const size_t count = m_SpawnPositions.size();
+        if (count > 0)
+        {
+            const size_t first = AppendParticles(count);
+            for (size_t k = 0; k < count; k++)
+            {
+                const float scale = m_SpawnRadii[k] / m_ParticleRadius;
+                InitParticle(first + k, m_SpawnPositions[k], settings.velocity, settings.acceleration, settings.mass * scale * scale, m_SpawnRadii[k]);
+            }
+            m_CurrentNumOfParticles += static_cast<unsigned int>(count);
+        }
+        emitter.OnSpawned(static_cast<int>(count), tried);
+    }
+}
+
+void SimulationSystem::UpdateSpatialGrid() 
+{
+    // The grid only has to be recreated when its dimensions, the radius range or the cell storage changed
     if (!m_SpatialGridInitialized) 
     {
-        // Initialize the grid with current particle positions
-        m_SpatialGrid = SpatialGrid(particleCount, m_ParticleRadius, m_Bounds.bottomLeft, m_Bounds.topRight);
-        m_SpatialGrid.InitCells(m_Positions);
+        m_SpatialGrid = SpatialGrid(static_cast<unsigned int>(m_Positions.size()), m_Radii, m_ParticleRadius, m_Bounds.bottomLeft, m_Bounds.topRight,
+            m_UseHashedGrid);
         m_SpatialGridInitialized = true;
     }
-    else {
-        // Check if we need to reinitialize the grid due to significant particle count change
-        if (std::abs(static_cast<int>(m_SpatialGrid.GetParticleCount()) - static_cast<int>(particleCount)) >
-            static_cast<int>(m_SpatialGrid.GetParticleCount()) / 10) 
+
+    // Cells are rebuilt from scratch every time, the counting sort is cheaper than tracking moved particles.
+    // The pairs listed from the previous cells don't match the new ones
+    PROFILE_SCOPE(m_Profiler, ProfilePhase::GridBuild);
+    m_SpatialGrid.BuildCells(m_Positions, m_Radii, m_ThreadPool);
+    m_NeighborListValid = false;
+
+    // The emitters query this grid until the next build, the drift from here is measured by the velocity cap pass
+    if (!m_Emitters.empty())
+        m_GridAnchors.assign(m_Positions.begin(), m_Positions.end());
+    else
+        m_GridAnchors.clear();
+    m_GridDrift = -1.0f;
+}
+
+void SimulationSystem::SetUseNeighborLists(bool v)
+{
+    m_UseNeighborLists = v;
+    m_NeighborListValid = false;
+    m_NeighborListStats = NeighborListStats();
+}
+
+void SimulationSystem::SetNeighborSkin(float radii)
+{
+    m_NeighborSkin = std::max(radii, 0.0f);
+    m_NeighborListValid = false;
+    m_NeighborListStats = NeighborListStats();
+}
+
+bool SimulationSystem::UpdateNeighborList()
+{
+    m_NeighborListStats.subSteps++;
+
+    // A list stays valid while no particle got closer to another by more than the skin, each may have moved half of it
+    bool needsBuild = !m_NeighborListValid || !m_SpatialGridInitialized || m_NeighborAnchors.size() != m_Positions.size();
+    if (!needsBuild)
+    {
+        PROFILE_SCOPE(m_Profiler, ProfilePhase::NeighborList);
+        const float halfSkin = m_NeighborListStats.skin * m_ParticleRadius * 0.5f;
+        const float halfSkinSq = halfSkin * halfSkin;
+
+        std::atomic<bool> hasMovedFar(false);
+        m_ThreadPool.ParallelFor(0, m_Positions.size(), [&](size_t start, size_t end, unsigned int)
         {
+            if (hasMovedFar.load(std::memory_order_relaxed))
+                return;
 
-            // Reinitialize the grid
-            m_SpatialGrid = SpatialGrid(particleCount, m_ParticleRadius, m_Bounds.bottomLeft, m_Bounds.topRight);
-            m_SpatialGrid.InitCells(m_Positions);
-        }
-        else 
+            bool localMovedFar = false;
+            for (size_t i = start; i < end; i++)
+                localMovedFar |= (m_Positions[i] - m_NeighborAnchors[i]).length_sq() > halfSkinSq;
+
+            if (localMovedFar)
+                hasMovedFar.store(true, std::memory_order_relaxed);
+        });
+        needsBuild = hasMovedFar.load();
+    }
+
+    if (!needsBuild)
+        return false;
+
+    UpdateSpatialGrid();
+
+    const float skin = std::min(m_NeighborSkin * m_ParticleRadius, m_SpatialGrid.GetMaxPairSkin());
+    {
+        PROFILE_SCOPE(m_Profiler, ProfilePhase::PairGeneration);
+        m_SpatialGrid.GenerateCollisionPairs(m_Positions, m_Radii, nullptr, skin);
+    }
+
+    m_NeighborAnchors.assign(m_Positions.begin(), m_Positions.end());
+    m_NeighborListValid = true;
+    m_NeighborListStats.builds++;
+    m_NeighborListStats.pairCount = m_SpatialGrid.GetCollisionPairs().size();
+    m_NeighborListStats.skin = skin / m_ParticleRadius;
+    return true;
+}
+
+// Gather column[order[k]] into slot k, the column ends up with count elements. The gather goes through the scratch bytes
+// and is copied back, the column keeps its address
+template<typename T>
+static void PermuteColumn(ParticleColumn<T>& column, const unsigned int* order, size_t count, ParticleColumn<uint8_t>& scratchBytes,
+    ThreadPool& threadPool)
+{
+    scratchBytes.resize(count * sizeof(T));
+    T* scratch = reinterpret_cast<T*>(scratchBytes.data());
+
+    threadPool.ParallelFor(0, count, [&](size_t start, size_t end, unsigned int)
+    {
+        for (size_t k = start; k < end; k++)
+            scratch[k] = column[order[k]];
+    });
+
+    column.resize(count);
+    threadPool.ParallelFor(0, count, [&](size_t start, size_t end, unsigned int)
+    {
+        std::memcpy(column.data() + start, scratch + start, (end - start) * sizeof(T));
+    });
+}
+
+// Copy column[sources[k]] into slot holes[k] and cut the column to count elements. The holes are all below count and
+// the sources all past it, so the moves never overlap
+template<typename T>
+static void FillColumnHoles(ParticleColumn<T>& column, const unsigned int* holes, const unsigned int* sources, size_t moveCount,
+    size_t count, ThreadPool& threadPool)
+{
+    threadPool.ParallelFor(0, moveCount, [&](size_t start, size_t end, unsigned int)
+    {
+        for (size_t k = start; k < end; k++)
+            column[holes[k]] = column[sources[k]];
+    });
+    column.resize(count);
+}
+
+void SimulationSystem::ReorderParticles()
+{
+    if (m_Positions.empty())
+        return;
+
+    // The sorted particle array of a freshly built grid is the cell order permutation
+    UpdateSpatialGrid();
+    const std::vector<unsigned int>& order = m_SpatialGrid.GetSortedParticles();
+
+    ForEachColumn([&](auto& column) { PermuteColumn(column, order.data(), order.size(), m_ReorderScratch, m_ThreadPool); });
+
+    // Remap ids to their new index
+    m_ThreadPool.ParallelFor(0, m_ParticleIds.size(), [&](size_t start, size_t end, unsigned int)
+    {
+        for (size_t k = start; k < end; k++)
+            m_IdToIndex[m_ParticleIds[k]] = static_cast<unsigned int>(k);
+    });
+
+    // Grid cells store old indices, rebuild them
+    UpdateSpatialGrid();
+}
+
+size_t SimulationSystem::RemoveParticles(const std::vector<uint8_t>& mask)
+{
+    const size_t particleCount = m_Positions.size();
+    const unsigned int REMOVED = SpatialGrid::REMOVED_PARTICLE;
+
+    // Survivors before every particle. A stable removal moves every survivor down to its rank, a swap removal keeps the
+    // survivors in place and fills the holes left below the new count with the survivors above it, in order
+    const size_t remainingCount = m_ThreadPool.ExclusiveScan(particleCount, [&](size_t i) { return mask[i] == 0; }, m_RemovalOffsets);
+    const size_t removedCount = particleCount - remainingCount;
+    if (removedCount == 0)
+        return 0;
+
+    // Retire the ids that go away while the removed particles are still there
+    m_ThreadPool.ParallelFor(0, particleCount, [&](size_t start, size_t end, unsigned int)
+    {
+        for (size_t i = start; i < end; i++)
         {
-            // Just update the existing grid
-            m_SpatialGrid.UpdateCells(m_Positions);
+            if (mask[i])
+                m_IdToIndex[m_ParticleIds[i]] = REMOVED_PARTICLE_INDEX;
         }
+    });
+
+    m_RemovalIndices.resize(particleCount);
+    const unsigned int* movedParticles = nullptr;
+    size_t movedCount = 0;
+    if (m_UseStableRemoval)
+    {
+        m_RemovalMoves.resize(remainingCount);
+        m_ThreadPool.ParallelFor(0, particleCount, [&](size_t start, size_t end, unsigned int)
+        {
+            for (size_t i = start; i < end; i++)
+            {
+                m_RemovalIndices[i] = mask[i] ? REMOVED : m_RemovalOffsets[i];
+                if (!mask[i])
+                    m_RemovalMoves[m_RemovalOffsets[i]] = static_cast<unsigned int>(i);
+            }
+        });
+
+        ForEachColumn([&](auto& column) { PermuteColumn(column, m_RemovalMoves.data(), remainingCount, m_ReorderScratch, m_ThreadPool); });
     }
+    else
+    {
+        // The k-th hole is the k-th removed particle below the new count, the k-th survivor above it fills it
+        const unsigned int keptBelow = m_RemovalOffsets[remainingCount];
+        const size_t moveCount = remainingCount - keptBelow;
+        m_RemovalMoves.resize(moveCount * 2);
+        unsigned int* holes = m_RemovalMoves.data();
+        unsigned int* sources = m_RemovalMoves.data() + moveCount;
+
+        m_ThreadPool.ParallelFor(0, particleCount, [&](size_t start, size_t end, unsigned int)
+        {
+            for (size_t i = start; i < end; i++)
+            {
+                const unsigned int index = static_cast<unsigned int>(i);
+                if (i < remainingCount)
+                {
+                    m_RemovalIndices[i] = mask[i] ? REMOVED : index;
+                    if (mask[i])
+                        holes[i - m_RemovalOffsets[i]] = index;
+                }
+                else if (!mask[i])
+                {
+                    sources[m_RemovalOffsets[i] - keptBelow] = index;
+                }
+                else
+                {
+                    m_RemovalIndices[i] = REMOVED;
+                }
+            }
+        });
+
+        m_ThreadPool.ParallelFor(0, moveCount, [&](size_t start, size_t end, unsigned int)
+        {
+            for (size_t k = start; k < end; k++)
+                m_RemovalIndices[sources[k]] = holes[k];
+        });
+
+        ForEachColumn([&](auto& column) { FillColumnHoles(column, holes, sources, moveCount, remainingCount, m_ThreadPool); });
+        movedParticles = sources;
+        movedCount = moveCount;
+    }
+
+    // A grid waiting to be recreated or missing the particles appended since its build has nothing to patch, the next
+    // build bins everything again
+    if (m_SpatialGridInitialized && m_SpatialGrid.GetBinnedCount() == particleCount)
+        m_SpatialGrid.RemoveParticles(m_RemovalIndices, remainingCount, movedParticles, movedCount, m_ThreadPool);
+    m_NeighborListValid = false;
+    m_GridAnchors.clear();
+    m_GridDrift = -1.0f;
+
+    // The survivors keep their ids, only the moved ones need their new index. m_ParticleIds moved with the other columns
+    if (m_UseStableRemoval)
+    {
+        m_ThreadPool.ParallelFor(0, remainingCount, [&](size_t start, size_t end, unsigned int)
+        {
+            for (size_t k = start; k < end; k++)
+                m_IdToIndex[m_ParticleIds[k]] = static_cast<unsigned int>(k);
+        });
+    }
+    else
+    {
+        const unsigned int* holes = m_RemovalMoves.data();
+        m_ThreadPool.ParallelFor(0, movedCount, [&](size_t start, size_t end, unsigned int)
+        {
+            for (size_t k = start; k < end; k++)
+                m_IdToIndex[m_ParticleIds[holes[k]]] = holes[k];
+        });
+    }
+
+    // Drop the removed ids from the live ones, keeping them ascending
+    const size_t liveCount = m_ThreadPool.ExclusiveScan(m_LiveIds.size(),
+        [&](size_t k) { return m_IdToIndex[m_LiveIds[k]] != REMOVED_PARTICLE_INDEX; }, m_RemovalOffsets);
+    m_RemovalLiveIds.resize(liveCount);
+    m_ThreadPool.ParallelFor(0, m_LiveIds.size(), [&](size_t start, size_t end, unsigned int)
+    {
+        for (size_t k = start; k < end; k++)
+        {
+            if (m_IdToIndex[m_LiveIds[k]] != REMOVED_PARTICLE_INDEX)
+                m_RemovalLiveIds[m_RemovalOffsets[k]] = m_LiveIds[k];
+        }
+    });
+    m_LiveIds.swap(m_RemovalLiveIds);
+
+    m_CurrentNumOfParticles -= static_cast<unsigned int>(std::min<size_t>(removedCount, m_CurrentNumOfParticles));
+    m_RemovedCount += removedCount;
+    return removedCount;
+}
+
+void SimulationSystem::AddSink(const Vec2& bottomLeft, const Vec2& topRight)
+{
+    ParticleSink sink;
+    sink.bottomLeft = Vec2(std::min(bottomLeft.x, topRight.x), std::min(bottomLeft.y, topRight.y));
+    sink.topRight = Vec2(std::max(bottomLeft.x, topRight.x), std::max(bottomLeft.y, topRight.y));
+    m_Sinks.push_back(sink);
+}
+
+void SimulationSystem::ApplySinks()
+{
+    if (m_Sinks.empty() || m_Positions.empty())
+        return;
+
+    PROFILE_SCOPE(m_Profiler, ProfilePhase::Removal);
+
+    // Flag the particles inside any sink, the removal only runs if one was found
+    m_RemovalMask.resize(m_Positions.size());
+    std::atomic<bool> hasRemovals(false);
+    m_ThreadPool.ParallelFor(0, m_Positions.size(), [&](size_t start, size_t end, unsigned int)
+    {
+        bool localRemovals = false;
+        for (size_t i = start; i < end; i++)
+        {
+            const Vec2 position = m_Positions[i];
+            uint8_t isInside = 0;
+            for (const ParticleSink& sink : m_Sinks)
+                isInside |= position.x >= sink.bottomLeft.x && position.x <= sink.topRight.x &&
+                    position.y >= sink.bottomLeft.y && position.y <= sink.topRight.y;
+            m_RemovalMask[i] = isInside;
+            localRemovals |= isInside != 0;
+        }
+
+        if (localRemovals)
+            hasRemovals.store(true, std::memory_order_relaxed);
+    });
+
+    if (hasRemovals.load())
+        RemoveParticles(m_RemovalMask);
 }
 
 void SimulationSystem::Reset(float particleRadius) {
     
     ClearParticles();
-    ClearStreams();
-
-    // Reset camera position
-    m_CameraPosition = Vec2(0.0f, 0.0f);
+    ClearEmitters();
 
     // Reset simulation state variables
     m_IsSpaceBarPressed = false;
@@ -218,24 +807,523 @@ void SimulationSystem::Reset(float particleRadius) {
     m_CurrentNumOfParticles = 0;
 
     // Reset spatial grid
-    m_SpatialGrid = SpatialGrid(m_SpatialGrid.GetParticleCount(), m_ParticleRadius, m_Bounds.bottomLeft, m_Bounds.topRight);
+    m_SpatialGrid = SpatialGrid(m_SpatialGrid.GetParticleCount(), m_Radii, m_ParticleRadius, m_Bounds.bottomLeft, m_Bounds.topRight, m_UseHashedGrid);
     m_SpatialGridInitialized = false;
 
     // Reserve vectors again at original capacity
-    unsigned int maxParticles = m_SpatialGrid.GetParticleCount();
-    m_Positions.reserve(maxParticles);
-    m_PrevPositions.reserve(maxParticles);
-    m_Accelerations.reserve(maxParticles);
-    m_Masses.reserve(maxParticles);
-    m_Temperatures.reserve(maxParticles);
-    m_Densities.reserve(maxParticles);
-    m_Pressures.reserve(maxParticles);
+    ReserveColumns(m_SpatialGrid.GetParticleCount());
+    m_UpdatesSinceReorder = 0;
+
+    // Same seed, same scene
+    m_RandomGenerator.seed(m_Seed);
+    m_StepIndex = 0;
+    m_StateHash = 0;
+    m_SubStepStats = SubStepStats();
+    m_SleepingCount = 0;
+    m_NeighborListStats = NeighborListStats();
+    m_RemovedCount = 0;
 
     m_ParticleRadius = particleRadius;
 }
 
+void SimulationSystem::SetParticleRadius(float newRad)
+{
+    // Every particle keeps its size relative to the reference radius, without a spread they all get exactly newRad
+    for (float& radius : m_Radii)
+        radius = newRad * (radius / m_ParticleRadius);
+
+    m_ParticleRadius = newRad;
+    m_SpatialGridInitialized = false;
+}
+
+void SimulationSystem::SetSubStepRange(unsigned int minSubSteps, unsigned int maxSubSteps)
+{
+    m_MinSubSteps = std::max(minSubSteps, 1u);
+    m_MaxSubSteps = std::max(maxSubSteps, m_MinSubSteps);
+}
+
+void SimulationSystem::AdaptSubSteps(float maxDisplacement, float maxOverlap)
+{
+    const unsigned int current = m_subSteps;
+    const float displacement = maxDisplacement / m_ParticleRadius;
+    const float overlap = maxOverlap / m_ParticleRadius;
+
+    // The displacement per substep scales with 1 / substeps, take just enough to stay under the target
+    const float neededForDisplacement = std::ceil(displacement * current / std::max(m_TargetDisplacement, 0.001f));
+    unsigned int desired = static_cast<unsigned int>(std::min(neededForDisplacement, static_cast<float>(m_MaxSubSteps)));
+
+    // Overlaps shrink with smaller substeps but not in a predictable way, step by one
+    if (overlap > m_TargetOverlap)
+        desired = std::max(desired, current + 1);
+    else if (overlap > m_TargetOverlap * 0.5f)
+        desired = std::max(desired, current);
+
+    // Grow at once, shrink by one substep per update so a single calm update doesn't drop the count
+    if (desired < current)
+        desired = current - 1;
+    desired = std::min(std::max(desired, m_MinSubSteps), m_MaxSubSteps);
+
+    m_SubStepStats.subSteps = current;
+    m_SubStepStats.maxDisplacement = displacement;
+    m_SubStepStats.maxOverlap = overlap;
+    m_SubStepStats.averageSubSteps = (m_SubStepStats.averageSubSteps == 0.0f) ? static_cast<float>(current)
+        : m_SubStepStats.averageSubSteps + (current - m_SubStepStats.averageSubSteps) * 0.02f;
+
+    if (desired == current)
+        return;
+
+    // The previous positions hold the displacement of one substep, keep the velocity for the new substep length
+    const float scale = static_cast<float>(current) / desired;
+    m_ThreadPool.ParallelFor(0, m_Positions.size(), [&](size_t start, size_t end, unsigned int)
+    {
+        for (size_t i = start; i < end; i++)
+            m_PrevPositions[i] = m_Positions[i] - (m_Positions[i] - m_PrevPositions[i]) * scale;
+    });
+
+    m_subSteps = desired;
+}
+
+std::vector<float>& SimulationSystem::GetThreadMaxima()
+{
+    const size_t size = static_cast<size_t>(GetNumThreads()) * THREAD_MAXIMA_STRIDE;
+    if (m_ThreadMaxima.size() != size)
+        m_ThreadMaxima.assign(size, 0.0f);
+    return m_ThreadMaxima;
+}
+
+void SimulationSystem::SetUseSleeping(bool v)
+{
+    m_UseSleeping = v;
+    if (!v)
+    {
+        std::fill(m_SleepCounters.begin(), m_SleepCounters.end(), 0);
+        m_SleepAnchors = m_Positions;
+        m_SleepingCount = 0;
+    }
+}
+
+void SimulationSystem::SetUseFluid(bool v)
+{
+    m_UseFluid = v;
+    if (v)
+        SetAttributes(m_Attributes);
+}
+
+void SimulationSystem::SetSleepSubSteps(unsigned int subSteps)
+{
+    m_SleepSubSteps = std::min(std::max(subSteps, 1u), static_cast<unsigned int>(PARTICLE_ASLEEP - 1));
+}
+
+void SimulationSystem::UpdateSleepStates()
+{
+    PROFILE_SCOPE(m_Profiler, ProfilePhase::Sleep);
+
+    const uint8_t CELL_HAS_AWAKE = 1;
+    const uint8_t CELL_HAS_MOVING = 2;
+    const uint8_t CELL_HAS_ASLEEP = 4;
+
+    const size_t cellCount = m_SpatialGrid.GetTotalCellCount();
+    const std::vector<unsigned int>& cellStart = m_SpatialGrid.GetCellStart();
+    const std::vector<unsigned int>& sortedParticles = m_SpatialGrid.GetSortedParticles();
+    const std::vector<unsigned int>& guestStart = m_SpatialGrid.GetGuestStart();
+    const std::vector<unsigned int>& sortedGuests = m_SpatialGrid.GetSortedGuests();
+    const bool hasGuests = m_SpatialGrid.GetLevelCount() > 1;
+
+    m_CellMotion.resize(cellCount);
+    m_CellIsAwake.resize(cellCount);
+
+    // Positions have just been integrated, so position - previous position is the move of this substep
+    const float wakeDistance = m_WakeThreshold * m_ParticleRadius;
+    const float wakeDistanceSq = wakeDistance * wakeDistance;
+
+    auto particleMotion = [&](unsigned int i)
+    {
+        if (m_SleepCounters[i] == PARTICLE_ASLEEP)
+            return CELL_HAS_ASLEEP;
+        if ((m_Positions[i] - m_PrevPositions[i]).length_sq() > wakeDistanceSq)
+            return static_cast<uint8_t>(CELL_HAS_AWAKE | CELL_HAS_MOVING);
+        return CELL_HAS_AWAKE;
+    };
+
+    // Flag the cells holding awake particles, sleeping ones and the ones holding a particle fast enough to wake its neighbors.
+    // Guests count as well, their pairs with the particles of a coarser level are found from its cells
+    std::atomic<unsigned int> sleepingCount(0);
+    m_ThreadPool.ParallelFor(0, cellCount, [&](size_t start, size_t end, unsigned int)
+    {
+        unsigned int localSleeping = 0;
+        for (size_t c = start; c < end; c++)
+        {
+            uint8_t motion = 0;
+            for (unsigned int k = cellStart[c]; k < cellStart[c + 1]; k++)
+            {
+                motion |= particleMotion(sortedParticles[k]);
+                localSleeping += m_SleepCounters[sortedParticles[k]] == PARTICLE_ASLEEP;
+            }
+
+            if (hasGuests)
+                for (unsigned int k = guestStart[c]; k < guestStart[c + 1]; k++)
+                    motion |= particleMotion(sortedGuests[k]);
+
+            m_CellMotion[c] = motion;
+        }
+        sleepingCount += localSleeping;
+    });
+
+    // Wake the sleeping particles and guests of the cells next to a moving particle, it may have pushed them or
+    // moved away from under them. Only the cell flags are read unless there is something to wake, and each cell
+    // only writes its own particles and guests. A particle is a guest of every coarser level, so the levels go one at a time
+    std::atomic<unsigned int> wokenCount(0);
+    for (int level = 0; level < m_SpatialGrid.GetLevelCount(); level++)
+    {
+        m_ThreadPool.ParallelFor(m_SpatialGrid.GetLevelCellBegin(level), m_SpatialGrid.GetLevelCellEnd(level), [&](size_t start, size_t end, unsigned int)
+        {
+            unsigned int localWoken = 0;
+            auto wake = [&](unsigned int i)
+            {
+                if (m_SleepCounters[i] != PARTICLE_ASLEEP)
+                    return;
+
+                m_SleepCounters[i] = 0;
+                m_SleepAnchors[i] = m_Positions[i];
+                localWoken++;
+            };
+
+            for (size_t c = start; c < end; c++)
+            {
+                const uint8_t motion = m_CellMotion[c];
+                m_CellIsAwake[c] = motion & CELL_HAS_AWAKE;
+                if (!(motion & CELL_HAS_ASLEEP))
+                    continue;
+
+                int cellX, cellY;
+                m_SpatialGrid.GetCellCoordinates(level, static_cast<int>(c), cellX, cellY);
+
+                uint8_t neighborMotion = 0;
+                for (int neighborY = cellY - 1; neighborY <= cellY + 1; neighborY++)
+                {
+                    for (int neighborX = cellX - 1; neighborX <= cellX + 1; neighborX++)
+                    {
+                        const int neighbor = m_SpatialGrid.FindCell(level, neighborX, neighborY);
+                        if (neighbor >= 0)
+                            neighborMotion |= m_CellMotion[neighbor];
+                    }
+                }
+
+                if (!(neighborMotion & CELL_HAS_MOVING))
+                    continue;
+
+                for (unsigned int k = cellStart[c]; k < cellStart[c + 1]; k++)
+                    wake(sortedParticles[k]);
+
+                if (hasGuests)
+                    for (unsigned int k = guestStart[c]; k < guestStart[c + 1]; k++)
+                        wake(sortedGuests[k]);
+
+                m_CellIsAwake[c] = 1;
+            }
+            wokenCount += localWoken;
+        });
+    }
+
+    m_SleepingCount = sleepingCount - wokenCount;
+}
+
+// Mixing steps of a 64 bit multiply-rotate hash
+static inline uint64_t HashCombine(uint64_t hash, uint64_t value)
+{
+    hash ^= value * 0x9E3779B97F4A7C15ull;
+    hash = (hash << 31) | (hash >> 33);
+    return hash * 0xBF58476D1CE4E5B9ull;
+}
+
+static inline uint64_t HashFinalize(uint64_t hash)
+{
+    hash ^= hash >> 30;
+    hash *= 0xBF58476D1CE4E5B9ull;
+    hash ^= hash >> 27;
+    hash *= 0x94D049BB133111EBull;
+    return hash ^ (hash >> 31);
+}
+
+static inline uint64_t FloatBits(float value)
+{
+    uint32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+uint64_t SimulationSystem::ComputeStateHash()
+{
+    // Every chunk of live ids is hashed on its own, the chunk hashes are then combined in id order
+    const size_t chunkSize = 4096;
+    const size_t particleCount = m_LiveIds.size();
+    const size_t chunkCount = (particleCount + chunkSize - 1) / chunkSize;
+    m_HashChunks.resize(chunkCount);
+
+    m_ThreadPool.ParallelForFixedChunks(0, particleCount, [&](size_t start, size_t end, unsigned int)
+    {
+        uint64_t hash = 0;
+        for (size_t k = start; k < end; k++)
+        {
+            const unsigned int i = m_IdToIndex[m_LiveIds[k]];
+            hash = HashCombine(hash, FloatBits(m_Positions[i].x) | (FloatBits(m_Positions[i].y) << 32));
+            hash = HashCombine(hash, FloatBits(m_PrevPositions[i].x) | (FloatBits(m_PrevPositions[i].y) << 32));
+            hash = HashCombine(hash, FloatBits(GetMass(i)) | (FloatBits(GetTemperature(i)) << 32));
+        }
+        m_HashChunks[start / chunkSize] = hash;
+    }, chunkSize);
+
+    uint64_t hash = HashCombine(0, particleCount);
+    for (size_t c = 0; c < chunkCount; c++)
+        hash = HashCombine(hash, m_HashChunks[c]);
+    return HashFinalize(hash);
+}
+
+bool SimulationSystem::SaveSnapshot(const std::string& path) const
+{
+    SnapshotHeader header = {};
+    header.particleCount = m_Positions.size();
+    header.bottomLeftX = m_Bounds.bottomLeft.x;
+    header.bottomLeftY = m_Bounds.bottomLeft.y;
+    header.topRightX = m_Bounds.topRight.x;
+    header.topRightY = m_Bounds.topRight.y;
+    header.particleRadius = m_ParticleRadius;
+    header.subSteps = m_subSteps;
+    header.nextParticleId = m_NextParticleId;
+    header.currentNumOfParticles = m_CurrentNumOfParticles;
+    header.reorderInterval = m_ReorderInterval;
+    header.updatesSinceReorder = m_UpdatesSinceReorder;
+    header.uniformMass = m_UniformMass;
+
+    header.constants.gravityX = GRAVITY.x;
+    header.constants.gravityY = GRAVITY.y;
+    header.constants.restitution = RESTITUTION;
+    header.constants.airResistance = AIR_RESISTANCE;
+    header.constants.maxVelocity = MAX_VELOCITY;
+    header.constants.minDeltaMovement = MIN_DELTA_MOVEMENT;
+    header.constants.dampingFactor = DAMPING_FACTOR;
+    header.constants.spaceBarForce = SPACEBAR_FORCE_COEFFICIENT;
+    header.constants.leftClickForce = LEFT_CLICK_FORCE_COEFFICIENT;
+    header.constants.maxForceDistanceSq = MAX_FORCE_DISTANCE_SQ;
+    header.constants.thermalDispersion = THERMAL_DISPERSION_PER_FRAME;
+    header.constants.maxThermalDiffusion = MAX_THERMAL_DIFFUSION_PER_COLLISION;
+
+    // Like the sinks, the emitters keep no particle of their own, their settings and progress are enough to go on
+    std::vector<SnapshotEmitter> emitters;
+    std::vector<SnapshotRateKey> rateKeys;
+    emitters.reserve(m_Emitters.size());
+    for (const ParticleEmitter& emitter : m_Emitters)
+    {
+        const EmitterSettings& settings = emitter.GetSettings();
+        SnapshotEmitter e;
+        e.shape = static_cast<uint32_t>(settings.shape);
+        e.startX = settings.start.x;
+        e.startY = settings.start.y;
+        e.endX = settings.end.x;
+        e.endY = settings.end.y;
+        e.radius = settings.radius;
+        e.velocityX = settings.velocity.x;
+        e.velocityY = settings.velocity.y;
+        e.accelerationX = settings.acceleration.x;
+        e.accelerationY = settings.acceleration.y;
+        e.mass = settings.mass;
+        e.jitter = settings.jitter;
+        e.total = settings.total;
+        e.spawned = emitter.GetSpawned();
+        e.time = emitter.GetTime();
+        e.credit = emitter.GetCredit();
+        e.siteRadius = emitter.GetSiteRadius();
+        e.nextSite = static_cast<uint32_t>(emitter.GetNextSite());
+        e.firstRateKey = static_cast<uint32_t>(rateKeys.size());
+        e.rateKeyCount = static_cast<uint32_t>(settings.rateCurve.size());
+        e.isActive = emitter.GetIsActive() ? 1 : 0;
+        for (const EmitterRateKey& key : settings.rateCurve)
+            rateKeys.push_back({ key.time, key.rate });
+        emitters.push_back(e);
+    }
+
+    // Every column has one element per particle
+    std::vector<SnapshotColumnData> columns =
+    {
+        { SnapshotColumn::Positions,     sizeof(Vec2),         m_Positions.data() },
+        { SnapshotColumn::PrevPositions, sizeof(Vec2),         m_PrevPositions.data() },
+        { SnapshotColumn::ParticleIds,   sizeof(unsigned int), m_ParticleIds.data() },
+        { SnapshotColumn::SleepCounters, sizeof(uint8_t),      m_SleepCounters.data() },
+        { SnapshotColumn::SleepAnchors,  sizeof(Vec2),         m_SleepAnchors.data() },
+        { SnapshotColumn::Radii,         sizeof(float),        m_Radii.data() },
+    };
+
+    // Id to index has one element per id given so far, it only fits the column format while no particle was removed.
+    // Loading rebuilds it from the ids anyway
+    if (m_IdToIndex.size() == m_Positions.size())
+        columns.push_back({ SnapshotColumn::IdToIndex, sizeof(unsigned int), m_IdToIndex.data() });
+
+    // Only the enabled optional columns, loading restores the same set of attributes
+    if (HasAttribute(ATTRIBUTE_ACCELERATIONS))
+        columns.push_back({ SnapshotColumn::Accelerations, sizeof(Vec2), m_Accelerations.data() });
+    if (HasAttribute(ATTRIBUTE_MASSES))
+        columns.push_back({ SnapshotColumn::Masses, sizeof(float), m_Masses.data() });
+    if (HasAttribute(ATTRIBUTE_TEMPERATURES))
+        columns.push_back({ SnapshotColumn::Temperatures, sizeof(float), m_Temperatures.data() });
+    if (HasAttribute(ATTRIBUTE_DENSITIES))
+        columns.push_back({ SnapshotColumn::Densities, sizeof(float), m_Densities.data() });
+    if (HasAttribute(ATTRIBUTE_PRESSURES))
+        columns.push_back({ SnapshotColumn::Pressures, sizeof(float), m_Pressures.data() });
+
+    return WriteSnapshot(path, header, emitters, rateKeys, columns);
+}
+
+bool SimulationSystem::LoadSnapshot(const std::string& path)
+{
+    MappedSnapshot snapshot;
+    if (!snapshot.Open(path))
+        return false;
+
+    const SnapshotHeader& header = snapshot.GetHeader();
+    const size_t count = static_cast<size_t>(header.particleCount);
+
+    const Vec2* positions = snapshot.GetColumn<Vec2>(SnapshotColumn::Positions);
+    const Vec2* prevPositions = snapshot.GetColumn<Vec2>(SnapshotColumn::PrevPositions);
+    const Vec2* accelerations = snapshot.GetColumn<Vec2>(SnapshotColumn::Accelerations);
+    const float* masses = snapshot.GetColumn<float>(SnapshotColumn::Masses);
+    const float* temperatures = snapshot.GetColumn<float>(SnapshotColumn::Temperatures);
+    const float* densities = snapshot.GetColumn<float>(SnapshotColumn::Densities);
+    const float* pressures = snapshot.GetColumn<float>(SnapshotColumn::Pressures);
+    const unsigned int* particleIds = snapshot.GetColumn<unsigned int>(SnapshotColumn::ParticleIds);
+    const unsigned int* idToIndex = snapshot.GetColumn<unsigned int>(SnapshotColumn::IdToIndex);
+    const uint8_t* sleepCounters = snapshot.GetColumn<uint8_t>(SnapshotColumn::SleepCounters);
+    const Vec2* sleepAnchors = snapshot.GetColumn<Vec2>(SnapshotColumn::SleepAnchors);
+    const float* radii = snapshot.GetColumn<float>(SnapshotColumn::Radii);
+
+    if (!positions || !prevPositions || !particleIds)
+    {
+        std::cerr << path << " is missing particle columns" << std::endl;
+        return false;
+    }
+
+    // The ids index other columns, a corrupted file must not make them read out of bounds. Id to index is rebuilt
+    // from the ids, which must be below the next id and unique. When the file has the column too, it must be their inverse
+    const size_t idCount = std::max<size_t>(header.nextParticleId, count);
+    std::vector<unsigned int> loadedIdToIndex(idCount, REMOVED_PARTICLE_INDEX);
+    for (size_t i = 0; i < count; i++)
+    {
+        const unsigned int id = particleIds[i];
+        if (id >= idCount || loadedIdToIndex[id] != REMOVED_PARTICLE_INDEX || (idToIndex && (id >= count || idToIndex[id] != i)))
+        {
+            std::cerr << path << " has inconsistent particle ids" << std::endl;
+            return false;
+        }
+        loadedIdToIndex[id] = static_cast<unsigned int>(i);
+    }
+
+    // Nothing can fail from here, replace the state
+    m_Positions.assign(positions, positions + count);
+    m_PrevPositions.assign(prevPositions, prevPositions + count);
+    m_ParticleIds.assign(particleIds, particleIds + count);
+    m_IdToIndex.assign(loadedIdToIndex.begin(), loadedIdToIndex.end());
+    m_LiveIds.clear();
+    for (size_t id = 0; id < idCount; id++)
+    {
+        if (loadedIdToIndex[id] != REMOVED_PARTICLE_INDEX)
+            m_LiveIds.push_back(static_cast<unsigned int>(id));
+    }
+
+    // The optional columns in the file are the enabled attributes, older files have all of them
+    if (header.uniformMass > 0.0f)
+        m_UniformMass = header.uniformMass;
+    SetAttributes((accelerations ? ATTRIBUTE_ACCELERATIONS : 0) | (masses ? ATTRIBUTE_MASSES : 0) |
+        (temperatures ? ATTRIBUTE_TEMPERATURES : 0) | (densities ? ATTRIBUTE_DENSITIES : 0) | (pressures ? ATTRIBUTE_PRESSURES : 0));
+    if (accelerations)
+        m_Accelerations.assign(accelerations, accelerations + count);
+    if (masses)
+        m_Masses.assign(masses, masses + count);
+    if (temperatures)
+        m_Temperatures.assign(temperatures, temperatures + count);
+    if (densities)
+        m_Densities.assign(densities, densities + count);
+    if (pressures)
+        m_Pressures.assign(pressures, pressures + count);
+
+    // Snapshots written before particles could sleep have every particle awake
+    if (sleepCounters && sleepAnchors)
+    {
+        m_SleepCounters.assign(sleepCounters, sleepCounters + count);
+        m_SleepAnchors.assign(sleepAnchors, sleepAnchors + count);
+    }
+    else
+    {
+        m_SleepCounters.assign(count, 0);
+        m_SleepAnchors = m_Positions;
+    }
+
+    // Snapshots written before particles had their own radius have them all at the reference one
+    if (radii)
+        m_Radii.assign(radii, radii + count);
+    else
+        m_Radii.assign(count, header.particleRadius);
+
+    m_Emitters.clear();
+    const SnapshotEmitter* emitters = snapshot.GetEmitters();
+    const SnapshotRateKey* rateKeys = snapshot.GetRateKeys();
+    for (uint32_t i = 0; i < header.emitterCount; i++)
+    {
+        const SnapshotEmitter& e = emitters[i];
+        EmitterSettings settings;
+        settings.shape = static_cast<EmitterShape>(e.shape);
+        settings.start = Vec2(e.startX, e.startY);
+        settings.end = Vec2(e.endX, e.endY);
+        settings.radius = e.radius;
+        settings.velocity = Vec2(e.velocityX, e.velocityY);
+        settings.acceleration = Vec2(e.accelerationX, e.accelerationY);
+        settings.mass = e.mass;
+        settings.jitter = e.jitter;
+        settings.total = e.total;
+        for (uint32_t k = 0; k < e.rateKeyCount; k++)
+            settings.rateCurve.push_back({ rateKeys[e.firstRateKey + k].time, rateKeys[e.firstRateKey + k].rate });
+
+        ParticleEmitter emitter(settings);
+        emitter.SetProgress(e.time, e.credit, e.spawned, e.siteRadius, e.nextSite);
+        emitter.SetIsActive(e.isActive != 0);
+        m_Emitters.push_back(emitter);
+    }
+
+    m_Bounds.bottomLeft = Vec2(header.bottomLeftX, header.bottomLeftY);
+    m_Bounds.topRight = Vec2(header.topRightX, header.topRightY);
+    m_SimWidth = std::abs(header.topRightX - header.bottomLeftX);
+    m_SimHeight = std::abs(header.topRightY - header.bottomLeftY);
+    m_ParticleRadius = header.particleRadius;
+    m_subSteps = header.subSteps;
+    m_NextParticleId = static_cast<unsigned int>(idCount);
+    m_CurrentNumOfParticles = header.currentNumOfParticles;
+    m_ReorderInterval = header.reorderInterval;
+    m_UpdatesSinceReorder = header.updatesSinceReorder;
+
+    GRAVITY = Vec2(header.constants.gravityX, header.constants.gravityY);
+    RESTITUTION = header.constants.restitution;
+    AIR_RESISTANCE = header.constants.airResistance;
+    INVERSE_AIR_RESISTANCE = (AIR_RESISTANCE > 0.0f) ? 1.0f / AIR_RESISTANCE : 0.0f;
+    MAX_VELOCITY = header.constants.maxVelocity;
+    MAX_VELOCITY_SQ = MAX_VELOCITY * MAX_VELOCITY;
+    MIN_DELTA_MOVEMENT = header.constants.minDeltaMovement;
+    DAMPING_FACTOR = header.constants.dampingFactor;
+    SPACEBAR_FORCE_COEFFICIENT = header.constants.spaceBarForce;
+    LEFT_CLICK_FORCE_COEFFICIENT = header.constants.leftClickForce;
+    MAX_FORCE_DISTANCE_SQ = header.constants.maxForceDistanceSq;
+    THERMAL_DISPERSION_PER_FRAME = header.constants.thermalDispersion;
+    MAX_THERMAL_DIFFUSION_PER_COLLISION = header.constants.maxThermalDiffusion;
+
+    // Bounds and radii may have changed
+    m_SpatialGridInitialized = false;
+
+    return true;
+}
+
 void SimulationSystem::UpdateMass(float newMass)
 {
+    m_UniformMass = newMass;
+    if (!HasAttribute(ATTRIBUTE_MASSES))
+        return;
+
     for (int i = 0; i < m_CurrentNumOfParticles; i++)
         m_Masses[i] = newMass;
 }
\ No newline at end of file
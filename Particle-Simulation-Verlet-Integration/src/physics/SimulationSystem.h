@@ -1,12 +1,19 @@
 #pragma once
-#include <GL/glew.h>
-#include <GLFW/glfw3.h>
 
 #include <vector>
+#include <string>
 #include <random>
+#include <cstdint>
+#include <algorithm>
 #include "VerletParticle.h"
 #include "Vec2.h"
 #include "SpatialGrid.h" 
+#include "ParticleColumn.h"
+#include "SimdKernels.h"
+#include "FluidSolver.h"
+#include "ParticleEmitter.h"
+#include "../core/ThreadPool.h"
+#include "../core/Profiler.h"
 
 #include "glm/glm.hpp"
 #include "glm/gtc/matrix_transform.hpp"
@@ -17,84 +24,296 @@ struct Bounds {
     Vec2 topRight;
 };
 
+// What the adaptive substep controller measured during the last update and what it chose from it
+struct SubStepStats {
+    unsigned int subSteps = 0;          // substeps used by the last update
+    float maxDisplacement = 0.0f;       // largest move of a particle during one substep, in radii
+    float maxOverlap = 0.0f;            // largest overlap the collision pass of the last substep left, in radii
+    float averageSubSteps = 0.0f;       // moving average over the last ~50 updates
+};
+
+// Axis aligned region removing every particle whose center enters it, an outlet when it covers a stretch of the bounds
+struct ParticleSink {
+    Vec2 bottomLeft;
+    Vec2 topRight;
+};
+
+// How often the neighbor list was rebuilt, to tune the skin against the number of candidate pairs
+struct NeighborListStats {
+    uint64_t builds = 0;                // list builds since the stats were reset
+    uint64_t subSteps = 0;              // collision passes that used a list, built or reused
+    size_t pairCount = 0;               // candidate pairs of the current list
+    float skin = 0.0f;                  // skin of the current list after clamping to the grid, in radii
+};
+
 class SimulationSystem
 {
 private:
     // Basic
     Bounds m_Bounds;
-    float m_ParticleRadius;
+    float m_ParticleRadius;     // radius of new particles, the smallest one if their size is spread out
+    float m_RadiusSpread;       // new particles get a radius between m_ParticleRadius and m_ParticleRadius * m_RadiusSpread
     float m_SimHeight;
     float m_SimWidth;
     unsigned int m_subSteps;
 
-    // Camera, Input, Display
-    Vec2 m_CameraPosition;
+    // Input, Display
     Vec2 m_MousePos;
-    float m_Zoom;
     unsigned int m_CurrentNumOfParticles;
     bool m_IsSpaceBarPressed;
     bool m_IsPaused;
     bool m_IsLeftButtonClicked;
     bool m_IsRightButtonClicked;
 
-    // SoA approach
-    std::vector<Vec2> m_Positions;
-    std::vector<Vec2> m_PrevPositions;
-    std::vector<Vec2> m_Accelerations;
-    std::vector<float> m_Masses;
-    std::vector<float> m_Temperatures;
-
-    // Not implented yet
-    std::vector<float> m_Densities;
-    std::vector<float> m_Pressures;
-
-    struct ParticleStream {
-        bool isActive = false;
-        Vec2 startPos;
-        Vec2 initialVelocity;
-        Vec2 acceleration;
-        int total = 0;
-        int spawned = 0;
-        float spawnInterval = 0.0f;
-        float timer = 0.0f;
-        float mass = 1.0f;
-    };
-
-    std::vector<ParticleStream> m_Streams;
+    // SoA approach, the columns grow in place without copying (see ParticleColumn)
+    ParticleColumn<Vec2> m_Positions;
+    ParticleColumn<Vec2> m_PrevPositions;
+    ParticleColumn<float> m_Radii;
+    ParticleColumn<uint8_t> m_SleepCounters;   // substeps spent below the sleep threshold, PARTICLE_ASLEEP once asleep
+    ParticleColumn<Vec2> m_SleepAnchors;       // position when the counter started, a particle falling from rest drifts away from it
+
+    // Optional columns, empty unless their attribute is enabled
+    uint32_t m_Attributes;
+    float m_UniformMass;                        // mass of every particle without ATTRIBUTE_MASSES
+    ParticleColumn<Vec2> m_Accelerations;
+    ParticleColumn<float> m_Masses;
+    ParticleColumn<float> m_Temperatures;
+    ParticleColumn<float> m_Densities;
+    ParticleColumn<float> m_Pressures;
+
+    // Stable particle ids, the SoA arrays get reordered so the index of a particle changes over time
+    ParticleColumn<unsigned int> m_ParticleIds;  // id of the particle stored at each index
+    ParticleColumn<unsigned int> m_IdToIndex;    // current index of every id given so far, REMOVED_PARTICLE_INDEX once removed
+    std::vector<unsigned int> m_LiveIds;         // ids of the particles in the scene, ascending
+    unsigned int m_NextParticleId;
+
+    // Reorder the SoA arrays in grid cell order every m_ReorderInterval updates, 0 disables it
+    unsigned int m_ReorderInterval;
+    unsigned int m_UpdatesSinceReorder;
+    ParticleColumn<uint8_t> m_ReorderScratch;   // gathered column, copied back so the columns keep their address
+
+    // Emitters, streams are emitters with a single site. The particles spawned by one emitter in an update are appended at once
+    std::vector<ParticleEmitter> m_Emitters;
+    std::vector<Vec2> m_SpawnPositions;
+    std::vector<float> m_SpawnRadii;
+
+    // Particles close enough to the sites of the emitter being spawned to touch a new particle, binned in cells a largest
+    // diameter wide. The particles larger than the new ones are kept aside and checked one by one
+    Vec2 m_SpawnOrigin;
+    float m_SpawnCellSize;
+    int m_SpawnColumns;
+    int m_SpawnRows;
+    std::vector<unsigned int> m_SpawnCellStart;
+    std::vector<unsigned int> m_SpawnCellEntries;
+    std::vector<unsigned int> m_SpawnLargeParticles;
+    std::vector<std::vector<unsigned int>> m_SpawnThreadNeighbors;
+
+    // Positions at the last grid build while there are emitters, and how far the particles moved from them as of the last
+    // velocity cap pass, < 0 if unknown. The spawn check queries the grid with that margin instead of scanning every particle
+    std::vector<Vec2> m_GridAnchors;
+    float m_GridDrift;
+
+    // Sinks, checked once per update. The removals compact every column, in order or by moving the last particles into the holes
+    std::vector<ParticleSink> m_Sinks;
+    bool m_UseStableRemoval;
+    uint64_t m_RemovedCount;                    // particles removed since the scene was created or reset
+    std::vector<uint8_t> m_RemovalMask;
+    std::vector<unsigned int> m_RemovalIndices; // new index of every particle, SpatialGrid::REMOVED_PARTICLE if removed
+    std::vector<unsigned int> m_RemovalOffsets; // survivors before every particle, then before every id
+    std::vector<unsigned int> m_RemovalMoves;   // stable: old index of every new index, swap: holes then the particles filling them
+    std::vector<unsigned int> m_RemovalLiveIds;
 
     SpatialGrid m_SpatialGrid;
     bool m_SpatialGridInitialized;
 
+    // Store only the occupied grid cells in a hash table instead of every cell of the bounds
+    bool m_UseHashedGrid;
+
+    // Worker threads shared by all the solver passes
+    ThreadPool m_ThreadPool;
+
+    // Resolve collisions while traversing the grid instead of building a pair list first
+    bool m_UseFusedCollisions;
+
+    // Integrate and resolve boundary collisions in a single sweep over the particles
+    bool m_UseFusedIntegration;
+
+    // Instruction set used by the integration kernel, can't go above what the CPU supports
+    SimdLevel m_SimdLevel;
+    SimdLevel m_MaxSimdLevel;
+
+    // Per phase timings of the last updates
+    Profiler m_Profiler;
+
+    // Adaptive substeps: the count of the next update is chosen from the motion measured in the last one
+    bool m_UseAdaptiveSubSteps;
+    unsigned int m_MinSubSteps;
+    unsigned int m_MaxSubSteps;
+    float m_TargetDisplacement;         // radii per substep
+    float m_TargetOverlap;              // radii
+    SubStepStats m_SubStepStats;
+    std::vector<float> m_ThreadMaxima;  // per thread maxima of the measuring passes, THREAD_MAXIMA_STRIDE apart
+
+    // Sleeping particles are neither integrated nor collided with each other until something wakes them
+    bool m_UseSleeping;
+    float m_SleepThreshold;                 // radii per substep
+    float m_WakeThreshold;                  // radii per substep
+    unsigned int m_SleepSubSteps;
+    std::vector<uint8_t> m_CellMotion;      // per cell, CELL_HAS_AWAKE | CELL_HAS_MOVING before the wake pass
+    std::vector<uint8_t> m_CellIsAwake;     // per cell, 1 if it holds an awake particle after the wake pass
+    unsigned int m_SleepingCount;
+
+    // Neighbor lists: the grid and the candidate pairs of the last build are reused by the collision passes until
+    // a particle has moved more than half the skin from where it was at the build
+    bool m_UseNeighborLists;
+    float m_NeighborSkin;                   // radii
+    bool m_NeighborListValid;               // false once anything else rebuilt the grid
+    std::vector<Vec2> m_NeighborAnchors;    // positions at the last build
+    NeighborListStats m_NeighborListStats;
+
+    // Fluid mode: SPH pressure and viscosity forces instead of the granular contacts
+    bool m_UseFluid;
+    FluidSettings m_FluidSettings;
+    std::vector<FluidCandidates> m_FluidCandidates;    // per thread neighbor buffers of the fluid pass
+
+    // Random numbers used to place new particles, always seeded from m_Seed so a scene can be rebuilt
+    unsigned int m_Seed;
+    std::mt19937 m_RandomGenerator;
+
+    // Deterministic mode: chunking independent of the thread count and a state hash after every update
+    bool m_IsDeterministic;
+    uint64_t m_StepIndex;
+    uint64_t m_StateHash;
+    std::vector<uint64_t> m_HashChunks;
+
+    // Reserve room for count particles in the columns in use
+    void ReserveColumns(size_t count);
+
+    // Grow every column by count particles and return the index of the first one. The new particles get their ids and
+    // a zeroed state, InitParticle sets the rest
+    size_t AppendParticles(size_t count);
+    void InitParticle(size_t index, const Vec2& position, const Vec2& velocity, const Vec2& acceleration, float mass, float radius);
+
+    // Call func(column) for every particle column in use, the ones indexed by particle. Permutations and removals move them all alike
+    template<typename Func>
+    void ForEachColumn(Func&& func)
+    {
+        func(m_Positions);
+        func(m_PrevPositions);
+        func(m_Radii);
+        func(m_SleepCounters);
+        func(m_SleepAnchors);
+        func(m_ParticleIds);
+
+        if (HasAttribute(ATTRIBUTE_ACCELERATIONS))
+            func(m_Accelerations);
+        if (HasAttribute(ATTRIBUTE_MASSES))
+            func(m_Masses);
+        if (HasAttribute(ATTRIBUTE_TEMPERATURES))
+            func(m_Temperatures);
+        if (HasAttribute(ATTRIBUTE_DENSITIES))
+            func(m_Densities);
+        if (HasAttribute(ATTRIBUTE_PRESSURES))
+            func(m_Pressures);
+    }
+
+    // Bin the particles that could touch a particle of at most maxRadius spawned in [siteMin, siteMax]. They are found in the
+    // cells of the last grid build around the sites, widened by the drift since, and the particles appended after the build
+    // are checked one by one. Without a known drift every position is scanned
+    void GatherSpawnNeighbors(const Vec2& siteMin, const Vec2& siteMax, float maxRadius);
+
+    // Return true if a particle of the given radius at position overlaps none of the gathered particles
+    bool IsSpawnSiteFree(const Vec2& position, float radius) const;
+
+    // Remove the particles inside a sink, called at the start of every update
+    void ApplySinks();
+
+    // Draw a random radius within the spread, uniform in log scale
+    float DrawSpreadRadius();
+
+    // Add a particle with a random radius within the spread, the mass grows with the area so every particle has the same density
+    void AddSpreadParticle(const Vec2& position, const Vec2& velocity, const Vec2& acceleration, float mass);
+
 public:
-    SimulationSystem(unsigned int numberOfParticles, const Vec2& bottomLeft, const Vec2& topRight, float particleRadius, const unsigned int substeps);
+    // Value of the sleep counter of a sleeping particle
+    static const uint8_t PARTICLE_ASLEEP = 255;
+
+    // Index of a removed particle id, ids are never given again
+    static const unsigned int REMOVED_PARTICLE_INDEX = ~0u;
+
+    // Floats between the maxima of two threads in GetThreadMaxima()
+    static const size_t THREAD_MAXIMA_STRIDE = 64 / sizeof(float);
+
+    // Optional particle columns. Positions, previous positions, radii, ids and the sleep state always exist, the
+    // passes only stream the optional columns that are enabled and are compiled once per combination
+    static const uint32_t ATTRIBUTE_ACCELERATIONS = 1 << 0;  // acceleration kept between updates, new particles start with theirs
+    static const uint32_t ATTRIBUTE_MASSES = 1 << 1;         // without it every particle has the uniform mass
+    static const uint32_t ATTRIBUTE_TEMPERATURES = 1 << 2;   // heating by drag, the floor and contacts, shown by the renderer
+    static const uint32_t ATTRIBUTE_DENSITIES = 1 << 3;
+    static const uint32_t ATTRIBUTE_PRESSURES = 1 << 4;
+    static const uint32_t DEFAULT_ATTRIBUTES = ATTRIBUTE_ACCELERATIONS | ATTRIBUTE_MASSES | ATTRIBUTE_TEMPERATURES;
+    static const uint32_t FLUID_ATTRIBUTES = ATTRIBUTE_ACCELERATIONS | ATTRIBUTE_DENSITIES | ATTRIBUTE_PRESSURES;
+
+    SimulationSystem(unsigned int numberOfParticles, const Vec2& bottomLeft, const Vec2& topRight, float particleRadius, const unsigned int substeps,
+        unsigned int numThreads = 0);
     ~SimulationSystem();
 
-    void AddParticle(const Vec2& position, const Vec2& velocity, const Vec2& acceleration, float mass);
+    void AddParticle(const Vec2& position, const Vec2& velocity, const Vec2& acceleration, float mass, float radius);
+
+    // Add count particles at once, the columns grow a single time
+    void AddParticles(size_t count, const Vec2* positions, const Vec2* velocities, const Vec2& acceleration, float mass, float radius);
 
     // Update simulation physics
     void Update(float deltaTime);
 
     // SoA accessors
-    const std::vector<Vec2>& GetPositions() const { return m_Positions; }
-    std::vector<Vec2>& GetPositions() { return m_Positions; }
+    const ParticleColumn<Vec2>& GetPositions() const { return m_Positions; }
+    ParticleColumn<Vec2>& GetPositions() { return m_Positions; }
+
+    const ParticleColumn<Vec2>& GetPrevPositions() const { return m_PrevPositions; }
+    ParticleColumn<Vec2>& GetPrevPositions() { return m_PrevPositions; }
+
+    const ParticleColumn<Vec2>& GetAccelerations() const { return m_Accelerations; }
+    ParticleColumn<Vec2>& GetAccelerations() { return m_Accelerations; }
+
+    const ParticleColumn<float>& GetMasses() const { return m_Masses; }
+    ParticleColumn<float>& GetMasses() { return m_Masses; }
+
+    const ParticleColumn<float>& GetRadii() const { return m_Radii; }
+    ParticleColumn<float>& GetRadii() { return m_Radii; }
+
+    const ParticleColumn<float>& GetTemperatures() const { return m_Temperatures; }
+    ParticleColumn<float>& GetTemperatures() { return m_Temperatures; }
+
+    const ParticleColumn<uint8_t>& GetSleepCounters() const { return m_SleepCounters; }
+    ParticleColumn<uint8_t>& GetSleepCounters() { return m_SleepCounters; }
+
+    const ParticleColumn<Vec2>& GetSleepAnchors() const { return m_SleepAnchors; }
+    ParticleColumn<Vec2>& GetSleepAnchors() { return m_SleepAnchors; }
+
+    const ParticleColumn<float>& GetDensities() const { return m_Densities; }
+    ParticleColumn<float>& GetDensities() { return m_Densities; }
+
+    const ParticleColumn<float>& GetPressures() const { return m_Pressures; }
+    ParticleColumn<float>& GetPressures() { return m_Pressures; }
 
-    const std::vector<Vec2>& GetPrevPositions() const { return m_PrevPositions; }
-    std::vector<Vec2>& GetPrevPositions() { return m_PrevPositions; }
+    // Return the stable id of the particle stored at each index
+    const ParticleColumn<unsigned int>& GetParticleIds() const { return m_ParticleIds; }
 
-    const std::vector<Vec2>& GetAccelerations() const { return m_Accelerations; }
-    std::vector<Vec2>& GetAccelerations() { return m_Accelerations; }
+    // Return the current index of a particle id, REMOVED_PARTICLE_INDEX if the particle was removed
+    unsigned int GetParticleIndex(unsigned int id) const { return m_IdToIndex[id]; }
 
-    const std::vector<float>& GetMasses() const { return m_Masses; }
-    std::vector<float>& GetMasses() { return m_Masses; }
+    // Return the ids of the particles in the scene, ascending
+    const std::vector<unsigned int>& GetLiveIds() const { return m_LiveIds; }
 
-    const std::vector<float>& GetTemperatures() const { return m_Temperatures; }
-    std::vector<float>& GetTemperatures() { return m_Temperatures; }
+    // Permute all the SoA arrays so particles sharing a grid cell are next to each other in memory
+    void ReorderParticles();
 
-    const std::vector<float>& GetDensities() const { return m_Densities; }
-    std::vector<float>& GetDensities() { return m_Densities; }
+    // Return how many updates pass between two reorders, 0 means never
+    unsigned int GetReorderInterval() const { return m_ReorderInterval; }
 
-    const std::vector<float>& GetPressures() const { return m_Pressures; }
-    std::vector<float>& GetPressures() { return m_Pressures; }
+    // Set how many updates pass between two reorders, 0 disables reordering
+    void SetReorderInterval(unsigned int interval) { m_ReorderInterval = interval; }
 
     // Get simulation bounds
     const Bounds GetBounds() const { return m_Bounds; }
@@ -106,11 +325,43 @@ public:
     // Add the desired amount of particles all at once
     void AddBulkParticles(unsigned int count, const Vec2& initialVelocity, const Vec2& acceleration, float mass);
 
-    // Update the UpdateStream method
-    void UpdateStreams(float deltaTime);
+    // Add an emitter spawning particles on its shape at the rate of its curve. Returns its index
+    size_t AddEmitter(const EmitterSettings& settings);
 
-    // Method to clear all streams
-    void ClearStreams() { m_Streams.clear(); }
+    // Spawn the particles due from every emitter, on the lattice sites free of other particles. A site is only used if the
+    // new particle overlaps nothing, the particles that found no free site stay due for the next updates
+    void UpdateEmitters(float deltaTime);
+
+    // Return the emitters of the scene
+    const std::vector<ParticleEmitter>& GetEmitters() const { return m_Emitters; }
+
+    // Method to clear all emitters, streams included
+    void ClearEmitters() { m_Emitters.clear(); }
+
+    // Remove every particle whose mask entry isn't 0, mask has one entry per particle. All the columns are compacted in
+    // parallel, in order or by swapping (see SetUseStableRemoval), and the grid cells of the last build are patched instead
+    // of rebuilt. Ids are stable: the remaining particles keep theirs and the removed ones map to REMOVED_PARTICLE_INDEX.
+    // Returns the number of particles removed
+    size_t RemoveParticles(const std::vector<uint8_t>& mask);
+
+    // Return true if removals keep the memory order of the remaining particles
+    bool GetUseStableRemoval() const { return m_UseStableRemoval; }
+
+    // Set if removals keep the memory order of the remaining particles, moving all of them, or fill the holes with the
+    // last particles, moving only as many as were removed
+    void SetUseStableRemoval(bool v) { m_UseStableRemoval = v; }
+
+    // Add a region removing the particles entering it. Sinks aren't saved in snapshots
+    void AddSink(const Vec2& bottomLeft, const Vec2& topRight);
+
+    // Return the sinks of the scene
+    const std::vector<ParticleSink>& GetSinks() const { return m_Sinks; }
+
+    // Method to clear all sinks
+    void ClearSinks() { m_Sinks.clear(); }
+
+    // Return the number of particles removed since the scene was created or reset
+    uint64_t GetRemovedCount() const { return m_RemovedCount; }
 
     // Method to clear all particles
     void ClearParticles() {
@@ -119,39 +370,75 @@ public:
         m_PrevPositions.clear();
         m_Accelerations.clear();
         m_Masses.clear();
+        m_Radii.clear();
         m_Temperatures.clear();
+        m_SleepCounters.clear();
+        m_SleepAnchors.clear();
         m_Densities.clear();
         m_Pressures.clear();
+        m_ParticleIds.clear();
+        m_IdToIndex.clear();
+        m_LiveIds.clear();
+        m_NextParticleId = 0;
         m_SpatialGridInitialized = false;
     }
 
     // Method to completely reset the simulation state
     void Reset(float particleRadius);
 
+    // Write particles, streams, bounds and physics constants to a binary snapshot file
+    bool SaveSnapshot(const std::string& path) const;
+
+    // Replace the whole simulation state with a snapshot written by SaveSnapshot, the current state is kept on failure
+    bool LoadSnapshot(const std::string& path);
+
     // Method to change the masses of all the particles in the simulation
     void UpdateMass(float newMass);
 
-    // Method to get active stream count
-    size_t GetActiveStreamCount() const { return m_Streams.size(); }
+    // Return the enabled optional columns, ATTRIBUTE_* flags
+    uint32_t GetAttributes() const { return m_Attributes; }
+
+    // Return true if the optional column is enabled
+    bool HasAttribute(uint32_t attribute) const { return (m_Attributes & attribute) != 0; }
+
+    // Enable a set of optional columns. Newly enabled columns get their default for the existing particles
+    // (no acceleration, the uniform mass, zero temperature, density and pressure), disabled ones are freed.
+    // The fluid mode keeps FLUID_ATTRIBUTES enabled
+    void SetAttributes(uint32_t attributes);
+
+    // Return the mass of every particle when the masses are disabled
+    float GetUniformMass() const { return m_UniformMass; }
+
+    // Return the mass of a particle whether the masses are enabled or not
+    float GetMass(size_t index) const { return HasAttribute(ATTRIBUTE_MASSES) ? m_Masses[index] : m_UniformMass; }
+
+    // Return the temperature of a particle, 0 when the temperatures are disabled
+    float GetTemperature(size_t index) const { return HasAttribute(ATTRIBUTE_TEMPERATURES) ? m_Temperatures[index] : 0.0f; }
+
+    // Method to get emitter count
+    size_t GetEmitterCount() const { return m_Emitters.size(); }
 
     // Method to get particle count
     size_t GetParticleCount() const { return m_Positions.size(); }
 
-    // Return projection matrix for rendering the simulation
-    glm::mat4 GetProjMatrix() const;
+    // Return projection matrix for rendering the given bounds in a window with the given aspect ratio
+    static glm::mat4 GetProjMatrix(const Bounds& bounds, float zoom, float windowAspect);
 
-    // Return a view matrix for the simulation
-    glm::mat4 GetViewMatrix() const;
+    // Return a view matrix centered on the given bounds and offset by the camera position
+    static glm::mat4 GetViewMatrix(const Bounds& bounds, const Vec2& cameraPosition);
 
-    // Return particle radius
+    // Return the radius of new particles, the smallest one with a radius spread. The thresholds given in radii are relative to it
     float GetParticleRadius() const { return m_ParticleRadius; }
 
+    // Return the ratio between the largest and the smallest radius of new particles
+    float GetRadiusSpread() const { return m_RadiusSpread; }
+
+    // Set the ratio between the largest and the smallest radius of new particles, 1 gives them all the same size
+    void SetRadiusSpread(float spread) { m_RadiusSpread = std::max(spread, 1.0f); }
+
     // Return simulation center
     Vec2 GetSimCenter() const { return (m_Bounds.topRight + m_Bounds.bottomLeft) * 0.5f; }
 
-    // Return simulation zoom
-    float GetZoom() const { return m_Zoom; }
-
     // Return check for spaceBar
     bool GetIsSpaceBarPressed() const { return m_IsSpaceBarPressed; }
 
@@ -164,27 +451,117 @@ public:
     // Set simulation Substeps
     void SetSubSteps(unsigned int newSub) { m_subSteps = newSub;}
 
+    // Return true if the substep count follows the motion of the particles
+    bool GetUseAdaptiveSubSteps() const { return m_UseAdaptiveSubSteps; }
+
+    // Set if the substep count follows the motion of the particles, SetSubSteps only sets the starting count then
+    void SetUseAdaptiveSubSteps(bool v) { m_UseAdaptiveSubSteps = v; }
+
+    // Return the range of the adaptive substep count
+    unsigned int GetMinSubSteps() const { return m_MinSubSteps; }
+    unsigned int GetMaxSubSteps() const { return m_MaxSubSteps; }
+
+    // Set the range of the adaptive substep count, at least 1 substep
+    void SetSubStepRange(unsigned int minSubSteps, unsigned int maxSubSteps);
+
+    // Return the largest move of a particle during one substep the controller aims for, in radii
+    float GetTargetDisplacement() const { return m_TargetDisplacement; }
+    void SetTargetDisplacement(float radii) { m_TargetDisplacement = radii; }
+
+    // Return the largest overlap left to the collision pass the controller aims for, in radii
+    float GetTargetOverlap() const { return m_TargetOverlap; }
+    void SetTargetOverlap(float radii) { m_TargetOverlap = radii; }
+
+    // Return the positions at the last grid build if the emitters need them and no particle was added or removed since,
+    // nullptr otherwise. The velocity cap pass measures the drift from them
+    const std::vector<Vec2>* GetGridAnchors() const { return m_GridAnchors.size() == m_Positions.size() ? &m_GridAnchors : nullptr; }
+
+    // Record the largest distance a particle moved from the grid anchors
+    void SetGridDrift(float drift) { m_GridDrift = drift; }
+
+    // Return what the controller measured and chose during the last update
+    const SubStepStats& GetSubStepStats() const { return m_SubStepStats; }
+
+    // Choose the substep count of the next update from the motion of the last one (absolute units), called by SolvePhysics.
+    // The previous positions are rescaled when the count changes so the velocities stay the same
+    void AdaptSubSteps(float maxDisplacement, float maxOverlap);
+
+    // Return the scratch of the passes measuring maxima, THREAD_MAXIMA_STRIDE floats per thread so each thread has its own
+    // cache line. It is all zeros, a pass zeroes it again once it reduced its maxima
+    std::vector<float>& GetThreadMaxima();
+
+    // Return true if settled particles are put to sleep
+    bool GetUseSleeping() const { return m_UseSleeping; }
+
+    // Set if settled particles are put to sleep, disabling it wakes every particle
+    void SetUseSleeping(bool v);
+
+    // Return the displacement per substep, and from where it settled, under which a particle counts as settled, in radii
+    float GetSleepThreshold() const { return m_SleepThreshold; }
+    void SetSleepThreshold(float radii) { m_SleepThreshold = radii; }
+
+    // Return the displacement per substep over which a particle wakes the sleeping particles around it, in radii
+    float GetWakeThreshold() const { return m_WakeThreshold; }
+    void SetWakeThreshold(float radii) { m_WakeThreshold = radii; }
+
+    // Return how many substeps in a row a particle has to stay settled before it falls asleep
+    unsigned int GetSleepSubSteps() const { return m_SleepSubSteps; }
+
+    // Set how many substeps in a row a particle has to stay settled before it falls asleep, 1 to PARTICLE_ASLEEP - 1
+    void SetSleepSubSteps(unsigned int subSteps);
+
+    // Return the number of sleeping particles as of the last wake pass
+    unsigned int GetSleepingCount() const { return m_SleepingCount; }
+
+    // Return 1 for every grid cell (of every level) holding an awake particle or guest, valid after UpdateSleepStates
+    const std::vector<uint8_t>& GetCellIsAwake() const { return m_CellIsAwake; }
+
+    // Wake the sleeping particles in and around the cells where a particle moves faster than the wake
+    // threshold and flag the cells holding awake particles. Called by the solver after every grid build
+    void UpdateSleepStates();
+
+    // Return true if the collision passes reuse the candidate pairs of the last grid build
+    bool GetUseNeighborLists() const { return m_UseNeighborLists; }
+
+    // Set if the collision passes reuse the candidate pairs of the last grid build. Takes over from the fused collisions
+    void SetUseNeighborLists(bool v);
+
+    // Return the margin added to the contact distance of the listed pairs, in radii
+    float GetNeighborSkin() const { return m_NeighborSkin; }
+
+    // Set the margin added to the contact distance of the listed pairs, in radii. It is clamped to the free room the grid
+    // cells leave around the contacts of their largest particles, 0.5 without a radius spread
+    void SetNeighborSkin(float radii);
+
+    // Return the rebuilds and the size of the neighbor list
+    const NeighborListStats& GetNeighborListStats() const { return m_NeighborListStats; }
+
+    // Make sure the grid and its pair list cover every contact: rebuild them if the list is missing or a particle moved
+    // more than half the skin since the last build, returns true if they were rebuilt. Called by the collision pass
+    bool UpdateNeighborList();
+
+    // Return true if the particles behave as a fluid
+    bool GetUseFluid() const { return m_UseFluid; }
+
+    // Switch between granular contacts and the SPH fluid pass. The fluid enables FLUID_ATTRIBUTES and doesn't sleep
+    void SetUseFluid(bool v);
+
+    // Return the stiffness, viscosity and rest density of the fluid mode
+    const FluidSettings& GetFluidSettings() const { return m_FluidSettings; }
+    void SetFluidSettings(const FluidSettings& settings) { m_FluidSettings = settings; }
+
+    // Return the neighbor buffers of the fluid pass, one per thread once the pass sized them
+    std::vector<FluidCandidates>& GetFluidCandidates() { return m_FluidCandidates; }
+
     // Return the number of particles currently inside the simulation
     unsigned int GetCurNumOfParticles() const { return m_CurrentNumOfParticles; }
 
-    // Set the zoom level
-    void SetZoom(float zoom) { m_Zoom = zoom; }
-
     // Set is SpaceBar pressed check to add a central force
     void SetIsSpaceBarPressed(bool v) { m_IsSpaceBarPressed = v; }
 
     // Set if simulation is paused with p button
     void SetIsPaused(bool v) { m_IsPaused = v; }
 
-    // Get camera position
-    const Vec2& GetCameraPosition() const { return m_CameraPosition; }
-
-    // Set camera position
-    void SetCameraPosition(const Vec2& position) { m_CameraPosition = position; }
-
-    // Move camera by offset
-    void MoveCamera(const Vec2& offset) { m_CameraPosition += offset; }
-
     // Getters for spatial grid 
     SpatialGrid& GetSpatialGrid() { return m_SpatialGrid; }
     const SpatialGrid& GetSpatialGrid() const { return m_SpatialGrid; }
@@ -192,6 +569,72 @@ public:
     // Initialize or update the spatial grid
     void UpdateSpatialGrid();
 
+    // Getters for the solver thread pool
+    ThreadPool& GetThreadPool() { return m_ThreadPool; }
+
+    // Return the number of threads used by the solver
+    unsigned int GetNumThreads() const { return m_ThreadPool.GetNumThreads(); }
+
+    // Set the number of threads used by the solver, 0 uses the hardware concurrency
+    void SetNumThreads(unsigned int numThreads) { m_ThreadPool.SetNumThreads(numThreads); }
+
+    // Getters for the phase profiler
+    Profiler& GetProfiler() { return m_Profiler; }
+    const Profiler& GetProfiler() const { return m_Profiler; }
+
+    // Return true if the spatial grid only stores its occupied cells
+    bool GetUseHashedGrid() const { return m_UseHashedGrid; }
+
+    // Set if the spatial grid stores only its occupied cells or every cell of the bounds, the grid is recreated on the next update
+    void SetUseHashedGrid(bool v)
+    {
+        m_UseHashedGrid = v;
+        m_SpatialGridInitialized = false;
+    }
+
+    // Return true if collisions are resolved during the grid traversal
+    bool GetUseFusedCollisions() const { return m_UseFusedCollisions; }
+
+    // Set if collisions are resolved during the grid traversal or from the collision pair list
+    void SetUseFusedCollisions(bool v) { m_UseFusedCollisions = v; }
+
+    // Return true if integration and boundary collisions run in the same pass
+    bool GetUseFusedIntegration() const { return m_UseFusedIntegration; }
+
+    // Set if integration and boundary collisions run in the same pass or in separate ones
+    void SetUseFusedIntegration(bool v) { m_UseFusedIntegration = v; }
+
+    // Return the instruction set used by the integration kernel
+    SimdLevel GetSimdLevel() const { return m_SimdLevel; }
+
+    // Return the best instruction set supported by this machine
+    SimdLevel GetMaxSimdLevel() const { return m_MaxSimdLevel; }
+
+    // Set the instruction set used by the integration kernel, clamped to what the machine supports
+    void SetSimdLevel(SimdLevel level) { m_SimdLevel = (level > m_MaxSimdLevel) ? m_MaxSimdLevel : level; }
+
+    // Return the seed of the random placement of AddBulkParticles
+    unsigned int GetSeed() const { return m_Seed; }
+
+    // Restart the random placement from the given seed, the same seed and scene setup give the same particles
+    void SetSeed(unsigned int seed) { m_Seed = seed; m_RandomGenerator.seed(seed); }
+
+    // Return true if the results don't depend on the number of threads and a state hash is computed every update
+    bool GetIsDeterministic() const { return m_IsDeterministic; }
+
+    // Set the deterministic mode
+    void SetIsDeterministic(bool v) { m_IsDeterministic = v; }
+
+    // Return the number of updates since the scene was created or reset
+    uint64_t GetStepIndex() const { return m_StepIndex; }
+
+    // Return the state hash of the last update, only computed in deterministic mode
+    uint64_t GetStateHash() const { return m_StateHash; }
+
+    // Hash the bits of positions, previous positions, masses and temperatures in particle id order. The result
+    // doesn't depend on the memory order of the particles nor on the number of threads
+    uint64_t ComputeStateHash();
+
     // Get mouse position, set to {-1, -1} if mouse is outside of simulation window
     const Vec2 GetMousePosition() const { return m_MousePos; }
 
@@ -234,9 +677,6 @@ public:
         Vec2 center = GetSimCenter();
         m_SimWidth = w;
 
-        // Adjust zoom proportionally to maintain the same visual width
-        m_Zoom *= w / m_SimWidth;
-
         // Recalculate bounds based on center
         m_Bounds.bottomLeft = Vec2(center.x - m_SimWidth / 2, center.y - m_SimHeight / 2);
         m_Bounds.topRight = Vec2(center.x + m_SimWidth / 2, center.y + m_SimHeight / 2);
@@ -245,5 +685,6 @@ public:
         m_SpatialGridInitialized = false;
     }
     
-    void SetParticleRadius(float newRad) { m_ParticleRadius = newRad; m_SpatialGridInitialized = false;}
+    // Set the radius of new particles, the radius of every particle is scaled by the same factor
+    void SetParticleRadius(float newRad);
 };
\ No newline at end of file
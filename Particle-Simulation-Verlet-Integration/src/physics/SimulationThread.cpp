@@ -0,0 +1,206 @@
+#include "SimulationThread.h"
+
+#include <chrono>
+#include <algorithm>
+
+SimulationThread::SimulationThread(SimulationSystem& simulation, float fixedDeltaTime)
+    : m_Simulation(simulation), m_FixedDeltaTime(fixedDeltaTime), m_StopRequested(false), m_IsSuspended(false),
+    m_IsRunning(false), m_CommandsPosted(0), m_CommandsExecuted(0)
+{
+}
+
+SimulationThread::~SimulationThread()
+{
+    Stop();
+}
+
+void SimulationThread::Start()
+{
+    if (m_IsRunning)
+        return;
+
+    // The reader has something to show before the first update
+    ExecuteCommands();
+    PublishFrame();
+
+    m_StopRequested = false;
+    m_IsRunning = true;
+    m_Thread = std::thread(&SimulationThread::ThreadLoop, this);
+}
+
+void SimulationThread::Stop()
+{
+    if (!m_IsRunning)
+        return;
+
+    m_StopRequested = true;
+    m_Thread.join();
+    m_IsRunning = false;
+
+    m_Recorder.Stop();
+}
+
+uint64_t SimulationThread::Post(Command command)
+{
+    const uint64_t sequence = ++m_CommandsPosted;
+
+    // Nobody else touches the simulation when the thread isn't running
+    if (!m_IsRunning)
+    {
+        command(m_Simulation);
+        m_CommandsExecuted++;
+        return sequence;
+    }
+
+    // Only full if the simulation thread is stuck in a very long update
+    while (!m_Commands.TryPush(std::move(command)))
+        std::this_thread::yield();
+
+    return sequence;
+}
+
+void SimulationThread::SetInput(const SimulationInput& input)
+{
+    Post([input](SimulationSystem& sim)
+    {
+        sim.SetMousePosition(input.mousePosition.x, input.mousePosition.y);
+        sim.SetIsSpaceBarPressed(input.isSpaceBarPressed);
+        sim.SetIsMouseLeftClicked(input.isLeftClickPressed);
+        sim.SetIsMouseRightClicked(input.isRightClickPressed);
+    });
+}
+
+void SimulationThread::StartRecording(const std::string& path)
+{
+    Post([this, path](SimulationSystem& sim)
+    {
+        m_Recorder.Start(path, sim, m_FixedDeltaTime);
+    });
+}
+
+void SimulationThread::StopRecording()
+{
+    Post([this](SimulationSystem&)
+    {
+        m_Recorder.Stop();
+    });
+}
+
+bool SimulationThread::ExecuteCommands()
+{
+    bool hasExecuted = false;
+    Command command;
+    while (m_Commands.TryPop(command))
+    {
+        command(m_Simulation);
+        m_CommandsExecuted++;
+        hasExecuted = true;
+    }
+    return hasExecuted;
+}
+
+void SimulationThread::PublishFrame()
+{
+    SimulationFrame& frame = m_Frames.GetWriteBuffer();
+
+    // assign keeps the capacity of the recycled buffer, no allocation once the particle count is stable
+    frame.positions.assign(m_Simulation.GetPositions().begin(), m_Simulation.GetPositions().end());
+    frame.prevPositions.assign(m_Simulation.GetPrevPositions().begin(), m_Simulation.GetPrevPositions().end());
+    frame.temperatures.assign(m_Simulation.GetTemperatures().begin(), m_Simulation.GetTemperatures().end());
+    frame.pressures.assign(m_Simulation.GetPressures().begin(), m_Simulation.GetPressures().end());
+    frame.radii.assign(m_Simulation.GetRadii().begin(), m_Simulation.GetRadii().end());
+
+    frame.bounds = m_Simulation.GetBounds();
+    frame.particleRadius = m_Simulation.GetParticleRadius();
+    frame.radiusSpread = m_Simulation.GetRadiusSpread();
+    frame.subSteps = m_Simulation.GetSubSteps();
+    frame.subStepStats = m_Simulation.GetSubStepStats();
+    frame.sleepingCount = m_Simulation.GetSleepingCount();
+    frame.neighborListStats = m_Simulation.GetNeighborListStats();
+    frame.useHashedGrid = m_Simulation.GetUseHashedGrid();
+    frame.gridCellCount = m_Simulation.GetSpatialGrid().GetTotalCellCount();
+    frame.currentNumOfParticles = m_Simulation.GetCurNumOfParticles();
+    frame.reorderInterval = m_Simulation.GetReorderInterval();
+    frame.attributes = m_Simulation.GetAttributes();
+    frame.useFluid = m_Simulation.GetUseFluid();
+    frame.sinks = m_Simulation.GetSinks();
+    frame.removedCount = m_Simulation.GetRemovedCount();
+    frame.emitters.clear();
+    frame.emittedCount = 0;
+    for (const ParticleEmitter& emitter : m_Simulation.GetEmitters())
+    {
+        frame.emitters.push_back(emitter.GetSettings());
+        frame.emittedCount += emitter.GetSpawned();
+    }
+    frame.isPaused = m_Simulation.GetIsPaused();
+    frame.constants = GetPhysicsConstants();
+    frame.stepIndex = m_Simulation.GetStepIndex();
+    frame.stateHash = m_Simulation.GetStateHash();
+    frame.commandsExecuted = m_CommandsExecuted;
+
+    const Profiler& profiler = m_Simulation.GetProfiler();
+    frame.isProfilerEnabled = profiler.GetIsEnabled();
+    frame.profiledFrames = profiler.GetRecordedFrames();
+    for (size_t p = 0; p < static_cast<size_t>(ProfilePhase::Count); p++)
+        frame.phaseStats[p] = profiler.GetStats(static_cast<ProfilePhase>(p));
+
+    frame.isRecording = m_Recorder.IsRecording();
+    frame.recordedFrames = m_Recorder.GetFramesWritten();
+    frame.recordedBytes = m_Recorder.GetBytesWritten();
+    frame.recordedRawBytes = m_Recorder.GetRawBytes();
+    frame.recordingStalls = m_Recorder.GetStalls();
+
+    m_Frames.Publish();
+}
+
+void SimulationThread::ThreadLoop()
+{
+    typedef std::chrono::steady_clock Clock;
+
+    // Same limits as Time::update
+    const int maxStepsPerIteration = 100;
+    const double maxElapsed = 0.25;
+
+    Clock::time_point lastTime = Clock::now();
+    double accumulator = 0.0;
+
+    while (!m_StopRequested)
+    {
+        const bool hasExecutedCommands = ExecuteCommands();
+
+        const Clock::time_point now = Clock::now();
+        const double elapsed = std::min(std::chrono::duration<double>(now - lastTime).count(), maxElapsed);
+        lastTime = now;
+
+        // Fixed steps covering the elapsed time, nothing accumulates while paused
+        int steps = 0;
+        if (!m_IsSuspended && !m_Simulation.GetIsPaused())
+        {
+            accumulator += elapsed;
+            steps = std::min(maxStepsPerIteration, static_cast<int>(accumulator / m_FixedDeltaTime));
+            accumulator -= steps * m_FixedDeltaTime;
+        }
+        else
+        {
+            accumulator = 0.0;
+        }
+
+        for (int i = 0; i < steps; i++)
+        {
+            m_Simulation.Update(m_FixedDeltaTime);
+            m_Recorder.CaptureFrame(m_Simulation);
+        }
+
+        if (steps > 0 || hasExecutedCommands)
+            PublishFrame();
+
+        // Sleep until the next step is due, commands are still picked up every millisecond while paused
+        if (steps == 0)
+        {
+            const double untilNextStep = (accumulator > 0.0) ? m_FixedDeltaTime - accumulator : 0.001;
+            std::this_thread::sleep_for(std::chrono::duration<double>(std::max(untilNextStep, 0.0)));
+        }
+    }
+
+    ExecuteCommands();
+}
@@ -0,0 +1,145 @@
+#pragma once
+#include <vector>
+#include <string>
+#include <thread>
+#include <atomic>
+#include <functional>
+#include <cstdint>
+
+#include "Vec2.h"
+#include "SimulationSystem.h"
+#include "TrajectoryRecorder.h"
+#include "Constants.h"
+#include "../core/Profiler.h"
+#include "../core/TripleBuffer.h"
+#include "../core/SpscQueue.h"
+
+// Immutable copy of the simulation published after the updates of a loop iteration, everything the
+// render thread and the interface need so they never read the simulation itself
+struct SimulationFrame
+{
+    // Particles in memory order, the velocity is encoded by the previous positions like in the solver
+    std::vector<Vec2> positions;
+    std::vector<Vec2> prevPositions;
+    std::vector<float> temperatures;    // empty when the temperature column is disabled
+    std::vector<float> pressures;       // empty when the pressure column is disabled
+    std::vector<float> radii;
+
+    Bounds bounds = {};
+    float particleRadius = 0.0f;       // radius of new particles
+    float radiusSpread = 1.0f;
+    unsigned int subSteps = 1;          // substeps of the next update
+    SubStepStats subStepStats;
+    unsigned int sleepingCount = 0;
+    NeighborListStats neighborListStats;
+    bool useHashedGrid = false;
+    size_t gridCellCount = 0;           // occupied cells when the grid is hashed
+    unsigned int currentNumOfParticles = 0;
+    unsigned int reorderInterval = 0;
+    uint32_t attributes = 0;            // enabled optional columns
+    bool useFluid = false;
+    std::vector<ParticleSink> sinks;
+    uint64_t removedCount = 0;
+    std::vector<EmitterSettings> emitters;
+    int emittedCount = 0;               // particles spawned by the emitters
+    bool isPaused = false;
+    PhysicsConstants constants;
+
+    uint64_t stepIndex = 0;
+    uint64_t stateHash = 0;
+    uint64_t commandsExecuted = 0;  // commands that ran before this frame was captured, see SimulationThread::Post
+
+    // Profiler
+    bool isProfilerEnabled = false;
+    size_t profiledFrames = 0;
+    ProfilePhaseStats phaseStats[static_cast<size_t>(ProfilePhase::Count)];
+
+    // Trajectory recording
+    bool isRecording = false;
+    uint64_t recordedFrames = 0;
+    uint64_t recordedBytes = 0;
+    uint64_t recordedRawBytes = 0;
+    uint64_t recordingStalls = 0;
+};
+
+// Input of the window, sent to the simulation thread only when it changes
+struct SimulationInput
+{
+    Vec2 mousePosition = { -1.0f, -1.0f };  // {-1, -1} if outside the simulation
+    bool isSpaceBarPressed = false;
+    bool isLeftClickPressed = false;
+    bool isRightClickPressed = false;
+};
+
+// Runs SimulationSystem::Update on its own thread at a fixed rate. Once started, the simulation
+// belongs to that thread: other threads change it through commands and read it through the
+// published frames, neither of them ever blocks the other.
+class SimulationThread
+{
+public:
+    using Command = std::function<void(SimulationSystem&)>;
+
+private:
+    static const size_t COMMAND_QUEUE_CAPACITY = 256;
+
+    SimulationSystem& m_Simulation;
+    float m_FixedDeltaTime;
+
+    std::thread m_Thread;
+    std::atomic<bool> m_StopRequested;
+    std::atomic<bool> m_IsSuspended;
+    bool m_IsRunning;
+
+    SpscQueue<Command, COMMAND_QUEUE_CAPACITY> m_Commands;
+    uint64_t m_CommandsPosted;          // producer side
+    uint64_t m_CommandsExecuted;        // simulation thread side
+
+    TripleBuffer<SimulationFrame> m_Frames;
+
+    // Owned by the simulation thread so every update is captured
+    TrajectoryRecorder m_Recorder;
+
+    void ThreadLoop();
+
+    // Run the queued commands, returns true if there was any
+    bool ExecuteCommands();
+
+    // Copy the simulation into the write buffer and publish it
+    void PublishFrame();
+
+public:
+    SimulationThread(SimulationSystem& simulation, float fixedDeltaTime);
+    ~SimulationThread();
+
+    SimulationThread(const SimulationThread&) = delete;
+    SimulationThread& operator=(const SimulationThread&) = delete;
+
+    // Publish a first frame and start stepping
+    void Start();
+
+    // Finish the current iteration, run the remaining commands and join the thread. The simulation can be used directly again
+    void Stop();
+
+    // Queue command to run on the simulation thread before the next update, from one thread only (the one driving the interface).
+    // Returns the sequence number of the command, frames with commandsExecuted >= it reflect its effect
+    uint64_t Post(Command command);
+
+    // Send the window input
+    void SetInput(const SimulationInput& input);
+
+    // Stop or resume stepping without touching the pause state of the simulation, e.g. while a replay is shown
+    void SetIsSuspended(bool v) { m_IsSuspended = v; }
+    bool GetIsSuspended() const { return m_IsSuspended; }
+
+    // Take the newest published frame if there is one, returns true if GetFrame changed
+    bool AcquireFrame() { return m_Frames.Acquire(); }
+
+    // Frame taken by the last AcquireFrame, valid until the next call
+    const SimulationFrame& GetFrame() const { return m_Frames.GetReadBuffer(); }
+
+    // Record every update to a trajectory file, see TrajectoryRecorder
+    void StartRecording(const std::string& path);
+    void StopRecording();
+
+    float GetFixedDeltaTime() const { return m_FixedDeltaTime; }
+};
@@ -0,0 +1,290 @@
+#include "Snapshot.h"
+#include "ParticleEmitter.h"
+
+#include <fstream>
+#include <iostream>
+#include <cstring>
+#include <limits>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+static uint64_t AlignUp(uint64_t value)
+{
+    return (value + SNAPSHOT_ALIGNMENT - 1) / SNAPSHOT_ALIGNMENT * SNAPSHOT_ALIGNMENT;
+}
+
+bool IsLittleEndianHost()
+{
+    const uint32_t value = 1;
+    unsigned char firstByte;
+    std::memcpy(&firstByte, &value, 1);
+    return firstByte == 1;
+}
+
+bool WriteSnapshot(const std::string& path, SnapshotHeader header, const std::vector<SnapshotEmitter>& emitters,
+    const std::vector<SnapshotRateKey>& rateKeys, const std::vector<SnapshotColumnData>& columns)
+{
+    if (!IsLittleEndianHost())
+    {
+        std::cerr << "Snapshots can only be written on little-endian machines" << std::endl;
+        return false;
+    }
+
+    std::memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.version = SNAPSHOT_VERSION;
+    header.headerSize = sizeof(SnapshotHeader);
+    header.columnCount = static_cast<uint32_t>(columns.size());
+    header.emitterCount = static_cast<uint32_t>(emitters.size());
+    header.rateKeyCount = static_cast<uint32_t>(rateKeys.size());
+
+    // Column blocks go after the tables, every block aligned so the mapped columns can be used by vector loads
+    std::vector<SnapshotColumnEntry> entries(columns.size());
+    uint64_t offset = AlignUp(sizeof(SnapshotHeader) + entries.size() * sizeof(SnapshotColumnEntry) + emitters.size() * sizeof(SnapshotEmitter)
+        + rateKeys.size() * sizeof(SnapshotRateKey));
+    for (size_t c = 0; c < columns.size(); c++)
+    {
+        entries[c].column = static_cast<uint32_t>(columns[c].column);
+        entries[c].elementSize = columns[c].elementSize;
+        entries[c].offset = offset;
+        entries[c].byteSize = header.particleCount * columns[c].elementSize;
+        offset = AlignUp(offset + entries[c].byteSize);
+    }
+
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    if (!file.good())
+    {
+        std::cerr << "Cannot open " << path << " for writing" << std::endl;
+        return false;
+    }
+
+    const char padding[SNAPSHOT_ALIGNMENT] = {};
+    uint64_t written = 0;
+    auto write = [&](const void* data, uint64_t size)
+    {
+        file.write(static_cast<const char*>(data), static_cast<std::streamsize>(size));
+        written += size;
+    };
+    auto pad = [&]()
+    {
+        write(padding, AlignUp(written) - written);
+    };
+
+    write(&header, sizeof(header));
+    if (!entries.empty())
+        write(entries.data(), entries.size() * sizeof(SnapshotColumnEntry));
+    if (!emitters.empty())
+        write(emitters.data(), emitters.size() * sizeof(SnapshotEmitter));
+    if (!rateKeys.empty())
+        write(rateKeys.data(), rateKeys.size() * sizeof(SnapshotRateKey));
+    pad();
+
+    for (size_t c = 0; c < columns.size(); c++)
+    {
+        if (entries[c].byteSize > 0)
+            write(columns[c].data, entries[c].byteSize);
+        pad();
+    }
+
+    if (!file.good())
+    {
+        std::cerr << "Failed to write " << path << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+MappedSnapshot::MappedSnapshot()
+    : m_Data(nullptr), m_Size(0),
+#ifdef _WIN32
+    m_FileHandle(nullptr), m_MappingHandle(nullptr)
+#else
+    m_FileDescriptor(-1)
+#endif
+{
+}
+
+MappedSnapshot::~MappedSnapshot()
+{
+    Close();
+}
+
+bool MappedSnapshot::Open(const std::string& path)
+{
+    Close();
+
+    if (!IsLittleEndianHost())
+    {
+        std::cerr << "Snapshots can only be loaded on little-endian machines" << std::endl;
+        return false;
+    }
+
+#ifdef _WIN32
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+    {
+        std::cerr << "Cannot open " << path << std::endl;
+        return false;
+    }
+
+    LARGE_INTEGER fileSize;
+    GetFileSizeEx(file, &fileSize);
+    HANDLE mapping = fileSize.QuadPart > 0 ? CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr) : nullptr;
+    const void* data = mapping ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+    if (!data)
+    {
+        std::cerr << "Cannot map " << path << std::endl;
+        if (mapping) CloseHandle(mapping);
+        CloseHandle(file);
+        return false;
+    }
+
+    m_FileHandle = file;
+    m_MappingHandle = mapping;
+    m_Size = static_cast<size_t>(fileSize.QuadPart);
+#else
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        std::cerr << "Cannot open " << path << std::endl;
+        return false;
+    }
+
+    struct stat fileStat;
+    void* data = MAP_FAILED;
+    if (fstat(fd, &fileStat) == 0 && fileStat.st_size > 0)
+        data = mmap(nullptr, static_cast<size_t>(fileStat.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+
+    if (data == MAP_FAILED)
+    {
+        std::cerr << "Cannot map " << path << std::endl;
+        close(fd);
+        return false;
+    }
+
+    m_FileDescriptor = fd;
+    m_Size = static_cast<size_t>(fileStat.st_size);
+#endif
+
+    m_Data = static_cast<const unsigned char*>(data);
+
+    if (!Validate(path))
+    {
+        Close();
+        return false;
+    }
+
+    return true;
+}
+
+void MappedSnapshot::Close()
+{
+#ifdef _WIN32
+    if (m_Data) UnmapViewOfFile(m_Data);
+    if (m_MappingHandle) CloseHandle(m_MappingHandle);
+    if (m_FileHandle) CloseHandle(m_FileHandle);
+    m_FileHandle = nullptr;
+    m_MappingHandle = nullptr;
+#else
+    if (m_Data) munmap(const_cast<unsigned char*>(m_Data), m_Size);
+    if (m_FileDescriptor >= 0) close(m_FileDescriptor);
+    m_FileDescriptor = -1;
+#endif
+
+    m_Data = nullptr;
+    m_Size = 0;
+}
+
+bool MappedSnapshot::Validate(const std::string& path) const
+{
+    if (m_Size < sizeof(SnapshotHeader) || std::memcmp(m_Data, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)) != 0)
+    {
+        std::cerr << path << " is not a snapshot file" << std::endl;
+        return false;
+    }
+
+    const SnapshotHeader& header = GetHeader();
+    if (header.version != SNAPSHOT_VERSION || header.headerSize != sizeof(SnapshotHeader))
+    {
+        std::cerr << path << " has snapshot version " << header.version << ", expected " << SNAPSHOT_VERSION << std::endl;
+        return false;
+    }
+
+    const uint64_t tablesSize = sizeof(SnapshotHeader) + static_cast<uint64_t>(header.columnCount) * sizeof(SnapshotColumnEntry)
+        + static_cast<uint64_t>(header.emitterCount) * sizeof(SnapshotEmitter) + static_cast<uint64_t>(header.rateKeyCount) * sizeof(SnapshotRateKey);
+    if (tablesSize > m_Size)
+    {
+        std::cerr << path << " is truncated" << std::endl;
+        return false;
+    }
+
+    // The columns are indexed with size_t, which is 32 bits wide on 32-bit builds
+    if (header.particleCount > std::numeric_limits<size_t>::max())
+    {
+        std::cerr << path << " has " << header.particleCount << " particles, more than this build can address" << std::endl;
+        return false;
+    }
+
+    // Every column has to hold exactly one element per particle and lie inside the file. The count is checked
+    // against the file size first, so a corrupted one cannot overflow the column size
+    const SnapshotColumnEntry* entries = reinterpret_cast<const SnapshotColumnEntry*>(m_Data + sizeof(SnapshotHeader));
+    for (uint32_t c = 0; c < header.columnCount; c++)
+    {
+        const SnapshotColumnEntry& entry = entries[c];
+        if (entry.elementSize == 0 || header.particleCount > m_Size / entry.elementSize
+            || entry.byteSize != header.particleCount * entry.elementSize || entry.offset > m_Size || entry.byteSize > m_Size - entry.offset)
+        {
+            std::cerr << path << " has a corrupted column " << entry.column << std::endl;
+            return false;
+        }
+    }
+
+    const SnapshotEmitter* emitters = GetEmitters();
+    for (uint32_t e = 0; e < header.emitterCount; e++)
+    {
+        const SnapshotEmitter& emitter = emitters[e];
+        if (emitter.shape > static_cast<uint32_t>(EmitterShape::Rect) || emitter.firstRateKey > header.rateKeyCount
+            || emitter.rateKeyCount > header.rateKeyCount - emitter.firstRateKey)
+        {
+            std::cerr << path << " has a corrupted emitter " << e << std::endl;
+            return false;
+        }
+    }
+
+    return true;
+}
+
+const SnapshotEmitter* MappedSnapshot::GetEmitters() const
+{
+    const SnapshotHeader& header = GetHeader();
+    return reinterpret_cast<const SnapshotEmitter*>(m_Data + sizeof(SnapshotHeader) + header.columnCount * sizeof(SnapshotColumnEntry));
+}
+
+const SnapshotRateKey* MappedSnapshot::GetRateKeys() const
+{
+    const SnapshotHeader& header = GetHeader();
+    return reinterpret_cast<const SnapshotRateKey*>(GetEmitters() + header.emitterCount);
+}
+
+const void* MappedSnapshot::FindColumn(SnapshotColumn column, uint32_t elementSize) const
+{
+    const SnapshotHeader& header = GetHeader();
+    const SnapshotColumnEntry* entries = reinterpret_cast<const SnapshotColumnEntry*>(m_Data + sizeof(SnapshotHeader));
+
+    for (uint32_t c = 0; c < header.columnCount; c++)
+    {
+        if (entries[c].column == static_cast<uint32_t>(column))
+            return entries[c].elementSize == elementSize ? m_Data + entries[c].offset : nullptr;
+    }
+
+    return nullptr;
+}
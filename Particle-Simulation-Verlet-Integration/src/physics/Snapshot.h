@@ -0,0 +1,181 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// Binary checkpoint of a SimulationSystem. The file is little-endian and laid out so it can be
+// mapped in memory and used without parsing:
+//
+//      SnapshotHeader
+//      SnapshotColumnEntry[columnCount]
+//      SnapshotEmitter[emitterCount]
+//      SnapshotRateKey[rateKeyCount]
+//      raw SoA column blocks, each starting on a SNAPSHOT_ALIGNMENT boundary
+//
+// Readers must skip columns they don't know, new columns only need a new SnapshotColumn value. Only the
+// positions, previous positions and ids are always there, the other columns are optional.
+// Any change to the existing structs needs a new SNAPSHOT_VERSION.
+
+const char SNAPSHOT_MAGIC[8] = { 'P', 'S', 'I', 'M', 'S', 'N', 'A', 'P' };
+const uint32_t SNAPSHOT_VERSION = 2;
+const uint64_t SNAPSHOT_ALIGNMENT = 64;
+
+enum class SnapshotColumn : uint32_t
+{
+    Positions = 0,
+    PrevPositions,
+    Accelerations,
+    Masses,
+    Temperatures,
+    Densities,
+    Pressures,
+    ParticleIds,
+    IdToIndex,
+    SleepCounters,
+    SleepAnchors,
+    Radii,
+    Count
+};
+
+// Values of the global physics constants when the snapshot was taken
+struct SnapshotConstants
+{
+    float gravityX, gravityY;
+    float restitution;
+    float airResistance;
+    float maxVelocity;
+    float minDeltaMovement;
+    float dampingFactor;
+    float spaceBarForce;
+    float leftClickForce;
+    float maxForceDistanceSq;
+    float thermalDispersion;
+    float maxThermalDiffusion;
+};
+
+struct SnapshotHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t headerSize;            // sizeof(SnapshotHeader), the column table starts right after it
+    uint64_t particleCount;
+    uint32_t columnCount;
+    uint32_t emitterCount;
+
+    float bottomLeftX, bottomLeftY;
+    float topRightX, topRightY;
+    float particleRadius;
+    uint32_t subSteps;
+    uint32_t nextParticleId;
+    uint32_t currentNumOfParticles;
+    uint32_t reorderInterval;
+    uint32_t updatesSinceReorder;
+
+    SnapshotConstants constants;
+    float uniformMass;              // mass of every particle when there is no Masses column, zero in older files
+    uint32_t rateKeyCount;          // rate keys of all the emitters
+};
+
+struct SnapshotColumnEntry
+{
+    uint32_t column;                // SnapshotColumn
+    uint32_t elementSize;           // bytes per particle
+    uint64_t offset;                // from the start of the file
+    uint64_t byteSize;
+};
+
+// Settings and progress of an emitter, its rate curve is rateKeyCount keys from firstRateKey in the rate key table
+struct SnapshotEmitter
+{
+    uint32_t shape;                 // EmitterShape
+    float startX, startY;
+    float endX, endY;
+    float radius;
+    float velocityX, velocityY;
+    float accelerationX, accelerationY;
+    float mass;
+    float jitter;
+    int32_t total;
+    int32_t spawned;
+    float time;
+    float credit;
+    float siteRadius;               // largest radius the sites were laid out for, 0 if they weren't yet
+    uint32_t nextSite;
+    uint32_t firstRateKey;
+    uint32_t rateKeyCount;
+    uint32_t isActive;
+};
+
+struct SnapshotRateKey
+{
+    float time;
+    float rate;
+};
+
+static_assert(sizeof(SnapshotConstants) == 48, "SnapshotConstants layout changed, bump SNAPSHOT_VERSION");
+static_assert(sizeof(SnapshotHeader) == 128, "SnapshotHeader layout changed, bump SNAPSHOT_VERSION");
+static_assert(sizeof(SnapshotColumnEntry) == 24, "SnapshotColumnEntry layout changed, bump SNAPSHOT_VERSION");
+static_assert(sizeof(SnapshotEmitter) == 84, "SnapshotEmitter layout changed, bump SNAPSHOT_VERSION");
+static_assert(sizeof(SnapshotRateKey) == 8, "SnapshotRateKey layout changed, bump SNAPSHOT_VERSION");
+
+// One SoA column to write
+struct SnapshotColumnData
+{
+    SnapshotColumn column;
+    uint32_t elementSize;
+    const void* data;
+};
+
+// Write a snapshot file, the header offsets and counts are filled in here. Returns false on I/O errors
+bool WriteSnapshot(const std::string& path, SnapshotHeader header, const std::vector<SnapshotEmitter>& emitters,
+    const std::vector<SnapshotRateKey>& rateKeys, const std::vector<SnapshotColumnData>& columns);
+
+// Return true if the machine stores integers and floats little-endian like the snapshot format
+bool IsLittleEndianHost();
+
+// Read only memory mapping of a snapshot file. The columns point straight into the mapping and
+// stay valid until Close() or the destructor.
+class MappedSnapshot
+{
+private:
+    const unsigned char* m_Data;
+    size_t m_Size;
+
+#ifdef _WIN32
+    void* m_FileHandle;
+    void* m_MappingHandle;
+#else
+    int m_FileDescriptor;
+#endif
+
+    bool Validate(const std::string& path) const;
+
+public:
+    MappedSnapshot();
+    ~MappedSnapshot();
+
+    MappedSnapshot(const MappedSnapshot&) = delete;
+    MappedSnapshot& operator=(const MappedSnapshot&) = delete;
+
+    // Map and validate a snapshot file, prints the reason and returns false if it can't be used
+    bool Open(const std::string& path);
+
+    // Unmap the file
+    void Close();
+
+    // Return true if a valid snapshot is mapped
+    bool IsOpen() const { return m_Data != nullptr; }
+
+    const SnapshotHeader& GetHeader() const { return *reinterpret_cast<const SnapshotHeader*>(m_Data); }
+
+    // Return the emitter and rate key tables, the emitters' keys are checked to lie inside the table
+    const SnapshotEmitter* GetEmitters() const;
+    const SnapshotRateKey* GetRateKeys() const;
+
+    // Return the column data, nullptr if the column is missing or its element size isn't sizeof(T)
+    template<typename T>
+    const T* GetColumn(SnapshotColumn column) const { return static_cast<const T*>(FindColumn(column, sizeof(T))); }
+
+    const void* FindColumn(SnapshotColumn column, uint32_t elementSize) const;
+};
@@ -1,14 +1,19 @@
 #include "Solver.h"
 #include "SpatialGrid.h"
-#include <thread>
+#include "SimdKernels.h"
+#include "FluidSolver.h"
 #include <iostream>
-
-void UpdateParticles(size_t start, size_t end, float subStepDt,
-    std::vector<Vec2>& positions,
-    std::vector<Vec2>& prevPositions,
-    std::vector<Vec2>& accelerations,
-    std::vector<float>& temperatures,
-    const std::vector<float>& masses,
+#include <algorithm>
+
+// Scalar integration of [start, end). Compiled once per set of enabled optional columns, a disabled acceleration column
+// starts every particle from rest, a disabled mass column uses uniformMass and disabled temperatures are skipped
+template<bool HasAccelerations, bool HasMasses, bool HasTemperatures>
+void UpdateParticles(size_t start, size_t end, float subStepDt, float uniformMass,
+    ParticleColumn<Vec2>& positions,
+    ParticleColumn<Vec2>& prevPositions,
+    ParticleColumn<Vec2>& accelerations,
+    ParticleColumn<float>& temperatures,
+    const ParticleColumn<float>& masses,
     Vec2 simCenter,
     Vec2 mousePos,
     bool isSpaceBarPressed,
@@ -17,8 +22,11 @@ void UpdateParticles(size_t start, size_t end, float subStepDt,
 
     for (size_t i = start; i < end; i++)
     {
+        Vec2 acceleration = HasAccelerations ? accelerations[i] : Vec2(0.0f, 0.0f);
+        const float mass = HasMasses ? masses[i] : uniformMass;
+
         // Apply gravity
-        accelerations[i] += GRAVITY;
+        acceleration += GRAVITY;
 
         // If spacebar is pressed you apply an attractive force to the center of the simulation
         if (isSpaceBarPressed)
@@ -33,7 +41,7 @@ void UpdateParticles(size_t start, size_t end, float subStepDt,
 
                 // Apply force towards center (strength decreases with distance)
                 Vec2 force = direction * (SPACEBAR_FORCE_COEFFICIENT);
-                accelerations[i] += force / masses[i];
+                acceleration += force / mass;
             }
         }
 
@@ -56,7 +64,7 @@ void UpdateParticles(size_t start, size_t end, float subStepDt,
 
                 // Apply force towards mouse position
                 Vec2 force = direction * forceMagnitude;
-                accelerations[i] += force / masses[i];
+                acceleration += force / mass;
             }
         }
 
@@ -79,7 +87,7 @@ void UpdateParticles(size_t start, size_t end, float subStepDt,
 
                 // Apply force towards mouse position
                 Vec2 force = direction * forceMagnitude;
-                accelerations[i] += force / masses[i];
+                acceleration += force / mass;
             }
         }
 
@@ -98,20 +106,25 @@ void UpdateParticles(size_t start, size_t end, float subStepDt,
         }
 
         // Apply air resistance
-        accelerations[i] -= velocity * (AIR_RESISTANCE / masses[i]);
-        temperatures[i] += velocity.length() * AIR_RESISTANCE * 0.01f;
+        acceleration -= velocity * (AIR_RESISTANCE / mass);
+        if (HasTemperatures)
+            temperatures[i] += velocity.length() * AIR_RESISTANCE * 0.01f;
 
         // Store current position for next integration step
         Vec2 temp = positions[i];
 
         // Verlet integration formula
-        positions[i] = positions[i] * 2.0f - prevPositions[i] + accelerations[i] * (subStepDt * subStepDt);
+        positions[i] = positions[i] * 2.0f - prevPositions[i] + acceleration * (subStepDt * subStepDt);
 
         // Update previous position
         prevPositions[i] = temp;
 
         // Reset acceleration for next frame
-        accelerations[i] = { 0.0f, 0.0f };
+        if (HasAccelerations)
+            accelerations[i] = { 0.0f, 0.0f };
+
+        if (!HasTemperatures)
+            continue;
 
         // Heat dispersion
         temperatures[i] -= THERMAL_DISPERSION_PER_FRAME;
@@ -124,149 +137,149 @@ void UpdateParticles(size_t start, size_t end, float subStepDt,
     }
 }
 
-void SolvePhysics(SimulationSystem& sim, float deltaTime, bool isSpaceBarPressed, bool isLeftClickPressed, bool isRightClickPressed)
+// Even out the temperatures of two touching particles
+inline void TransferHeat(size_t i, size_t j, ParticleColumn<float>& temperatures)
 {
-    // Get references to SoA data
-    std::vector<Vec2>& positions = sim.GetPositions();
-    std::vector<Vec2>& prevPositions = sim.GetPrevPositions();
-    std::vector<Vec2>& accelerations = sim.GetAccelerations();
-    std::vector<float>& masses = sim.GetMasses();
-    std::vector<float>& temperatures = sim.GetTemperatures();
-
-    size_t particleCount = positions.size();
-    const float subStepDt = deltaTime / sim.GetSubSteps();
-
-    unsigned int numThreads = 2;
-    std::vector<std::thread> threads;
-    size_t particlesPerThread = particleCount / numThreads;
-
-    for (int step = 0; step < sim.GetSubSteps(); step++)
+    float deltaTemp = std::abs(temperatures[i] - temperatures[j]);
+    if (deltaTemp > 0.01f)
     {
+        float heatTransfered = std::min(MAX_THERMAL_DIFFUSION_PER_COLLISION, deltaTemp / 2.0f);
+        if (temperatures[i] > temperatures[j])
         {
-            for (unsigned int t = 0; t < numThreads; ++t)
-            {
-                size_t start = t * particlesPerThread;
-                size_t end = (t == numThreads - 1) ? particleCount : start + particlesPerThread;
-
-                threads.emplace_back(UpdateParticles, start, end, subStepDt,
-                    std::ref(positions), std::ref(prevPositions), std::ref(accelerations),
-                    std::ref(temperatures), std::cref(masses), sim.GetSimCenter(), sim.GetMousePosition(),
-                    isSpaceBarPressed, isLeftClickPressed, isRightClickPressed);
-            }
-
-            for (auto& t : threads) t.join();
-            threads.clear(); // This should prevent crashes? dunno
+            temperatures[i] -= heatTransfered;
+            temperatures[j] += heatTransfered;
+        }
+        else
+        {
+            temperatures[j] -= heatTransfered;
+            temperatures[i] += heatTransfered;
         }
-
-        // Solve collisions
-        SolveBoundaryCollisions(sim, deltaTime);
-        SolveParticleCollisions(sim, deltaTime);
     }
 }
 
-void SolveParticleCollisions(SimulationSystem& sim, float deltaTime)
+// Returns the overlap of the two particles, 0 if they are further apart than contactDistance (the sum of their radii).
+// Without a mass column both particles take half the correction
+template<bool HasMasses, bool HasTemperatures>
+inline float ResolveParticleCollision(size_t i, size_t j, float contactDistance, float responseCoef,
+    ParticleColumn<Vec2>& positions,
+    ParticleColumn<float>& temperatures,
+    const ParticleColumn<float>& masses)
 {
-    std::vector<Vec2>& positions = sim.GetPositions();
-    std::vector<Vec2>& prevPositions = sim.GetPrevPositions();
-    std::vector<float>& masses = sim.GetMasses();
-    std::vector<float>& temperatures = sim.GetTemperatures();
+    // Calculate distance vector between particles
+    Vec2 delta = positions[i] - positions[j];
+    float distSq = delta.length_sq();
 
-    const float subStepDt = deltaTime / sim.GetSubSteps();
-    size_t particleCount = positions.size();
-    const float diameter = sim.GetParticleRadius() * 2.0f;
-    const float responseCoef = 1.0f; // Just for debugging
+    // Handle collision response
+    if (distSq < contactDistance * contactDistance && distSq > 0.0f) {
+        float dist = sqrt(distSq);
+        Vec2 normal = delta / dist;
 
-    // Update the spatial grid in the simulation system
-    sim.UpdateSpatialGrid();
+        float overlap = contactDistance - dist;
 
-    SpatialGrid& spatialGrid = sim.GetSpatialGrid();
+        float p1Ratio = 0.5f;
+        float p2Ratio = 0.5f;
+        if (HasMasses)
+        {
+            float totalMass = masses[i] + masses[j];
+            p1Ratio = masses[j] / totalMass;
+            p2Ratio = masses[i] / totalMass;
+        }
 
-    // Get coll. pairs
-    spatialGrid.GenerateCollisionPairs(positions);
-    const auto& collisionPairs = spatialGrid.GetCollisionPairs();
+        Vec2 ds1 = normal * (overlap * p1Ratio * responseCoef);
+        Vec2 ds2 = normal * (overlap * p2Ratio * responseCoef);
 
-    // Process collision for each pair
-    for (const auto& pair : collisionPairs) {
-        size_t i = pair.first;
-        size_t j = pair.second;
+        if ((ds1.length() < MIN_DELTA_MOVEMENT) && (ds2.length() < MIN_DELTA_MOVEMENT))
+            return overlap;
 
-        // Calculate distance vector between particles
-        Vec2 delta = positions[i] - positions[j];
-        float distSq = delta.length_sq();
+        // Position correction
+        positions[i] += ds1;
+        positions[j] -= ds2;
 
-        // Handle collision response
-        if (distSq < diameter * diameter && distSq > 0.0f) {
-            float dist = sqrt(distSq);
-            Vec2 normal = delta / dist;
+        if (HasTemperatures)
+            TransferHeat(i, j, temperatures);
 
-            float overlap = diameter - dist;
+        return overlap;
+    }
 
-            float totalMass = masses[i] + masses[j];
-            float p1Ratio = masses[j] / totalMass;
-            float p2Ratio = masses[i] / totalMass;
+    return 0.0f;
+}
 
-            Vec2 ds1 = normal * (overlap * p1Ratio * responseCoef);
-            Vec2 ds2 = normal * (overlap * p2Ratio * responseCoef);
+// Same as ResolveParticleCollision with the sleeping particle j acting as a static obstacle, the awake particle i
+// takes the whole correction. Moving j would give it a velocity from its frozen previous position when it wakes.
+// Being pushed by a particle that moves more than the sleep distance wakes j, resting on it doesn't
+template<bool HasTemperatures>
+inline float ResolveSleepingCollision(size_t i, size_t j, float contactDistance, float responseCoef, float sleepDistanceSq,
+    ParticleColumn<Vec2>& positions,
+    const ParticleColumn<Vec2>& prevPositions,
+    ParticleColumn<float>& temperatures,
+    uint8_t* sleepCounters)
+{
+    Vec2 delta = positions[i] - positions[j];
+    float distSq = delta.length_sq();
 
-            if ((ds1.length() < MIN_DELTA_MOVEMENT) && (ds2.length() < MIN_DELTA_MOVEMENT))
-                continue;
+    if (distSq < contactDistance * contactDistance && distSq > 0.0f) {
+        float dist = sqrt(distSq);
+        float overlap = contactDistance - dist;
 
-            // Position correction
-            positions[i] += normal * (overlap * p1Ratio * responseCoef);
-            positions[j] -= normal * (overlap * p2Ratio * responseCoef);
+        Vec2 ds = (delta / dist) * (overlap * responseCoef);
+        if (ds.length() < MIN_DELTA_MOVEMENT)
+            return overlap;
 
+        if ((positions[i] - prevPositions[i]).length_sq() > sleepDistanceSq)
+            sleepCounters[j] = 0;
 
-            // Heat transfer
-            float deltaTemp = abs(temperatures[i] - temperatures[j]);
-            if (deltaTemp > 0.01f)
-            {
-                if (temperatures[i] > temperatures[j])
-                {
-                    float heatTransfered = std::min(MAX_THERMAL_DIFFUSION_PER_COLLISION, deltaTemp / 2.0f);
-                    temperatures[i] -= heatTransfered;
-                    temperatures[j] += heatTransfered;
-                }
-                else
-                {
-                    float heatTransfered = std::min(MAX_THERMAL_DIFFUSION_PER_COLLISION, deltaTemp / 2.0f);
-                    temperatures[j] -= heatTransfered;
-                    temperatures[i] += heatTransfered;
-                }
-            }
-        }
+        positions[i] += ds;
+        if (HasTemperatures)
+            TransferHeat(i, j, temperatures);
+        return overlap;
     }
 
-    // Apply velocity cap after collision resolution
-    for (size_t i = 0; i < particleCount; i++) {
-        // Calculate current velocity
-        Vec2 velocity = (positions[i] - prevPositions[i]) / subStepDt;
+    return 0.0f;
+}
 
-        // Cap velocity if it exceeds maximum speed
-        float velocityMagSq = velocity.length_sq();
-        if (velocityMagSq > MAX_VELOCITY_SQ) {
-            // Scale down the velocity vector to maximum allowed
-            float scale = MAX_VELOCITY / std::sqrt(velocityMagSq);
-            velocity *= scale;
+// Count the substeps each particle of [start, end) spends within the sleep distance, both per substep and from its anchor,
+// and put it to sleep once it reaches sleepSubSteps. The anchor catches particles falling from rest, they move less than
+// the distance per substep for a while. A particle moving more, or reached by the spacebar or mouse force, is awake again
+inline void UpdateSleepCounters(size_t start, size_t end, float sleepDistanceSq, unsigned int sleepSubSteps,
+    const IntegrationParams& params,
+    const ParticleColumn<Vec2>& positions,
+    ParticleColumn<Vec2>& prevPositions,
+    ParticleColumn<uint8_t>& sleepCounters,
+    ParticleColumn<Vec2>& sleepAnchors)
+{
+    const Vec2 mousePos(params.mouseX, params.mouseY);
+    for (size_t i = start; i < end; i++)
+    {
+        const bool isForced = params.applySpaceBar ||
+            (params.applyMouseForce && (mousePos - positions[i]).length_sq() < params.maxForceDistanceSq);
 
-            // Adjust previous position to reflect the capped velocity
-            prevPositions[i] = positions[i] - velocity * subStepDt;
+        if (isForced || (positions[i] - prevPositions[i]).length_sq() > sleepDistanceSq ||
+            (positions[i] - sleepAnchors[i]).length_sq() > sleepDistanceSq)
+        {
+            sleepCounters[i] = 0;
+            sleepAnchors[i] = positions[i];
+        }
+        else if (sleepCounters[i] != SimulationSystem::PARTICLE_ASLEEP && ++sleepCounters[i] >= sleepSubSteps)
+        {
+            // Falls asleep at rest, it wakes up with no velocity
+            sleepCounters[i] = SimulationSystem::PARTICLE_ASLEEP;
+            prevPositions[i] = positions[i];
         }
     }
 }
 
-void SolveBoundaryCollisions(SimulationSystem& sim, float deltaTime)
+// Reflect the particles in [start, end) that left the simulation bounds
+template<bool HasTemperatures>
+inline void ResolveBoundaryCollisions(size_t start, size_t end, const Bounds& bounds, float subStepDt,
+    ParticleColumn<Vec2>& positions,
+    ParticleColumn<Vec2>& prevPositions,
+    ParticleColumn<float>& temperatures,
+    const ParticleColumn<float>& radii)
 {
-    std::vector<Vec2>& positions = sim.GetPositions();
-    std::vector<float>& temperatures = sim.GetTemperatures();
-    std::vector<Vec2>& prevPositions = sim.GetPrevPositions();
-
-    const Bounds bounds = sim.GetBounds();
-    const float radius = sim.GetParticleRadius();
-    const float subStepDt = deltaTime / sim.GetSubSteps();
-    size_t particleCount = positions.size();
-
-    for (size_t i = 0; i < particleCount; i++)
+    for (size_t i = start; i < end; i++)
     {
+        const float radius = radii[i];
+
         // Calculate current velocity before collision handling
         Vec2 velocity = (positions[i] - prevPositions[i]) / subStepDt;
         bool collisionOccurred = false;
@@ -298,7 +311,8 @@ void SolveBoundaryCollisions(SimulationSystem& sim, float deltaTime)
             collisionOccurred = true;
 
             // Heat source
-            temperatures[i] += MAX_THERMAL_DIFFUSION_PER_COLLISION;
+            if (HasTemperatures)
+                temperatures[i] += MAX_THERMAL_DIFFUSION_PER_COLLISION;
         }
 
         // Top boundary
@@ -310,12 +324,451 @@ void SolveBoundaryCollisions(SimulationSystem& sim, float deltaTime)
             collisionOccurred = true;
 
             // Heat sink
-            temperatures[i] -= MAX_THERMAL_DIFFUSION_PER_COLLISION;
+            if (HasTemperatures)
+                temperatures[i] -= MAX_THERMAL_DIFFUSION_PER_COLLISION;
         }
 
         // Update previous position if collision occurred to maintain the reflected velocity
         if (collisionOccurred)
             prevPositions[i] = positions[i] - velocity * subStepDt;
-        
     }
+}
+
+void SolvePhysics(SimulationSystem& sim, float deltaTime, bool isSpaceBarPressed, bool isLeftClickPressed, bool isRightClickPressed)
+{
+    // Get references to SoA data
+    ParticleColumn<Vec2>& positions = sim.GetPositions();
+    ParticleColumn<Vec2>& prevPositions = sim.GetPrevPositions();
+    ParticleColumn<Vec2>& accelerations = sim.GetAccelerations();
+    ParticleColumn<float>& masses = sim.GetMasses();
+    ParticleColumn<float>& temperatures = sim.GetTemperatures();
+
+    size_t particleCount = positions.size();
+    const float subStepDt = deltaTime / sim.GetSubSteps();
+
+    ThreadPool& threadPool = sim.GetThreadPool();
+    const Vec2 simCenter = sim.GetSimCenter();
+    const Vec2 mousePos = sim.GetMousePosition();
+
+    // Same inputs as UpdateParticles for the vector kernels
+    const SimdLevel simdLevel = sim.GetSimdLevel();
+    const bool isMouseInside = mousePos != Vec2(-1, -1);
+    IntegrationParams params;
+    params.dt = subStepDt;
+    params.gravityX = GRAVITY.x;
+    params.gravityY = GRAVITY.y;
+    params.centerX = simCenter.x;
+    params.centerY = simCenter.y;
+    params.mouseX = mousePos.x;
+    params.mouseY = mousePos.y;
+    params.applySpaceBar = isSpaceBarPressed;
+    params.applyMouseForce = isMouseInside && (isLeftClickPressed || isRightClickPressed);
+    params.mouseForceSign = isLeftClickPressed ? 1.0f : -1.0f;
+    params.spaceBarForce = SPACEBAR_FORCE_COEFFICIENT;
+    params.mouseForce = LEFT_CLICK_FORCE_COEFFICIENT;
+    params.maxForceDistanceSq = MAX_FORCE_DISTANCE_SQ;
+    params.maxVelocity = MAX_VELOCITY;
+    params.maxVelocitySq = MAX_VELOCITY_SQ;
+    params.airResistance = AIR_RESISTANCE;
+    params.thermalDispersion = THERMAL_DISPERSION_PER_FRAME;
+    params.uniformMass = sim.GetUniformMass();
+
+    // Vec2 is two packed floats, the kernels see the arrays as interleaved x/y
+    static_assert(sizeof(Vec2) == 2 * sizeof(float), "Vec2 must be two packed floats");
+    float* positionsData = reinterpret_cast<float*>(positions.data());
+    float* prevPositionsData = reinterpret_cast<float*>(prevPositions.data());
+    // Disabled columns are passed as null, the kernels are instantiated for the enabled set
+    const bool hasAccelerations = sim.HasAttribute(SimulationSystem::ATTRIBUTE_ACCELERATIONS);
+    const bool hasMasses = sim.HasAttribute(SimulationSystem::ATTRIBUTE_MASSES);
+    const bool hasTemperatures = sim.HasAttribute(SimulationSystem::ATTRIBUTE_TEMPERATURES);
+    float* accelerationsData = hasAccelerations ? reinterpret_cast<float*>(accelerations.data()) : nullptr;
+    float* temperaturesData = hasTemperatures ? temperatures.data() : nullptr;
+    const float* massesData = hasMasses ? masses.data() : nullptr;
+
+    Profiler& profiler = sim.GetProfiler();
+    const bool useFusedIntegration = sim.GetUseFusedIntegration();
+    const Bounds bounds = sim.GetBounds();
+    const float radius = sim.GetParticleRadius();
+    const ParticleColumn<float>& radii = sim.GetRadii();
+
+    // Vector kernels take the bulk of the range, the scalar path the remainder
+    auto integrate = [&](size_t start, size_t end)
+    {
+        if (simdLevel == SimdLevel::AVX2)
+            start = UpdateParticlesAVX2(start, end, params, positionsData, prevPositionsData,
+                accelerationsData, temperaturesData, massesData);
+        else if (simdLevel == SimdLevel::SSE)
+            start = UpdateParticlesSSE(start, end, params, positionsData, prevPositionsData,
+                accelerationsData, temperaturesData, massesData);
+
+        DispatchAttributeFlags(hasAccelerations, hasMasses, hasTemperatures, [&](auto accelerationsTag, auto massesTag, auto temperaturesTag)
+        {
+            UpdateParticles<decltype(accelerationsTag)::value, decltype(massesTag)::value, decltype(temperaturesTag)::value>(
+                start, end, subStepDt, params.uniformMass, positions, prevPositions, accelerations,
+                temperatures, masses, simCenter, mousePos,
+                isSpaceBarPressed, isLeftClickPressed, isRightClickPressed);
+        });
+    };
+
+    auto resolveBoundaries = [&](size_t start, size_t end)
+    {
+        if (hasTemperatures)
+            ResolveBoundaryCollisions<true>(start, end, bounds, subStepDt, positions, prevPositions, temperatures, radii);
+        else
+            ResolveBoundaryCollisions<false>(start, end, bounds, subStepDt, positions, prevPositions, temperatures, radii);
+    };
+
+    // Sleeping particles are skipped, the others are integrated in runs so the vector kernels still get contiguous ranges.
+    // The periodic reordering keeps the particles of a settled pile next to each other
+    const bool useFluid = sim.GetUseFluid();
+    const bool useSleeping = sim.GetUseSleeping() && !useFluid;
+    ParticleColumn<uint8_t>& sleepCounters = sim.GetSleepCounters();
+    ParticleColumn<Vec2>& sleepAnchors = sim.GetSleepAnchors();
+    const float sleepDistance = sim.GetSleepThreshold() * radius;
+    const float sleepDistanceSq = sleepDistance * sleepDistance;
+    const unsigned int sleepSubSteps = sim.GetSleepSubSteps();
+    auto integrateAwake = [&](size_t start, size_t end)
+    {
+        if (!useSleeping)
+        {
+            integrate(start, end);
+            return;
+        }
+
+        UpdateSleepCounters(start, end, sleepDistanceSq, sleepSubSteps, params, positions, prevPositions, sleepCounters, sleepAnchors);
+
+        size_t i = start;
+        while (i < end)
+        {
+            while (i < end && sleepCounters[i] == SimulationSystem::PARTICLE_ASLEEP)
+                i++;
+            const size_t runStart = i;
+            while (i < end && sleepCounters[i] != SimulationSystem::PARTICLE_ASLEEP)
+                i++;
+            if (runStart < i)
+                integrate(runStart, i);
+        }
+    };
+
+    // The vector kernels leave the tail of every chunk to the scalar path. In deterministic mode the chunks
+    // have a fixed size so the same particles take the same path whatever the number of threads.
+    // Every other pass is either per particle or works on disjoint cells in a fixed order.
+    const bool isDeterministic = sim.GetIsDeterministic();
+    auto parallelIntegrate = [&](auto&& func)
+    {
+        if (isDeterministic)
+            threadPool.ParallelForFixedChunks(0, particleCount, func, 4096);
+        else
+            threadPool.ParallelFor(0, particleCount, func);
+    };
+
+    // The adaptive substep count is chosen from the motion of the last substep
+    const bool useAdaptiveSubSteps = sim.GetUseAdaptiveSubSteps();
+    SubStepMotion motion;
+
+    const unsigned int subSteps = sim.GetSubSteps();
+    for (unsigned int step = 0; step < subSteps; step++)
+    {
+        // The fluid forces of the substep go in the accelerations the integration applies
+        if (useFluid)
+            SolveFluidForces(sim, deltaTime);
+
+        // Every pass returns only when all the threads are done with it, so the 
+        // passes below always see a fully integrated substep
+        if (useFusedIntegration)
+        {
+            // Integrate and reflect small blocks so the boundary pass finds the block still in cache,
+            // the whole particle set is streamed from memory once instead of twice
+            PROFILE_SCOPE(profiler, ProfilePhase::Integrate);
+            parallelIntegrate([&](size_t start, size_t end, unsigned int)
+            {
+                const size_t blockSize = 512;
+                for (size_t blockStart = start; blockStart < end; blockStart += blockSize)
+                {
+                    const size_t blockEnd = std::min(blockStart + blockSize, end);
+                    integrateAwake(blockStart, blockEnd);
+                    resolveBoundaries(blockStart, blockEnd);
+                }
+            });
+        }
+        else
+        {
+            {
+                PROFILE_SCOPE(profiler, ProfilePhase::Integrate);
+                parallelIntegrate([&](size_t start, size_t end, unsigned int)
+                {
+                    integrateAwake(start, end);
+                });
+            }
+
+            SolveBoundaryCollisions(sim, deltaTime);
+        }
+
+        // The integration of the next substep caps the velocity before using it, so the fused path
+        // only needs the separate cap pass after the last substep
+        const bool isLastSubStep = step + 1 == subSteps;
+        SubStepMotion* stepMotion = (useAdaptiveSubSteps && isLastSubStep) ? &motion : nullptr;
+
+        // The pressure keeps the fluid particles apart, there are no contacts to resolve
+        if (!useFluid)
+            SolveParticleCollisions(sim, deltaTime, !useFusedIntegration || isLastSubStep, stepMotion);
+        else if (!useFusedIntegration || isLastSubStep)
+            SolveVelocityCap(sim, deltaTime, stepMotion);
+    }
+
+    if (useAdaptiveSubSteps)
+        sim.AdaptSubSteps(motion.maxDisplacement, motion.maxOverlap);
+}
+
+void SolveParticleCollisions(SimulationSystem& sim, float deltaTime, bool applyVelocityCap, SubStepMotion* motion)
+{
+    ParticleColumn<Vec2>& positions = sim.GetPositions();
+    ParticleColumn<Vec2>& prevPositions = sim.GetPrevPositions();
+    ParticleColumn<float>& masses = sim.GetMasses();
+    ParticleColumn<float>& temperatures = sim.GetTemperatures();
+
+    const ParticleColumn<float>& radii = sim.GetRadii();
+
+    const float responseCoef = 1.0f; // Just for debugging
+
+    // Update the spatial grid in the simulation system. With neighbor lists the grid and its pairs
+    // are only rebuilt once a particle moved far enough to reach a pair that isn't listed
+    const bool useNeighborLists = sim.GetUseNeighborLists();
+    if (useNeighborLists)
+        sim.UpdateNeighborList();
+    else
+        sim.UpdateSpatialGrid();
+
+    // Pairs of two sleeping particles are skipped, cells without awake particles around them aren't even visited
+    const float sleepDistance = sim.GetSleepThreshold() * sim.GetParticleRadius();
+    const float sleepDistanceSq = sleepDistance * sleepDistance;
+    uint8_t* sleepCounters = nullptr;
+    const std::vector<uint8_t>* cellIsAwake = nullptr;
+    if (sim.GetUseSleeping())
+    {
+        sim.UpdateSleepStates();
+        sleepCounters = sim.GetSleepCounters().data();
+        cellIsAwake = &sim.GetCellIsAwake();
+    }
+
+    // The pair kernel is compiled for the enabled mass and temperature columns
+    auto makeResolvePair = [&](auto massesTag, auto temperaturesTag)
+    {
+        typedef decltype(massesTag) MassesTag;
+        typedef decltype(temperaturesTag) TemperaturesTag;
+        return [&](unsigned int particleA, unsigned int particleB)
+        {
+            const float contactDistance = radii[particleA] + radii[particleB];
+            if (sleepCounters)
+            {
+                const bool isAsleepA = sleepCounters[particleA] == SimulationSystem::PARTICLE_ASLEEP;
+                const bool isAsleepB = sleepCounters[particleB] == SimulationSystem::PARTICLE_ASLEEP;
+                if (isAsleepA && isAsleepB)
+                    return 0.0f;
+                if (isAsleepA)
+                    return ResolveSleepingCollision<TemperaturesTag::value>(particleB, particleA, contactDistance, responseCoef, sleepDistanceSq, positions, prevPositions, temperatures, sleepCounters);
+                if (isAsleepB)
+                    return ResolveSleepingCollision<TemperaturesTag::value>(particleA, particleB, contactDistance, responseCoef, sleepDistanceSq, positions, prevPositions, temperatures, sleepCounters);
+            }
+            return ResolveParticleCollision<MassesTag::value, TemperaturesTag::value>(particleA, particleB, contactDistance, responseCoef, positions, temperatures, masses);
+        };
+    };
+
+    SpatialGrid& spatialGrid = sim.GetSpatialGrid();
+    Profiler& profiler = sim.GetProfiler();
+
+    // One maximum per thread, each on its own cache line, reduced once the pass is done
+    const size_t maximaStride = SimulationSystem::THREAD_MAXIMA_STRIDE;
+    std::vector<float>& threadMaxima = sim.GetThreadMaxima();
+    auto reduceMaxima = [&]()
+    {
+        float result = 0.0f;
+        for (size_t t = 0; t < threadMaxima.size(); t += maximaStride)
+            result = std::max(result, threadMaxima[t]);
+        std::fill(threadMaxima.begin(), threadMaxima.end(), 0.0f);
+        return result;
+    };
+
+    // Walk the candidate pairs of every cell with the given pair kernel, keeping the largest value it returns per thread if measured
+    auto walkPairs = [&](auto&& pairKernel, bool measure)
+    {
+        if (sim.GetUseFusedCollisions() && !useNeighborLists)
+        {
+            // Resolve every candidate while walking the cells, no pair buffer and no second pass over the positions.
+            // The levels share particles through their guests, so they are processed one after the other
+            for (int level = 0; level < spatialGrid.GetLevelCount(); level++)
+            {
+                spatialGrid.ForEachColoredCell(sim.GetThreadPool(), level, [&](int cellIndex, int cellX, int cellY, unsigned int threadIndex)
+                {
+                    const SpatialGrid::PairCells cells = spatialGrid.GetPairCells(level, cellIndex, cellX, cellY);
+                    if (cellIsAwake && !spatialGrid.IsAnyPairCellFlagged(cells, *cellIsAwake))
+                        return;
+
+                    if (!measure)
+                    {
+                        spatialGrid.ForEachCellPair(cells, pairKernel);
+                        spatialGrid.ForEachGuestPair(cells, pairKernel);
+                        return;
+                    }
+
+                    float& maxValue = threadMaxima[threadIndex * maximaStride];
+                    auto kernelAndMeasure = [&](unsigned int particleA, unsigned int particleB)
+                    {
+                        maxValue = std::max(maxValue, pairKernel(particleA, particleB));
+                    };
+                    spatialGrid.ForEachCellPair(cells, kernelAndMeasure);
+                    spatialGrid.ForEachGuestPair(cells, kernelAndMeasure);
+                });
+            }
+        }
+        else
+        {
+            const auto& collisionPairs = spatialGrid.GetCollisionPairs();
+            const std::vector<unsigned int>& cellPairStart = spatialGrid.GetCellPairStart();
+
+            for (int level = 0; level < spatialGrid.GetLevelCount(); level++)
+            {
+                spatialGrid.ForEachColoredCell(sim.GetThreadPool(), level, [&](int cellIndex, int cellX, int cellY, unsigned int threadIndex)
+                {
+                    if (useNeighborLists && cellIsAwake &&
+                        !spatialGrid.IsAnyPairCellFlagged(spatialGrid.GetPairCells(level, cellIndex, cellX, cellY), *cellIsAwake))
+                        return;
+
+                    // Process collision for each pair of the cell
+                    float maxValue = 0.0f;
+                    for (unsigned int p = cellPairStart[cellIndex]; p < cellPairStart[cellIndex + 1]; p++)
+                        maxValue = std::max(maxValue, pairKernel(collisionPairs[p].first, collisionPairs[p].second));
+
+                    if (measure)
+                        threadMaxima[threadIndex * maximaStride] = std::max(threadMaxima[threadIndex * maximaStride], maxValue);
+                });
+            }
+        }
+    };
+
+    // Get coll. pairs, a neighbor list has them already. It keeps the pairs of sleeping
+    // particles as they may wake before the next build, their cells are skipped below instead
+    if (!useNeighborLists && !sim.GetUseFusedCollisions())
+    {
+        PROFILE_SCOPE(profiler, ProfilePhase::PairGeneration);
+        spatialGrid.GenerateCollisionPairs(positions, radii, cellIsAwake);
+    }
+
+    {
+        PROFILE_SCOPE(profiler, ProfilePhase::CollisionResolve);
+        const bool hasMasses = sim.HasAttribute(SimulationSystem::ATTRIBUTE_MASSES);
+        const bool hasTemperatures = sim.HasAttribute(SimulationSystem::ATTRIBUTE_TEMPERATURES);
+        DispatchAttributeFlags(false, hasMasses, hasTemperatures, [&](auto, auto massesTag, auto temperaturesTag)
+        {
+            walkPairs(makeResolvePair(massesTag, temperaturesTag), false);
+        });
+    }
+
+    // The pass only sees the overlaps before its own corrections, the ones it leaves are measured by walking the
+    // pairs again without moving anything
+    if (motion)
+    {
+        PROFILE_SCOPE(profiler, ProfilePhase::OverlapCheck);
+        walkPairs([&](unsigned int particleA, unsigned int particleB)
+        {
+            if (sleepCounters && sleepCounters[particleA] == SimulationSystem::PARTICLE_ASLEEP &&
+                sleepCounters[particleB] == SimulationSystem::PARTICLE_ASLEEP)
+                return 0.0f;
+
+            const float contactDistance = radii[particleA] + radii[particleB];
+            const float distSq = (positions[particleA] - positions[particleB]).length_sq();
+            return distSq < contactDistance * contactDistance ? contactDistance - std::sqrt(distSq) : 0.0f;
+        }, true);
+        motion->maxOverlap = reduceMaxima();
+    }
+
+    if (applyVelocityCap)
+        SolveVelocityCap(sim, deltaTime, motion);
+}
+
+void SolveVelocityCap(SimulationSystem& sim, float deltaTime, SubStepMotion* motion)
+{
+    ParticleColumn<Vec2>& positions = sim.GetPositions();
+    ParticleColumn<Vec2>& prevPositions = sim.GetPrevPositions();
+
+    const float subStepDt = deltaTime / sim.GetSubSteps();
+    size_t particleCount = positions.size();
+
+    // One maximum per thread, each on its own cache line. The second one is the drift from the grid anchors
+    const size_t maximaStride = SimulationSystem::THREAD_MAXIMA_STRIDE;
+    std::vector<float>& threadMaxima = sim.GetThreadMaxima();
+
+    // The emitters query the last grid, the particles have to be found in cells wide enough for how far they moved since
+    const std::vector<Vec2>* gridAnchors = sim.GetGridAnchors();
+
+    PROFILE_SCOPE(sim.GetProfiler(), ProfilePhase::VelocityCap);
+    sim.GetThreadPool().ParallelFor(0, particleCount, [&](size_t start, size_t end, unsigned int threadIndex)
+    {
+        float maxVelocitySq = 0.0f;
+        float maxDriftSq = 0.0f;
+        for (size_t i = start; i < end; i++) {
+            if (gridAnchors)
+                maxDriftSq = std::max(maxDriftSq, (positions[i] - (*gridAnchors)[i]).length_sq());
+
+            // Calculate current velocity
+            Vec2 velocity = (positions[i] - prevPositions[i]) / subStepDt;
+
+            // Cap velocity if it exceeds maximum speed
+            float velocityMagSq = velocity.length_sq();
+            if (velocityMagSq > MAX_VELOCITY_SQ) {
+                // Scale down the velocity vector to maximum allowed
+                float scale = MAX_VELOCITY / std::sqrt(velocityMagSq);
+                velocity *= scale;
+                velocityMagSq = MAX_VELOCITY_SQ;
+
+                // Adjust previous position to reflect the capped velocity
+                prevPositions[i] = positions[i] - velocity * subStepDt;
+            }
+
+            maxVelocitySq = std::max(maxVelocitySq, velocityMagSq);
+        }
+
+        float* maxima = &threadMaxima[threadIndex * maximaStride];
+        if (motion)
+            maxima[0] = std::max(maxima[0], maxVelocitySq);
+        maxima[1] = std::max(maxima[1], maxDriftSq);
+    });
+
+    float maxVelocitySq = 0.0f;
+    float maxDriftSq = 0.0f;
+    for (size_t t = 0; t < threadMaxima.size(); t += maximaStride)
+    {
+        maxVelocitySq = std::max(maxVelocitySq, threadMaxima[t]);
+        maxDriftSq = std::max(maxDriftSq, threadMaxima[t + 1]);
+    }
+    std::fill(threadMaxima.begin(), threadMaxima.end(), 0.0f);
+
+    if (gridAnchors)
+        sim.SetGridDrift(std::sqrt(maxDriftSq));
+    if (motion)
+        motion->maxDisplacement = std::sqrt(maxVelocitySq) * subStepDt;
+}
+
+void SolveBoundaryCollisions(SimulationSystem& sim, float deltaTime)
+{
+    ParticleColumn<Vec2>& positions = sim.GetPositions();
+    ParticleColumn<float>& temperatures = sim.GetTemperatures();
+    ParticleColumn<Vec2>& prevPositions = sim.GetPrevPositions();
+
+    const ParticleColumn<float>& radii = sim.GetRadii();
+
+    const Bounds bounds = sim.GetBounds();
+    const float subStepDt = deltaTime / sim.GetSubSteps();
+    size_t particleCount = positions.size();
+
+    const bool hasTemperatures = sim.HasAttribute(SimulationSystem::ATTRIBUTE_TEMPERATURES);
+
+    PROFILE_SCOPE(sim.GetProfiler(), ProfilePhase::Boundary);
+    sim.GetThreadPool().ParallelFor(0, particleCount, [&](size_t start, size_t end, unsigned int)
+    {
+        if (hasTemperatures)
+            ResolveBoundaryCollisions<true>(start, end, bounds, subStepDt, positions, prevPositions, temperatures, radii);
+        else
+            ResolveBoundaryCollisions<false>(start, end, bounds, subStepDt, positions, prevPositions, temperatures, radii);
+    });
 }
\ No newline at end of file
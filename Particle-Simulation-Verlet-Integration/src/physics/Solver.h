@@ -4,6 +4,17 @@
 #include "./SimulationSystem.h"
 #include "./Constants.h"
 
+// Largest particle motion of a substep, measured for the adaptive substep count
+struct SubStepMotion
+{
+    float maxDisplacement = 0.0f;   // largest distance a particle moved during the substep
+    float maxOverlap = 0.0f;        // largest overlap left once the collision pass is done
+};
+
 void SolvePhysics(SimulationSystem& sim, float deltaTime, bool isSpaceBarPressed, bool isLeftClickPressed, bool isRightClickPressed);
-void SolveParticleCollisions(SimulationSystem& sim, float deltaTime);
-void SolveBoundaryCollisions(SimulationSystem& sim, float deltaTime);
\ No newline at end of file
+// Resolve the particle collisions of a substep, motion is filled if not null. The overlap is measured by walking
+// the pairs again after the pass, the displacement only by the velocity cap pass
+void SolveParticleCollisions(SimulationSystem& sim, float deltaTime, bool applyVelocityCap = true, SubStepMotion* motion = nullptr);
+void SolveBoundaryCollisions(SimulationSystem& sim, float deltaTime);
+// Scale down the velocities above MAX_VELOCITY, the largest displacement left is written to motion if not null
+void SolveVelocityCap(SimulationSystem& sim, float deltaTime, SubStepMotion* motion = nullptr);
\ No newline at end of file
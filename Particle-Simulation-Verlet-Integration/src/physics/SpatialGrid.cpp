@@ -1,137 +1,666 @@
 #include "SpatialGrid.h"
 
-void SpatialGrid::InitCells(std::vector<Vec2>& particlePositions)
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+// The order inside a cell depends on which thread counted first, sort the (small) cells so the
+// layout is the same on every run
+static inline void SortCell(unsigned int* cellBeginPtr, unsigned int* cellEndPtr)
+{
+    for (unsigned int* it = cellBeginPtr + 1; it < cellEndPtr; it++)
+    {
+        unsigned int value = *it;
+        unsigned int* hole = it;
+        while (hole > cellBeginPtr && *(hole - 1) > value)
+        {
+            *hole = *(hole - 1);
+            hole--;
+        }
+        *hole = value;
+    }
+}
+
+void SpatialGrid::BuildCells(const ParticleColumn<Vec2>& particlePositions, const ParticleColumn<float>& particleRadii, ThreadPool& threadPool)
 {
-    // Resize the grid to match the calculated grid dimensions
-    m_Grid.resize(m_GridWidth * m_GridHeight);
+    if (m_UseHashing)
+    {
+        BuildHashedCells(particlePositions, particleRadii, threadPool);
+        return;
+    }
+
+    const size_t particleCount = particlePositions.size();
+    const size_t cellCount = m_TotalCellCount;
+    const unsigned int numThreads = threadPool.GetNumThreads();
+    const int levelCount = GetLevelCount();
 
-    // Clear any existing data
-    Clear();
+    // Guests are sorted alongside the particles, in the same phases
+    const bool hasGuests = levelCount > 1;
+    const size_t guestsPerParticle = static_cast<size_t>(levelCount - 1);
 
-    // Add each particle to its corresponding cell
-    for (unsigned int i = 0; i < particlePositions.size(); i++)
+    m_ParticleCells.resize(particleCount);
+    m_ParticleSlots.resize(particleCount);
+    m_ParticleLevels.resize(particleCount);
+    m_SortedParticles.resize(particleCount);
+    m_ThreadSums.resize(numThreads * 2);
+    if (hasGuests)
     {
-        // Calculate cell index for current particle position
-        int cellIndex = GetCellIndex(particlePositions[i]);
+        m_GuestCells.resize(particleCount * guestsPerParticle);
+        m_GuestSlots.resize(particleCount * guestsPerParticle);
+        m_SortedGuests.resize(particleCount * guestsPerParticle);
+    }
 
-        // Add particle index to the cell
-        if (cellIndex >= 0 && cellIndex < m_Grid.size())
+    // Every phase works on its own range and the threads wait for each other before the next one
+    threadPool.Run([&](unsigned int threadIndex)
+    {
+        size_t cellBegin, cellEnd;
+        size_t particleBegin, particleEnd;
+        threadPool.GetThreadRange(0, cellCount, threadIndex, cellBegin, cellEnd);
+        threadPool.GetThreadRange(0, particleCount, threadIndex, particleBegin, particleEnd);
+
+        // Reset counters
+        for (size_t c = cellBegin; c < cellEnd; c++)
         {
-            m_Grid[cellIndex].push_back(i);
+            m_CellCount[c].store(0, std::memory_order_relaxed);
+            if (hasGuests)
+                m_GuestCount[c].store(0, std::memory_order_relaxed);
+        }
 
-            // Store the current cell for each particle
-            if (m_ParticleCells.size() <= i)
-                m_ParticleCells.resize(i + 1);
+        threadPool.Sync();
 
+        // Count particles per cell, the returned value is the slot of the particle inside its cell
+        for (size_t i = particleBegin; i < particleEnd; i++)
+        {
+            const int level = hasGuests ? GetLevel(particleRadii[i]) : 0;
+            int cellIndex = GetCellIndex(level, particlePositions[i]);
+            m_ParticleLevels[i] = static_cast<uint8_t>(level);
             m_ParticleCells[i] = cellIndex;
+            m_ParticleSlots[i] = m_CellCount[cellIndex].fetch_add(1, std::memory_order_relaxed);
+
+            if (!hasGuests)
+                continue;
+
+            // And as a guest in every coarser level
+            for (int guestLevel = 1; guestLevel < levelCount; guestLevel++)
+            {
+                const size_t entry = i * guestsPerParticle + guestLevel - 1;
+                if (guestLevel <= level)
+                {
+                    m_GuestCells[entry] = -1;
+                    continue;
+                }
+
+                const int guestCell = GetCellIndex(guestLevel, particlePositions[i]);
+                m_GuestCells[entry] = guestCell;
+                m_GuestSlots[entry] = m_GuestCount[guestCell].fetch_add(1, std::memory_order_relaxed);
+            }
         }
+
+        threadPool.Sync();
+
+        // Exclusive prefix sum of the counts, first the sum of each thread range...
+        unsigned int localSum = 0;
+        unsigned int localGuestSum = 0;
+        for (size_t c = cellBegin; c < cellEnd; c++)
+        {
+            localSum += m_CellCount[c].load(std::memory_order_relaxed);
+            if (hasGuests)
+                localGuestSum += m_GuestCount[c].load(std::memory_order_relaxed);
+        }
+        m_ThreadSums[threadIndex] = localSum;
+        m_ThreadSums[numThreads + threadIndex] = localGuestSum;
+
+        threadPool.Sync();
+
+        // ...then every thread offsets its range by the sums of the previous ones
+        unsigned int offset = 0;
+        unsigned int guestOffset = 0;
+        for (unsigned int t = 0; t < threadIndex; t++)
+        {
+            offset += m_ThreadSums[t];
+            guestOffset += m_ThreadSums[numThreads + t];
+        }
+
+        for (size_t c = cellBegin; c < cellEnd; c++)
+        {
+            m_CellStart[c] = offset;
+            offset += m_CellCount[c].load(std::memory_order_relaxed);
+
+            if (hasGuests)
+            {
+                m_GuestStart[c] = guestOffset;
+                guestOffset += m_GuestCount[c].load(std::memory_order_relaxed);
+            }
+        }
+
+        if (threadIndex == numThreads - 1)
+        {
+            m_CellStart[cellCount] = static_cast<unsigned int>(particleCount);
+            if (hasGuests)
+                m_GuestStart[cellCount] = guestOffset;
+        }
+
+        threadPool.Sync();
+
+        // Scatter particle indices into their cells
+        for (size_t i = particleBegin; i < particleEnd; i++)
+            m_SortedParticles[m_CellStart[m_ParticleCells[i]] + m_ParticleSlots[i]] = static_cast<unsigned int>(i);
+
+        if (hasGuests)
+        {
+            for (size_t entry = particleBegin * guestsPerParticle; entry < particleEnd * guestsPerParticle; entry++)
+                if (m_GuestCells[entry] >= 0)
+                    m_SortedGuests[m_GuestStart[m_GuestCells[entry]] + m_GuestSlots[entry]] = static_cast<unsigned int>(entry / guestsPerParticle);
+        }
+
+        threadPool.Sync();
+
+        for (size_t c = cellBegin; c < cellEnd; c++)
+        {
+            SortCell(m_SortedParticles.data() + m_CellStart[c], m_SortedParticles.data() + m_CellStart[c + 1]);
+            if (hasGuests)
+                SortCell(m_SortedGuests.data() + m_GuestStart[c], m_SortedGuests.data() + m_GuestStart[c + 1]);
+        }
+    });
+}
+
+void SpatialGrid::RemoveParticles(const std::vector<unsigned int>& newIndices, size_t remainingCount, const unsigned int* movedParticles,
+    size_t movedCount, ThreadPool& threadPool)
+{
+    const size_t particleCount = newIndices.size();
+    const size_t cellCount = m_TotalCellCount;
+    const int levelCount = GetLevelCount();
+    const bool hasGuests = levelCount > 1;
+    const size_t guestsPerParticle = static_cast<size_t>(levelCount - 1);
+
+    // The survivors before a sorted entry give its compacted position and the survivors before a cell its new start, so the
+    // cells keep their order without being visited one by one. The compacted entries go to a scratch buffer and are swapped in
+    auto compactCells = [&](std::vector<unsigned int>& cellStart, std::vector<unsigned int>& sorted)
+    {
+        const size_t entryCount = cellStart[cellCount];
+        const unsigned int keptCount = threadPool.ExclusiveScan(entryCount,
+            [&](size_t k) { return newIndices[sorted[k]] != REMOVED_PARTICLE; }, m_RemovalKept);
+
+        m_RemovalSorted.resize(keptCount);
+        threadPool.ParallelFor(0, entryCount, [&](size_t start, size_t end, unsigned int)
+        {
+            for (size_t k = start; k < end; k++)
+            {
+                const unsigned int newIndex = newIndices[sorted[k]];
+                if (newIndex != REMOVED_PARTICLE)
+                    m_RemovalSorted[m_RemovalKept[k]] = newIndex;
+            }
+        });
+
+        threadPool.ParallelFor(0, cellCount + 1, [&](size_t start, size_t end, unsigned int)
+        {
+            for (size_t c = start; c < end; c++)
+                cellStart[c] = m_RemovalKept[cellStart[c]];
+        });
+        sorted.swap(m_RemovalSorted);
+    };
+
+    // The moved particles took lower indices, flag the cells they are in to sort them again once compacted. They are few,
+    // so they are flagged serially
+    if (m_RemovalCellFlags.size() != cellCount)
+        m_RemovalCellFlags.assign(cellCount, 0);
+    m_RemovalCellList.clear();
+    auto flagCell = [&](int cell, uint8_t flag)
+    {
+        if (m_RemovalCellFlags[cell] == 0)
+            m_RemovalCellList.push_back(cell);
+        m_RemovalCellFlags[cell] |= flag;
+    };
+    for (size_t k = 0; k < movedCount; k++)
+    {
+        flagCell(m_ParticleCells[movedParticles[k]], 1);
+        for (size_t level = 0; level < guestsPerParticle && hasGuests; level++)
+        {
+            const int guestCell = m_GuestCells[movedParticles[k] * guestsPerParticle + level];
+            if (guestCell >= 0)
+                flagCell(guestCell, 2);
+        }
+    }
+
+    compactCells(m_CellStart, m_SortedParticles);
+    if (hasGuests)
+    {
+        compactCells(m_GuestStart, m_SortedGuests);
+        m_SortedGuests.resize(remainingCount * guestsPerParticle);
+    }
+
+    // Per particle entries move with their particle. The slots are only used while building, they just keep their size
+    m_RemovalCells.resize(remainingCount);
+    m_RemovalLevels.resize(remainingCount);
+    if (hasGuests)
+        m_RemovalGuestCells.resize(remainingCount * guestsPerParticle);
+
+    threadPool.ParallelFor(0, particleCount, [&](size_t start, size_t end, unsigned int)
+    {
+        for (size_t i = start; i < end; i++)
+        {
+            const unsigned int newIndex = newIndices[i];
+            if (newIndex == REMOVED_PARTICLE)
+                continue;
+
+            m_RemovalCells[newIndex] = m_ParticleCells[i];
+            m_RemovalLevels[newIndex] = m_ParticleLevels[i];
+            for (size_t level = 0; level < guestsPerParticle && hasGuests; level++)
+                m_RemovalGuestCells[newIndex * guestsPerParticle + level] = m_GuestCells[i * guestsPerParticle + level];
+        }
+    });
+
+    m_ParticleCells.swap(m_RemovalCells);
+    m_ParticleLevels.swap(m_RemovalLevels);
+    m_ParticleSlots.resize(remainingCount);
+    if (hasGuests)
+    {
+        m_GuestCells.swap(m_RemovalGuestCells);
+        m_GuestSlots.resize(remainingCount * guestsPerParticle);
+    }
+
+    threadPool.ParallelFor(0, m_RemovalCellList.size(), [&](size_t start, size_t end, unsigned int)
+    {
+        for (size_t k = start; k < end; k++)
+        {
+            const int cell = m_RemovalCellList[k];
+            if (m_RemovalCellFlags[cell] & 1)
+                SortCell(m_SortedParticles.data() + m_CellStart[cell], m_SortedParticles.data() + m_CellStart[cell + 1]);
+            if (m_RemovalCellFlags[cell] & 2)
+                SortCell(m_SortedGuests.data() + m_GuestStart[cell], m_SortedGuests.data() + m_GuestStart[cell + 1]);
+            m_RemovalCellFlags[cell] = 0;
+        }
+    }, 64);
+
+    // Pairs name the old indices
+    m_CollisionPairs.clear();
+    m_CellPairStart.assign(cellCount + 1, 0);
+}
+
+// Index of the lowest set bit, bits must not be 0
+static inline int CountTrailingZeros(uint64_t bits)
+{
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_ARM64))
+    unsigned long index;
+    _BitScanForward64(&index, bits);
+    return static_cast<int>(index);
+#elif defined(_MSC_VER)
+    // 32-bit targets only scan 32 bits at a time
+    unsigned long index;
+    if (_BitScanForward(&index, static_cast<unsigned long>(bits)))
+        return static_cast<int>(index);
+    _BitScanForward(&index, static_cast<unsigned long>(bits >> 32));
+    return static_cast<int>(index) + 32;
+#else
+    return __builtin_ctzll(bits);
+#endif
+}
+
+void SpatialGrid::AllocateHashTable(size_t capacity)
+{
+    m_HashCapacity = capacity;
+
+    const size_t slotCount = capacity + HASH_PROBE_PADDING;
+    m_HashKeys.reset(new std::atomic<uint64_t>[slotCount]);
+    m_OccupiedSlots.reset(new std::atomic<uint64_t>[slotCount / 64]);
+    m_CellCount.reset(new std::atomic<unsigned int>[slotCount]);
+    if (GetLevelCount() > 1)
+        m_GuestCount.reset(new std::atomic<unsigned int>[slotCount]);
+    m_SlotRemap.resize(slotCount);
+    m_SlotCells.resize(slotCount);
+
+    // Builds only reset the slots they used
+    for (size_t slot = 0; slot < slotCount; slot++)
+    {
+        m_HashKeys[slot].store(EMPTY_KEY, std::memory_order_relaxed);
+        m_CellCount[slot].store(0, std::memory_order_relaxed);
+        if (GetLevelCount() > 1)
+            m_GuestCount[slot].store(0, std::memory_order_relaxed);
     }
+    for (size_t word = 0; word < slotCount / 64; word++)
+        m_OccupiedSlots[word].store(0, std::memory_order_relaxed);
 }
 
-void SpatialGrid::UpdateCells(std::vector<Vec2>& particlePositions)
+int SpatialGrid::InsertCell(uint64_t key)
 {
-    if (m_ParticleCells.size() < particlePositions.size()) 
+    // Linear probing, a free slot is claimed with a compare and swap so threads can insert at the same time
+    for (size_t slot = GetHomeSlot(key); slot < m_HashCapacity + HASH_PROBE_PADDING; slot++)
     {
-        size_t oldSize = m_ParticleCells.size();
-        m_ParticleCells.resize(particlePositions.size());
+        uint64_t slotKey = m_HashKeys[slot].load(std::memory_order_relaxed);
+        if (slotKey == EMPTY_KEY && m_HashKeys[slot].compare_exchange_strong(slotKey, key, std::memory_order_relaxed))
+        {
+            m_OccupiedSlots[slot >> 6].fetch_or(1ull << (slot & 63), std::memory_order_relaxed);
+            return static_cast<int>(slot);
+        }
+
+        // Already there, or inserted by another thread in the meantime
+        if (slotKey == key)
+            return static_cast<int>(slot);
+    }
+    return -1;
+}
+
+void SpatialGrid::BuildHashedCells(const ParticleColumn<Vec2>& particlePositions, const ParticleColumn<float>& particleRadii, ThreadPool& threadPool)
+{
+    const size_t particleCount = particlePositions.size();
+    const unsigned int numThreads = threadPool.GetNumThreads();
+    const int levelCount = GetLevelCount();
+    const size_t bucketCount = static_cast<size_t>(levelCount) * CELL_COLORS;
 
-        // Initialize new particles with invalid cell index
-        for (size_t i = oldSize; i < m_ParticleCells.size(); i++) 
-            m_ParticleCells[i] = -1;  
-        
+    const bool hasGuests = levelCount > 1;
+    const size_t guestsPerParticle = static_cast<size_t>(levelCount - 1);
+
+    m_ParticleCells.resize(particleCount);
+    m_ParticleSlots.resize(particleCount);
+    m_ParticleLevels.resize(particleCount);
+    m_SortedParticles.resize(particleCount);
+    m_ThreadSums.resize(numThreads * bucketCount * 3);
+    m_ClusterRuns.resize(numThreads);
+    if (hasGuests)
+    {
+        m_GuestCells.resize(particleCount * guestsPerParticle);
+        m_GuestSlots.resize(particleCount * guestsPerParticle);
+        m_SortedGuests.resize(particleCount * guestsPerParticle);
     }
 
-    // Check each particle for cell changes
-    for (unsigned int i = 0; i < particlePositions.size(); i++)
+    // At most half of the slots should be used. The cells of the last build are the best guess for this one,
+    // a table that got too full is grown by the next build
+    const size_t expectedCells = (m_HashCapacity > 0) ? m_TotalCellCount : particleCount;
+    size_t capacity = 1024;
+    while (capacity < 2 * expectedCells)
+        capacity *= 2;
+    if (capacity > m_HashCapacity || capacity * 4 < m_HashCapacity)
+        AllocateHashTable(capacity);
+
+    std::atomic<bool> hasOverflowed(false);
+    auto build = [&](unsigned int threadIndex)
     {
-        // Calculate the current cell index
-        int newCellIndex = GetCellIndex(particlePositions[i]);
-        int oldCellIndex = i < m_ParticleCells.size() ? m_ParticleCells[i] : -1;
+        // Threads split the table by 64 slot words and own the runs of occupied slots starting in their words
+        const size_t slotCount = m_HashCapacity + HASH_PROBE_PADDING;
+        size_t wordBegin, wordEnd;
+        size_t particleBegin, particleEnd;
+        threadPool.GetThreadRange(0, slotCount / 64, threadIndex, wordBegin, wordEnd);
+        threadPool.GetThreadRange(0, particleCount, threadIndex, particleBegin, particleEnd);
 
-        // If particle is new or has moved to a different cell
-        if (oldCellIndex != newCellIndex)
+        auto forEachOwnedRun = [&](auto&& func)
         {
-            // If it was in a valid cell before, remove it
-            if (oldCellIndex >= 0 && oldCellIndex < m_Grid.size())
+            for (size_t word = wordBegin; word < wordEnd; word++)
             {
-                auto& oldCell = m_Grid[oldCellIndex];
-                oldCell.erase(std::remove(oldCell.begin(), oldCell.end(), i), oldCell.end());
+                const uint64_t bits = m_OccupiedSlots[word].load(std::memory_order_relaxed);
+                const uint64_t previousBits = (bits << 1) | ((word > 0) ? m_OccupiedSlots[word - 1].load(std::memory_order_relaxed) >> 63 : 0);
+                uint64_t runStarts = bits & ~previousBits;
+                while (runStarts != 0)
+                {
+                    const size_t runBegin = word * 64 + CountTrailingZeros(runStarts);
+                    runStarts &= runStarts - 1;
+
+                    size_t runEnd = runBegin + 1;
+                    while (runEnd < slotCount && IsSlotOccupied(runEnd))
+                        runEnd++;
+                    func(runBegin, runEnd);
+                }
             }
+        };
 
-            // Add to new cell
-            if (newCellIndex >= 0 && newCellIndex < m_Grid.size())
+        // Empty the slots of the last build
+        for (size_t word = wordBegin; word < wordEnd; word++)
+        {
+            uint64_t bits = m_OccupiedSlots[word].load(std::memory_order_relaxed);
+            while (bits != 0)
             {
-                m_Grid[newCellIndex].push_back(i);
-                m_ParticleCells[i] = newCellIndex;
+                const size_t slot = word * 64 + CountTrailingZeros(bits);
+                bits &= bits - 1;
+                m_HashKeys[slot].store(EMPTY_KEY, std::memory_order_relaxed);
+                m_CellCount[slot].store(0, std::memory_order_relaxed);
+                if (hasGuests)
+                    m_GuestCount[slot].store(0, std::memory_order_relaxed);
             }
+            m_OccupiedSlots[word].store(0, std::memory_order_relaxed);
         }
-    }
-}
 
-void SpatialGrid::GenerateCollisionPairs(std::vector<Vec2>& particlePositions)
-{
-    m_CollisionPairs.clear();
+        threadPool.Sync();
 
-    // Approximate number of collision pairs to expect
-    m_CollisionPairs.reserve(particlePositions.size() * 4);  
+        // Insert the cell of every particle and guest, the counters give the slot of each one inside its cell.
+        // Until the cells are numbered m_ParticleCells and m_GuestCells hold table slots
+        for (size_t i = particleBegin; i < particleEnd; i++)
+        {
+            const int level = hasGuests ? GetLevel(particleRadii[i]) : 0;
+            const int slot = InsertCell(GetCellKey(level, particlePositions[i]));
+            if (slot < 0)
+            {
+                hasOverflowed = true;
+                break;
+            }
 
-    float maxDistSq = (m_ParticleRadius * 2.0f) * (m_ParticleRadius * 2.0f);
+            m_ParticleLevels[i] = static_cast<uint8_t>(level);
+            m_ParticleCells[i] = slot;
+            m_ParticleSlots[i] = m_CellCount[slot].fetch_add(1, std::memory_order_relaxed);
 
-    // Iterate through each cell
-    for (int cellY = 0; cellY < m_GridHeight; cellY++)
-    {
-        for (int cellX = 0; cellX < m_GridWidth; cellX++)
+            if (!hasGuests)
+                continue;
+
+            for (int guestLevel = 1; guestLevel < levelCount; guestLevel++)
+            {
+                const size_t entry = i * guestsPerParticle + guestLevel - 1;
+                if (guestLevel <= level)
+                {
+                    m_GuestCells[entry] = -1;
+                    continue;
+                }
+
+                const int guestSlot = InsertCell(GetCellKey(guestLevel, particlePositions[i]));
+                if (guestSlot < 0)
+                {
+                    hasOverflowed = true;
+                    break;
+                }
+
+                m_GuestCells[entry] = guestSlot;
+                m_GuestSlots[entry] = m_GuestCount[guestSlot].fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+
+        threadPool.Sync();
+
+        // Every thread sees the flag after the sync, they all leave and the table is grown
+        if (hasOverflowed)
+            return;
+
+        // Which slots are occupied doesn't depend on the insertion order, but which key lands where inside a run of
+        // occupied slots does. Sorting every run by home slot gives the same valid layout whatever the thread timings.
+        // Cells are numbered by (level, color) then by slot, count the cells, particles and guests of each bucket as well
+        unsigned int* threadSums = &m_ThreadSums[threadIndex * bucketCount * 3];
+        std::fill(threadSums, threadSums + bucketCount * 3, 0);
+        auto addToSums = [&](size_t slot)
         {
-            int cellIndex = cellX + cellY * m_GridWidth;
-            const auto& cellParticles = m_Grid[cellIndex];
+            unsigned int* sums = threadSums + GetKeyBucket(m_HashKeys[slot].load(std::memory_order_relaxed)) * 3;
+            sums[0]++;
+            sums[1] += m_CellCount[slot].load(std::memory_order_relaxed);
+            if (hasGuests)
+                sums[2] += m_GuestCount[slot].load(std::memory_order_relaxed);
+        };
 
-            // Compare particles within the same cell
-            for (size_t i = 0; i < cellParticles.size(); i++)
+        std::vector<ClusterEntry>& run = m_ClusterRuns[threadIndex];
+        forEachOwnedRun([&](size_t runBegin, size_t runEnd)
+        {
+            if (runEnd == runBegin + 1)
             {
-                unsigned int particleA = cellParticles[i];
+                m_SlotRemap[runBegin] = static_cast<unsigned int>(runBegin);
+                addToSums(runBegin);
+                return;
+            }
 
-                // Compare with other particles in the same cell
-                for (size_t j = i + 1; j < cellParticles.size(); j++)
+            run.clear();
+            for (size_t slot = runBegin; slot < runEnd; slot++)
+            {
+                const uint64_t key = m_HashKeys[slot].load(std::memory_order_relaxed);
+                const unsigned int guestCount = hasGuests ? m_GuestCount[slot].load(std::memory_order_relaxed) : 0;
+                run.push_back({ GetHomeSlot(key), key, m_CellCount[slot].load(std::memory_order_relaxed), guestCount, static_cast<unsigned int>(slot) });
+            }
+
+            std::sort(run.begin(), run.end(), [](const ClusterEntry& a, const ClusterEntry& b)
+            {
+                return a.homeSlot != b.homeSlot ? a.homeSlot < b.homeSlot : a.key < b.key;
+            });
+
+            for (size_t k = 0; k < run.size(); k++)
+            {
+                const size_t slot = runBegin + k;
+                m_HashKeys[slot].store(run[k].key, std::memory_order_relaxed);
+                m_CellCount[slot].store(run[k].count, std::memory_order_relaxed);
+                if (hasGuests)
+                    m_GuestCount[slot].store(run[k].guestCount, std::memory_order_relaxed);
+                m_SlotRemap[run[k].slot] = static_cast<unsigned int>(slot);
+                addToSums(slot);
+            }
+        });
+
+        threadPool.Sync();
+
+        // Offsets of each (bucket, thread), a few hundred values so a single thread does it
+        if (threadIndex == numThreads - 1)
+        {
+            unsigned int cellOffset = 0;
+            unsigned int particleOffset = 0;
+            unsigned int guestOffset = 0;
+            for (size_t bucket = 0; bucket < bucketCount; bucket++)
+            {
+                m_BucketStart[bucket] = cellOffset;
+                for (unsigned int t = 0; t < numThreads; t++)
                 {
-                    unsigned int particleB = cellParticles[j];
-
-                    if (AreParticlesCloseEnoughSq(particlePositions[particleA],
-                        particlePositions[particleB],
-                        maxDistSq))
-                    {
-                        m_CollisionPairs.push_back({ particleA, particleB });
-                    }
+                    unsigned int* sums = &m_ThreadSums[(t * bucketCount + bucket) * 3];
+                    const unsigned int cells = sums[0];
+                    const unsigned int particles = sums[1];
+                    const unsigned int guests = sums[2];
+                    sums[0] = cellOffset;
+                    sums[1] = particleOffset;
+                    sums[2] = guestOffset;
+                    cellOffset += cells;
+                    particleOffset += particles;
+                    guestOffset += guests;
                 }
+            }
+            m_BucketStart[bucketCount] = cellOffset;
 
-                // Compare with particles in neighboring cells (only positive direction to avoid duplicates)
-                for (int offsetY = 0; offsetY <= 1; offsetY++)
+            m_TotalCellCount = cellOffset;
+            m_CellCoordinates.resize(cellOffset);
+            m_CellStart.resize(cellOffset + 1);
+            m_CellStart[cellOffset] = particleOffset;
+            if (hasGuests)
+            {
+                m_GuestStart.resize(cellOffset + 1);
+                m_GuestStart[cellOffset] = guestOffset;
+            }
+        }
+
+        threadPool.Sync();
+
+        // Number the cells of the owned runs, in slot order inside each bucket
+        forEachOwnedRun([&](size_t runBegin, size_t runEnd)
+        {
+            for (size_t slot = runBegin; slot < runEnd; slot++)
+            {
+                const uint64_t key = m_HashKeys[slot].load(std::memory_order_relaxed);
+                unsigned int* offsets = threadSums + GetKeyBucket(key) * 3;
+                const unsigned int cell = offsets[0]++;
+                m_SlotCells[slot] = static_cast<int>(cell);
+                m_CellCoordinates[cell] = std::make_pair(GetKeyX(key), GetKeyY(key));
+                m_CellStart[cell] = offsets[1];
+                offsets[1] += m_CellCount[slot].load(std::memory_order_relaxed);
+                if (hasGuests)
                 {
-                    for (int offsetX = (offsetY == 0 ? 1 : -1); offsetX <= 1; offsetX++)
-                    {
-                        int neighborX = cellX + offsetX;
-                        int neighborY = cellY + offsetY;
-
-                        // Skip cells outside of grid boundaries
-                        if (neighborX < 0 || neighborX >= m_GridWidth ||
-                            neighborY < 0 || neighborY >= m_GridHeight)
-                            continue;
-
-                        int neighborCellIndex = neighborX + neighborY * m_GridWidth;
-                        const auto& neighborParticles = m_Grid[neighborCellIndex];
-
-                        // Compare with all particles in the neighboring cell
-                        for (unsigned int particleB : neighborParticles)
-                        {
-                            if (AreParticlesCloseEnoughSq(particlePositions[particleA],
-                                particlePositions[particleB],
-                                maxDistSq))
-                            {
-                                m_CollisionPairs.push_back({ particleA, particleB });
-                            }
-                        }
-                    }
+                    m_GuestStart[cell] = offsets[2];
+                    offsets[2] += m_GuestCount[slot].load(std::memory_order_relaxed);
                 }
             }
+        });
+
+        threadPool.Sync();
+
+        // Scatter particle and guest indices into their cells
+        for (size_t i = particleBegin; i < particleEnd; i++)
+        {
+            const int cell = m_SlotCells[m_SlotRemap[m_ParticleCells[i]]];
+            m_ParticleCells[i] = cell;
+            m_SortedParticles[m_CellStart[cell] + m_ParticleSlots[i]] = static_cast<unsigned int>(i);
+        }
+
+        if (hasGuests)
+        {
+            for (size_t entry = particleBegin * guestsPerParticle; entry < particleEnd * guestsPerParticle; entry++)
+            {
+                if (m_GuestCells[entry] < 0)
+                    continue;
+
+                const int cell = m_SlotCells[m_SlotRemap[m_GuestCells[entry]]];
+                m_GuestCells[entry] = cell;
+                m_SortedGuests[m_GuestStart[cell] + m_GuestSlots[entry]] = static_cast<unsigned int>(entry / guestsPerParticle);
+            }
+        }
+
+        threadPool.Sync();
+
+        size_t cellBegin, cellEnd;
+        threadPool.GetThreadRange(0, m_TotalCellCount, threadIndex, cellBegin, cellEnd);
+        for (size_t c = cellBegin; c < cellEnd; c++)
+        {
+            SortCell(m_SortedParticles.data() + m_CellStart[c], m_SortedParticles.data() + m_CellStart[c + 1]);
+            if (hasGuests)
+                SortCell(m_SortedGuests.data() + m_GuestStart[c], m_SortedGuests.data() + m_GuestStart[c + 1]);
+        }
+    };
+
+    // A run of occupied slots reached the end of the table, only with a table much too small for the cells
+    threadPool.Run(build);
+    while (hasOverflowed)
+    {
+        AllocateHashTable(m_HashCapacity * 2);
+        hasOverflowed = false;
+        threadPool.Run(build);
+    }
+}
+
+void SpatialGrid::GenerateCollisionPairs(const ParticleColumn<Vec2>& particlePositions, const ParticleColumn<float>& particleRadii,
+    const std::vector<uint8_t>* cellIsAwake, float skin)
+{
+    m_CollisionPairs.clear();
+
+    // Approximate number of collision pairs to expect
+    m_CollisionPairs.reserve(particlePositions.size() * 4);
+
+    // Particles are candidates if they are closer than the sum of their radii plus the skin
+    auto addIfClose = [&](unsigned int particleA, unsigned int particleB)
+    {
+        const float contactDistance = particleRadii[particleA] + particleRadii[particleB] + skin;
+        if (AreParticlesCloseEnoughSq(particlePositions[particleA], particlePositions[particleB], contactDistance * contactDistance))
+            m_CollisionPairs.push_back({ particleA, particleB });
+    };
+
+    // Pairs are only ever generated towards the current cell and its positive neighbors,
+    // so every cell owns a contiguous range of the pair vector
+    m_CellPairStart.resize(m_TotalCellCount + 1);
+
+    // Iterate through each cell of each level
+    for (int level = 0; level < GetLevelCount(); level++)
+    {
+        const size_t levelEnd = GetLevelCellEnd(level);
+        for (size_t c = GetLevelCellBegin(level); c < levelEnd; c++)
+        {
+            const int cellIndex = static_cast<int>(c);
+            m_CellPairStart[c] = static_cast<unsigned int>(m_CollisionPairs.size());
+            if (IsCellEmpty(cellIndex))
+                continue;
+
+            int cellX, cellY;
+            GetCellCoordinates(level, cellIndex, cellX, cellY);
+            const PairCells cells = GetPairCells(level, cellIndex, cellX, cellY);
+            if (cellIsAwake && !IsAnyPairCellFlagged(cells, *cellIsAwake))
+                continue;
+
+            ForEachCellPair(cells, addIfClose);
+            ForEachGuestPair(cells, addIfClose);
         }
     }
+
+    m_CellPairStart[m_TotalCellCount] = static_cast<unsigned int>(m_CollisionPairs.size());
 }
@@ -1,50 +1,309 @@
 #pragma once
 
 #include <vector>
-#include <algorithm>  // For std::remove
+#include <memory>
+#include <atomic>
+#include <algorithm>
+#include <cstdint>
+#include <cmath>
 #include "Vec2.h"
+#include "ParticleColumn.h"
+#include "../core/ThreadPool.h"
 
+// Hierarchical grid stored in CSR layout. Every particle is binned in the level matching its radius: level 0 is sized
+// for the smallest particles and each next level for radii four times as large, so a few large particles don't blow up the
+// cells of all the others. The cells of all the levels share one index space, the particles of cell i are
+// m_SortedParticles[m_CellStart[i]] ... m_SortedParticles[m_CellStart[i + 1] - 1].
+// A particle can only touch a larger one within the 3x3 cells around it in the level of the larger one, so every
+// particle is also binned as a guest in each coarser level (m_GuestStart / m_SortedGuests, same layout) and the pairs
+// across levels are found from there. With equal radii there is a single level and no guests.
+// The whole grid is rebuilt every substep with a parallel counting sort.
+//
+// In hashed mode only the occupied cells exist: an open addressing table maps (level, x, y) to a cell and the cells are
+// numbered level by level, then by color, so memory and traversal scale with the particles instead of the bounds.
+// Cell coordinates aren't clamped to the bounds in this mode.
 class SpatialGrid
 {
+public:
+	static const int MAX_LEVELS = 8;
+	static const int LEVEL_RATIO_LOG2 = 2;	// radii grow 4 times from one level to the next
+	static const int CELL_COLORS = 6;		// see ForEachColoredCell
+	static const unsigned int REMOVED_PARTICLE = ~0u;	// new index of a removed particle, see RemoveParticles
+
+	// A cell owning candidate pairs with its positive neighbors: right, then the three cells above from left to right.
+	// Neighbors outside the grid, or without particles in hashed mode, are -1
+	struct PairCells
+	{
+		int level;
+		int cell;
+		int neighbors[4];
+	};
+
 private:
-	float m_ParticleRadius;
-	float m_CellSize;
+	static const uint64_t EMPTY_KEY = ~0ull;
+	static const int KEY_COORDINATE_BITS = 30;
+	static const int KEY_COORDINATE_BIAS = 1 << 29;
+	static const size_t HASH_PROBE_PADDING = 256;	// probes run past the last home slot instead of wrapping around
+
+	struct GridLevel
+	{
+		float maxRadius;	// largest radius binned in the level
+		float cellSize;
+		int width;
+		int height;
+		size_t cellOffset;	// index of the first cell of the level
+	};
+
+	float m_MinRadius;
+	float m_MaxRadius;
 	Vec2 m_MinBound;
 	Vec2 m_MaxBound;
-	int m_GridWidth;
-	int m_GridHeight;
+	std::vector<GridLevel> m_Levels;
+	size_t m_TotalCellCount;
 	unsigned int m_NumberOfParticles;
 	std::vector<std::pair<int, int>> m_CollisionPairs;
-	std::vector<std::vector<unsigned int>> m_Grid; // store particles with index in 1D array
+	std::vector<unsigned int> m_CellPairStart;	   // Pairs found from cell i are [m_CellPairStart[i], m_CellPairStart[i + 1])
+
+	std::unique_ptr<std::atomic<unsigned int>[]> m_CellCount; // Number of particles in each cell
+	std::vector<unsigned int> m_CellStart;		   // Offset of each cell in m_SortedParticles, has one extra entry at the end
+	std::vector<unsigned int> m_SortedParticles;   // Particle indices sorted by cell
 	std::vector<int> m_ParticleCells;			   // Track which cell each particle is in
+	std::vector<unsigned int> m_ParticleSlots;	   // Position of each particle inside its cell, used by the scatter pass
+	std::vector<uint8_t> m_ParticleLevels;		   // Level of each particle
+	std::vector<unsigned int> m_ThreadSums;		   // Per thread partial sums for the prefix scan
+	std::vector<unsigned int> m_RemovalKept;	   // Survivors before every sorted entry, see RemoveParticles
+	std::vector<unsigned int> m_RemovalSorted;	   // Compacted arrays, swapped in once filled
+	std::vector<int> m_RemovalCells;
+	std::vector<uint8_t> m_RemovalLevels;
+	std::vector<int> m_RemovalGuestCells;
+	std::vector<uint8_t> m_RemovalCellFlags;	   // Cells to sort again after a swap removal
+	std::vector<int> m_RemovalCellList;
+
+	// Guests, entry (particle, level) is at particle * (level count - 1) + level - 1, cell -1 if the level isn't coarser
+	std::unique_ptr<std::atomic<unsigned int>[]> m_GuestCount;
+	std::vector<unsigned int> m_GuestStart;
+	std::vector<unsigned int> m_SortedGuests;
+	std::vector<int> m_GuestCells;
+	std::vector<unsigned int> m_GuestSlots;
+
+	// Hashed mode, the cell counters above are per table slot
+	bool m_UseHashing;
+	size_t m_HashCapacity;								 // Number of home slots, a power of two
+	std::unique_ptr<std::atomic<uint64_t>[]> m_HashKeys; // Cell key of each slot, EMPTY_KEY if free
+	std::unique_ptr<std::atomic<uint64_t>[]> m_OccupiedSlots; // One bit per slot, the passes over the table only visit these
+	std::vector<unsigned int> m_SlotRemap;				 // Slot a key was moved to when its cluster was sorted
+	std::vector<int> m_SlotCells;						 // Cell of each occupied slot
+	std::vector<std::pair<int, int>> m_CellCoordinates;	 // Coordinates of each cell
+	std::vector<unsigned int> m_BucketStart;			 // First cell of each (level, color), has one extra entry at the end
+
+	// Slot of a table cluster being sorted back into the same layout whatever the insertion order
+	struct ClusterEntry
+	{
+		size_t homeSlot;
+		uint64_t key;
+		unsigned int count;
+		unsigned int guestCount;
+		unsigned int slot;
+	};
+	std::vector<std::vector<ClusterEntry>> m_ClusterRuns; // Per thread scratch of the cluster sort, only grows
+
+	void BuildHashedCells(const ParticleColumn<Vec2>& particlePositions, const ParticleColumn<float>& particleRadii, ThreadPool& threadPool);
+	void AllocateHashTable(size_t capacity);
+	int InsertCell(uint64_t key);
+
+	// Pack the level and the coordinates of a cell, coordinates are clamped to +-2^29 cells
+	static inline uint64_t MakeCellKey(int level, int cellX, int cellY)
+	{
+		const int x = std::min(std::max(cellX, -KEY_COORDINATE_BIAS), KEY_COORDINATE_BIAS - 1) + KEY_COORDINATE_BIAS;
+		const int y = std::min(std::max(cellY, -KEY_COORDINATE_BIAS), KEY_COORDINATE_BIAS - 1) + KEY_COORDINATE_BIAS;
+		return (static_cast<uint64_t>(level) << (2 * KEY_COORDINATE_BITS)) | (static_cast<uint64_t>(y) << KEY_COORDINATE_BITS) | static_cast<uint64_t>(x);
+	}
+
+	static inline int GetKeyLevel(uint64_t key) { return static_cast<int>(key >> (2 * KEY_COORDINATE_BITS)); }
+	static inline int GetKeyX(uint64_t key) { return static_cast<int>(key & ((1u << KEY_COORDINATE_BITS) - 1)) - KEY_COORDINATE_BIAS; }
+	static inline int GetKeyY(uint64_t key) { return static_cast<int>((key >> KEY_COORDINATE_BITS) & ((1u << KEY_COORDINATE_BITS) - 1)) - KEY_COORDINATE_BIAS; }
+
+	// Index of the (level, color) bucket of a cell, colors are numbered like ForEachColoredCell visits them
+	static inline int GetKeyBucket(uint64_t key)
+	{
+		const int colorX = ((GetKeyX(key) % 3) + 3) % 3;
+		const int colorY = GetKeyY(key) & 1;
+		return GetKeyLevel(key) * CELL_COLORS + colorY * 3 + colorX;
+	}
+
+	// Mix all the bits of the key, neighboring cells land anywhere in the table so runs of occupied slots stay short
+	inline size_t GetHomeSlot(uint64_t key) const
+	{
+		key ^= key >> 33;
+		key *= 0xFF51AFD7ED558CCDull;
+		key ^= key >> 33;
+		key *= 0xC4CEB9FE1A85EC53ull;
+		key ^= key >> 33;
+		return static_cast<size_t>(key) & (m_HashCapacity - 1);
+	}
+
+	inline bool IsSlotOccupied(size_t slot) const
+	{
+		return (m_OccupiedSlots[slot >> 6].load(std::memory_order_relaxed) >> (slot & 63)) & 1;
+	}
+
+	// Unclamped coordinates of the cell holding a position in the given level
+	inline uint64_t GetCellKey(int level, const Vec2& position) const
+	{
+		const GridLevel& gridLevel = m_Levels[level];
+		const int x = static_cast<int>(std::floor((position.x - m_MinBound.x) / gridLevel.cellSize));
+		const int y = static_cast<int>(std::floor((position.y - m_MinBound.y) / gridLevel.cellSize));
+		return MakeCellKey(level, x, y);
+	}
 
 public:
-	SpatialGrid(unsigned int numberOfParticles, float particleRadius, const Vec2& minBound, const Vec2& maxBound)
-		:m_NumberOfParticles(numberOfParticles), m_ParticleRadius(particleRadius), m_CellSize(particleRadius * 2.5f),
-		m_MinBound(minBound), m_MaxBound(maxBound)
+	// Levels are created for the radii of the given particles, or for defaultRadius if there are none yet
+	SpatialGrid(unsigned int numberOfParticles, const ParticleColumn<float>& particleRadii, float defaultRadius, const Vec2& minBound, const Vec2& maxBound,
+		bool useHashing = false)
+		:m_MinRadius(defaultRadius), m_MaxRadius(defaultRadius), m_MinBound(minBound), m_MaxBound(maxBound),
+		m_TotalCellCount(0), m_NumberOfParticles(numberOfParticles), m_UseHashing(useHashing), m_HashCapacity(0)
 	{
-		m_GridWidth = static_cast<int>((maxBound.x - minBound.x) / m_CellSize) + 1;
-		m_GridHeight = static_cast<int>((maxBound.y - minBound.y) / m_CellSize) + 1;
+		if (!particleRadii.empty())
+		{
+			const auto range = std::minmax_element(particleRadii.begin(), particleRadii.end());
+			m_MinRadius = *range.first;
+			m_MaxRadius = *range.second;
+		}
 
-		// Initialize grid with the correct size
-		m_Grid.resize(m_GridWidth * m_GridHeight);
+		// Radius range of a level, only the ranges holding particles get one. Every occupied range keeps its level even when it
+		// holds many particles, merging them into a coarser level was slower on continuous distributions, see the README
+		auto upperRadius = [&](int range) { return m_MinRadius * std::ldexp(1.0f, (range + 1) * LEVEL_RATIO_LOG2); };
 
-		// Reserve space for particle cell tracking
-		m_ParticleCells.resize(numberOfParticles, -1);
+		uint32_t occupiedRanges = 1;
+		for (float radius : particleRadii)
+		{
+			int range = 0;
+			while (range < 15 && radius >= upperRadius(range))
+				range++;
+			occupiedRanges |= 1u << range;
+		}
 
-		for (auto& cell : m_Grid) {
-			cell.reserve(15); // Conservative number for max neighbors per cell
+		for (int range = 0; range < 16; range++)
+		{
+			if (!(occupiedRanges & (1u << range)))
+				continue;
+
+			// Past MAX_LEVELS the last level takes all the remaining ranges
+			const bool isLast = (occupiedRanges >> range) == 1 || m_Levels.size() + 1 == MAX_LEVELS;
+
+			GridLevel gridLevel;
+			gridLevel.maxRadius = isLast ? m_MaxRadius : std::min(upperRadius(range), m_MaxRadius);
+			gridLevel.cellSize = gridLevel.maxRadius * 2.5f;
+			gridLevel.width = static_cast<int>((maxBound.x - minBound.x) / gridLevel.cellSize) + 1;
+			gridLevel.height = static_cast<int>((maxBound.y - minBound.y) / gridLevel.cellSize) + 1;
+			gridLevel.cellOffset = m_TotalCellCount;
+			m_TotalCellCount += static_cast<size_t>(gridLevel.width) * gridLevel.height;
+			m_Levels.push_back(gridLevel);
+
+			if (isLast)
+				break;
+		}
+
+		// Two flat arrays for the cells instead of one vector per cell. The hashed cells only exist once built
+		if (m_UseHashing)
+		{
+			m_TotalCellCount = 0;
+			m_BucketStart.assign(m_Levels.size() * CELL_COLORS + 1, 0);
+		}
+		else
+		{
+			m_CellCount.reset(new std::atomic<unsigned int>[m_TotalCellCount]);
+			if (m_Levels.size() > 1)
+				m_GuestCount.reset(new std::atomic<unsigned int>[m_TotalCellCount]);
+		}
+
+		m_CellStart.resize(m_TotalCellCount + 1, 0);
+		if (m_Levels.size() > 1)
+			m_GuestStart.resize(m_TotalCellCount + 1, 0);
+
+		// Reserve space for particle tracking
+		m_SortedParticles.reserve(numberOfParticles);
+		m_ParticleCells.reserve(numberOfParticles);
+		m_ParticleSlots.reserve(numberOfParticles);
+	}
+
+	// Get the level a particle of the given radius is binned in, the first one sized for it
+	inline int GetLevel(float radius) const
+	{
+		int level = 0;
+		while (level + 1 < static_cast<int>(m_Levels.size()) && radius >= m_Levels[level].maxRadius)
+			level++;
+		return level;
+	}
+
+	// Get the cell index of a position in the given level
+	inline int GetCellIndex(int level, const Vec2& position) const
+	{
+		const GridLevel& gridLevel = m_Levels[level];
+		int x = static_cast<int>((position.x - m_MinBound.x) / gridLevel.cellSize);
+		x = (x < 0) ? 0 : ((x >= gridLevel.width) ? gridLevel.width - 1 : x);
+		int y = static_cast<int>((position.y - m_MinBound.y) / gridLevel.cellSize);
+		y = (y < 0) ? 0 : ((y >= gridLevel.height) ? gridLevel.height - 1 : y);
+		return static_cast<int>(gridLevel.cellOffset) + x + y * gridLevel.width;
+	}
+
+	// Get the cell at the given coordinates of a level, -1 if it is outside the grid or, in hashed mode, empty
+	inline int FindCell(int level, int cellX, int cellY) const
+	{
+		if (!m_UseHashing)
+		{
+			const GridLevel& gridLevel = m_Levels[level];
+			if (cellX < 0 || cellY < 0 || cellX >= gridLevel.width || cellY >= gridLevel.height)
+				return -1;
+			return static_cast<int>(gridLevel.cellOffset) + cellX + cellY * gridLevel.width;
+		}
+
+		const uint64_t key = MakeCellKey(level, cellX, cellY);
+		for (size_t slot = GetHomeSlot(key); slot < m_HashCapacity + HASH_PROBE_PADDING; slot++)
+		{
+			const uint64_t slotKey = m_HashKeys[slot].load(std::memory_order_relaxed);
+			if (slotKey == key)
+				return m_SlotCells[slot];
+			if (slotKey == EMPTY_KEY)
+				return -1;
 		}
+		return -1;
 	}
 
-	// Get particle index from position
-	inline int GetCellIndex(const Vec2& position) const
+	// Get the coordinates of a cell of the given level
+	inline void GetCellCoordinates(int level, int cellIndex, int& cellX, int& cellY) const
 	{
-		int x = static_cast<int>((position.x - m_MinBound.x) / m_CellSize);
-		x = (x < 0) ? 0 : ((x >= m_GridWidth) ? m_GridWidth - 1 : x);
-		int y = static_cast<int>((position.y - m_MinBound.y) / m_CellSize);
-		y = (y < 0) ? 0 : ((y >= m_GridHeight) ? m_GridHeight - 1 : y);
-		return x + y * m_GridWidth;
+		if (m_UseHashing)
+		{
+			cellX = m_CellCoordinates[cellIndex].first;
+			cellY = m_CellCoordinates[cellIndex].second;
+			return;
+		}
+
+		const GridLevel& gridLevel = m_Levels[level];
+		const int localIndex = cellIndex - static_cast<int>(gridLevel.cellOffset);
+		cellX = localIndex % gridLevel.width;
+		cellY = localIndex / gridLevel.width;
+	}
+
+	// Get a cell with its positive neighbors
+	inline PairCells GetPairCells(int level, int cellIndex, int cellX, int cellY) const
+	{
+		PairCells cells;
+		cells.level = level;
+		cells.cell = cellIndex;
+		cells.neighbors[0] = FindCell(level, cellX + 1, cellY);
+		cells.neighbors[1] = FindCell(level, cellX - 1, cellY + 1);
+		cells.neighbors[2] = FindCell(level, cellX, cellY + 1);
+		cells.neighbors[3] = FindCell(level, cellX + 1, cellY + 1);
+		return cells;
+	}
+
+	// Return true if no particle or guest is binned in the cell, such a cell owns no pairs
+	inline bool IsCellEmpty(int cellIndex) const
+	{
+		return m_CellStart[cellIndex] == m_CellStart[cellIndex + 1] &&
+			(m_GuestStart.empty() || m_GuestStart[cellIndex] == m_GuestStart[cellIndex + 1]);
 	}
 
 	// Checks if particles are close enough to be inserted in the potential collision neighbor vector
@@ -59,31 +318,319 @@ public:
 		return (dx2 + dy2) <= maxDistanceSq && dy2 <= maxDistanceSq;
 	}
 
-	// Clear grid cell but don't delete it
+	// Clear grid cells but keep the allocations
 	void Clear()
 	{
-		for (auto& cell : m_Grid) 
-			cell.clear();
-
+		if (m_UseHashing)
+		{
+			m_TotalCellCount = 0;
+			m_CellStart.resize(1);
+			m_GuestStart.resize(m_GuestStart.empty() ? 0 : 1);
+			std::fill(m_BucketStart.begin(), m_BucketStart.end(), 0);
+		}
+		std::fill(m_CellStart.begin(), m_CellStart.end(), 0);
+		std::fill(m_GuestStart.begin(), m_GuestStart.end(), 0);
+		m_SortedParticles.clear();
+		m_SortedGuests.clear();
 		m_CollisionPairs.clear();
-		std::fill(m_ParticleCells.begin(), m_ParticleCells.end(), -1);
+		m_ParticleCells.clear();
 	}
 
-	// Initialize cells with particle positions
-	void InitCells(std::vector<Vec2>& particlePositions);
+	// Rebuild all the cells from the particle positions and radii with a parallel counting sort
+	void BuildCells(const ParticleColumn<Vec2>& particlePositions, const ParticleColumn<float>& particleRadii, ThreadPool& threadPool);
 
-	// Update cells with new particle positions - only move particles that changed cells
-	void UpdateCells(std::vector<Vec2>& particlePositions);
+	// Drop removed particles from the cells of the last build and rename the others, newIndices gives the index of every
+	// particle of the build after the removal or REMOVED_PARTICLE. The cells keep their place, so the grid can be queried
+	// until the next build without binning anything again. The new indices follow the old order except for the moved
+	// particles (old indices), only their cells are sorted again. The collision pairs are dropped
+	void RemoveParticles(const std::vector<unsigned int>& newIndices, size_t remainingCount, const unsigned int* movedParticles,
+		size_t movedCount, ThreadPool& threadPool);
 
-	// Generate collision pairs for all particles
-	void GenerateCollisionPairs(std::vector<Vec2>& particlePositions);
+	// Pairs owned by cell (x, y) only touch particles in cells x-1..x+1, y..y+1, so cells 3 columns or 2 rows apart never
+	// share a particle. Each of the 6 colors is handed to the thread pool and processed without locks, the colors are
+	// processed one after the other. Empty cells are skipped. func(cellIndex, cellX, cellY, threadIndex)
+	template<typename Func>
+	void ForEachColoredCell(ThreadPool& threadPool, int level, Func&& func) const
+	{
+		const GridLevel& gridLevel = m_Levels[level];
+		for (int color = 0; color < CELL_COLORS; color++)
+		{
+			if (m_UseHashing)
+			{
+				const size_t bucket = static_cast<size_t>(level) * CELL_COLORS + color;
+				threadPool.ParallelFor(m_BucketStart[bucket], m_BucketStart[bucket + 1], [&](size_t start, size_t end, unsigned int threadIndex)
+				{
+					for (size_t c = start; c < end; c++)
+						func(static_cast<int>(c), m_CellCoordinates[c].first, m_CellCoordinates[c].second, threadIndex);
+				}, 64);
+				continue;
+			}
+
+			const int colorX = color % 3;
+			const int colorY = color / 3;
+			const int cellsPerRow = (gridLevel.width - colorX + 2) / 3;
+			const int rows = (gridLevel.height - colorY + 1) / 2;
+			if (cellsPerRow <= 0 || rows <= 0)
+				continue;
+
+			threadPool.ParallelFor(0, static_cast<size_t>(cellsPerRow) * rows, [&](size_t start, size_t end, unsigned int threadIndex)
+			{
+				for (size_t k = start; k < end; k++)
+				{
+					const int cellX = colorX + static_cast<int>(k % cellsPerRow) * 3;
+					const int cellY = colorY + static_cast<int>(k / cellsPerRow) * 2;
+					const int cellIndex = static_cast<int>(gridLevel.cellOffset) + cellX + cellY * gridLevel.width;
+					if (!IsCellEmpty(cellIndex))
+						func(cellIndex, cellX, cellY, threadIndex);
+				}
+			}, 64);
+		}
+	}
+
+	// Call func(particleA, particleB) for every candidate pair of particles of the level owned by the cell: particles of
+	// the cell itself and of its positive neighbors, so each pair is visited once
+	template<typename Func>
+	void ForEachCellPair(const PairCells& cells, Func&& func) const
+	{
+		const unsigned int cellBegin = m_CellStart[cells.cell];
+		const unsigned int cellEnd = m_CellStart[cells.cell + 1];
+
+		for (unsigned int i = cellBegin; i < cellEnd; i++)
+		{
+			const unsigned int particleA = m_SortedParticles[i];
+
+			// Other particles in the same cell
+			for (unsigned int j = i + 1; j < cellEnd; j++)
+				func(particleA, m_SortedParticles[j]);
+
+			// Neighboring cells, only positive direction to avoid duplicates
+			for (int neighbor : cells.neighbors)
+			{
+				if (neighbor < 0)
+					continue;
+
+				const unsigned int neighborEnd = m_CellStart[neighbor + 1];
+				for (unsigned int n = m_CellStart[neighbor]; n < neighborEnd; n++)
+					func(particleA, m_SortedParticles[n]);
+			}
+		}
+	}
+
+	// Call func(guest, particle) for every candidate pair of a smaller particle binned as a guest in the level and a particle of
+	// the level owned by the cell: guests of the cell with particles of the cell and its positive neighbors, then particles of
+	// the cell with guests of its positive neighbors. Like ForEachCellPair only these cells are touched
+	template<typename Func>
+	void ForEachGuestPair(const PairCells& cells, Func&& func) const
+	{
+		if (cells.level == 0)
+			return;
+
+		const unsigned int cellBegin = m_CellStart[cells.cell];
+		const unsigned int cellEnd = m_CellStart[cells.cell + 1];
+		const unsigned int guestBegin = m_GuestStart[cells.cell];
+		const unsigned int guestEnd = m_GuestStart[cells.cell + 1];
+		if (cellBegin == cellEnd && guestBegin == guestEnd)
+			return;
+
+		// Guests of the cell against the particles of a cell, the loops are ordered so empty cells cost nothing
+		auto pairGuestsWith = [&](unsigned int begin, unsigned int end)
+		{
+			for (unsigned int n = begin; n < end; n++)
+				for (unsigned int g = guestBegin; g < guestEnd; g++)
+					func(m_SortedGuests[g], m_SortedParticles[n]);
+		};
+
+		pairGuestsWith(cellBegin, cellEnd);
+
+		for (int neighbor : cells.neighbors)
+		{
+			if (neighbor < 0)
+				continue;
+
+			if (guestBegin != guestEnd)
+				pairGuestsWith(m_CellStart[neighbor], m_CellStart[neighbor + 1]);
+
+			for (unsigned int i = cellBegin; i < cellEnd; i++)
+				for (unsigned int g = m_GuestStart[neighbor]; g < m_GuestStart[neighbor + 1]; g++)
+					func(m_SortedGuests[g], m_SortedParticles[i]);
+		}
+	}
+
+	// Call func(particles, count) with the particles binned in the cells of every level touching [boxMin, boxMax] grown by
+	// margin plus the largest radius of the level. This covers every particle whose binned position is within its own
+	// radius plus margin of the box, each particle once as guests are left out. Dense grids clamp the box to the border cells
+	template<typename Func>
+	void ForEachCellInBox(const Vec2& boxMin, const Vec2& boxMax, float margin, Func&& func) const
+	{
+		for (int level = 0; level < static_cast<int>(m_Levels.size()); level++)
+		{
+			const GridLevel& gridLevel = m_Levels[level];
+			const float reach = margin + gridLevel.maxRadius;
+			int firstX = static_cast<int>(std::floor((boxMin.x - reach - m_MinBound.x) / gridLevel.cellSize));
+			int firstY = static_cast<int>(std::floor((boxMin.y - reach - m_MinBound.y) / gridLevel.cellSize));
+			int lastX = static_cast<int>(std::floor((boxMax.x + reach - m_MinBound.x) / gridLevel.cellSize));
+			int lastY = static_cast<int>(std::floor((boxMax.y + reach - m_MinBound.y) / gridLevel.cellSize));
+
+			// In dense mode the cells of a row are consecutive, so are their particles: one run per row
+			if (!m_UseHashing)
+			{
+				firstX = std::min(std::max(firstX, 0), gridLevel.width - 1);
+				lastX = std::min(std::max(lastX, 0), gridLevel.width - 1);
+				firstY = std::min(std::max(firstY, 0), gridLevel.height - 1);
+				lastY = std::min(std::max(lastY, 0), gridLevel.height - 1);
+				for (int y = firstY; y <= lastY; y++)
+				{
+					const int rowCell = static_cast<int>(gridLevel.cellOffset) + y * gridLevel.width;
+					const unsigned int runStart = m_CellStart[rowCell + firstX];
+					const unsigned int runEnd = m_CellStart[rowCell + lastX + 1];
+					if (runStart < runEnd)
+						func(m_SortedParticles.data() + runStart, runEnd - runStart);
+				}
+				continue;
+			}
+
+			for (int y = firstY; y <= lastY; y++)
+			{
+				for (int x = firstX; x <= lastX; x++)
+				{
+					const int cell = FindCell(level, x, y);
+					if (cell >= 0 && m_CellStart[cell] < m_CellStart[cell + 1])
+						func(m_SortedParticles.data() + m_CellStart[cell], m_CellStart[cell + 1] - m_CellStart[cell]);
+				}
+			}
+		}
+	}
+
+	// Call func(particles, count) with the particles binned in the 3x3 cells around a position, in every level. The cells of
+	// every level are at least as wide as those of level 0, so this covers every particle within GetCellSize(0) of the position.
+	// Dense grids put particles outside the bounds in the border cells, the position is clamped the same way
+	template<typename Func>
+	void ForEachNeighborCell(const Vec2& position, Func&& func) const
+	{
+		for (int level = 0; level < static_cast<int>(m_Levels.size()); level++)
+		{
+			const GridLevel& gridLevel = m_Levels[level];
+			int cellX = static_cast<int>(std::floor((position.x - m_MinBound.x) / gridLevel.cellSize));
+			int cellY = static_cast<int>(std::floor((position.y - m_MinBound.y) / gridLevel.cellSize));
+			if (!m_UseHashing)
+			{
+				cellX = std::min(std::max(cellX, 0), gridLevel.width - 1);
+				cellY = std::min(std::max(cellY, 0), gridLevel.height - 1);
+			}
+
+			// In dense mode the cells of a row are consecutive, so are their particles: one run per row
+			if (!m_UseHashing)
+			{
+				const int firstX = std::max(cellX - 1, 0);
+				const int lastX = std::min(cellX + 1, gridLevel.width - 1);
+				for (int y = std::max(cellY - 1, 0); y <= std::min(cellY + 1, gridLevel.height - 1); y++)
+				{
+					const int rowCell = static_cast<int>(gridLevel.cellOffset) + y * gridLevel.width;
+					const unsigned int runStart = m_CellStart[rowCell + firstX];
+					const unsigned int runEnd = m_CellStart[rowCell + lastX + 1];
+					if (runStart < runEnd)
+						func(m_SortedParticles.data() + runStart, runEnd - runStart);
+				}
+				continue;
+			}
+
+			for (int y = cellY - 1; y <= cellY + 1; y++)
+			{
+				for (int x = cellX - 1; x <= cellX + 1; x++)
+				{
+					const int cell = FindCell(level, x, y);
+					if (cell >= 0 && m_CellStart[cell] < m_CellStart[cell + 1])
+						func(m_SortedParticles.data() + m_CellStart[cell], m_CellStart[cell + 1] - m_CellStart[cell]);
+				}
+			}
+		}
+	}
+
+	// Return true if the cell or one of the positive neighbors the pair iterations pair it with is flagged
+	inline bool IsAnyPairCellFlagged(const PairCells& cells, const std::vector<uint8_t>& cellFlags) const
+	{
+		if (cellFlags[cells.cell])
+			return true;
+		for (int neighbor : cells.neighbors)
+			if (neighbor >= 0 && cellFlags[neighbor])
+				return true;
+		return false;
+	}
+
+	// Generate collision pairs for all particles, level by level. If cellIsAwake is given, cells whose pairs only
+	// involve cells without awake particles are skipped. Pairs closer than the sum of their radii plus skin are kept,
+	// skin can't go over GetMaxPairSkin or pairs binned two cells apart would be missed
+	void GenerateCollisionPairs(const ParticleColumn<Vec2>& particlePositions, const ParticleColumn<float>& particleRadii,
+		const std::vector<uint8_t>* cellIsAwake = nullptr, float skin = 0.0f);
 
 	// Get all generated collision pairs
 	const std::vector<std::pair<int, int>>& GetCollisionPairs() const { return m_CollisionPairs; }
 
-	// Get particle count of a certain cell
+	// Get the offset of the first collision pair generated from each cell, has one extra entry at the end
+	const std::vector<unsigned int>& GetCellPairStart() const { return m_CellPairStart; }
+
+	// Get the number of levels, 1 if all the radii are within a factor 4
+	int GetLevelCount() const { return static_cast<int>(m_Levels.size()); }
+
+	// Get the width of the cells of a level, 2.5 times the largest radius binned in it
+	float GetCellSize(int level) const { return m_Levels[level].cellSize; }
+
+	// Get the largest distance that can be added to the contact distance of the pair candidates: the cells of every
+	// level are half a largest radius wider than the contacts of that level, the first level has the smallest margin
+	float GetMaxPairSkin() const { return m_Levels[0].cellSize - 2.0f * m_Levels[0].maxRadius; }
+
+	// Get the dimensions in cells of a level
+	int GetGridWidth(int level) const { return m_Levels[level].width; }
+	int GetGridHeight(int level) const { return m_Levels[level].height; }
+
+	// Get the cells of a level, [GetLevelCellBegin, GetLevelCellEnd)
+	size_t GetLevelCellBegin(int level) const
+	{
+		return m_UseHashing ? m_BucketStart[static_cast<size_t>(level) * CELL_COLORS] : m_Levels[level].cellOffset;
+	}
+	size_t GetLevelCellEnd(int level) const
+	{
+		return m_UseHashing ? m_BucketStart[static_cast<size_t>(level + 1) * CELL_COLORS]
+			: m_Levels[level].cellOffset + static_cast<size_t>(m_Levels[level].width) * m_Levels[level].height;
+	}
+
+	// Get the number of cells of all the levels, in hashed mode only the occupied ones as of the last build
+	size_t GetTotalCellCount() const { return m_TotalCellCount; }
+
+	// Return true if only the occupied cells are stored
+	bool GetUseHashing() const { return m_UseHashing; }
+
+	// Get the number of slots of the hash table, 0 before the first hashed build
+	size_t GetHashCapacity() const { return m_HashCapacity; }
+
+	// Get the radius range the levels were sized for
+	float GetMinRadius() const { return m_MinRadius; }
+	float GetMaxRadius() const { return m_MaxRadius; }
+
+	// Get the particle count the grid was created for
 	unsigned int GetParticleCount() const { return m_NumberOfParticles; }
 
-	// Get grid
-	const std::vector<std::vector<unsigned int>>& GetGrid() const { return m_Grid; }
-};
\ No newline at end of file
+	// Get the number of particles binned by the last build, 0 before the first one
+	size_t GetBinnedCount() const { return m_ParticleCells.size(); }
+
+	// Get the offset of each cell inside the sorted particle array, has one extra entry at the end
+	const std::vector<unsigned int>& GetCellStart() const { return m_CellStart; }
+
+	// Get number of particles inside a cell
+	unsigned int GetCellCount(int cellIndex) const { return m_CellStart[cellIndex + 1] - m_CellStart[cellIndex]; }
+
+	// Get particle indices sorted by cell, every particle appears once so it's also a permutation of all of them
+	const std::vector<unsigned int>& GetSortedParticles() const { return m_SortedParticles; }
+
+	// Get the cell of each particle as of the last build
+	const std::vector<int>& GetParticleCells() const { return m_ParticleCells; }
+
+	// Get the level of each particle as of the last build
+	const std::vector<uint8_t>& GetParticleLevels() const { return m_ParticleLevels; }
+
+	// Get the offset of each cell inside the sorted guest array, has one extra entry at the end. Empty with a single level
+	const std::vector<unsigned int>& GetGuestStart() const { return m_GuestStart; }
+
+	// Get the indices of the guests of every cell, sorted by cell
+	const std::vector<unsigned int>& GetSortedGuests() const { return m_SortedGuests; }
+};
@@ -0,0 +1,147 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <algorithm>
+
+// Trajectory file written by TrajectoryRecorder. Little-endian:
+//
+//      TrajectoryHeader
+//      { TrajectoryFrameHeader, payload[payloadSize] } per frame
+//
+// Every frame stores x, y and temperature of each particle in particle id order, quantized to
+// 16 bits (positions against the recorded bounds, temperature against [0, TRAJECTORY_MAX_TEMPERATURE]).
+// The payload starts with the ids of the frame, ids are stable and removed ones never come back: the
+// varint number of runs of consecutive ids, then per run the varint gap since the end of the previous
+// run and the varint length. It goes on with, per value, the zigzag varint of the difference with a
+// prediction from the same id in the previous frames (see PredictTrajectoryValue). Keyframes predict
+// zero so playback can start from them, ids missing from the previous frames count as zero too.
+
+const char TRAJECTORY_MAGIC[8] = { 'P', 'S', 'I', 'M', 'T', 'R', 'A', 'J' };
+const uint32_t TRAJECTORY_VERSION = 2;
+const uint32_t TRAJECTORY_FRAME_MARKER = 0x454D5246; // "FRME"
+const uint32_t TRAJECTORY_KEYFRAME_FLAG = 1;
+const float TRAJECTORY_MAX_TEMPERATURE = 400.0f;
+const uint32_t TRAJECTORY_QUANTIZATION_STEPS = 65535;
+
+struct TrajectoryHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t headerSize;
+    float bottomLeftX, bottomLeftY;
+    float topRightX, topRightY;
+    float frameTime;                // seconds between two frames
+    float particleRadius;
+    uint32_t keyframeInterval;
+    uint32_t reserved;
+};
+
+struct TrajectoryFrameHeader
+{
+    uint32_t marker;                // TRAJECTORY_FRAME_MARKER
+    uint32_t flags;
+    uint64_t frameIndex;
+    uint32_t particleCount;         // ids in the frame
+    uint32_t payloadSize;
+};
+
+static_assert(sizeof(TrajectoryHeader) == 48, "TrajectoryHeader layout changed, bump TRAJECTORY_VERSION");
+static_assert(sizeof(TrajectoryFrameHeader) == 24, "TrajectoryFrameHeader layout changed, bump TRAJECTORY_VERSION");
+
+// Map value from [minValue, maxValue] to [0, TRAJECTORY_QUANTIZATION_STEPS], values outside are clamped
+inline uint16_t QuantizeTrajectoryValue(float value, float minValue, float maxValue)
+{
+    float t = (value - minValue) / (maxValue - minValue);
+    t = std::min(std::max(t, 0.0f), 1.0f);
+    return static_cast<uint16_t>(t * TRAJECTORY_QUANTIZATION_STEPS + 0.5f);
+}
+
+inline float DequantizeTrajectoryValue(uint16_t value, float minValue, float maxValue)
+{
+    return minValue + (maxValue - minValue) * (static_cast<float>(value) / TRAJECTORY_QUANTIZATION_STEPS);
+}
+
+// Prediction of a value from the same value in the last two frames. Order is the number of frames
+// since the last keyframe capped to 2: keyframes predict 0, the next frame repeats the last value
+// and the others extrapolate at constant velocity, so steadily moving particles cost about a byte.
+inline int32_t PredictTrajectoryValue(uint64_t order, uint16_t last, uint16_t beforeLast)
+{
+    if (order == 0)
+        return 0;
+    if (order == 1)
+        return last;
+    return 2 * static_cast<int32_t>(last) - static_cast<int32_t>(beforeLast);
+}
+
+// Small differences of either sign become small unsigned numbers
+inline uint32_t ZigZagEncode(int32_t value) { return (static_cast<uint32_t>(value) << 1) ^ static_cast<uint32_t>(value >> 31); }
+inline int32_t ZigZagDecode(uint32_t value) { return static_cast<int32_t>(value >> 1) ^ -static_cast<int32_t>(value & 1); }
+
+// 7 bits per byte, high bit set when more bytes follow
+inline void WriteVarint(std::vector<uint8_t>& out, uint32_t value)
+{
+    while (value >= 0x80)
+    {
+        out.push_back(static_cast<uint8_t>(value | 0x80));
+        value >>= 7;
+    }
+    out.push_back(static_cast<uint8_t>(value));
+}
+
+// Return false if the varint runs past end
+inline bool ReadVarint(const uint8_t*& data, const uint8_t* end, uint32_t& value)
+{
+    value = 0;
+    for (int shift = 0; shift < 35 && data < end; shift += 7)
+    {
+        const uint8_t byte = *data++;
+        value |= static_cast<uint32_t>(byte & 0x7F) << shift;
+        if (!(byte & 0x80))
+            return true;
+    }
+    return false;
+}
+
+// Append the runs of consecutive ids of an ascending id list
+inline void WriteTrajectoryIds(std::vector<uint8_t>& out, const std::vector<unsigned int>& ids)
+{
+    uint32_t runCount = 0;
+    for (size_t k = 0; k < ids.size(); k++)
+        runCount += (k == 0 || ids[k] != ids[k - 1] + 1) ? 1 : 0;
+    WriteVarint(out, runCount);
+
+    uint32_t runEnd = 0;
+    for (size_t k = 0; k < ids.size();)
+    {
+        size_t last = k;
+        while (last + 1 < ids.size() && ids[last + 1] == ids[last] + 1)
+            last++;
+        WriteVarint(out, ids[k] - runEnd);
+        WriteVarint(out, static_cast<uint32_t>(last - k + 1));
+        runEnd = ids[last] + 1;
+        k = last + 1;
+    }
+}
+
+// Read the ids written by WriteTrajectoryIds, returns false if they run past end or aren't count ids
+inline bool ReadTrajectoryIds(const uint8_t*& data, const uint8_t* end, size_t count, std::vector<unsigned int>& ids)
+{
+    ids.clear();
+    uint32_t runCount;
+    if (!ReadVarint(data, end, runCount))
+        return false;
+
+    uint64_t runEnd = 0;
+    for (uint32_t r = 0; r < runCount; r++)
+    {
+        uint32_t gap, length;
+        if (!ReadVarint(data, end, gap) || !ReadVarint(data, end, length) || ids.size() + length > count ||
+            runEnd + gap + length > 0xFFFFFFFFull)
+            return false;
+        for (uint64_t id = runEnd + gap; id < runEnd + gap + length; id++)
+            ids.push_back(static_cast<unsigned int>(id));
+        runEnd += gap + length;
+    }
+    return ids.size() == count;
+}
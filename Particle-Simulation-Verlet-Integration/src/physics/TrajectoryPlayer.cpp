@@ -0,0 +1,262 @@
+#include "TrajectoryPlayer.h"
+
+#include <iostream>
+#include <cstring>
+#include <algorithm>
+
+TrajectoryPlayer::TrajectoryPlayer()
+    : m_Header(), m_LastIsKeyframe(false), m_LastIdCount(0), m_BeforeLastIdCount(0), m_CurrentFrame(-1), m_LastSeekDecodes(0), m_PlaybackTime(0.0f), m_Speed(1.0f),
+    m_IsPlaying(false), m_IsLooping(true)
+{
+}
+
+bool TrajectoryPlayer::Open(const std::string& path)
+{
+    Close();
+
+    m_File.open(path, std::ios::binary);
+    if (!m_File.good())
+    {
+        std::cerr << "Cannot open " << path << std::endl;
+        return false;
+    }
+
+    m_File.read(reinterpret_cast<char*>(&m_Header), sizeof(m_Header));
+    if (!m_File.good() || std::memcmp(m_Header.magic, TRAJECTORY_MAGIC, sizeof(TRAJECTORY_MAGIC)) != 0)
+    {
+        std::cerr << path << " is not a trajectory file" << std::endl;
+        Close();
+        return false;
+    }
+
+    if (m_Header.version != TRAJECTORY_VERSION || m_Header.headerSize != sizeof(TrajectoryHeader) || m_Header.keyframeInterval == 0)
+    {
+        std::cerr << path << " has trajectory version " << m_Header.version << ", expected " << TRAJECTORY_VERSION << std::endl;
+        Close();
+        return false;
+    }
+
+    m_File.seekg(0, std::ios::end);
+    const uint64_t fileSize = static_cast<uint64_t>(m_File.tellg());
+
+    // Only the frame headers are read, payloads are skipped
+    uint64_t offset = sizeof(TrajectoryHeader);
+    while (offset + sizeof(TrajectoryFrameHeader) <= fileSize)
+    {
+        TrajectoryFrameHeader frameHeader;
+        m_File.seekg(static_cast<std::streamoff>(offset));
+        m_File.read(reinterpret_cast<char*>(&frameHeader), sizeof(frameHeader));
+        if (!m_File.good() || frameHeader.marker != TRAJECTORY_FRAME_MARKER)
+            break;
+
+        const uint64_t payloadOffset = offset + sizeof(TrajectoryFrameHeader);
+        if (payloadOffset + frameHeader.payloadSize > fileSize)
+            break;
+
+        // Playback can only start at a keyframe
+        const bool isKeyframe = (frameHeader.flags & TRAJECTORY_KEYFRAME_FLAG) != 0;
+        if (m_Frames.empty() && !isKeyframe)
+            break;
+
+        FrameEntry entry;
+        entry.offset = payloadOffset;
+        entry.frameIndex = frameHeader.frameIndex;
+        entry.particleCount = frameHeader.particleCount;
+        entry.payloadSize = frameHeader.payloadSize;
+        entry.isKeyframe = isKeyframe;
+
+        if (isKeyframe)
+            m_Keyframes.push_back(m_Frames.size());
+        m_Frames.push_back(entry);
+
+        offset = payloadOffset + frameHeader.payloadSize;
+    }
+
+    m_File.clear();
+
+    if (m_Frames.empty())
+    {
+        std::cerr << path << " has no complete frame" << std::endl;
+        Close();
+        return false;
+    }
+
+    return Seek(0);
+}
+
+void TrajectoryPlayer::Close()
+{
+    if (m_File.is_open())
+        m_File.close();
+    m_File.clear();
+
+    m_Frames.clear();
+    m_Keyframes.clear();
+    m_Positions.clear();
+    m_PrevPositions.clear();
+    m_Temperatures.clear();
+    m_Quantized.clear();
+    m_LastQuantized.clear();
+    m_BeforeLastQuantized.clear();
+    m_PreviousQuantized.clear();
+    m_LastIsKeyframe = false;
+    m_Ids.clear();
+    m_LastIdCount = 0;
+    m_BeforeLastIdCount = 0;
+    m_CurrentFrame = -1;
+    m_PlaybackTime = 0.0f;
+    m_IsPlaying = false;
+}
+
+bool TrajectoryPlayer::DecodeFrame(size_t frame)
+{
+    const FrameEntry& entry = m_Frames[frame];
+
+    m_Payload.resize(entry.payloadSize);
+    m_File.seekg(static_cast<std::streamoff>(entry.offset));
+    m_File.read(reinterpret_cast<char*>(m_Payload.data()), entry.payloadSize);
+    if (!m_File.good())
+    {
+        m_File.clear();
+        return false;
+    }
+
+    // Mirror of TrajectoryRecorder::EncodeFrame
+    const uint8_t* data = m_Payload.data();
+    const uint8_t* end = data + m_Payload.size();
+    if (!ReadTrajectoryIds(data, end, entry.particleCount, m_Ids))
+        return false;
+
+    const size_t idCount = m_Ids.empty() ? 0 : static_cast<size_t>(m_Ids.back()) + 1;
+    const size_t valueCount = idCount * 3;
+    const uint64_t order = std::min<uint64_t>(entry.frameIndex % m_Header.keyframeInterval, 2);
+    m_LastIsKeyframe = order == 0;
+    if (order == 0)
+    {
+        // The velocities of the keyframe still need the frame before it
+        m_PreviousQuantized.swap(m_LastQuantized);
+        m_Quantized.assign(valueCount, 0);
+        m_LastQuantized.assign(valueCount, 0);
+        m_BeforeLastQuantized.assign(valueCount, 0);
+    }
+    m_Quantized.resize(std::max(m_Quantized.size(), valueCount), 0);
+    m_LastQuantized.resize(std::max(m_LastQuantized.size(), valueCount), 0);
+    m_BeforeLastQuantized.resize(std::max(m_BeforeLastQuantized.size(), valueCount), 0);
+
+    for (unsigned int id : m_Ids)
+    {
+        for (size_t k = static_cast<size_t>(id) * 3; k < static_cast<size_t>(id) * 3 + 3; k++)
+        {
+            uint32_t encoded;
+            if (!ReadVarint(data, end, encoded))
+                return false;
+
+            const int32_t prediction = PredictTrajectoryValue(order, m_LastQuantized[k], m_BeforeLastQuantized[k]);
+            m_Quantized[k] = static_cast<uint16_t>(prediction + ZigZagDecode(encoded));
+        }
+    }
+
+    m_BeforeLastQuantized.swap(m_LastQuantized);
+    m_LastQuantized.swap(m_Quantized);
+    m_BeforeLastIdCount = m_LastIdCount;
+    m_LastIdCount = idCount;
+    return true;
+}
+
+void TrajectoryPlayer::UpdateOutputs(bool hasPreviousFrame)
+{
+    const size_t particleCount = m_Ids.size();
+    m_Positions.resize(particleCount);
+    m_PrevPositions.resize(particleCount);
+    m_Temperatures.resize(particleCount);
+
+    // Particles without a previous frame (first frame or spawned in this one) have no velocity. Ids are given in
+    // increasing order, so the ones below the id count of the previous frame were in it
+    const size_t previousIdCount = hasPreviousFrame ? m_BeforeLastIdCount : 0;
+    const std::vector<uint16_t>& previous = m_LastIsKeyframe ? m_PreviousQuantized : m_BeforeLastQuantized;
+    for (size_t i = 0; i < particleCount; i++)
+    {
+        const size_t slot = static_cast<size_t>(m_Ids[i]) * 3;
+        m_Positions[i].x = DequantizeTrajectoryValue(m_LastQuantized[slot + 0], m_Header.bottomLeftX, m_Header.topRightX);
+        m_Positions[i].y = DequantizeTrajectoryValue(m_LastQuantized[slot + 1], m_Header.bottomLeftY, m_Header.topRightY);
+        m_Temperatures[i] = DequantizeTrajectoryValue(m_LastQuantized[slot + 2], 0.0f, TRAJECTORY_MAX_TEMPERATURE);
+
+        if (m_Ids[i] < previousIdCount)
+        {
+            m_PrevPositions[i].x = DequantizeTrajectoryValue(previous[slot + 0], m_Header.bottomLeftX, m_Header.topRightX);
+            m_PrevPositions[i].y = DequantizeTrajectoryValue(previous[slot + 1], m_Header.bottomLeftY, m_Header.topRightY);
+        }
+        else
+        {
+            m_PrevPositions[i] = m_Positions[i];
+        }
+    }
+}
+
+bool TrajectoryPlayer::Seek(size_t frame)
+{
+    if (!IsOpen() || frame >= m_Frames.size())
+        return false;
+
+    if (static_cast<long long>(frame) == m_CurrentFrame)
+    {
+        m_LastSeekDecodes = 0;
+        return true;
+    }
+
+    // Closest keyframe at or before the target
+    const size_t keyframe = *(std::upper_bound(m_Keyframes.begin(), m_Keyframes.end(), frame) - 1);
+
+    // Keep decoding from the current frame if it's between the keyframe and the target
+    const long long previousFrame = m_CurrentFrame;
+    size_t first = keyframe;
+    if (m_CurrentFrame >= static_cast<long long>(keyframe) && m_CurrentFrame < static_cast<long long>(frame))
+        first = static_cast<size_t>(m_CurrentFrame) + 1;
+
+    m_LastSeekDecodes = 0;
+    for (size_t f = first; f <= frame; f++)
+    {
+        if (!DecodeFrame(f))
+        {
+            std::cerr << "Corrupted trajectory frame " << f << std::endl;
+            m_CurrentFrame = -1;
+            return false;
+        }
+        m_LastSeekDecodes++;
+    }
+
+    m_CurrentFrame = static_cast<long long>(frame);
+    // The frame before the target is in the history if it was decoded too, or was the current one
+    UpdateOutputs(frame > first || (first > 0 && previousFrame == static_cast<long long>(first) - 1));
+    return true;
+}
+
+bool TrajectoryPlayer::Advance(float realDeltaTime)
+{
+    if (!IsOpen() || !m_IsPlaying || m_Header.frameTime <= 0.0f)
+        return false;
+
+    // Whole frames elapsed at the playback speed, faster speeds skip frames but still decode the deltas in between
+    m_PlaybackTime += realDeltaTime * m_Speed;
+    const long long framesElapsed = static_cast<long long>(m_PlaybackTime / m_Header.frameTime);
+    if (framesElapsed <= 0)
+        return false;
+    m_PlaybackTime -= framesElapsed * m_Header.frameTime;
+
+    const long long frameCount = static_cast<long long>(m_Frames.size());
+    long long target = m_CurrentFrame + framesElapsed;
+    if (target >= frameCount)
+    {
+        if (m_IsLooping)
+        {
+            target %= frameCount;
+        }
+        else
+        {
+            target = frameCount - 1;
+            m_IsPlaying = false;
+        }
+    }
+
+    return Seek(static_cast<size_t>(target));
+}
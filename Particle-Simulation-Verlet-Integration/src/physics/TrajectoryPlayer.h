@@ -0,0 +1,107 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <fstream>
+#include <cstdint>
+
+#include "Vec2.h"
+#include "Trajectory.h"
+#include "SimulationSystem.h"
+
+// Plays back a file written by TrajectoryRecorder. Opening scans the frame headers once and builds
+// an index of frame offsets and keyframes, seeking then decodes the closest keyframe before the
+// target plus at most keyframeInterval - 1 deltas. Sequential playback decodes one frame at a time.
+class TrajectoryPlayer
+{
+private:
+    struct FrameEntry
+    {
+        uint64_t offset;            // of the payload
+        uint64_t frameIndex;
+        uint32_t particleCount;
+        uint32_t payloadSize;
+        bool isKeyframe;
+    };
+
+    std::ifstream m_File;
+    TrajectoryHeader m_Header;
+    std::vector<FrameEntry> m_Frames;
+    std::vector<size_t> m_Keyframes;            // positions in m_Frames
+
+    // Quantized x, y, temperature of the last two decoded frames indexed by id, same rotation as the recorder
+    std::vector<uint16_t> m_Quantized;
+    std::vector<uint16_t> m_LastQuantized;
+    std::vector<uint16_t> m_BeforeLastQuantized;
+    std::vector<uint16_t> m_PreviousQuantized;  // frame before the last one when that is a keyframe, the history restarts there
+    bool m_LastIsKeyframe;
+    std::vector<uint8_t> m_Payload;
+
+    // Ids of the last decoded frame, and the number of ids given before the frame preceding it
+    std::vector<unsigned int> m_Ids;
+    size_t m_LastIdCount;
+    size_t m_BeforeLastIdCount;
+
+    // Current frame in simulation units
+    std::vector<Vec2> m_Positions;
+    std::vector<Vec2> m_PrevPositions;
+    std::vector<float> m_Temperatures;
+
+    long long m_CurrentFrame;                   // -1 until the first frame is decoded
+    unsigned int m_LastSeekDecodes;
+    float m_PlaybackTime;
+    float m_Speed;
+    bool m_IsPlaying;
+    bool m_IsLooping;
+
+    bool DecodeFrame(size_t frame);
+    void UpdateOutputs(bool hasPreviousFrame);
+
+public:
+    TrajectoryPlayer();
+
+    // Read the header and index the frames, a truncated last frame is ignored. Returns false if the file can't be used
+    bool Open(const std::string& path);
+
+    // Close the file and drop the decoded frame
+    void Close();
+
+    // Return true if a trajectory is open
+    bool IsOpen() const { return m_File.is_open(); }
+
+    // Decode the given frame, returns false if it's out of range or the file is corrupted
+    bool Seek(size_t frame);
+
+    // Move the playback forward by realDeltaTime * speed seconds, returns true if the current frame changed
+    bool Advance(float realDeltaTime);
+
+    // Return the number of complete frames in the file
+    size_t GetFrameCount() const { return m_Frames.size(); }
+
+    // Return the decoded frame, -1 if none
+    long long GetCurrentFrame() const { return m_CurrentFrame; }
+
+    // Return how many frames the last Seek had to decode
+    unsigned int GetLastSeekDecodes() const { return m_LastSeekDecodes; }
+
+    // Decoded particles of the current frame, in particle id order, removed particles are left out
+    const std::vector<Vec2>& GetPositions() const { return m_Positions; }
+    const std::vector<Vec2>& GetPrevPositions() const { return m_PrevPositions; }
+    const std::vector<float>& GetTemperatures() const { return m_Temperatures; }
+
+    // Recording parameters
+    Bounds GetBounds() const { return { Vec2(m_Header.bottomLeftX, m_Header.bottomLeftY), Vec2(m_Header.topRightX, m_Header.topRightY) }; }
+    float GetFrameTime() const { return m_Header.frameTime; }
+    float GetParticleRadius() const { return m_Header.particleRadius; }
+    unsigned int GetKeyframeInterval() const { return m_Header.keyframeInterval; }
+
+    // Playback speed relative to real time
+    float GetSpeed() const { return m_Speed; }
+    void SetSpeed(float speed) { m_Speed = speed; }
+
+    bool GetIsPlaying() const { return m_IsPlaying; }
+    void SetIsPlaying(bool v) { m_IsPlaying = v; m_PlaybackTime = 0.0f; }
+
+    // Restart from the first frame at the end instead of stopping
+    bool GetIsLooping() const { return m_IsLooping; }
+    void SetIsLooping(bool v) { m_IsLooping = v; }
+};
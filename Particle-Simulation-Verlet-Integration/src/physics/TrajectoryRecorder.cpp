@@ -0,0 +1,214 @@
+#include "TrajectoryRecorder.h"
+#include "SimulationSystem.h"
+
+#include <iostream>
+#include <cstring>
+
+TrajectoryRecorder::TrajectoryRecorder()
+    : m_FillIndex(0), m_StopRequested(false), m_IsRecording(false), m_Header(), m_WriteFailed(false),
+    m_FramesCaptured(0), m_FramesWritten(0), m_BytesWritten(0), m_RawBytes(0), m_Stalls(0)
+{
+}
+
+TrajectoryRecorder::~TrajectoryRecorder()
+{
+    Stop();
+}
+
+bool TrajectoryRecorder::Start(const std::string& path, const SimulationSystem& sim, float frameTime, unsigned int keyframeInterval)
+{
+    Stop();
+
+    m_File.open(path, std::ios::binary | std::ios::trunc);
+    if (!m_File.good())
+    {
+        std::cerr << "Cannot open " << path << " for writing" << std::endl;
+        return false;
+    }
+
+    const Bounds bounds = sim.GetBounds();
+    m_Header = TrajectoryHeader();
+    std::memcpy(m_Header.magic, TRAJECTORY_MAGIC, sizeof(m_Header.magic));
+    m_Header.version = TRAJECTORY_VERSION;
+    m_Header.headerSize = sizeof(TrajectoryHeader);
+    m_Header.bottomLeftX = bounds.bottomLeft.x;
+    m_Header.bottomLeftY = bounds.bottomLeft.y;
+    m_Header.topRightX = bounds.topRight.x;
+    m_Header.topRightY = bounds.topRight.y;
+    m_Header.frameTime = frameTime;
+    m_Header.particleRadius = sim.GetParticleRadius();
+    m_Header.keyframeInterval = std::max(keyframeInterval, 1u);
+    m_File.write(reinterpret_cast<const char*>(&m_Header), sizeof(m_Header));
+
+    m_Quantized.clear();
+    m_LastQuantized.clear();
+    m_BeforeLastQuantized.clear();
+    m_Buffers[0].isPending = false;
+    m_Buffers[1].isPending = false;
+    m_FillIndex = 0;
+    m_Queue.clear();
+    m_StopRequested = false;
+    m_WriteFailed = false;
+    m_FramesCaptured = 0;
+    m_FramesWritten = 0;
+    m_BytesWritten = sizeof(m_Header);
+    m_RawBytes = 0;
+    m_Stalls = 0;
+
+    m_IsRecording = true;
+    m_Writer = std::thread(&TrajectoryRecorder::WriterLoop, this);
+    return true;
+}
+
+void TrajectoryRecorder::CaptureFrame(const SimulationSystem& sim)
+{
+    if (!m_IsRecording)
+        return;
+
+    FrameBuffer& frame = m_Buffers[m_FillIndex];
+    {
+        std::unique_lock<std::mutex> lock(m_Mutex);
+        if (frame.isPending)
+        {
+            m_Stalls++;
+            m_FreeCondition.wait(lock, [&]() { return !frame.isPending; });
+        }
+    }
+
+    // Store in id order so the same particle is predicted from its own history in every frame, even after
+    // reordering or removals
+    const ParticleColumn<Vec2>& positions = sim.GetPositions();
+    const std::vector<unsigned int>& ids = sim.GetLiveIds();
+    const size_t particleCount = ids.size();
+
+    frame.ids.assign(ids.begin(), ids.end());
+    frame.positions.resize(particleCount);
+    frame.temperatures.resize(particleCount);
+    for (size_t k = 0; k < particleCount; k++)
+    {
+        const unsigned int index = sim.GetParticleIndex(ids[k]);
+        frame.positions[k] = positions[index];
+        frame.temperatures[k] = sim.GetTemperature(index);
+    }
+    frame.frameIndex = m_FramesCaptured++;
+
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        frame.isPending = true;
+        m_Queue.push_back(m_FillIndex);
+    }
+    m_PendingCondition.notify_one();
+
+    m_FillIndex ^= 1;
+}
+
+void TrajectoryRecorder::Stop()
+{
+    if (!m_IsRecording)
+        return;
+
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        m_StopRequested = true;
+    }
+    m_PendingCondition.notify_one();
+
+    m_Writer.join();
+    m_File.close();
+    m_IsRecording = false;
+
+    if (m_WriteFailed)
+        std::cerr << "Trajectory recording stopped early, the disk write failed" << std::endl;
+}
+
+void TrajectoryRecorder::WriterLoop()
+{
+    while (true)
+    {
+        unsigned int bufferIndex;
+        {
+            std::unique_lock<std::mutex> lock(m_Mutex);
+            m_PendingCondition.wait(lock, [&]() { return m_StopRequested || !m_Queue.empty(); });
+
+            // Drain the queue before stopping
+            if (m_Queue.empty())
+                return;
+
+            bufferIndex = m_Queue.front();
+            m_Queue.pop_front();
+        }
+
+        if (!m_WriteFailed)
+            EncodeFrame(m_Buffers[bufferIndex]);
+
+        {
+            std::lock_guard<std::mutex> lock(m_Mutex);
+            m_Buffers[bufferIndex].isPending = false;
+        }
+        m_FreeCondition.notify_one();
+    }
+}
+
+void TrajectoryRecorder::EncodeFrame(const FrameBuffer& frame)
+{
+    const size_t particleCount = frame.positions.size();
+    const bool isKeyframe = frame.frameIndex % m_Header.keyframeInterval == 0;
+
+    // Ids spawned since the previous frames are predicted from zero, the slots of removed ids are never read again.
+    // Keyframes start from a zeroed history, like the player seeking to them
+    const size_t valueCount = frame.ids.empty() ? 0 : (static_cast<size_t>(frame.ids.back()) + 1) * 3;
+    const uint64_t order = std::min<uint64_t>(frame.frameIndex % m_Header.keyframeInterval, 2);
+    if (order == 0)
+    {
+        m_Quantized.assign(valueCount, 0);
+        m_LastQuantized.assign(valueCount, 0);
+        m_BeforeLastQuantized.assign(valueCount, 0);
+    }
+    m_Quantized.resize(std::max(m_Quantized.size(), valueCount), 0);
+    m_LastQuantized.resize(std::max(m_LastQuantized.size(), valueCount), 0);
+    m_BeforeLastQuantized.resize(std::max(m_BeforeLastQuantized.size(), valueCount), 0);
+
+    m_Payload.clear();
+    m_Payload.reserve(particleCount * 6);
+    WriteTrajectoryIds(m_Payload, frame.ids);
+
+    // Quantize against the recorded bounds
+    for (size_t i = 0; i < particleCount; i++)
+    {
+        const size_t slot = static_cast<size_t>(frame.ids[i]) * 3;
+        m_Quantized[slot + 0] = QuantizeTrajectoryValue(frame.positions[i].x, m_Header.bottomLeftX, m_Header.topRightX);
+        m_Quantized[slot + 1] = QuantizeTrajectoryValue(frame.positions[i].y, m_Header.bottomLeftY, m_Header.topRightY);
+        m_Quantized[slot + 2] = QuantizeTrajectoryValue(frame.temperatures[i], 0.0f, TRAJECTORY_MAX_TEMPERATURE);
+
+        for (size_t k = slot; k < slot + 3; k++)
+        {
+            const int32_t prediction = PredictTrajectoryValue(order, m_LastQuantized[k], m_BeforeLastQuantized[k]);
+            WriteVarint(m_Payload, ZigZagEncode(static_cast<int32_t>(m_Quantized[k]) - prediction));
+        }
+    }
+
+    // Rotate the history, the oldest frame becomes the next scratch buffer
+    m_BeforeLastQuantized.swap(m_LastQuantized);
+    m_LastQuantized.swap(m_Quantized);
+
+    TrajectoryFrameHeader frameHeader;
+    frameHeader.marker = TRAJECTORY_FRAME_MARKER;
+    frameHeader.flags = isKeyframe ? TRAJECTORY_KEYFRAME_FLAG : 0;
+    frameHeader.frameIndex = frame.frameIndex;
+    frameHeader.particleCount = static_cast<uint32_t>(particleCount);
+    frameHeader.payloadSize = static_cast<uint32_t>(m_Payload.size());
+
+    m_File.write(reinterpret_cast<const char*>(&frameHeader), sizeof(frameHeader));
+    if (!m_Payload.empty())
+        m_File.write(reinterpret_cast<const char*>(m_Payload.data()), m_Payload.size());
+
+    if (!m_File.good())
+    {
+        m_WriteFailed = true;
+        return;
+    }
+
+    m_BytesWritten += sizeof(frameHeader) + m_Payload.size();
+    m_RawBytes += particleCount * (sizeof(Vec2) + sizeof(float));
+    m_FramesWritten++;
+}
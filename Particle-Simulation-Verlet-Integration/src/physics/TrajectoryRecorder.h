@@ -0,0 +1,93 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <fstream>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <atomic>
+#include <cstdint>
+
+#include "Vec2.h"
+#include "Trajectory.h"
+
+class SimulationSystem;
+
+// Records positions and temperatures of every update to a trajectory file (see Trajectory.h).
+// CaptureFrame only copies the particles into one of two buffers, quantization, delta encoding
+// and disk writes happen on a background thread while the simulation keeps running.
+class TrajectoryRecorder
+{
+private:
+    struct FrameBuffer
+    {
+        std::vector<unsigned int> ids;
+        std::vector<Vec2> positions;
+        std::vector<float> temperatures;
+        uint64_t frameIndex = 0;
+        bool isPending = false;     // owned by the writer thread until it's encoded
+    };
+
+    FrameBuffer m_Buffers[2];
+    unsigned int m_FillIndex;
+
+    std::thread m_Writer;
+    std::mutex m_Mutex;
+    std::condition_variable m_PendingCondition;
+    std::condition_variable m_FreeCondition;
+    std::deque<unsigned int> m_Queue;
+    bool m_StopRequested;
+    bool m_IsRecording;
+
+    // Writer thread state
+    std::ofstream m_File;
+    TrajectoryHeader m_Header;
+    std::vector<uint16_t> m_Quantized;          // x, y, temperature of each particle
+    std::vector<uint16_t> m_LastQuantized;      // same for the last two written frames, indexed by id
+    std::vector<uint16_t> m_BeforeLastQuantized;
+    std::vector<uint8_t> m_Payload;
+    bool m_WriteFailed;
+
+    // Statistics, the writer thread updates them while the main thread reads them
+    uint64_t m_FramesCaptured;
+    std::atomic<uint64_t> m_FramesWritten;
+    std::atomic<uint64_t> m_BytesWritten;
+    std::atomic<uint64_t> m_RawBytes;
+    uint64_t m_Stalls;
+
+    void WriterLoop();
+    void EncodeFrame(const FrameBuffer& frame);
+
+public:
+    TrajectoryRecorder();
+    ~TrajectoryRecorder();
+
+    TrajectoryRecorder(const TrajectoryRecorder&) = delete;
+    TrajectoryRecorder& operator=(const TrajectoryRecorder&) = delete;
+
+    // Create the file and start the writer thread. Positions are quantized against the current bounds of the
+    // simulation, a keyframe is written every keyframeInterval frames. Returns false if the file can't be created
+    bool Start(const std::string& path, const SimulationSystem& sim, float frameTime, unsigned int keyframeInterval = 60);
+
+    // Copy the current particles, blocks only if the writer is still busy with both buffers
+    void CaptureFrame(const SimulationSystem& sim);
+
+    // Write the remaining frames, close the file and join the writer thread
+    void Stop();
+
+    // Return true between Start and Stop
+    bool IsRecording() const { return m_IsRecording; }
+
+    // Return the number of frames already on disk
+    uint64_t GetFramesWritten() const { return m_FramesWritten; }
+
+    // Return the size of the file written so far
+    uint64_t GetBytesWritten() const { return m_BytesWritten; }
+
+    // Return what the same frames would take as raw floats (x, y, temperature)
+    uint64_t GetRawBytes() const { return m_RawBytes; }
+
+    // Return how many times CaptureFrame had to wait for the writer
+    uint64_t GetStalls() const { return m_Stalls; }
+};